@@ -0,0 +1,174 @@
+#include "bench.h"
+#include "test.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <ccan/talloc/talloc.h>
+
+static int g_fields;
+
+int64_t bench_allocs() {
+	return test_allocs();
+}
+
+void bench_samples_init(struct bench_samples *s) {
+	s->cap = 64;
+	s->n = 0;
+	s->total = 0;
+	s->ns = talloc_array(NULL, uint64_t, s->cap);
+}
+
+void bench_samples_free(struct bench_samples *s) {
+	talloc_free(s->ns);
+	s->ns = NULL;
+}
+
+void bench_samples_add(struct bench_samples *s, uint64_t ns) {
+	if(s->n >= s->cap) {
+		s->cap *= 2;
+		s->ns = talloc_realloc(NULL, s->ns, uint64_t, s->cap);
+	}
+	s->ns[s->n++] = ns;
+	s->total += ns;
+}
+
+static int cmp_u64(const void *a, const void *b) {
+	uint64_t x = *(const uint64_t *) a;
+	uint64_t y = *(const uint64_t *) b;
+
+	return (x > y) - (x < y);
+}
+
+uint64_t bench_samples_pct(struct bench_samples *s, double pct) {
+	size_t i;
+
+	if(s->n < 1)
+		return 0;
+
+	qsort(s->ns, s->n, sizeof(*s->ns), cmp_u64);
+	i = (size_t) (pct/100.0 * (s->n - 1) + 0.5);
+	return s->ns[(i < s->n)? i : s->n - 1];
+}
+
+static void sep() {
+	if(g_fields++ > 0)
+		fputs(", ", stdout);
+}
+
+void bench_begin(const char *suite, const char *name) {
+	g_fields = 0;
+	fputc('{', stdout);
+	bench_field_str("suite", suite);
+	bench_field_str("name", name);
+}
+
+void bench_field_int(const char *key, int64_t val) {
+	sep();
+	printf("\"%s\": %lld", key, (long long) val);
+}
+
+void bench_field_double(const char *key, double val) {
+	sep();
+	printf("\"%s\": %.3f", key, val);
+}
+
+/* keys and values are all chosen by the benchmarks, so 
+ * only quotes and backslashes need escaping */
+void bench_field_str(const char *key, const char *val) {
+	sep();
+	printf("\"%s\": \"", key);
+	for(; *val != '\0'; val++) {
+		if(*val == '"' || *val == '\\')
+			fputc('\\', stdout);
+		fputc(*val, stdout);
+	}
+	fputc('"', stdout);
+}
+
+/* each sample is @batch operations, which only ops_per_sec counts */
+static void field_samples(struct bench_samples *s, size_t batch) {
+	bench_field_int("n", s->n);
+	bench_field_int("p50_ns", bench_samples_pct(s, 50));
+	bench_field_int("p90_ns", bench_samples_pct(s, 90));
+	bench_field_int("p99_ns", bench_samples_pct(s, 99));
+	bench_field_int("max_ns", bench_samples_pct(s, 100));
+	bench_field_int("mean_ns", (s->n > 0)? s->total/s->n : 0);
+	bench_field_double("ops_per_sec", 
+		(s->total > 0)? s->n * batch * 1e9 / s->total : 0.0);
+}
+
+void bench_field_samples(struct bench_samples *s) {
+	field_samples(s, 1);
+}
+
+void bench_end() {
+	fputs("}\n", stdout);
+	fflush(stdout);
+}
+
+int bench_more(size_t i, size_t min, size_t max, uint64_t start, uint64_t budget_ns) {
+	if(i < min)
+		return 1;
+	if(i >= max)
+		return 0;
+
+	return bench_now() - start < budget_ns;
+}
+
+void bench_opts_parse(struct bench_opts *o, int argc, char *argv[]) {
+	int opt;
+
+	o->min_iters = 5;
+	o->max_iters = 100000;
+	o->budget_ns = 500*1000000ULL;
+
+	opterr = 0;
+	while( (opt = getopt(argc, argv, "n:t:")) != -1) {
+		switch(opt) {
+		case 'n': o->max_iters = strtoul(optarg, NULL, 0); break;
+		case 't': o->budget_ns = strtoull(optarg, NULL, 0)*1000000ULL; break;
+		default: break;
+		}
+	}
+	if(o->max_iters < o->min_iters)
+		o->min_iters = o->max_iters;
+}
+
+double bench_ops(struct bench_samples *s, const struct bench_opts *o, 
+		void (*fn)(void *), void *user, size_t batch) {
+	size_t i, cap;
+	uint64_t start, t0;
+	int64_t allocs;
+
+	/* warm up caches and anything allocated on first use */
+	(*fn)(user);
+
+	cap = s->cap;
+	allocs = bench_allocs();
+	start = bench_now();
+	for(i = 0; bench_more(i, o->min_iters, o->max_iters, start, o->budget_ns); i++) {
+		t0 = bench_now();
+		(*fn)(user);
+		bench_samples_add(s, bench_now() - t0);
+	}
+	if(allocs < 0 || i < 1)
+		return -1;
+
+	allocs = bench_allocs() - allocs;
+	/* dont count the reallocs of bench_samples_add */
+	for(; cap < s->cap; cap *= 2)
+		allocs--;
+
+	return (double) allocs / (i*batch);
+}
+
+void bench_field_ops(struct bench_samples *s, size_t batch, double allocs_per_op) {
+	bench_field_int("batch", batch);
+	field_samples(s, batch);
+	bench_field_double("ns_per_op", 
+		(s->n > 0)? (double) s->total / (s->n*batch) : 0.0);
+	bench_field_double("p50_ns_per_op", (double) bench_samples_pct(s, 50) / batch);
+	if(allocs_per_op >= 0)
+		bench_field_double("allocs_per_op", allocs_per_op);
+}
@@ -0,0 +1,73 @@
+#ifndef AUG_DB_BENCH_H
+#define AUG_DB_BENCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "util.h"
+
+/* helpers shared by the *_bench programs. results are written to
+ * stdout as one json object per line so that runs of different
+ * builds can be compared with script/aug-db-bench-cmp. anything
+ * meant for a human goes to stderr. */
+
+struct bench_samples {
+	/* talloc'd */
+	uint64_t *ns;
+	size_t n;
+	size_t cap;
+	uint64_t total;
+};
+
+void bench_samples_init(struct bench_samples *s);
+void bench_samples_free(struct bench_samples *s);
+void bench_samples_add(struct bench_samples *s, uint64_t ns);
+/* sorts the samples, so this changes their order */
+uint64_t bench_samples_pct(struct bench_samples *s, double pct);
+
+/* an object is started with bench_begin, gets fields from the
+ * bench_field_* functions and is written with bench_end */
+void bench_begin(const char *suite, const char *name);
+void bench_field_int(const char *key, int64_t val);
+void bench_field_double(const char *key, double val);
+void bench_field_str(const char *key, const char *val);
+/* adds n, p50_ns, p90_ns, p99_ns, max_ns, mean_ns and ops_per_sec */
+void bench_field_samples(struct bench_samples *s);
+void bench_end();
+
+/* returns non-zero while another iteration should run: at least
+ * @min iterations and after that until @max iterations have run or
+ * @budget_ns nanoseconds have passed since @start. */
+int bench_more(size_t i, size_t min, size_t max, uint64_t start, uint64_t budget_ns);
+
+/* limits shared by the microbenchmarks */
+struct bench_opts {
+	size_t min_iters;
+	size_t max_iters;
+	uint64_t budget_ns;
+};
+
+/* parses -n MAX_ITERS and -t MS_PER_BENCH. other options are 
+ * ignored so that the BENCH_ARGS given to `make bench` can be 
+ * passed to every program. */
+void bench_opts_parse(struct bench_opts *o, int argc, char *argv[]);
+
+/* the number of malloc, calloc and realloc calls this process has
+ * made, or -1 if this build cant count them, see test_allocs */
+int64_t bench_allocs();
+
+/* times @fn(@user), which is expected to perform @batch operations,
+ * until bench_more says to stop. each sample is one call of @fn.
+ * returns the average number of allocations per operation or -1 if
+ * they cant be counted. */
+double bench_ops(struct bench_samples *s, const struct bench_opts *o, 
+		void (*fn)(void *), void *user, size_t batch);
+/* adds the fields of bench_field_samples (which are per batch, 
+ * except ops_per_sec) and ns_per_op, p50_ns_per_op and allocs_per_op */
+void bench_field_ops(struct bench_samples *s, size_t batch, double allocs_per_op);
+
+static inline uint64_t bench_now() {
+	return util_now_ns();
+}
+
+#endif /* AUG_DB_BENCH_H */
@@ -0,0 +1,258 @@
+#include "corpus.h"
+
+#include "db.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <ccan/array_size/array_size.h>
+#include <ccan/talloc/talloc.h>
+
+/* blobs are added in transactions of this many */
+#define CORPUS_BULK_SIZE 10000
+
+static const char *const g_cmds[] = {
+	"ls", "git", "grep", "awk", "sed", "find", "make", "ssh", "tar",
+	"curl", "docker", "kubectl", "rsync", "python", "gcc", "vim",
+	"cat", "tail", "ps", "kill", "du", "sort", "uniq", "xargs"
+};
+
+static const char *const g_args[] = {
+	"-la", "-rf", "--verbose", "-n", "status", "log --oneline", "-i",
+	"--all", "-exec rm {} \\;", "-name '*.c'", "| head -20", "-v",
+	"commit -m 'wip'", "--no-pager diff", "-czf", "-xzf", "run --rm -it",
+	"get pods", "-avz --delete", "-O2 -Wall", "| sort -n", "-p 2222"
+};
+
+static const char *const g_paths[] = {
+	"/etc/passwd", "/var/log/syslog", "~/src", "/tmp", "./build",
+	"/usr/local/bin", "src/db.c", "~/.ssh/config", "/dev/null",
+	"backup.tar.gz", "Makefile", "/srv/www/html"
+};
+
+/* the first and last lines of multi-line scripts */
+static const char *const g_script_heads[] = {
+	"for f in *; do", "while read -r line; do", "if [ -f \"$1\" ]; then",
+	"#!/bin/sh\nset -e", "{", "case \"$1\" in\n  start)"
+};
+static const char *const g_script_tails[] = {
+	"done", "done < input.txt", "fi", "exit 0", "}", "  ;;\nesac"
+};
+
+void corpus_default_opts(struct corpus_opts *opts) {
+	opts->seed = 1;
+	opts->nblobs = 1000;
+	opts->ntags = 200;
+	opts->zipf_s = 1.0;
+	opts->script_ratio = 0.05;
+	opts->raw_ratio = 0.01;
+	opts->trash_ratio = 0.02;
+	opts->chosen_ratio = 0.3;
+	opts->rechosen_ratio = 0.5;
+	opts->history_days = 365;
+	/* 2013-01-01 */
+	opts->now = 1356998400;
+}
+
+uint64_t corpus_rand(struct corpus *c) {
+	/* xorshift64* */
+	c->rng ^= c->rng >> 12;
+	c->rng ^= c->rng << 25;
+	c->rng ^= c->rng >> 27;
+	return c->rng * 2685821657736338717ULL;
+}
+
+size_t corpus_range(struct corpus *c, size_t n) {
+	return (n > 0)? corpus_rand(c) % n : 0;
+}
+
+double corpus_unit(struct corpus *c) {
+	return (corpus_rand(c) >> 11) * (1.0/9007199254740992.0);
+}
+
+void corpus_init(struct corpus *c, const struct corpus_opts *opts) {
+	size_t i;
+	double sum;
+
+	c->opts = *opts;
+	c->rng = opts->seed*0x9e3779b97f4a7c15ULL + 1;
+	c->i = 0;
+	c->tag_names = talloc_array(NULL, char *, opts->ntags);
+	for(i = 0; i < opts->ntags; i++) {
+		if(i < ARRAY_SIZE(g_cmds))
+			c->tag_names[i] = talloc_strdup(c->tag_names, g_cmds[i]);
+		else
+			c->tag_names[i] = talloc_asprintf(c->tag_names, "tag%03u", (unsigned int) i);
+	}
+
+	c->tag_cdf = talloc_array(NULL, double, (opts->ntags > 0)? opts->ntags : 1);
+	for(sum = 0, i = 0; i < opts->ntags; i++) {
+		sum += 1.0/pow(i+1, opts->zipf_s);
+		c->tag_cdf[i] = sum;
+	}
+	for(i = 0; i < opts->ntags; i++)
+		c->tag_cdf[i] /= sum;
+}
+
+void corpus_free(struct corpus *c) {
+	talloc_free(c->tag_names);
+	c->tag_names = NULL;
+	talloc_free(c->tag_cdf);
+	c->tag_cdf = NULL;
+}
+
+/* the index of a zipf distributed tag */
+static size_t zipf_tag(struct corpus *c) {
+	size_t lo, hi, mid;
+	double u;
+
+	u = corpus_unit(c);
+	lo = 0;
+	hi = c->opts.ntags - 1;
+	while(lo < hi) {
+		mid = lo + (hi - lo)/2;
+		if(c->tag_cdf[mid] > u)
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
+
+	return lo;
+}
+
+#define PICK(_c, _arr) _arr[corpus_range(_c, ARRAY_SIZE(_arr))]
+
+static char *command(struct corpus *c, char *s) {
+	size_t i, nargs;
+
+	s = talloc_asprintf_append(s, "%s", PICK(c, g_cmds));
+	nargs = 1 + corpus_range(c, 4);
+	/* every now and then a really long one */
+	if(corpus_range(c, 50) == 0)
+		nargs += 20 + corpus_range(c, 40);
+	for(i = 0; i < nargs; i++)
+		s = talloc_asprintf_append(s, " %s", 
+				(i & 1)? PICK(c, g_paths) : PICK(c, g_args));
+
+	return s;
+}
+
+static char *script(struct corpus *c, char *s) {
+	size_t i, n, which;
+
+	which = corpus_range(c, ARRAY_SIZE(g_script_heads));
+	s = talloc_asprintf_append(s, "%s\n", g_script_heads[which]);
+	n = 1 + corpus_range(c, 8);
+	for(i = 0; i < n; i++) {
+		s = talloc_asprintf_append(s, "  ");
+		s = command(c, s);
+		s = talloc_asprintf_append(s, "\n");
+	}
+
+	return talloc_asprintf_append(s, "%s", g_script_tails[which]);
+}
+
+static void raw_blob(struct corpus *c, void *ctx, struct corpus_entry *e) {
+	size_t i;
+	uint32_t n;
+
+	e->size = 8 + corpus_range(c, 120);
+	e->data = talloc_array(ctx, uint8_t, e->size + sizeof(n));
+	for(i = 0; i < e->size; i++)
+		e->data[i] = (uint8_t) corpus_rand(c);
+	/* blobs are unique in the db, so make sure these are */
+	n = (uint32_t) c->i;
+	memcpy(e->data + e->size, &n, sizeof(n));
+	e->size += sizeof(n);
+	e->raw = 1;
+}
+
+/* a blob is given fewer tags than it drew if it keeps drawing ones
+ * it already has, which only happens with a tiny or steep vocabulary */
+#define CORPUS_TAG_TRIES 64
+
+void corpus_next(struct corpus *c, void *ctx, struct corpus_entry *e) {
+	char *s;
+	size_t i, j, n, tries;
+	int64_t t;
+	double u;
+
+	u = corpus_unit(c);
+	if(u < c->opts.raw_ratio)
+		raw_blob(c, ctx, e);
+	else {
+		s = talloc_strdup(ctx, "");
+		if(u < c->opts.raw_ratio + c->opts.script_ratio)
+			s = script(c, s);
+		else
+			s = command(c, s);
+		/* blobs are unique in the db, so make sure these are */
+		s = talloc_asprintf_append(s, " # %u", (unsigned int) c->i);
+
+		e->data = (uint8_t *) s;
+		e->size = strlen(s);
+		e->raw = 0;
+	}
+
+	n = (c->opts.ntags > 0)? 1 + corpus_range(c, CORPUS_MAX_TAGS) : 0;
+	for(e->ntags = 0, tries = 0; e->ntags < n && tries < CORPUS_TAG_TRIES; tries++) {
+		e->tags[e->ntags] = c->tag_names[zipf_tag(c)];
+		/* duplicates would be ignored by the db, which would make
+		 * the popular tags fall short of their co-occurrence, so 
+		 * draw again */
+		for(j = 0; j < e->ntags; j++)
+			if(e->tags[j] == e->tags[e->ntags])
+				break;
+		if(j == e->ntags)
+			e->ntags++;
+	}
+
+	e->trash = corpus_unit(c) < c->opts.trash_ratio;
+	e->nchosen = 0;
+	if(corpus_unit(c) < c->opts.chosen_ratio) {
+		do {
+			/* cubing makes recent times more likely */
+			u = corpus_unit(c);
+			t = c->opts.now - (int64_t) (u*u*u * c->opts.history_days * 86400.0);
+			/* keep them in order */
+			for(i = e->nchosen; i > 0 && e->chosen_at[i-1] > t; i--)
+				e->chosen_at[i] = e->chosen_at[i-1];
+			e->chosen_at[i] = t;
+			e->nchosen++;
+		} while(e->nchosen < CORPUS_MAX_CHOICES 
+				&& corpus_unit(c) < c->opts.rechosen_ratio);
+	}
+
+	c->i++;
+}
+
+int *corpus_populate(struct corpus *c) {
+	int *ids;
+	size_t i, j;
+	void *ctx;
+	struct corpus_entry e;
+
+	ids = talloc_array(NULL, int, (c->opts.nblobs > 0)? c->opts.nblobs : 1);
+	ctx = talloc_new(NULL);
+	for(i = 0; i < c->opts.nblobs; i++) {
+		if(i % CORPUS_BULK_SIZE == 0) {
+			if(i > 0)
+				db_bulk_end();
+			db_bulk_begin();
+			talloc_free(ctx);
+			ctx = talloc_new(NULL);
+		}
+
+		corpus_next(c, ctx, &e);
+		ids[i] = db_add(e.data, e.size, e.raw, e.tags, e.ntags);
+		for(j = 0; j < e.nchosen; j++)
+			db_set_chosen_at(ids[i], e.chosen_at[j]);
+		if(e.trash)
+			db_trash(ids[i]);
+	}
+	if(c->opts.nblobs > 0)
+		db_bulk_end();
+	talloc_free(ctx);
+
+	return ids;
+}
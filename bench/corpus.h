@@ -0,0 +1,82 @@
+#ifndef AUG_DB_CORPUS_H
+#define AUG_DB_CORPUS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* generates a reproducible database of shell command like blobs
+ * for the benchmarks and for bench/corpus_gen.c. the same options
+ * (including the seed) always produce the same database. */
+
+struct corpus_opts {
+	uint64_t seed;
+	size_t nblobs;
+	/* size of the tag vocabulary */
+	size_t ntags;
+	/* tags are chosen with probability proportional to
+	 * 1/rank^zipf_s, so 0 means uniform */
+	double zipf_s;
+	/* the fractions of blobs that are multi-line scripts and raw
+	 * binary data. the rest are one line commands. */
+	double script_ratio;
+	double raw_ratio;
+	/* the fraction of blobs that are in the trash */
+	double trash_ratio;
+	/* the fraction of blobs that have been chosen from the ui at
+	 * least once. the times they were chosen are spread over the
+	 * history_days before now, with recent times more likely. */
+	double chosen_ratio;
+	/* the chance that a blob which was chosen was chosen again,
+	 * up to CORPUS_MAX_CHOICES times */
+	double rechosen_ratio;
+	unsigned int history_days;
+	/* seconds since the epoch. fixed by default so that the 
+	 * generated database doesnt depend on when it was made. */
+	int64_t now;
+};
+
+#define CORPUS_MAX_TAGS 4
+#define CORPUS_MAX_CHOICES 8
+
+struct corpus_entry {
+	/* talloc'd, a child of the ctx given to corpus_next */
+	uint8_t *data;
+	size_t size;
+	int raw;
+	const char *tags[CORPUS_MAX_TAGS];
+	size_t ntags;
+	int trash;
+	/* the times it was chosen, oldest first */
+	int64_t chosen_at[CORPUS_MAX_CHOICES];
+	size_t nchosen;
+};
+
+struct corpus {
+	struct corpus_opts opts;
+	uint64_t rng;
+	/* number of entries generated so far */
+	size_t i;
+	/* talloc'd, tag_names[0] is the most common tag */
+	char **tag_names;
+	/* talloc'd, tag_cdf[i] is the probability of choosing a tag
+	 * from tag_names[0..i] */
+	double *tag_cdf;
+};
+
+void corpus_default_opts(struct corpus_opts *opts);
+void corpus_init(struct corpus *c, const struct corpus_opts *opts);
+void corpus_free(struct corpus *c);
+
+void corpus_next(struct corpus *c, void *ctx, struct corpus_entry *e);
+/* adds opts.nblobs entries to the (already initialized) db.
+ * returns a talloc'd array of the blob ids in the order they
+ * were generated. */
+int *corpus_populate(struct corpus *c);
+
+uint64_t corpus_rand(struct corpus *c);
+/* a uniformly random number in [0, n) */
+size_t corpus_range(struct corpus *c, size_t n);
+/* a uniformly random number in [0, 1) */
+double corpus_unit(struct corpus *c);
+
+#endif /* AUG_DB_CORPUS_H */
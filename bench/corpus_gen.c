@@ -0,0 +1,104 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <locale.h>
+#include <sys/stat.h>
+#include <ccan/talloc/talloc.h>
+
+#include "test.h"
+#include "bench.h"
+#include "corpus.h"
+#include "db.h"
+
+/* writes a synthetic database with the shape of a real one: the
+ * same options and seed always produce the same database, so a 
+ * database like a production one can be shared as a command line
+ * instead of as a file full of someones shell history. e.g.
+ *   corpus_gen -n 2000000 -T 5000 -z 1.2 -x 0.1 -o /tmp/big.sqlite */
+
+static void usage(const char *name) {
+	struct corpus_opts d;
+
+	corpus_default_opts(&d);
+	fprintf(stderr, "usage: %s -o PATH [-f] [OPTIONS]\n"
+		"  -o PATH     the database to write\n"
+		"  -f          overwrite PATH if it exists\n"
+		"  -n N        number of blobs (%u)\n"
+		"  -S SEED     random seed (%u)\n"
+		"  -T N        number of distinct tags (%u)\n"
+		"  -z S        zipf exponent of the tag distribution (%.2f)\n"
+		"  -m RATIO    fraction of multi-line scripts (%.2f)\n"
+		"  -r RATIO    fraction of raw binary blobs (%.2f)\n"
+		"  -x RATIO    fraction of trashed blobs (%.2f)\n"
+		"  -c RATIO    fraction of blobs that were ever chosen (%.2f)\n"
+		"  -R RATIO    chance a chosen blob was chosen again (%.2f)\n"
+		"  -H DAYS     chosen_at times go back this many days (%u)\n"
+		"  -N SECONDS  the time the history ends at (%lld)\n",
+		name, (unsigned int) d.nblobs, (unsigned int) d.seed, 
+		(unsigned int) d.ntags, d.zipf_s, d.script_ratio, d.raw_ratio,
+		d.trash_ratio, d.chosen_ratio, d.rechosen_ratio, d.history_days, (long long) d.now);
+	exit(1);
+}
+
+int main(int argc, char *argv[]) {
+	struct corpus c;
+	struct corpus_opts opts;
+	struct stat st;
+	const char *path;
+	int opt, force, *ids;
+	uint64_t t0, elapsed;
+
+	setlocale(LC_ALL,"");
+	corpus_default_opts(&opts);
+	path = NULL;
+	force = 0;
+	while( (opt = getopt(argc, argv, "o:fn:S:T:z:m:r:x:c:R:H:N:")) != -1) {
+		switch(opt) {
+		case 'o': path = optarg; break;
+		case 'f': force = 1; break;
+		case 'n': opts.nblobs = strtoul(optarg, NULL, 0); break;
+		case 'S': opts.seed = strtoull(optarg, NULL, 0); break;
+		case 'T': opts.ntags = strtoul(optarg, NULL, 0); break;
+		case 'z': opts.zipf_s = strtod(optarg, NULL); break;
+		case 'm': opts.script_ratio = strtod(optarg, NULL); break;
+		case 'r': opts.raw_ratio = strtod(optarg, NULL); break;
+		case 'x': opts.trash_ratio = strtod(optarg, NULL); break;
+		case 'c': opts.chosen_ratio = strtod(optarg, NULL); break;
+		case 'R': opts.rechosen_ratio = strtod(optarg, NULL); break;
+		case 'H': opts.history_days = strtoul(optarg, NULL, 0); break;
+		case 'N': opts.now = strtoll(optarg, NULL, 0); break;
+		default: usage(argv[0]);
+		}
+	}
+	if(path == NULL || optind != argc)
+		usage(argv[0]);
+
+	if(stat(path, &st) == 0) {
+		if(!force) {
+			fprintf(stderr, "%s already exists, use -f to overwrite it\n", path);
+			return 1;
+		}
+		unlink(path);
+	}
+
+	test_init_api();
+	if(db_init(path) != 0) {
+		fprintf(stderr, "failed to create db at %s\n", path);
+		return 1;
+	}
+
+	corpus_init(&c, &opts);
+	t0 = bench_now();
+	ids = corpus_populate(&c);
+	elapsed = bench_now() - t0;
+	fprintf(stderr, "wrote %u blobs to %s in %.3fs\n", 
+		(unsigned int) opts.nblobs, path, elapsed/1e9);
+
+	talloc_free(ids);
+	corpus_free(&c);
+	db_free();
+	test_free_api();
+
+	return 0;
+}
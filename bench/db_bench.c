@@ -0,0 +1,221 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <locale.h>
+#include <sys/stat.h>
+#include <ccan/array_size/array_size.h>
+#include <ccan/talloc/talloc.h>
+
+#include "test.h"
+#include "bench.h"
+#include "corpus.h"
+#include "db.h"
+
+/* populates a database for each size given with -s and times
+ * the queries the ui runs against it, as well as the writes that
+ * happen when a result is chosen or trashed. the 1M blob database
+ * takes a while to build, so it is only used when asked for:
+ * db_bench -s 1000,10000,100000,1000000 */
+
+#define DEFAULT_SIZES "1000,10000,100000"
+#define SHAPE_MAX_WORDS 12
+
+struct shape {
+	const char *name;
+	const char *queries[2];
+	size_t nqueries;
+	/* an index into the corpus tag names or -1 */
+	int tag;
+	/* an offset of -1 means half of the db */
+	int offset;
+	/* #tag words as they would be typed, without the '#' */
+	const char *words[SHAPE_MAX_WORDS];
+};
+
+static const struct shape g_shapes[] = {
+	{"query_empty", {NULL}, 0, -1, 0, {NULL}},
+	{"query_short", {"gi"}, 1, -1, 0, {NULL}},
+	{"query_long", {"log --oneline ~/src"}, 1, -1, 0, {NULL}},
+	{"query_multi", {"git", "status"}, 2, -1, 0, {NULL}},
+	{"query_tag", {NULL}, 0, 0, 0, {NULL}},
+	{"query_short_tag", {"-la"}, 1, 1, 0, {NULL}},
+	{"query_short_rare_tag", {"-la"}, 1, 60, 0, {NULL}},
+	{"query_tag_and", {NULL}, 0, -1, 0, {"ls&git"}},
+	{"query_tag_and_not", {NULL}, 0, -1, 0, {"ls&!git&!grep"}},
+	/* each word is the ten tags starting with it */
+	{"query_short_many_tags", {"-la"}, 1, -1, 0,
+		{"tag03", "tag04", "tag05", "tag06", "tag07", "tag08",
+		 "tag09", "tag10", "tag11", "tag12", "tag13", "tag14"}},
+	{"query_empty_deep_offset", {NULL}, 0, -1, -1, {NULL}},
+	{"query_short_deep_offset", {"s"}, 1, -1, -1, {NULL}}
+};
+
+static struct {
+	const char *dir;
+	uint64_t seed;
+	size_t min_iters;
+	size_t max_iters;
+	uint64_t budget_ns;
+} g;
+
+static void bench_query(struct corpus *c, size_t size, const struct shape *sh) {
+	struct bench_samples s;
+	struct db_query q;
+	const uint8_t *tags[SHAPE_MAX_WORDS];
+	unsigned int offset;
+	size_t i, rows, ntags;
+	uint64_t start, t0;
+
+	ntags = 0;
+	if(sh->tag >= 0)
+		tags[ntags++] = (const uint8_t *) c->tag_names[sh->tag];
+	for(i = 0; i < SHAPE_MAX_WORDS && sh->words[i] != NULL; i++)
+		tags[ntags++] = (const uint8_t *) sh->words[i];
+	offset = (sh->offset < 0)? size/2 : (unsigned int) sh->offset;
+
+	bench_samples_init(&s);
+	rows = 0;
+	start = bench_now();
+	for(i = 0; bench_more(i, g.min_iters, g.max_iters, start, g.budget_ns); i++) {
+		t0 = bench_now();
+		db_query_prepare(&q, offset, (const uint8_t **) sh->queries, sh->nqueries,
+				tags, ntags);
+		for(rows = 0; db_query_step(&q) == 0; rows++)
+			;
+		db_query_free(&q);
+		bench_samples_add(&s, bench_now() - t0);
+	}
+
+	bench_begin("db", sh->name);
+	bench_field_int("size", size);
+	bench_field_int("rows", rows);
+	bench_field_samples(&s);
+	bench_end();
+	bench_samples_free(&s);
+}
+
+static void bench_write(struct corpus *c, size_t size, const int *ids, 
+		const char *name, void (*fn)(int)) {
+	struct bench_samples s;
+	size_t i;
+	uint64_t start, t0;
+	int id;
+
+	bench_samples_init(&s);
+	start = bench_now();
+	for(i = 0; bench_more(i, g.min_iters, g.max_iters, start, g.budget_ns); i++) {
+		id = ids[corpus_range(c, size)];
+		t0 = bench_now();
+		(*fn)(id);
+		bench_samples_add(&s, bench_now() - t0);
+	}
+
+	bench_begin("db", name);
+	bench_field_int("size", size);
+	bench_field_samples(&s);
+	bench_end();
+	bench_samples_free(&s);
+}
+
+static void bench_size(size_t size) {
+	char *path;
+	struct corpus c;
+	struct corpus_opts opts;
+	struct stat st;
+	int *ids;
+	size_t i;
+	uint64_t t0, elapsed;
+
+	path = talloc_asprintf(NULL, "%s/aug-db-bench-%d-%u.sqlite", g.dir, 
+			(int) getpid(), (unsigned int) size);
+	unlink(path);
+	if(db_init(path) != 0) {
+		fprintf(stderr, "failed to create db at %s\n", path);
+		exit(1);
+	}
+
+	corpus_default_opts(&opts);
+	opts.seed = g.seed;
+	opts.nblobs = size;
+	corpus_init(&c, &opts);
+
+	fprintf(stderr, "populating %u blobs...\n", (unsigned int) size);
+	t0 = bench_now();
+	ids = corpus_populate(&c);
+	elapsed = bench_now() - t0;
+
+	bench_begin("db", "populate");
+	bench_field_int("size", size);
+	bench_field_int("total_ns", elapsed);
+	bench_field_double("blobs_per_sec", size*1e9/elapsed);
+	if(stat(path, &st) == 0)
+		bench_field_int("file_bytes", st.st_size);
+	bench_end();
+
+	for(i = 0; i < ARRAY_SIZE(g_shapes); i++)
+		bench_query(&c, size, &g_shapes[i]);
+
+	bench_write(&c, size, ids, "update_chosen_at", db_update_chosen_at);
+	/* this one changes what the queries return, so it goes last */
+	bench_write(&c, size, ids, "trash", db_trash);
+
+	talloc_free(ids);
+	corpus_free(&c);
+	db_free();
+	unlink(path);
+	talloc_free(path);
+}
+
+static void usage(const char *name) {
+	fprintf(stderr, "usage: %s [-s SIZE,...] [-S SEED] [-n MAX_ITERS] [-t MS_PER_BENCH] [-d DIR]\n", name);
+	exit(1);
+}
+
+int main(int argc, char *argv[]) {
+	const char *sizes;
+	char *sz, *end;
+	int opt;
+
+	setlocale(LC_ALL,"");
+	sizes = DEFAULT_SIZES;
+	g.dir = "/tmp";
+	g.seed = 1;
+	g.min_iters = 5;
+	g.max_iters = 1000;
+	g.budget_ns = 2000*1000000ULL;
+	while( (opt = getopt(argc, argv, "s:S:n:t:d:")) != -1) {
+		switch(opt) {
+		case 's': sizes = optarg; break;
+		case 'S': g.seed = strtoull(optarg, NULL, 0); break;
+		case 'n': g.max_iters = strtoul(optarg, NULL, 0); break;
+		case 't': g.budget_ns = strtoull(optarg, NULL, 0)*1000000ULL; break;
+		case 'd': g.dir = optarg; break;
+		default: usage(argv[0]);
+		}
+	}
+	if(g.max_iters < g.min_iters)
+		g.min_iters = g.max_iters;
+
+	/* check the whole list before a size is run, which can take
+	 * minutes */
+	for(sz = (char *) sizes; *sz != '\0'; sz = end) {
+		strtoul(sz, &end, 10);
+		if(end == sz)
+			usage(argv[0]);
+		if(*end == ',' && end[1] != '\0')
+			end++;
+		else if(*end != '\0')
+			usage(argv[0]);
+	}
+
+	test_init_api();
+	for(sz = (char *) sizes; *sz != '\0'; sz = end) {
+		bench_size(strtoul(sz, &end, 10));
+		if(*end == ',')
+			end++;
+	}
+	test_free_api();
+
+	return 0;
+}
@@ -0,0 +1,96 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <locale.h>
+#include <wchar.h>
+#include <ccan/array_size/array_size.h>
+#include <ccan/talloc/talloc.h>
+
+#include "test.h"
+#include "bench.h"
+#include "encoding.h"
+
+/* times encoding_wchar_to_utf8 on the sort of input the ui gives
+ * it: a short query typed by the user and a longer pasted one, in
+ * ascii and in text that needs 2, 3 and 4 byte sequences. */
+
+/* conversions per sample */
+#define BATCH 100
+
+struct input {
+	const char *name;
+	const wchar_t *text;
+	/* the text is repeated this many times */
+	size_t repeat;
+};
+
+static const struct input g_inputs[] = {
+	{"ascii_8", L"git stat", 1},
+	{"ascii_256", L"find . -name '*.c' | ", 12},
+	{"non_ascii_8", L"été 中文\U0001f600", 1},
+	{"non_ascii_256", L"café über 中文 ○◌ \U0001f600 ", 16}
+};
+
+struct run {
+	uint32_t *wchars;
+	size_t n;
+	uint8_t *utf8;
+	size_t utf8_len;
+};
+
+static void convert(void *user) {
+	struct run *r = user;
+	size_t i;
+
+	for(i = 0; i < BATCH; i++)
+		encoding_wchar_to_utf8(r->utf8, r->utf8_len, r->wchars, r->n);
+}
+
+static void bench_input(const struct bench_opts *o, const struct input *in) {
+	struct bench_samples s;
+	struct run r;
+	size_t i, len;
+	double allocs;
+
+	len = wcslen(in->text);
+	r.n = len*in->repeat;
+	r.wchars = talloc_array(NULL, uint32_t, r.n);
+	for(i = 0; i < r.n; i++)
+		r.wchars[i] = in->text[i % len];
+	r.utf8_len = r.n*4;
+	r.utf8 = talloc_array(NULL, uint8_t, r.utf8_len);
+
+	bench_samples_init(&s);
+	allocs = bench_ops(&s, o, convert, &r, BATCH);
+
+	bench_begin("encoding", in->name);
+	bench_field_int("chars", r.n);
+	bench_field_int("utf8_bytes", r.utf8_len - 
+		encoding_wchar_to_utf8(r.utf8, r.utf8_len, r.wchars, r.n));
+	bench_field_ops(&s, BATCH, allocs);
+	bench_end();
+
+	bench_samples_free(&s);
+	talloc_free(r.wchars);
+	talloc_free(r.utf8);
+}
+
+int main(int argc, char *argv[]) {
+	struct bench_opts o;
+	size_t i;
+
+	setlocale(LC_ALL,"");
+	bench_opts_parse(&o, argc, argv);
+
+	test_init_api();
+	if(encoding_init() != 0) {
+		fprintf(stderr, "failed to init encoding\n");
+		return 1;
+	}
+	for(i = 0; i < ARRAY_SIZE(g_inputs); i++)
+		bench_input(&o, &g_inputs[i]);
+	encoding_free();
+	test_free_api();
+
+	return 0;
+}
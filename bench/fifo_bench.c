@@ -0,0 +1,104 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <locale.h>
+#include <ccan/array_size/array_size.h>
+#include <ccan/talloc/talloc.h>
+
+#include "test.h"
+#include "bench.h"
+#include "fifo.h"
+
+/* times fifo_write followed by fifo_consume of the same amount.
+ * with a chunk that divides the capacity the copies never wrap,
+ * otherwise the read and write positions drift so that some of the
+ * copies are split in two at the end of the buffer. */
+
+#define FIFO_ELEMS 256
+/* write+consume pairs per sample */
+#define BATCH 1000
+
+struct pattern {
+	const char *name;
+	size_t chunk;
+	/* elements left in the fifo between pairs */
+	size_t fill;
+};
+
+static const struct pattern g_patterns[] = {
+	{"single", 1, 0},
+	{"chunk_aligned", 16, 0},
+	{"chunk_wrap", 15, 0},
+	{"chunk_wrap_half_full", 15, FIFO_ELEMS/2},
+	{"fill_drain", FIFO_ELEMS, 0}
+};
+
+static const size_t g_elem_sizes[] = {1, 4, 16, 64};
+
+struct run {
+	struct fifo f;
+	const struct pattern *p;
+	void *buf;
+	void *src;
+	void *dest;
+};
+
+static void pairs(void *user) {
+	struct run *r = user;
+	size_t i;
+
+	for(i = 0; i < BATCH; i++) {
+		fifo_write(&r->f, r->src, r->p->chunk);
+		fifo_consume(&r->f, r->dest, r->p->chunk);
+	}
+}
+
+static void bench_pattern(const struct bench_opts *o, 
+		const struct pattern *p, size_t elem_size) {
+	struct bench_samples s;
+	struct run r;
+	char *name;
+	double allocs;
+
+	r.p = p;
+	r.buf = talloc_size(NULL, elem_size*FIFO_ELEMS);
+	r.src = talloc_zero_size(NULL, elem_size*FIFO_ELEMS);
+	r.dest = talloc_size(NULL, elem_size*FIFO_ELEMS);
+	fifo_init(&r.f, r.buf, elem_size, FIFO_ELEMS);
+	fifo_write(&r.f, r.src, p->fill);
+
+	bench_samples_init(&s);
+	allocs = bench_ops(&s, o, pairs, &r, BATCH);
+
+	name = talloc_asprintf(NULL, "%s_%u", p->name, (unsigned int) elem_size);
+	bench_begin("fifo", name);
+	bench_field_int("elem_size", elem_size);
+	bench_field_int("chunk", p->chunk);
+	bench_field_int("fill", p->fill);
+	bench_field_ops(&s, BATCH, allocs);
+	bench_field_double("bytes_per_sec", 
+		(s.total > 0)? 2.0 * s.n * BATCH * p->chunk * elem_size * 1e9 / s.total : 0.0);
+	bench_end();
+
+	talloc_free(name);
+	bench_samples_free(&s);
+	talloc_free(r.buf);
+	talloc_free(r.src);
+	talloc_free(r.dest);
+}
+
+int main(int argc, char *argv[]) {
+	struct bench_opts o;
+	size_t i, j;
+
+	setlocale(LC_ALL,"");
+	bench_opts_parse(&o, argc, argv);
+
+	test_init_api();
+	for(i = 0; i < ARRAY_SIZE(g_elem_sizes); i++)
+		for(j = 0; j < ARRAY_SIZE(g_patterns); j++)
+			bench_pattern(&o, &g_patterns[j], g_elem_sizes[i]);
+	test_free_api();
+
+	return 0;
+}
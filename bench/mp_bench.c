@@ -0,0 +1,341 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <locale.h>
+#include <sys/wait.h>
+#include <ccan/array_size/array_size.h>
+#include <ccan/talloc/talloc.h>
+
+#include "test.h"
+#include "bench.h"
+#include "corpus.h"
+#include "db.h"
+
+/* runs reader and writer processes against one database at the
+ * same time, the way several terminals running aug-db share one
+ * ~/.aug-db.sqlite. readers run the ui queries, checking
+ * db_generation before each one like a cache would. writers add,
+ * choose and trash blobs. the latencies of both are reported along
+ * with how often each had to wait for another process' lock:
+ * mp_bench -w 4 -r 8 -i 1 -t 5000 */
+
+#define DEFAULT_SIZE 10000
+/* rows read from each query, about one screen of results */
+#define READ_ROWS 12
+
+static const char *const g_queries[] = {"", "gi", "-la", "ssh", "tar -czf"};
+
+/* what each child sends back through its pipe, followed by
+ * @n samples */
+struct result {
+	uint64_t ops;
+	uint64_t busy_retries;
+	/* db_generation calls, how many saw a new generation and
+	 * the time spent in them */
+	uint64_t gen_checks;
+	uint64_t gen_changes;
+	uint64_t gen_ns;
+	uint64_t n;
+};
+
+static struct {
+	const char *path;
+	uint64_t seed;
+	size_t size;
+	int writers;
+	int readers;
+	/* pause between the writes of each writer */
+	unsigned int interval_ms;
+	uint64_t budget_ns;
+} g;
+
+static void reader(struct result *r, struct bench_samples *s) {
+	struct db_query q;
+	const uint8_t *queries[1];
+	uint64_t start, t0;
+	uint32_t gen, last;
+	size_t i, rows;
+
+	last = 0;
+	start = bench_now();
+	for(i = 0; bench_now() - start < g.budget_ns; i++) {
+		t0 = bench_now();
+		gen = db_generation();
+		r->gen_ns += bench_now() - t0;
+		r->gen_checks++;
+		if(gen != last)
+			r->gen_changes++;
+		last = gen;
+
+		queries[0] = (const uint8_t *) g_queries[i % ARRAY_SIZE(g_queries)];
+		t0 = bench_now();
+		db_query_prepare(&q, 0, queries, (queries[0][0] != '\0')? 1 : 0, NULL, 0);
+		for(rows = 0; rows < READ_ROWS && db_query_step(&q) == 0; rows++)
+			;
+		db_query_free(&q);
+		bench_samples_add(s, bench_now() - t0);
+		r->ops++;
+	}
+}
+
+static void writer(int idx, struct result *r, struct bench_samples *s) {
+	struct corpus c;
+	struct corpus_opts opts;
+	struct corpus_entry e;
+	uint64_t start, t0;
+	size_t op;
+	void *ctx;
+	int id;
+
+	corpus_default_opts(&opts);
+	opts.seed = g.seed + 1 + idx;
+	corpus_init(&c, &opts);
+	/* so that the blobs dont collide with those of other writers */
+	c.i = g.size + (size_t) idx*1000000;
+
+	start = bench_now();
+	while(bench_now() - start < g.budget_ns) {
+		op = corpus_range(&c, 10);
+		id = 1 + (int) corpus_range(&c, g.size);
+		ctx = talloc_new(NULL);
+		if(op < 3)
+			corpus_next(&c, ctx, &e);
+
+		t0 = bench_now();
+		if(op < 3)
+			db_add(e.data, e.size, e.raw, e.tags, e.ntags);
+		else if(op < 9)
+			db_update_chosen_at(id);
+		else
+			db_trash(id);
+		bench_samples_add(s, bench_now() - t0);
+		r->ops++;
+		talloc_free(ctx);
+
+		if(g.interval_ms > 0)
+			util_usleep(0, g.interval_ms*1000);
+	}
+
+	corpus_free(&c);
+}
+
+static int write_all(int fd, const void *buf, size_t n) {
+	ssize_t amt;
+
+	while(n > 0) {
+		if( (amt = write(fd, buf, n)) < 0) {
+			if(errno == EINTR)
+				continue;
+			return -1;
+		}
+		buf = (const uint8_t *) buf + amt;
+		n -= amt;
+	}
+
+	return 0;
+}
+
+static int read_all(int fd, void *buf, size_t n) {
+	ssize_t amt;
+
+	while(n > 0) {
+		if( (amt = read(fd, buf, n)) <= 0) {
+			if(amt < 0 && errno == EINTR)
+				continue;
+			return -1;
+		}
+		buf = (uint8_t *) buf + amt;
+		n -= amt;
+	}
+
+	return 0;
+}
+
+/* runs in the child, never returns */
+static void child(int idx, int is_writer, int fd) {
+	struct result r;
+	struct bench_samples s;
+
+	memset(&r, 0, sizeof(r));
+	bench_samples_init(&s);
+	if(db_init(g.path) != 0) {
+		fprintf(stderr, "failed to open db at %s\n", g.path);
+		_exit(1);
+	}
+
+	if(is_writer)
+		writer(idx, &r, &s);
+	else
+		reader(&r, &s);
+
+	r.busy_retries = db_busy_retries();
+	r.n = s.n;
+	db_free();
+	if(write_all(fd, &r, sizeof(r)) != 0
+			|| write_all(fd, s.ns, s.n*sizeof(*s.ns)) != 0)
+		_exit(1);
+
+	bench_samples_free(&s);
+	_exit(0);
+}
+
+/* adds the result of a child read from @fd to @total and @s */
+static int collect(int fd, struct result *total, struct bench_samples *s) {
+	struct result r;
+	uint64_t ns;
+	size_t i;
+
+	if(read_all(fd, &r, sizeof(r)) != 0)
+		return -1;
+	for(i = 0; i < r.n; i++) {
+		if(read_all(fd, &ns, sizeof(ns)) != 0)
+			return -1;
+		bench_samples_add(s, ns);
+	}
+
+	total->ops += r.ops;
+	total->busy_retries += r.busy_retries;
+	total->gen_checks += r.gen_checks;
+	total->gen_changes += r.gen_changes;
+	total->gen_ns += r.gen_ns;
+	return 0;
+}
+
+static void report(const char *name, const struct result *r, struct bench_samples *s) {
+	bench_begin("mp", name);
+	bench_field_int("size", g.size);
+	bench_field_int("writers", g.writers);
+	bench_field_int("readers", g.readers);
+	bench_field_int("interval_ms", g.interval_ms);
+	bench_field_int("ops", r->ops);
+	bench_field_int("busy_retries", r->busy_retries);
+	bench_field_double("busy_per_op",
+		(r->ops > 0)? (double) r->busy_retries / r->ops : 0.0);
+	if(r->gen_checks > 0) {
+		bench_field_int("gen_changes", r->gen_changes);
+		bench_field_double("gen_check_ns", (double) r->gen_ns / r->gen_checks);
+	}
+	bench_field_samples(s);
+	bench_end();
+}
+
+static void populate() {
+	struct corpus c;
+	struct corpus_opts opts;
+
+	unlink(g.path);
+	if(db_init(g.path) != 0) {
+		fprintf(stderr, "failed to create db at %s\n", g.path);
+		exit(1);
+	}
+
+	corpus_default_opts(&opts);
+	opts.seed = g.seed;
+	opts.nblobs = g.size;
+	corpus_init(&c, &opts);
+	fprintf(stderr, "populating %u blobs...\n", (unsigned int) g.size);
+	talloc_free(corpus_populate(&c));
+	corpus_free(&c);
+	db_free();
+}
+
+static void usage(const char *name) {
+	fprintf(stderr, "usage: %s [-s SIZE] [-w WRITERS] [-r READERS] [-i WRITE_INTERVAL_MS] "
+			"[-t MS] [-S SEED] [-d DIR]\n", name);
+	exit(1);
+}
+
+int main(int argc, char *argv[]) {
+	const char *dir;
+	int opt, i, nchildren, status, failed;
+	int *fds;
+	pid_t *pids;
+	struct result reads, writes;
+	struct bench_samples read_s, write_s;
+
+	setlocale(LC_ALL,"");
+	dir = "/tmp";
+	g.seed = 1;
+	g.size = DEFAULT_SIZE;
+	g.writers = 2;
+	g.readers = 4;
+	g.interval_ms = 5;
+	g.budget_ns = 3000*1000000ULL;
+	/* -n is accepted and ignored, like the other benchmarks do
+	 * with the options they dont use */
+	while( (opt = getopt(argc, argv, "s:w:r:i:t:S:d:n:")) != -1) {
+		switch(opt) {
+		case 's': g.size = strtoul(optarg, NULL, 0); break;
+		case 'w': g.writers = atoi(optarg); break;
+		case 'r': g.readers = atoi(optarg); break;
+		case 'i': g.interval_ms = strtoul(optarg, NULL, 0); break;
+		case 't': g.budget_ns = strtoull(optarg, NULL, 0)*1000000ULL; break;
+		case 'S': g.seed = strtoull(optarg, NULL, 0); break;
+		case 'd': dir = optarg; break;
+		case 'n': break;
+		default: usage(argv[0]);
+		}
+	}
+	/* the size is also the range of ids the writers touch */
+	if(g.size < 1 || g.writers < 0 || g.readers < 0)
+		usage(argv[0]);
+
+	test_init_api();
+	g.path = talloc_asprintf(NULL, "%s/aug-db-mp-bench-%d.sqlite", dir, (int) getpid());
+	populate();
+
+	nchildren = g.writers + g.readers;
+	fds = talloc_array(NULL, int, nchildren + 1);
+	pids = talloc_array(NULL, pid_t, nchildren + 1);
+	fflush(stdout);
+	fflush(stderr);
+	for(i = 0; i < nchildren; i++) {
+		int p[2];
+
+		if(pipe(p) != 0 || (pids[i] = fork()) < 0) {
+			perror("failed to start child");
+			exit(1);
+		}
+		if(pids[i] == 0) {
+			close(p[0]);
+			child(i, i < g.writers, p[1]);
+		}
+		close(p[1]);
+		fds[i] = p[0];
+	}
+
+	memset(&reads, 0, sizeof(reads));
+	memset(&writes, 0, sizeof(writes));
+	bench_samples_init(&read_s);
+	bench_samples_init(&write_s);
+	failed = 0;
+	for(i = 0; i < nchildren; i++) {
+		if(i < g.writers)
+			failed |= collect(fds[i], &writes, &write_s);
+		else
+			failed |= collect(fds[i], &reads, &read_s);
+		close(fds[i]);
+		if(waitpid(pids[i], &status, 0) != pids[i]
+				|| !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+			failed = -1;
+	}
+	if(failed != 0)
+		fprintf(stderr, "some of the processes failed\n");
+
+	if(g.readers > 0)
+		report("query", &reads, &read_s);
+	if(g.writers > 0)
+		report("write", &writes, &write_s);
+
+	bench_samples_free(&read_s);
+	bench_samples_free(&write_s);
+	talloc_free(fds);
+	talloc_free(pids);
+	unlink(g.path);
+	talloc_free((char *) g.path);
+	test_free_api();
+
+	return (failed != 0)? 1 : 0;
+}
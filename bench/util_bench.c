@@ -0,0 +1,85 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <locale.h>
+#include <ccan/array_size/array_size.h>
+#include <ccan/talloc/talloc.h>
+
+#include "test.h"
+#include "bench.h"
+#include "util.h"
+
+/* times util_tal_join and util_tal_multiply, which build the sql
+ * of every query. the strings are freed in the timed loop as the
+ * query code frees them after each query. */
+
+/* calls per sample */
+#define BATCH 100
+
+static const size_t g_counts[] = {1, 4, 16, 64};
+
+struct run {
+	char **strings;
+	size_t n;
+};
+
+static void join(void *user) {
+	struct run *r = user;
+	size_t i;
+
+	for(i = 0; i < BATCH; i++)
+		talloc_free(util_tal_join(NULL, r->strings, " AND "));
+}
+
+static void multiply(void *user) {
+	struct run *r = user;
+	size_t i;
+
+	for(i = 0; i < BATCH; i++)
+		talloc_free(util_tal_multiply(NULL, "value LIKE ?", " AND ", r->n));
+}
+
+static void bench_fn(const struct bench_opts *o, const char *fn_name,
+		void (*fn)(void *), size_t n) {
+	struct bench_samples s;
+	struct run r;
+	char *name;
+	size_t i;
+	double allocs;
+
+	r.n = n;
+	r.strings = talloc_array(NULL, char *, n+1);
+	for(i = 0; i < n; i++)
+		r.strings[i] = talloc_asprintf(r.strings, "tag%u.name = ?", (unsigned int) i);
+	r.strings[n] = NULL;
+
+	bench_samples_init(&s);
+	allocs = bench_ops(&s, o, fn, &r, BATCH);
+
+	name = talloc_asprintf(NULL, "%s_%u", fn_name, (unsigned int) n);
+	bench_begin("util", name);
+	bench_field_int("strings", n);
+	bench_field_ops(&s, BATCH, allocs);
+	bench_end();
+
+	talloc_free(name);
+	bench_samples_free(&s);
+	talloc_free(r.strings);
+}
+
+int main(int argc, char *argv[]) {
+	struct bench_opts o;
+	size_t i;
+
+	setlocale(LC_ALL,"");
+	bench_opts_parse(&o, argc, argv);
+
+	test_init_api();
+	for(i = 0; i < ARRAY_SIZE(g_counts); i++)
+		bench_fn(&o, "tal_join", join, g_counts[i]);
+	for(i = 0; i < ARRAY_SIZE(g_counts); i++)
+		bench_fn(&o, "tal_multiply", multiply, g_counts[i]);
+	test_free_api();
+
+	return 0;
+}
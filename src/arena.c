@@ -0,0 +1,89 @@
+/* 
+ * Copyright 2013 anthony cantor
+ * This file is part of aug-db.
+ *
+ * aug-db is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * aug-db is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with aug-db.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "arena.h"
+
+#include "err.h"
+
+#include <ccan/talloc/talloc.h>
+
+#define ARENA_ALIGN 16
+#define ARENA_ROUND(_n) ( ((_n) + ARENA_ALIGN - 1) & ~((size_t) ARENA_ALIGN - 1) )
+
+/* (re)allocates buf to hold @size bytes */
+static void alloc_buf(struct arena *a, size_t size) {
+	talloc_free(a->mem);
+	a->size = ARENA_ROUND(size);
+	if( (a->mem = talloc_size(a->ctx, a->size + ARENA_ALIGN)) == NULL)
+		err_panic(0, "failed to allocate arena of %zu bytes", a->size);
+	a->buf = (uint8_t *) ARENA_ROUND( (uintptr_t) a->mem);
+}
+
+void arena_init(struct arena *a, size_t size) {
+	a->ctx = talloc_new(NULL);
+	a->mem = NULL;
+	alloc_buf(a, size);
+	a->used = 0;
+	a->overflow = NULL;
+	a->want = 0;
+}
+
+void arena_free(struct arena *a) {
+	talloc_free(a->ctx);
+	a->ctx = NULL;
+	a->mem = NULL;
+	a->buf = NULL;
+	a->overflow = NULL;
+	a->size = a->used = a->want = 0;
+}
+
+void *arena_alloc(struct arena *a, size_t size) {
+	void *p;
+
+	size = ARENA_ROUND(size);
+	a->want += size;
+	if(size <= a->size - a->used) {
+		p = a->buf + a->used;
+		a->used += size;
+		return p;
+	}
+
+	if(a->overflow == NULL)
+		a->overflow = talloc_new(a->ctx);
+	if( (p = talloc_size(a->overflow, (size > 0)? size : 1)) == NULL)
+		err_panic(0, "failed to allocate %zu bytes", size);
+	return p;
+}
+
+void arena_reset(struct arena *a) {
+	if(a->overflow != NULL) {
+		talloc_free(a->overflow);
+		a->overflow = NULL;
+	}
+
+	/* with a little extra so that slowly growing frames 
+	 * dont reallocate every time */
+	if(a->want > a->size)
+		alloc_buf(a, a->want + a->want/4);
+
+	a->used = 0;
+	a->want = 0;
+}
+
+size_t arena_usage(const struct arena *a) {
+	return (a->ctx != NULL)? talloc_total_size(a->ctx) : 0;
+}
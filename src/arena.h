@@ -0,0 +1,54 @@
+/* 
+ * Copyright 2013 anthony cantor
+ * This file is part of aug-db.
+ *
+ * aug-db is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * aug-db is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with aug-db.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef AUG_DB_ARENA_H
+#define AUG_DB_ARENA_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* memory for things that only live until the end of a frame. 
+ * allocating is just moving an offset into a buffer, and everything
+ * is given back at once by arena_reset. an allocation that doesnt
+ * fit in the buffer is talloc'd instead, and the next reset grows 
+ * the buffer so that the same amount fits from then on. */
+struct arena {
+	/* talloc parent of mem and overflow */
+	void *ctx;
+	/* buf is mem rounded up to the alignment */
+	void *mem;
+	uint8_t *buf;
+	size_t size;
+	size_t used;
+	/* parent of the allocations that didnt fit, or NULL */
+	void *overflow;
+	/* bytes asked for since the last reset, fitting or not */
+	size_t want;
+};
+
+void arena_init(struct arena *a, size_t size);
+void arena_free(struct arena *a);
+/* the result is aligned for any type and is never NULL */
+void *arena_alloc(struct arena *a, size_t size);
+#define arena_array(_a, _type, _n) \
+	((_type *) arena_alloc(_a, sizeof(_type)*(_n)))
+/* invalidates everything allocated since the last reset */
+void arena_reset(struct arena *a);
+/* bytes held, for mem.h */
+size_t arena_usage(const struct arena *a);
+
+#endif /* AUG_DB_ARENA_H */
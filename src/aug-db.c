@@ -21,8 +21,14 @@
 #include "ui.h"
 #include "db.h"
 #include "util.h"
+#include "trace.h"
+#include "db_prof.h"
+#include "lock_prof.h"
+#include "metrics.h"
+#include "mem.h"
 
 #include <strings.h>
+#include <ccan/str/str.h>
 
 #include "api_calls.h"
 
@@ -36,9 +42,33 @@ struct aug_plugin_cb g_callbacks;
 
 static uint32_t g_cmd_ch;
 static int g_freed;
+/* talloc'd path of the trace file or NULL */
+static char *g_trace_path;
+
+/* @paths is a colon separated list of shared dbs */
+static void attach_shared(const char *paths) {
+	char *list, *path, *save;
+	wordexp_t exp;
+
+	list = talloc_strdup(NULL, paths);
+	for(path = strtok_r(list, ":", &save); path != NULL; 
+			path = strtok_r(NULL, ":", &save)) {
+		if(util_expand_path(path, &exp) != 0) {
+			aug_log("failed to expand shared db path %s\n", path);
+			continue;
+		}
+		if(db_attach_shared(exp.we_wordv[0]) == 0)
+			aug_log("shared db: %s\n", exp.we_wordv[0]);
+		else
+			aug_log("failed to attach shared db %s\n", exp.we_wordv[0]);
+		wordfree(&exp);
+	}
+	talloc_free(list);
+}
 
 int aug_plugin_init(struct aug_plugin *plugin, const struct aug_api *api) {
-	const char *key, *dbpath;
+	const char *key, *dbpath, *trace_path, *slow_path, *slow_ms, *span_path;
+	const char *metrics_path, *metrics_ms, *budget_kb, *shared;
 	const char default_key[] = "^R";
 	wordexp_t exp;
 
@@ -48,10 +78,17 @@ int aug_plugin_init(struct aug_plugin *plugin, const struct aug_api *api) {
 	aug_log("init\n");
 
 	g_freed = 0;
+	trace_init();
 	aug_callbacks_init(&g_callbacks);
 	g_callbacks.input_char = on_input;
 	g_callbacks.screen_dims_change = on_dims_change;
 
+	mem_init();
+	if(aug_conf_val(aug_plugin_name, "mem_budget_kb", &budget_kb) != 0)
+		budget_kb = stringify(MEM_DEFAULT_BUDGET_KB);
+	mem_set_budget(strtoul(budget_kb, NULL, 10)*1024);
+	aug_log("memory budget: %skB\n", budget_kb);
+
 	if(aug_conf_val(aug_plugin_name, "db", &dbpath) == 0) {
 		aug_log("db file: %s\n", dbpath);
 	} 
@@ -71,6 +108,42 @@ int aug_plugin_init(struct aug_plugin *plugin, const struct aug_api *api) {
 	}
 	wordfree(&exp);
 
+	if(aug_conf_val(aug_plugin_name, "shared", &shared) == 0)
+		attach_shared(shared);
+
+	if(aug_conf_val(aug_plugin_name, "slow_query_log", &slow_path) == 0) {
+		if(aug_conf_val(aug_plugin_name, "slow_query_ms", &slow_ms) != 0)
+			slow_ms = "100";
+		if(util_expand_path(slow_path, &exp) == 0) {
+			if(db_slow_query_log(exp.we_wordv[0], strtoul(slow_ms, NULL, 10)) == 0)
+				aug_log("slow query log: %s (%sms)\n", exp.we_wordv[0], slow_ms);
+			wordfree(&exp);
+		}
+		else
+			aug_log("failed to expand slow query log path\n");
+	}
+
+	g_trace_path = NULL;
+	if(aug_conf_val(aug_plugin_name, "trace", &trace_path) == 0) {
+		if(util_expand_path(trace_path, &exp) == 0) {
+			g_trace_path = talloc_strdup(NULL, exp.we_wordv[0]);
+			wordfree(&exp);
+			aug_log("trace file: %s\n", g_trace_path);
+		}
+		else
+			aug_log("failed to expand trace path\n");
+	}
+
+	if(aug_conf_val(aug_plugin_name, "span_trace", &span_path) == 0) {
+		if(util_expand_path(span_path, &exp) == 0) {
+			trace_spans_enable(exp.we_wordv[0]);
+			wordfree(&exp);
+			aug_log("span trace file: %s\n", trace_spans_path());
+		}
+		else
+			aug_log("failed to expand span trace path\n");
+	}
+
 	if( aug_conf_val(aug_plugin_name, "key", &key) == 0) {
 		aug_log("command key: %s\n", key);
 	} 
@@ -97,6 +170,20 @@ int aug_plugin_init(struct aug_plugin *plugin, const struct aug_api *api) {
 		return -1;
 	}
 
+	if(aug_conf_val(aug_plugin_name, "metrics", &metrics_path) == 0) {
+		if(aug_conf_val(aug_plugin_name, "metrics_ms", &metrics_ms) != 0)
+			metrics_ms = stringify(METRICS_DEFAULT_MS);
+		if(util_expand_path(metrics_path, &exp) == 0) {
+			if(metrics_init(exp.we_wordv[0], strtoul(metrics_ms, NULL, 10)) == 0)
+				aug_log("metrics file: %s (every %sms)\n", exp.we_wordv[0], metrics_ms);
+			else
+				aug_log("failed to start metrics timer\n");
+			wordfree(&exp);
+		}
+		else
+			aug_log("failed to expand metrics path\n");
+	}
+
 	aug_callbacks(&g_callbacks, NULL);
 	
 	return 0;
@@ -110,7 +197,20 @@ void aug_plugin_free() {
 	aug_log("free\n");
 	aug_key_unbind(g_cmd_ch);
 	ui_free();
+	metrics_free();
+	db_prof_log();
+	lock_prof_log();
 	db_free();
+	mem_free();
+
+	if(g_trace_path != NULL) {
+		if(trace_dump(g_trace_path) != 0)
+			aug_log("failed to write trace file %s\n", g_trace_path);
+		talloc_free(g_trace_path);
+	}
+	if(trace_spans_path() != NULL && trace_spans_dump() != 0)
+		aug_log("failed to write span trace file %s\n", trace_spans_path());
+	trace_free();
 }
 
 static void on_cmd_key(uint32_t ch, void *user) {
@@ -125,11 +225,13 @@ static void on_input(uint32_t *ch, aug_action *action, void *user) {
 	(void)(action);
 	(void)(user);
 
+	TRACE_SPAN_BEGIN(TRACE_SPAN_ON_INPUT, *ch);
 	if( (status = ui_on_input(ch)) < 0)
 		err_warn(0, "ui input buffer is full");
 	
 	if(status == 0)
 		*action = AUG_ACT_CANCEL;
+	TRACE_SPAN_END(TRACE_SPAN_ON_INPUT);
 }
 
 static void on_dims_change(int rows, int cols, void *user) {
@@ -0,0 +1,474 @@
+/* 
+ * Copyright 2013 anthony cantor
+ * This file is part of aug-db.
+ *
+ * aug-db is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * aug-db is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with aug-db.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "bitmap.h"
+
+#include "err.h"
+
+#include <string.h>
+#include <ccan/talloc/talloc.h>
+
+#define BITMAP_MIN_CAP 4
+
+void bitmap_init(struct bitmap *b) {
+	b->ctx = talloc_new(NULL);
+	b->c = NULL;
+	b->n = 0;
+	b->cap = 0;
+}
+
+void bitmap_free(struct bitmap *b) {
+	talloc_free(b->ctx);
+	b->ctx = NULL;
+	b->c = NULL;
+	b->n = b->cap = 0;
+}
+
+void bitmap_clear(struct bitmap *b) {
+	bitmap_free(b);
+	bitmap_init(b);
+}
+
+/* the index of the container with @key, or where it would go */
+static int find(const struct bitmap *b, uint16_t key, size_t *idx) {
+	size_t lo, hi, mid;
+
+	/* ids are mostly added in order, so check the end first */
+	if(b->n > 0 && b->c[b->n-1].key < key) {
+		*idx = b->n;
+		return 0;
+	}
+
+	lo = 0;
+	hi = b->n;
+	while(lo < hi) {
+		mid = lo + (hi - lo)/2;
+		if(b->c[mid].key < key)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	*idx = lo;
+	return lo < b->n && b->c[lo].key == key;
+}
+
+/* the index of the first element of @a not less than @low */
+static uint32_t array_lower_bound(const uint16_t *a, uint32_t n, uint16_t low) {
+	uint32_t lo, hi, mid;
+
+	lo = 0;
+	hi = n;
+	while(lo < hi) {
+		mid = lo + (hi - lo)/2;
+		if(a[mid] < low)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+static int container_contains(const struct bitmap_container *c, uint16_t low) {
+	uint32_t i;
+
+	if(c->bits != 0)
+		return (c->u.words[low >> 6] >> (low & 63)) & 1;
+
+	i = array_lower_bound(c->u.array, c->n, low);
+	return i < c->n && c->u.array[i] == low;
+}
+
+static struct bitmap_container *insert(struct bitmap *b, size_t idx, uint16_t key) {
+	struct bitmap_container *c;
+
+	if(b->n == b->cap) {
+		b->cap = (b->cap < BITMAP_MIN_CAP)? BITMAP_MIN_CAP : b->cap*2;
+		b->c = talloc_realloc(b->ctx, b->c, struct bitmap_container, b->cap);
+		if(b->c == NULL)
+			err_panic(0, "failed to grow bitmap to %zu containers", b->cap);
+	}
+
+	memmove(&b->c[idx+1], &b->c[idx], (b->n - idx)*sizeof(b->c[0]));
+	b->n++;
+	c = &b->c[idx];
+	c->key = key;
+	c->bits = 0;
+	c->n = 0;
+	c->cap = 0;
+	c->u.array = NULL;
+	return c;
+}
+
+static void remove_container(struct bitmap *b, size_t idx) {
+	if(b->c[idx].bits != 0)
+		talloc_free(b->c[idx].u.words);
+	else
+		talloc_free(b->c[idx].u.array);
+
+	memmove(&b->c[idx], &b->c[idx+1], (b->n - idx - 1)*sizeof(b->c[0]));
+	b->n--;
+}
+
+static void to_bits(struct bitmap *b, struct bitmap_container *c) {
+	uint64_t *words;
+	uint32_t i;
+
+	if( (words = talloc_zero_array(b->ctx, uint64_t, BITMAP_WORDS)) == NULL)
+		err_panic(0, "failed to allocate bitmap container");
+	for(i = 0; i < c->n; i++)
+		words[c->u.array[i] >> 6] |= 1ULL << (c->u.array[i] & 63);
+
+	talloc_free(c->u.array);
+	c->u.words = words;
+	c->bits = 1;
+	c->cap = 0;
+}
+
+/* a bitset goes back to being an array once it is small enough */
+static void fit(struct bitmap *b, struct bitmap_container *c) {
+	uint16_t *array;
+	uint32_t i, j;
+	uint64_t w;
+
+	if(c->bits == 0 || c->n > BITMAP_ARRAY_MAX)
+		return;
+
+	if( (array = talloc_array(b->ctx, uint16_t, (c->n > 0)? c->n : 1)) == NULL)
+		err_panic(0, "failed to allocate bitmap container");
+	for(j = 0, i = 0; i < BITMAP_WORDS; i++)
+		for(w = c->u.words[i]; w != 0; w &= w - 1)
+			array[j++] = (i << 6) | __builtin_ctzll(w);
+
+	talloc_free(c->u.words);
+	c->u.array = array;
+	c->bits = 0;
+	c->cap = c->n;
+}
+
+static uint32_t count_words(const uint64_t *words) {
+	uint32_t i, n;
+
+	for(n = 0, i = 0; i < BITMAP_WORDS; i++)
+		n += __builtin_popcountll(words[i]);
+
+	return n;
+}
+
+int bitmap_add(struct bitmap *b, uint32_t x) {
+	struct bitmap_container *c;
+	uint16_t low;
+	uint32_t i;
+	size_t idx;
+
+	low = x & 0xffff;
+	if(find(b, x >> 16, &idx) == 0)
+		c = insert(b, idx, x >> 16);
+	else
+		c = &b->c[idx];
+
+	if(c->bits == 0) {
+		/* appending is the common case */
+		if(c->n > 0 && c->u.array[c->n-1] >= low) {
+			i = array_lower_bound(c->u.array, c->n, low);
+			if(c->u.array[i] == low)
+				return 0;
+		}
+		else
+			i = c->n;
+
+		if(c->n == BITMAP_ARRAY_MAX)
+			to_bits(b, c);
+		else {
+			if(c->n == c->cap) {
+				c->cap = (c->cap < BITMAP_MIN_CAP)? BITMAP_MIN_CAP : c->cap*2;
+				if(c->cap > BITMAP_ARRAY_MAX)
+					c->cap = BITMAP_ARRAY_MAX;
+				c->u.array = talloc_realloc(b->ctx, c->u.array, uint16_t, c->cap);
+				if(c->u.array == NULL)
+					err_panic(0, "failed to grow bitmap container");
+			}
+			memmove(&c->u.array[i+1], &c->u.array[i], (c->n - i)*sizeof(uint16_t));
+			c->u.array[i] = low;
+			c->n++;
+			return 1;
+		}
+	}
+
+	if( (c->u.words[low >> 6] >> (low & 63)) & 1)
+		return 0;
+	c->u.words[low >> 6] |= 1ULL << (low & 63);
+	c->n++;
+	return 1;
+}
+
+int bitmap_remove(struct bitmap *b, uint32_t x) {
+	struct bitmap_container *c;
+	uint16_t low;
+	uint32_t i;
+	size_t idx;
+
+	low = x & 0xffff;
+	if(find(b, x >> 16, &idx) == 0)
+		return 0;
+	c = &b->c[idx];
+	if(container_contains(c, low) == 0)
+		return 0;
+
+	if(c->bits != 0) {
+		c->u.words[low >> 6] &= ~(1ULL << (low & 63));
+		c->n--;
+		fit(b, c);
+	}
+	else {
+		i = array_lower_bound(c->u.array, c->n, low);
+		memmove(&c->u.array[i], &c->u.array[i+1], (c->n - i - 1)*sizeof(uint16_t));
+		c->n--;
+	}
+
+	if(c->n == 0)
+		remove_container(b, idx);
+	return 1;
+}
+
+int bitmap_contains(const struct bitmap *b, uint32_t x) {
+	size_t idx;
+
+	if(find(b, x >> 16, &idx) == 0)
+		return 0;
+
+	return container_contains(&b->c[idx], x & 0xffff);
+}
+
+size_t bitmap_count(const struct bitmap *b) {
+	size_t i, n;
+
+	for(n = 0, i = 0; i < b->n; i++)
+		n += b->c[i].n;
+
+	return n;
+}
+
+/* talloc'd copy of the data of a container */
+static void *dup_data(struct bitmap *b, const struct bitmap_container *c) {
+	size_t size;
+	void *data;
+
+	size = (c->bits != 0)? BITMAP_WORDS*sizeof(uint64_t) 
+		: ((c->n > 0)? c->n : 1)*sizeof(uint16_t);
+	if( (data = talloc_size(b->ctx, size)) == NULL)
+		err_panic(0, "failed to copy bitmap container");
+	memcpy(data, (c->bits != 0)? (const void *) c->u.words : (const void *) c->u.array, 
+			(c->bits != 0)? size : c->n*sizeof(uint16_t));
+	return data;
+}
+
+static void copy_container(struct bitmap *b, struct bitmap_container *dst, 
+		const struct bitmap_container *src) {
+	*dst = *src;
+	if(src->bits != 0)
+		dst->u.words = dup_data(b, src);
+	else {
+		dst->u.array = dup_data(b, src);
+		dst->cap = (src->n > 0)? src->n : 1;
+	}
+}
+
+void bitmap_copy(struct bitmap *dst, const struct bitmap *src) {
+	size_t i;
+
+	bitmap_clear(dst);
+	for(i = 0; i < src->n; i++)
+		copy_container(dst, insert(dst, dst->n, src->c[i].key), &src->c[i]);
+}
+
+/* @d |= @s */
+static void or_container(struct bitmap *b, struct bitmap_container *d, 
+		const struct bitmap_container *s) {
+	uint16_t *array;
+	uint32_t i, j, n, cap;
+
+	cap = d->n + s->n;
+	if(d->bits == 0 && s->bits == 0 && cap <= BITMAP_ARRAY_MAX) {
+		if( (array = talloc_array(b->ctx, uint16_t, cap)) == NULL)
+			err_panic(0, "failed to allocate bitmap container");
+		for(n = 0, i = 0, j = 0; i < d->n || j < s->n; ) {
+			if(j >= s->n || (i < d->n && d->u.array[i] < s->u.array[j]) )
+				array[n++] = d->u.array[i++];
+			else if(i >= d->n || s->u.array[j] < d->u.array[i])
+				array[n++] = s->u.array[j++];
+			else {
+				array[n++] = d->u.array[i++];
+				j++;
+			}
+		}
+		talloc_free(d->u.array);
+		d->u.array = array;
+		d->n = n;
+		d->cap = cap;
+		return;
+	}
+
+	if(d->bits == 0)
+		to_bits(b, d);
+	if(s->bits != 0) {
+		for(i = 0; i < BITMAP_WORDS; i++)
+			d->u.words[i] |= s->u.words[i];
+	}
+	else {
+		for(i = 0; i < s->n; i++)
+			d->u.words[s->u.array[i] >> 6] |= 1ULL << (s->u.array[i] & 63);
+	}
+	d->n = count_words(d->u.words);
+	/* two arrays sharing many ids can still fit in one */
+	fit(b, d);
+}
+
+void bitmap_or(struct bitmap *dst, const struct bitmap *src) {
+	size_t i, idx;
+
+	for(i = 0; i < src->n; i++) {
+		if(find(dst, src->c[i].key, &idx) == 0)
+			copy_container(dst, insert(dst, idx, src->c[i].key), &src->c[i]);
+		else
+			or_container(dst, &dst->c[idx], &src->c[i]);
+	}
+}
+
+/* keeps the ids of @d which are (@keep != 0) or arent (@keep == 0)
+ * in @s */
+static void filter_container(struct bitmap *b, struct bitmap_container *d, 
+		const struct bitmap_container *s, int keep) {
+	uint16_t *array;
+	uint32_t i, n;
+
+	if(d->bits == 0) {
+		for(n = 0, i = 0; i < d->n; i++)
+			if( (container_contains(s, d->u.array[i]) != 0) == (keep != 0) )
+				d->u.array[n++] = d->u.array[i];
+		d->n = n;
+		return;
+	}
+
+	if(s->bits == 0 && keep != 0) {
+		/* no more than s->n are left, so they go straight into 
+		 * an array */
+		if( (array = talloc_array(b->ctx, uint16_t, (s->n > 0)? s->n : 1)) == NULL)
+			err_panic(0, "failed to allocate bitmap container");
+		for(n = 0, i = 0; i < s->n; i++)
+			if(container_contains(d, s->u.array[i]))
+				array[n++] = s->u.array[i];
+		talloc_free(d->u.words);
+		d->u.array = array;
+		d->bits = 0;
+		d->n = n;
+		d->cap = (s->n > 0)? s->n : 1;
+		return;
+	}
+
+	if(s->bits != 0) {
+		for(i = 0; i < BITMAP_WORDS; i++)
+			d->u.words[i] &= (keep != 0)? s->u.words[i] : ~s->u.words[i];
+	}
+	else {
+		for(i = 0; i < s->n; i++)
+			d->u.words[s->u.array[i] >> 6] &= ~(1ULL << (s->u.array[i] & 63));
+	}
+	d->n = count_words(d->u.words);
+	fit(b, d);
+}
+
+void bitmap_and(struct bitmap *dst, const struct bitmap *src) {
+	size_t i, n, idx;
+
+	for(n = 0, i = 0; i < dst->n; i++) {
+		if(find(src, dst->c[i].key, &idx) == 0) {
+			dst->c[i].n = 0;
+		}
+		else
+			filter_container(dst, &dst->c[i], &src->c[idx], 1);
+		if(dst->c[i].n == 0) {
+			talloc_free(dst->c[i].u.array);
+			continue;
+		}
+		dst->c[n++] = dst->c[i];
+	}
+	dst->n = n;
+}
+
+void bitmap_andnot(struct bitmap *dst, const struct bitmap *src) {
+	size_t i, n, idx;
+
+	for(n = 0, i = 0; i < dst->n; i++) {
+		if(find(src, dst->c[i].key, &idx) != 0) {
+			filter_container(dst, &dst->c[i], &src->c[idx], 0);
+			if(dst->c[i].n == 0) {
+				talloc_free(dst->c[i].u.array);
+				continue;
+			}
+		}
+		dst->c[n++] = dst->c[i];
+	}
+	dst->n = n;
+}
+
+void bitmap_iter_init(struct bitmap_iter *it, const struct bitmap *b, uint32_t from) {
+	const struct bitmap_container *c;
+
+	it->b = b;
+	it->i = 0;
+	if(find(b, from >> 16, &it->ci) == 0)
+		return;
+
+	c = &b->c[it->ci];
+	if(c->bits != 0)
+		it->i = from & 0xffff;
+	else
+		it->i = array_lower_bound(c->u.array, c->n, from & 0xffff);
+}
+
+int bitmap_iter_next(struct bitmap_iter *it, uint32_t *x) {
+	const struct bitmap_container *c;
+	uint64_t w;
+
+	for(; it->ci < it->b->n; it->ci++, it->i = 0) {
+		c = &it->b->c[it->ci];
+		if(c->bits == 0) {
+			if(it->i < c->n) {
+				*x = ((uint32_t) c->key << 16) | c->u.array[it->i++];
+				return 0;
+			}
+			continue;
+		}
+
+		while(it->i < 65536) {
+			if( (w = c->u.words[it->i >> 6] >> (it->i & 63)) != 0) {
+				it->i += __builtin_ctzll(w);
+				*x = ((uint32_t) c->key << 16) | it->i++;
+				return 0;
+			}
+			it->i = (it->i | 63) + 1;
+		}
+	}
+
+	return -1;
+}
+
+size_t bitmap_usage(const struct bitmap *b) {
+	return (b->ctx != NULL)? talloc_total_size(b->ctx) : 0;
+}
@@ -0,0 +1,92 @@
+/* 
+ * Copyright 2013 anthony cantor
+ * This file is part of aug-db.
+ *
+ * aug-db is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * aug-db is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with aug-db.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef AUG_DB_BITMAP_H
+#define AUG_DB_BITMAP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* a compressed set of 32 bit ids in the style of roaring bitmaps.
+ * the ids are split up by their upper 16 bits, and the lower 16 
+ * bits of the ids sharing them go into one container: a sorted 
+ * array while there are at most BITMAP_ARRAY_MAX of them, and a 
+ * bitset of 2^16 bits after that. sparse and dense sets both stay
+ * small, and the containers are combined in one pass each. */
+
+#define BITMAP_ARRAY_MAX 4096
+/* the words of a bitset container */
+#define BITMAP_WORDS (65536/64)
+
+struct bitmap_container {
+	/* the upper 16 bits of the ids */
+	uint16_t key;
+	/* non-zero for a bitset */
+	uint16_t bits;
+	/* the number of ids */
+	uint32_t n;
+	/* the slots of an array */
+	uint32_t cap;
+	union {
+		uint16_t *array;
+		uint64_t *words;
+	} u;
+};
+
+struct bitmap {
+	/* talloc parent of the containers */
+	void *ctx;
+	/* sorted by key */
+	struct bitmap_container *c;
+	size_t n;
+	size_t cap;
+};
+
+/* walks the ids of a bitmap in order, see bitmap_iter_next */
+struct bitmap_iter {
+	const struct bitmap *b;
+	size_t ci;
+	uint32_t i;
+};
+
+void bitmap_init(struct bitmap *b);
+void bitmap_free(struct bitmap *b);
+void bitmap_clear(struct bitmap *b);
+
+/* these return non-zero if @x was not already in or was in @b */
+int bitmap_add(struct bitmap *b, uint32_t x);
+int bitmap_remove(struct bitmap *b, uint32_t x);
+int bitmap_contains(const struct bitmap *b, uint32_t x);
+size_t bitmap_count(const struct bitmap *b);
+
+/* @dst becomes a copy of @src, the union of the two, the 
+ * intersection of the two or the ids of @dst not in @src */
+void bitmap_copy(struct bitmap *dst, const struct bitmap *src);
+void bitmap_or(struct bitmap *dst, const struct bitmap *src);
+void bitmap_and(struct bitmap *dst, const struct bitmap *src);
+void bitmap_andnot(struct bitmap *dst, const struct bitmap *src);
+
+/* starts at the first id not less than @from. @b mustnt change
+ * while it is being walked. */
+void bitmap_iter_init(struct bitmap_iter *it, const struct bitmap *b, uint32_t from);
+/* puts the next id into *@x. returns -1 after the last one. */
+int bitmap_iter_next(struct bitmap_iter *it, uint32_t *x);
+
+/* bytes held, for mem.h */
+size_t bitmap_usage(const struct bitmap *b);
+
+#endif /* AUG_DB_BITMAP_H */
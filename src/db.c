@@ -19,12 +19,20 @@
 #include "err.h"
 #include "api_calls.h"
 #include "util.h"
+#include "trace.h"
+#include "db_prof.h"
+#include "mem.h"
+#include "tagdict.h"
+#include "tagmatch.h"
 
 #include <ccan/array_size/array_size.h>
 #include <ccan/talloc/talloc.h>
 #include <ccan/str/str.h>
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
 
-#define AUG_DB_SCHEMA_VERSION 2
+#define AUG_DB_SCHEMA_VERSION 5
 /* SCHEMA
  *
  * version 1:
@@ -32,6 +40,20 @@
  *		tags: INTEGER id, TEXT name
  *		blobs: INTEGER id, BLOB value, INTEGER raw
  *		fk_blobs_tags: INTEGER blob_id, INTEGER tag_id
+ * version 2:
+ *		blobs: INTEGER trash
+ * version 3:
+ *		index on blobs (trash, chosen_at DESC) for the empty query
+ *		index on fk_blobs_tags (tag_id, blob_id) for tag queries
+ * version 4:
+ *		shared_overlay: TEXT db, INTEGER blob_id, INTEGER chosen_at, 
+ *			INTEGER trash. what was chosen and trashed from the 
+ *			read-only shared dbs, see db_attach_shared
+ * version 5:
+ *		tags: INTEGER blob_count. the number of blobs outside the 
+ *			trash with the tag, for evaluating tag queries. kept up
+ *			to date by db_tag_blob and db_trash and corrected by 
+ *			db_refresh_stats.
  *
  * if raw = 0, the blob value will be interpreted as 
  * utf-8 encoded text. if raw != 0, then the blob
@@ -86,66 +108,275 @@ const char db_qm1_fk_blobs_tags[] =
 
 const char db_qs_version[] = "SELECT version FROM admin LIMIT 1";
 
+/* what tags.blob_count of the tag in the row of tags should be */
+#define DB_TAG_BLOB_COUNT \
+	"SELECT COUNT(*) FROM fk_blobs_tags bt " \
+		"INNER JOIN blobs b ON b.id = bt.blob_id " \
+		"WHERE bt.tag_id = tags.id AND b.trash == 0"
+
+/* a row of the recent cache */
+struct db_recent_row {
+	uint8_t *data;
+	size_t size;
+	int raw;
+	int id;
+	int64_t chosen_at;
+};
+
+/* the most tag matches kept for the next queries, see db_match_get */
+#define DB_MATCH_CACHE 4
+
+/* a tag match kept after its query, which the next query with the 
+ * same tags and search terms uses again. */
+struct db_match {
+	struct tagmatch m;
+	/* the tags and then the search terms it was evaluated with, 
+	 * each after the last with its '\0', talloc'd. NULL if the
+	 * slot is empty. */
+	char *key;
+	size_t ntags;
+	size_t nqueries;
+	/* the generation of the postings it was evaluated from */
+	uint32_t gen;
+	/* zero once the postings it came from were dropped, so it
+	 * is freed once the last query using it is */
+	int valid;
+	/* the queries using it and when one last started to */
+	int users;
+	uint64_t used;
+};
+
 static struct {
 	sqlite3 *handle;
+	/* for the memory of sqlite, see db_sqlite_usage */
+	int mem_id;
+	/* number of DB_BEGIN's without a matching DB_COMMIT. only
+	 * the outermost pair actually begins and commits, so that
+	 * a bulk transaction can wrap many db_add's */
+	int txn_depth;
+	/* number of times a statement found the db locked by another
+	 * process and waited for it, see db_busy_cb */
+	uint64_t busy_retries;
+	/* a prepared statement for each query shape, given
+	 * back by db_query_free so that the next query of the same 
+	 * shape doesnt have to format and prepare its sql again */
+	sqlite3_stmt *query_stmts[DB_PROF_SHAPES];
+	/* a statement for each source looking up the tags whose names
+	 * contain a search term, see db_query_name_tags */
+	sqlite3_stmt *name_stmts[DB_MAX_SHARED + 1];
+	/* the tag matches of the last queries with tags, so that 
+	 * typing after the tags doesnt evaluate them again. @tick
+	 * counts their uses. */
+	struct {
+		struct db_match slots[DB_MATCH_CACHE];
+		uint64_t tick;
+	} matches;
+	/* talloc'd paths of the attached shared dbs. the nth is
+	 * attached as "shared<n>" and its blobs have n as their
+	 * source, see db_id_source */
+	char *shared[DB_MAX_SHARED];
+	size_t nshared;
+	/* the first rows of the empty query, see db_recent_warm. the
+	 * data of the rows is talloc'd under @ctx, @gen is the 
+	 * generation they were read at and @complete is set if the
+	 * empty query has no more rows than these. */
+	struct {
+		void *ctx;
+		struct db_recent_row rows[DB_RECENT_MAX];
+		size_t n;
+		int valid;
+		int complete;
+		uint32_t gen;
+		size_t hits;
+		size_t misses;
+		int mem_id;
+	} recent;
+	/* the names of the tags in the personal and shared dbs as of
+	 * generation @gen, see db_tags_check */
+	struct {
+		struct tagdict dict;
+		int valid;
+		uint32_t gen;
+		int mem_id;
+	} tags;
+	/* the blobs outside the trash and the postings of the tags 
+	 * in g.tags.dict as of generation @gen, for tag queries. it
+	 * is all talloc'd under @ctx, see db_postings_load. */
+	struct {
+		void *ctx;
+		struct bitmap *all;
+		int valid;
+		uint32_t gen;
+		int mem_id;
+	} postings;
+	/* the generation and change count when the current write 
+	 * began and whether the generation after it is only down to
+	 * it, see db_write_begin */
+	struct {
+		int ok;
+		uint32_t gen;
+		uint32_t after;
+		int changes;
+	} write;
+	/* the stats refresh, see db_refresh_stats. @thread has its own
+	 * connection to the db at @path, which is talloc'd. @stop is
+	 * set by the main thread and @done by the refresh thread after
+	 * it has set @status and @err. @gen is the generation of the
+	 * last check for drift. */
+	struct {
+		char *path;
+		pthread_t thread;
+		int running;
+		int stop;
+		int done;
+		int status;
+		char err[256];
+		int checked;
+		uint32_t gen;
+	} refresh;
+	/* the result of db_counts as of generation @gen of the main
+	 * db, so that it only counts again after a write */
+	struct {
+		int blobs;
+		int trashed;
+		int tags;
+		int valid;
+		uint32_t gen;
+	} counts;
 } g;
 
 static int db_version(int *);
 static int db_migrate();
 
 static void db_query_fmt(size_t, size_t, char **);
+static void db_query_prepare_stmt(struct db_query *, unsigned int, const uint8_t **, 
+		size_t, const uint8_t **, size_t);
+static void db_recent_drop();
+static size_t db_recent_usage(void *);
+static size_t db_tags_usage(void *);
+static void db_postings_drop();
+static void db_matches_drop();
+static void db_postings_add(const char *, int);
+static size_t db_postings_usage(void *);
+static size_t db_sqlite_usage(void *);
+static void db_sqlite_evict(void *, size_t);
+static void db_postings_evict(void *, size_t);
+static void db_recent_evict(void *, size_t);
+static uint32_t db_file_generation(const char *);
+static char *db_query_fmt_merged(size_t, size_t);
 
 #define DB_EXECUTE(_query, _err_msg) \
 	do { \
-		aug_log("execute query %s\n", _query); \
+		TRACE_COARSE(TRACE_EV_DB_EXECUTE, trace_sql(_query), 0); \
 		if(sqlite3_exec(g.handle, _query, NULL, NULL, NULL) != SQLITE_OK) { \
 			err_panic(0, _err_msg ": %s", sqlite3_errmsg(g.handle) ); \
 		} \
 	} while(0)
 
+/* every transaction writes, so it takes the write lock up front. 
+ * a deferred transaction that reads first can find another process
+ * waiting to write when it wants to, and then sqlite gives up on it
+ * without asking db_busy_cb. */
 #define DB_BEGIN() \
 	do { \
-		aug_log("BEGIN transaction\n"); \
-		DB_EXECUTE("BEGIN", "failed to begin db transaction"); \
+		if(g.txn_depth++ > 0) \
+			break; \
+		TRACE_COARSE(TRACE_EV_DB_BEGIN, 0, 0); \
+		DB_EXECUTE("BEGIN IMMEDIATE", "failed to begin db transaction"); \
 	} while(0)
 
 #define DB_COMMIT() \
 	do { \
-		aug_log("COMMIT transaction\n"); \
+		uint64_t _commit_t0; \
+		err_assert(g.txn_depth > 0); \
+		if(--g.txn_depth > 0) \
+			break; \
+		TRACE_COARSE(TRACE_EV_DB_COMMIT, 0, 0); \
+		_commit_t0 = util_now_ns(); \
 		while(1) { \
 			switch(sqlite3_exec(g.handle, "COMMIT", NULL, NULL, NULL)) { \
 			case SQLITE_OK: \
 				break; \
 			case SQLITE_BUSY: \
+				__atomic_add_fetch(&g.busy_retries, 1, __ATOMIC_RELAXED); \
 				continue; \
 			default: \
 				err_panic(0, "failed to commit db transaction: %s", sqlite3_errmsg(g.handle) ); \
 			} \
 			break; \
 		} \
+		db_prof_record(NULL, DB_PROF_COMMIT, util_now_ns() - _commit_t0); \
 	} while(0)
 
 #define DB_ROLLBACK() \
 	do { \
-		aug_log("ROLLBACK transaction\n"); \
+		g.txn_depth = 0; \
+		/* it may have tags and postings that were never committed */ \
+		g.tags.valid = 0; \
+		g.postings.valid = 0; \
+		TRACE_COARSE(TRACE_EV_DB_ROLLBACK, 0, 0); \
 		DB_EXECUTE("ROLLBACK", "failed to rollback db transaction"); \
 	} while(0)
 
+/* when another process has the db locked sqlite calls this until
+ * it returns zero. each wait is a millisecond longer than the last 
+ * up to DB_BUSY_MAX_WAIT_MS, and DB_BUSY_TRIES waits add up to 
+ * about five seconds. */
+#define DB_BUSY_MAX_WAIT_MS 20
+#define DB_BUSY_TRIES 260
+static int db_busy_cb(void *user, int n) {
+	(void)(user);
+
+	if(n >= DB_BUSY_TRIES)
+		return 0;
+
+	__atomic_add_fetch(&g.busy_retries, 1, __ATOMIC_RELAXED);
+	util_usleep(0, ((n < DB_BUSY_MAX_WAIT_MS)? n + 1 : DB_BUSY_MAX_WAIT_MS)*1000);
+	return 1;
+}
+
 int db_init(const char *fpath) {
-	if(sqlite3_open(fpath, &g.handle) != SQLITE_OK) {
+	g.txn_depth = 0;
+	g.nshared = 0;
+	memset(&g.recent, 0, sizeof(g.recent));
+	memset(&g.postings, 0, sizeof(g.postings));
+	memset(&g.counts, 0, sizeof(g.counts));
+	memset(&g.matches, 0, sizeof(g.matches));
+	memset(&g.refresh, 0, sizeof(g.refresh));
+	g.refresh.path = talloc_strdup(NULL, fpath);
+	tagdict_init(&g.tags.dict);
+	g.tags.valid = 0;
+	/* uris are needed to attach the shared dbs read-only */
+	if(sqlite3_open_v2(fpath, &g.handle, 
+			SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE | SQLITE_OPEN_URI, NULL) != SQLITE_OK) {
 		err_warn(0, "failed to open sqlite db: %s", sqlite3_errmsg(g.handle));
 		goto fail;
 	}
+	sqlite3_busy_handler(g.handle, db_busy_cb, NULL);
+	db_prof_init(g.handle);
 
 	if(db_migrate() != 0) {
 		err_warn(0, "failed to migrate db");
 		goto fail;
 	}
+	if(tagmatch_register(g.handle, DB_SOURCE_SHIFT) != 0)
+		goto fail;
+	g.recent.mem_id = mem_register("recent", MEM_PRIO_RECENT, db_recent_usage, 
+			db_recent_evict, NULL);
+	/* the tags are needed for every tag query, so they are only counted */
+	g.tags.mem_id = mem_register("tags", MEM_PRIO_NONE, db_tags_usage, NULL, NULL);
+	g.postings.mem_id = mem_register("postings", MEM_PRIO_POSTINGS, db_postings_usage, 
+			db_postings_evict, NULL);
+	g.mem_id = mem_register("sqlite", MEM_PRIO_SQLITE, db_sqlite_usage, 
+			db_sqlite_evict, NULL);
 
 	return 0;
 
 fail:
+	tagdict_free(&g.tags.dict);
 	sqlite3_close(g.handle);
+	talloc_free(g.refresh.path);
+	g.refresh.path = NULL;
 	return -1;
 }
 
@@ -221,6 +452,133 @@ fail:
 	return -1;	
 }
 
+static int db_migrate_v3() {
+	const char *query;
+
+	aug_log("migrate to schema v3\n");
+#define RUN_QM(_query) \
+	do { \
+		if(sqlite3_exec(g.handle, _query, NULL, NULL, NULL) != SQLITE_OK) { \
+			query = _query; \
+			goto rollback; \
+		} \
+	} while(0)
+
+	if(sqlite3_exec(g.handle, "BEGIN", NULL, NULL, NULL) != SQLITE_OK) {
+		query = "BEGIN";
+		goto fail;
+	}
+	RUN_QM(
+		"CREATE INDEX blobs_trash_chosen_at " \
+		"ON blobs (trash, chosen_at DESC)" \
+	);
+	RUN_QM(
+		"CREATE INDEX fk_blobs_tags_tag_id " \
+		"ON fk_blobs_tags (tag_id, blob_id)" \
+	);
+	RUN_QM(
+		"UPDATE admin SET " \
+		"version = 3, " \
+		"updated_at = strftime('%s', 'now') " \
+	);
+	RUN_QM("COMMIT");
+#undef RUN_QM
+
+	return 0;
+
+rollback:
+	if(sqlite3_exec(g.handle, "ROLLBACK", NULL, NULL, NULL) != SQLITE_OK)
+		err_warn(0, "failed to rollback: %s", sqlite3_errmsg(g.handle));
+fail:
+	err_warn(0, "failed to execute query %s: %s", query, sqlite3_errmsg(g.handle));
+	return -1;	
+}
+
+static int db_migrate_v4() {
+	const char *query;
+
+	aug_log("migrate to schema v4\n");
+#define RUN_QM(_query) \
+	do { \
+		if(sqlite3_exec(g.handle, _query, NULL, NULL, NULL) != SQLITE_OK) { \
+			query = _query; \
+			goto rollback; \
+		} \
+	} while(0)
+
+	if(sqlite3_exec(g.handle, "BEGIN", NULL, NULL, NULL) != SQLITE_OK) {
+		query = "BEGIN";
+		goto fail;
+	}
+	RUN_QM(
+		"CREATE TABLE shared_overlay (" \
+			"db TEXT NOT NULL ON CONFLICT ROLLBACK, " \
+			"blob_id INTEGER NOT NULL ON CONFLICT ROLLBACK, " \
+			"chosen_at INTEGER NOT NULL ON CONFLICT ROLLBACK " \
+				"DEFAULT (0), " \
+			"trash INTEGER NOT NULL ON CONFLICT ROLLBACK " \
+				"DEFAULT 0, " \
+			"PRIMARY KEY (db, blob_id) ON CONFLICT IGNORE" \
+		")" \
+	);
+	RUN_QM(
+		"UPDATE admin SET " \
+		"version = 4, " \
+		"updated_at = strftime('%s', 'now') " \
+	);
+	RUN_QM("COMMIT");
+#undef RUN_QM
+
+	return 0;
+
+rollback:
+	if(sqlite3_exec(g.handle, "ROLLBACK", NULL, NULL, NULL) != SQLITE_OK)
+		err_warn(0, "failed to rollback: %s", sqlite3_errmsg(g.handle));
+fail:
+	err_warn(0, "failed to execute query %s: %s", query, sqlite3_errmsg(g.handle));
+	return -1;	
+}
+
+static int db_migrate_v5() {
+	const char *query;
+
+	aug_log("migrate to schema v5\n");
+#define RUN_QM(_query) \
+	do { \
+		if(sqlite3_exec(g.handle, _query, NULL, NULL, NULL) != SQLITE_OK) { \
+			query = _query; \
+			goto rollback; \
+		} \
+	} while(0)
+
+	if(sqlite3_exec(g.handle, "BEGIN", NULL, NULL, NULL) != SQLITE_OK) {
+		query = "BEGIN";
+		goto fail;
+	}
+	RUN_QM(
+		"ALTER TABLE tags ADD COLUMN " \
+			"blob_count INTEGER NOT NULL ON CONFLICT ROLLBACK " \
+				"DEFAULT 0" \
+	);
+	RUN_QM("UPDATE tags SET blob_count = (" DB_TAG_BLOB_COUNT ")");
+	RUN_QM(
+		"UPDATE admin SET " \
+		"version = 5, " \
+		"updated_at = strftime('%s', 'now') " \
+	);
+	RUN_QM("COMMIT");
+#undef RUN_QM
+
+	return 0;
+
+rollback:
+	if(sqlite3_exec(g.handle, "ROLLBACK", NULL, NULL, NULL) != SQLITE_OK)
+		err_warn(0, "failed to rollback: %s", sqlite3_errmsg(g.handle));
+fail:
+	err_warn(0, "failed to execute query %s: %s", query, sqlite3_errmsg(g.handle));
+	return -1;	
+}
+
 static int db_migrate() {
 	int version;
 
@@ -230,7 +588,7 @@ static int db_migrate() {
 	}
 	aug_log("db version: %d\n", version);
 
-	while(version < 2) {
+	while(version < AUG_DB_SCHEMA_VERSION) {
 		switch(version) {
 		case 0:
 			if(db_migrate_v1() != 0)
@@ -240,6 +598,18 @@ static int db_migrate() {
 			if(db_migrate_v2() != 0)
 				return -1;
 			break;
+		case 2:
+			if(db_migrate_v3() != 0)
+				return -1;
+			break;
+		case 3:
+			if(db_migrate_v4() != 0)
+				return -1;
+			break;
+		case 4:
+			if(db_migrate_v5() != 0)
+				return -1;
+			break;
 		default:
 			err_warn(0, "dont know how to migrate from db version %d", version);
 			return -1;
@@ -290,7 +660,47 @@ fail:
 	return -1;
 }
 
+/* the sql of the cached statements depends on the attached dbs */
+static void db_query_stmts_free() {
+	size_t i;
+
+	for(i = 0; i < ARRAY_SIZE(g.query_stmts); i++) {
+		if(g.query_stmts[i] == NULL)
+			continue;
+		if(sqlite3_finalize(g.query_stmts[i]) != SQLITE_OK)
+			err_warn(0, "failed to finalize statement: %s", sqlite3_errmsg(g.handle));
+		g.query_stmts[i] = NULL;
+	}
+	for(i = 0; i < ARRAY_SIZE(g.name_stmts); i++) {
+		if(g.name_stmts[i] == NULL)
+			continue;
+		if(sqlite3_finalize(g.name_stmts[i]) != SQLITE_OK)
+			err_warn(0, "failed to finalize statement: %s", sqlite3_errmsg(g.handle));
+		g.name_stmts[i] = NULL;
+	}
+}
+
 void db_free() {
+	size_t i;
+
+	db_refresh_stats_stop();
+	db_refresh_stats_end(1);
+	talloc_free(g.refresh.path);
+	g.refresh.path = NULL;
+	db_query_stmts_free();
+	mem_unregister(g.recent.mem_id);
+	db_recent_drop();
+	mem_unregister(g.postings.mem_id);
+	db_postings_drop();
+	mem_unregister(g.tags.mem_id);
+	tagdict_free(&g.tags.dict);
+	mem_unregister(g.mem_id);
+	for(i = 0; i < g.nshared; i++) {
+		talloc_free(g.shared[i]);
+		g.shared[i] = NULL;
+	}
+	g.nshared = 0;
+	db_prof_free();
 	if(sqlite3_close(g.handle) != SQLITE_OK)
 		err_warn(0, "failed to close sqlite db: %s", sqlite3_errmsg(g.handle));
 }
@@ -298,16 +708,16 @@ void db_free() {
 
 #define DB_STMT_PREP(_sql, _stmt_pptr) \
 	do { \
-		aug_log("prepare query %s\n", _sql); \
 		if(sqlite3_prepare_v2(g.handle, _sql, -1, _stmt_pptr, NULL) != SQLITE_OK) { \
 			err_panic(0, "failed to prepare %s: %s", \
 							_sql, sqlite3_errmsg(g.handle)); \
 		} \
+		TRACE_FINE(TRACE_EV_DB_PREP, *(_stmt_pptr), trace_sql(_sql)); \
 	} while(0)
 
 #define DB_STMT_FINALIZE(_stmt_ptr) \
 	do { \
-		aug_log("finalize stmt %p\n", _stmt_ptr); \
+		TRACE_FINE(TRACE_EV_DB_FINALIZE, _stmt_ptr, 0); \
 		if(sqlite3_finalize(_stmt_ptr) != SQLITE_OK) { \
 			err_warn(0, "failed to finalize statement: %s", sqlite3_errmsg(g.handle)); \
 		} \
@@ -315,17 +725,23 @@ void db_free() {
 
 #define DB_STMT_RESET(_stmt_ptr) \
 	do { \
-		aug_log("reset stmt %p\n", _stmt_ptr); \
+		TRACE_FINE(TRACE_EV_DB_RESET, _stmt_ptr, 0); \
 		if(sqlite3_reset(_stmt_ptr) != SQLITE_OK) { \
 			err_panic(0, "expected reset to return SQLITE_OK: %s", sqlite3_errmsg(g.handle)); \
 		} \
 	} while(0)
 
-static int db_stmt_step(sqlite3_stmt *stmt) {
+/* adds the time spent in sqlite3_step to *ns */
+static int db_stmt_step_timed(sqlite3_stmt *stmt, uint64_t *ns) {
 	int status;
-
-	aug_log("step stmt %p\n", stmt);
-	if( (status = sqlite3_step(stmt)) != SQLITE_ROW) {
+	uint64_t t0;
+
+	db_prof_step_begin(stmt);
+	t0 = util_now_ns();
+	status = sqlite3_step(stmt);
+	*ns += util_now_ns() - t0;
+	TRACE_FINE(TRACE_EV_DB_STEP, stmt, status);
+	if(status != SQLITE_ROW) {
 		if(status == SQLITE_DONE)
 			return -1;
 		else 
@@ -335,9 +751,19 @@ static int db_stmt_step(sqlite3_stmt *stmt) {
 	return 0;
 }
 
+static int db_stmt_step(sqlite3_stmt *stmt) {
+	int status;
+	uint64_t ns;
+
+	ns = 0;
+	status = db_stmt_step_timed(stmt, &ns);
+	db_prof_record(stmt, -1, ns);
+	return status;
+}
+
 #define DB_STMT_EXEC(_stmt_ptr) \
 	do { \
-		aug_log("exec stmt %p\n", _stmt_ptr); \
+		TRACE_FINE(TRACE_EV_DB_EXEC, _stmt_ptr, 0); \
 		if(db_stmt_step(_stmt_ptr) == 0) { \
 			err_panic(0, "expected SQLITE_DONE"); \
 		} \
@@ -367,35 +793,58 @@ static int db_stmt_step(sqlite3_stmt *stmt) {
 		} \
 	} while(0) 
 
+#define DB_BIND_INT64(_stmt_ptr, _idx, _val) \
+	do { \
+		if(sqlite3_bind_int64(_stmt_ptr, _idx, _val) != SQLITE_OK) { \
+			err_panic(0, "failed to bind int64: %s", sqlite3_errmsg(g.handle)); \
+		} \
+	} while(0) 
+
 #define DB_BIND_PRM_IDX(_stmt_ptr, _name, _idx_ptr) \
 	do { \
 		if( ((*_idx_ptr) = sqlite3_bind_parameter_index(_stmt_ptr, _name)) < 1) { \
 			err_panic(0, "failed to find index for %s", _name); \
 		} \
 	} while(0)
+
+/* binds the path of the nth shared db to @db<n>, which is
+ * how shared_overlay knows it */
+static void db_bind_shared(sqlite3_stmt *stmt, size_t n) {
+	char name[16];
+	int idx;
+
+	snprintf(name, sizeof(name), "@db%d", (int) n);
+	if( (idx = sqlite3_bind_parameter_index(stmt, name)) < 1)
+		return;
+	DB_BIND_TEXT(stmt, idx, g.shared[n-1]);
+}
 		
-static int db_blob_id(const void *data, size_t bytes) {
+static int db_blob_id(const void *data, size_t bytes, int *trash) {
 	int id;
 	sqlite3_stmt *stmt;
 	
 	id = 0;
-	DB_STMT_PREP("SELECT id FROM blobs WHERE value = ?", &stmt);
+	DB_STMT_PREP("SELECT id, trash FROM blobs WHERE value = ?", &stmt);
 	DB_BIND_BLOB(stmt, 1, data, bytes);
 	if(db_stmt_step(stmt) != 0) 
 		goto done; /* no rows in the blobs table */
 
 	id = sqlite3_column_int(stmt, 0);
+	*trash = sqlite3_column_int(stmt, 1);
 done:
 	DB_STMT_FINALIZE(stmt);
 	return id;
 }
 
 /* this function should be run within a transaction */
-static int db_find_or_create_blob(const void *data, size_t bytes, int raw) {
+static int db_find_or_create_blob(const void *data, size_t bytes, int raw, 
+		int *created, int *trash) {
 	sqlite3_stmt *stmt;
 	int bid;
 
-	if( (bid = db_blob_id(data, bytes)) > 0) {
+	*created = 0;
+	*trash = 0;
+	if( (bid = db_blob_id(data, bytes, trash)) > 0) {
 		return bid;
 	}
 	
@@ -405,23 +854,221 @@ static int db_find_or_create_blob(const void *data, size_t bytes, int raw) {
 	DB_STMT_EXEC(stmt);
 
 	bid = sqlite3_last_insert_rowid(g.handle);
+	*created = 1;
+	db_postings_add(NULL, bid);
 	return bid;
 }
 
-static int db_tag_id(const char *tag) {
+static void db_tags_load() {
 	sqlite3_stmt *stmt;
-	int id;
-
-	id = 0;
-	DB_STMT_PREP("SELECT id FROM tags WHERE name = ?", &stmt);
-	DB_BIND_TEXT(stmt, 1, tag);
-	if(db_stmt_step(stmt) != 0) 
-		goto done; /* no rows in the tags table */
+	const char *name;
+	char *sql;
+	size_t i;
 
-	id = sqlite3_column_int(stmt, 0);
-done:
+	/* they belong to the entries */
+	db_postings_drop();
+	tagdict_clear(&g.tags.dict);
+	g.tags.gen = db_generation();
+	/* the unique index on name gives them in order */
+	DB_STMT_PREP("SELECT name, id, blob_count FROM tags ORDER BY name", &stmt);
+	while(db_stmt_step(stmt) == 0) {
+		name = (const char *) sqlite3_column_text(stmt, 0);
+		tagdict_add(&g.tags.dict, name, sqlite3_column_int(stmt, 1));
+		tagdict_count(&g.tags.dict, name, sqlite3_column_int(stmt, 2));
+	}
 	DB_STMT_FINALIZE(stmt);
-	return id;
+
+	for(i = 1; i <= g.nshared; i++) {
+		sql = talloc_asprintf(NULL, "SELECT name FROM shared%d.tags ORDER BY name", (int) i);
+		DB_STMT_PREP(sql, &stmt);
+		while(db_stmt_step(stmt) == 0)
+			tagdict_add(&g.tags.dict, (const char *) sqlite3_column_text(stmt, 0), 0);
+		DB_STMT_FINALIZE(stmt);
+		talloc_free(sql);
+	}
+
+	g.tags.valid = 1;
+}
+
+/* loads the tags again if another process might have added some */
+static void db_tags_check() {
+	if(g.tags.valid == 0 || g.tags.gen != db_generation())
+		db_tags_load();
+}
+
+static size_t db_tags_usage(void *user) {
+	(void)(user);
+	return tagdict_usage(&g.tags.dict);
+}
+
+size_t db_tag_complete(const char *prefix, char *buf, size_t size) {
+	db_tags_check();
+	return tagdict_complete(&g.tags.dict, prefix, buf, size);
+}
+
+int db_tag_word(const char *word) {
+	db_tags_check();
+	return tagmatch_word(&g.tags.dict, word);
+}
+
+/* a bitmap which goes with the rest of the postings */
+static struct bitmap *db_postings_new() {
+	struct bitmap *b;
+
+	if( (b = talloc(g.postings.ctx, struct bitmap)) == NULL)
+		err_panic(0, "failed to allocate postings");
+	bitmap_init(b);
+	talloc_steal(b, b->ctx);
+	return b;
+}
+
+static void db_postings_drop() {
+	size_t i;
+
+	db_matches_drop();
+	for(i = 0; i < g.tags.dict.n; i++)
+		g.tags.dict.entries[i].postings = NULL;
+	talloc_free(g.postings.ctx);
+	g.postings.ctx = NULL;
+	g.postings.all = NULL;
+	g.postings.valid = 0;
+}
+
+static size_t db_postings_usage(void *user) {
+	(void)(user);
+	return (g.postings.ctx != NULL)? mem_talloc_usage(g.postings.ctx) : 0;
+}
+
+static void db_postings_evict(void *user, size_t want) {
+	(void)(user);
+	(void)(want);
+	db_postings_drop();
+}
+
+/* the whole heap of sqlite, which is mostly the page cache */
+static size_t db_sqlite_usage(void *user) {
+	(void)(user);
+	return (size_t) sqlite3_memory_used();
+}
+
+/* sqlite3_release_memory does nothing unless sqlite was built with
+ * SQLITE_ENABLE_MEMORY_MANAGEMENT, but the unused pages cached for
+ * a connection can always be given back */
+static void db_sqlite_evict(void *user, size_t want) {
+	(void)(user);
+	(void)(want);
+	sqlite3_db_release_memory(g.handle);
+}
+
+/* reads the blobs outside the trash and the tags of every blob from
+ * the personal and shared dbs. g.tags must be loaded. */
+static void db_postings_load() {
+	sqlite3_stmt *stmt;
+	const struct tagdict_entry *e;
+	struct tagdict_entry *entry;
+	const char *name;
+	char *schema, *sql;
+	uint32_t source;
+	size_t i;
+
+	db_postings_drop();
+	g.postings.ctx = talloc_new(NULL);
+	g.postings.all = db_postings_new();
+	g.postings.gen = db_generation();
+	for(i = 0; i <= g.nshared; i++) {
+		source = (uint32_t) i << DB_SOURCE_SHIFT;
+		if(i == 0)
+			schema = talloc_strdup(NULL, "main");
+		else
+			schema = talloc_asprintf(NULL, "shared%d", (int) i);
+
+		/* the overlay decides which blobs of a shared db are trashed */
+		sql = talloc_asprintf(schema, 
+			"SELECT b.id FROM %s.blobs b WHERE b.trash == 0%s", schema, 
+			(i == 0)? "" : 
+				" AND NOT EXISTS (SELECT 1 FROM main.shared_overlay o "
+					"WHERE o.db = ?1 AND o.blob_id = b.id AND o.trash != 0)");
+		DB_STMT_PREP(sql, &stmt);
+		if(i > 0)
+			DB_BIND_TEXT(stmt, 1, g.shared[i-1]);
+		while(db_stmt_step(stmt) == 0)
+			bitmap_add(g.postings.all, source | (uint32_t) sqlite3_column_int(stmt, 0));
+		DB_STMT_FINALIZE(stmt);
+
+		/* in the order the tags were given to the blobs, so the
+		 * ids mostly go on the end of the postings */
+		sql = talloc_asprintf(schema, 
+			"SELECT t.name, bt.blob_id FROM %s.fk_blobs_tags bt "
+				"INNER JOIN %s.tags t ON t.id = bt.tag_id", 
+			schema, schema);
+		DB_STMT_PREP(sql, &stmt);
+		e = NULL;
+		while(db_stmt_step(stmt) == 0) {
+			name = (const char *) sqlite3_column_text(stmt, 0);
+			if(e == NULL || strcmp(e->name, name) != 0) 
+				e = tagdict_find(&g.tags.dict, name);
+			if(e == NULL)
+				continue;
+			entry = &g.tags.dict.entries[e - g.tags.dict.entries];
+			if(entry->postings == NULL)
+				entry->postings = db_postings_new();
+			bitmap_add(entry->postings, source | (uint32_t) sqlite3_column_int(stmt, 1));
+		}
+		DB_STMT_FINALIZE(stmt);
+		talloc_free(schema);
+	}
+
+	g.postings.valid = 1;
+}
+
+/* loads the postings again if another process might have changed
+ * them */
+static void db_postings_check() {
+	db_tags_check();
+	if(g.postings.valid == 0 || g.postings.gen != db_generation())
+		db_postings_load();
+}
+
+/* adds the blob @id to the postings of @tag, or to the blobs outside
+ * the trash if @tag is NULL. does nothing if they arent loaded. */
+static void db_postings_add(const char *tag, int id) {
+	const struct tagdict_entry *e;
+	struct tagdict_entry *entry;
+
+	if(g.postings.valid == 0)
+		return;
+	if(tag == NULL) {
+		bitmap_add(g.postings.all, (uint32_t) id);
+		return;
+	}
+
+	/* db_find_or_create_tag adds every tag it is given, so the 
+	 * dictionary would have to be stale */
+	if( (e = tagdict_find(&g.tags.dict, tag)) == NULL) {
+		db_postings_drop();
+		return;
+	}
+	entry = &g.tags.dict.entries[e - g.tags.dict.entries];
+	if(entry->postings == NULL)
+		entry->postings = db_postings_new();
+	bitmap_add(entry->postings, (uint32_t) id);
+}
+
+/* the postings keep the tags of a trashed blob, which are taken
+ * out along with the trash by tagmatch_eval */
+static void db_postings_trash(int id) {
+	if(g.postings.valid != 0)
+		bitmap_remove(g.postings.all, (uint32_t) id);
+}
+
+static int db_tag_id(const char *tag) {
+	const struct tagdict_entry *e;
+
+	db_tags_check();
+	if( (e = tagdict_find(&g.tags.dict, tag)) == NULL)
+		return 0;
+
+	return e->id;
 }
 
 /* this should be run within a transaction */
@@ -438,13 +1085,18 @@ static int db_find_or_create_tag(const char *tag) {
 	DB_STMT_EXEC(stmt);
 
 	tid = sqlite3_last_insert_rowid(g.handle);
+	/* a name only the shared dbs had gets the new id */
+	tagdict_add(&g.tags.dict, tag, tid);
 	return tid;
 }
 
-static void db_tag_blob(int bid, const char **tags, size_t ntags) {
+/* tags blob @bid with @tags. the blob counts of the tags it didnt
+ * have yet go up if @counted is set, which it is unless the blob is
+ * in the trash. this should be run within a transaction. */
+static void db_tag_blob(int bid, int counted, const char **tags, size_t ntags) {
 	int tid;
 	size_t i;
-	sqlite3_stmt *stmt;
+	sqlite3_stmt *stmt, *count;
 	const char *sql = 
 		"INSERT INTO fk_blobs_tags (blob_id, tag_id) "
 		"VALUES (?, ?)";
@@ -454,6 +1106,7 @@ static void db_tag_blob(int bid, const char **tags, size_t ntags) {
 	if(ntags < 1)
 		return;
 
+	count = NULL;
 	DB_STMT_PREP(sql, &stmt);
 	DB_BIND_INT(stmt, 1, bid);
 	for(i = 0; i < ntags; i++) {
@@ -464,106 +1117,714 @@ static void db_tag_blob(int bid, const char **tags, size_t ntags) {
 		DB_BIND_INT(stmt, 2, tid);
 		if(db_stmt_step(stmt) == 0)
 			err_panic(0, "expected SQLITE_DONE from %s: ", sql);
+		/* zero if the blob already had the tag */
+		if(sqlite3_changes(g.handle) < 1)
+			continue;
+		db_postings_add(tags[i], bid);
+		if(counted == 0)
+			continue;
+
+		if(count == NULL)
+			DB_STMT_PREP("UPDATE tags SET blob_count = blob_count + 1 WHERE id = ?", &count);
+		else
+			DB_STMT_RESET(count);
+		DB_BIND_INT(count, 1, tid);
+		if(db_stmt_step(count) == 0)
+			err_panic(0, "didnt expect statement to return rows");
+		tagdict_count(&g.tags.dict, tags[i], 1);
 	}
 
 	DB_STMT_FINALIZE(stmt);
+	if(count != NULL)
+		DB_STMT_FINALIZE(count);
 }
 
-void db_trash(int bid) {
+/* takes @bid, which has just gone into the trash, out of the blob
+ * counts of its tags. this should be run within a transaction. */
+static void db_tag_uncount(int bid) {
 	sqlite3_stmt *stmt;
 
-	DB_BEGIN();
 	DB_STMT_PREP(
-		"UPDATE blobs "
-			"SET trash = 1 "
-			"WHERE id = ?", 
+		"SELECT t.name FROM fk_blobs_tags bt "
+			"INNER JOIN tags t ON t.id = bt.tag_id "
+			"WHERE bt.blob_id = ?",
 		&stmt
 	);
 	DB_BIND_INT(stmt, 1, bid);
-	if(db_stmt_step(stmt) != -1)
-		err_panic(0, "didnt expect statement to return rows");
+	while(db_stmt_step(stmt) == 0)
+		tagdict_count(&g.tags.dict, (const char *) sqlite3_column_text(stmt, 0), -1);
+	DB_STMT_FINALIZE(stmt);
 
-	DB_STMT_FINALIZE(stmt);	
-	DB_COMMIT();
+	DB_STMT_PREP(
+		"UPDATE tags SET blob_count = blob_count - 1 "
+			"WHERE id IN (SELECT tag_id FROM fk_blobs_tags WHERE blob_id = ?)",
+		&stmt
+	);
+	DB_BIND_INT(stmt, 1, bid);
+	DB_STMT_EXEC(stmt);
 }
 
-void db_add(const void *data, size_t bytes, int raw, const char **tags, size_t ntags) {
-	int bid;
-	
-	DB_BEGIN();
-	bid = db_find_or_create_blob(data, bytes, raw);
-	db_tag_blob(bid, tags, ntags);
-	DB_COMMIT();
+/* the rows of the empty query are ordered by chosen_at DESC, id ASC.
+ * returns non-zero if a row with @chosen_at and @id goes before @row */
+static int db_recent_before(int64_t chosen_at, int id, const struct db_recent_row *row) {
+	return chosen_at > row->chosen_at 
+		|| (chosen_at == row->chosen_at && id < row->id);
 }
 
-#define DB_QUERY_COLUMNS "b.value, b.raw, b.id"
-#define DB_QUERY_LIMIT "LIMIT 200 OFFSET @offset"
-#define DB_NON_TRASH_BLOB "trash == 0"
-
-void db_query_prepare(struct db_query *query, unsigned int offset, const uint8_t **queries, 
-		size_t nqueries, const uint8_t **tags, size_t ntags) {
-	char *sql;
-	size_t i;
-	int offset_idx;
-	
-	if(nqueries < 1 && ntags < 1) {
-		sql = 
-			"SELECT DISTINCT " 
-				DB_QUERY_COLUMNS ", 0 AS score "
-			"FROM blobs b " 
-			"WHERE " DB_NON_TRASH_BLOB " "
-			"ORDER BY b.chosen_at DESC "
-			DB_QUERY_LIMIT ;
-	}
-	else 
-		db_query_fmt(nqueries, ntags, &sql);
+static void db_recent_drop() {
+	talloc_free(g.recent.ctx);
+	g.recent.ctx = NULL;
+	g.recent.n = 0;
+	g.recent.valid = 0;
+}
 
-	DB_STMT_PREP(sql, &query->stmt);
-	aug_log("db: prepare sql (%p) %s\n", query->stmt, sql);
+static size_t db_recent_usage(void *user) {
+	(void)(user);
+	return (g.recent.ctx != NULL)? mem_talloc_usage(g.recent.ctx) : 0;
+}
 
-#define DB_QP_BIND(_idx, _ptr) \
-	DB_BIND_BUF(text, query->stmt, _idx, _ptr, -1, SQLITE_TRANSIENT)
+static void db_recent_evict(void *user, size_t want) {
+	(void)(user);
+	(void)(want);
+	db_recent_drop();
+}
 
-	for(i = 0; i < nqueries; i++) {
-		/*aug_log("bind %s to ?(%d)\n", queries[i], i+1);*/
-		DB_QP_BIND(i+1, (const char *) queries[i]);
-	}
-	for(i = 0; i < ntags; i++) {
-		/*aug_log("bind %s to ?(%d)\n", tags[i], nqueries+i+1);*/
-		DB_QP_BIND(nqueries+i+1, (const char *) tags[i]);
+static void db_recent_fill() {
+	struct db_query q;
+	struct db_recent_row *row;
+	const uint8_t *data;
+
+	db_recent_drop();
+	g.recent.ctx = talloc_new(NULL);
+	/* a change committed while the rows are read is noticed by
+	 * the next check */
+	g.recent.gen = db_generation();
+	db_query_prepare_stmt(&q, 0, NULL, 0, NULL, 0);
+	while(g.recent.n < DB_RECENT_MAX && db_query_step(&q) == 0) {
+		row = &g.recent.rows[g.recent.n++];
+		db_query_value_ref(&q, &data, &row->size, &row->raw, &row->id);
+		row->chosen_at = sqlite3_column_int64(q.stmt, 4);
+		row->data = talloc_array(g.recent.ctx, uint8_t, row->size);
+		memcpy(row->data, data, row->size);
 	}
-#undef DB_QP_BIND
+	g.recent.complete = (g.recent.n < DB_RECENT_MAX);
+	db_query_free(&q);
+	g.recent.valid = 1;
+}
 
-	DB_BIND_PRM_IDX(query->stmt, "@offset", &offset_idx);
-	DB_BIND_INT(query->stmt, offset_idx, offset);
+int db_recent_warm() {
+	/* the in place updates can leave it short of rows */
+	if(g.recent.valid && g.recent.gen == db_generation()
+			&& (g.recent.complete || g.recent.n >= DB_RECENT_MAX/2))
+		return 0;
 
-	if(!(nqueries < 1 && ntags < 1))
-		talloc_free(sql);
+	db_recent_fill();
+	return 1;
 }
 
-void db_query_free(struct db_query *query) {
-	aug_log("db: free %p\n", query->stmt);
-	DB_STMT_FINALIZE(query->stmt);
-	query->stmt = NULL;
+void db_recent_stats(size_t *hits, size_t *misses) {
+	*hits = g.recent.hits;
+	*misses = g.recent.misses;
 }
 
-int db_query_step(struct db_query *query) {
-	if(db_stmt_step(query->stmt) != 0) {
-		db_query_reset(query);
-		return -1;
-	}
+/* writes which can change what the caches hold call this right 
+ * after DB_BEGIN and db_write_end right after DB_COMMIT. a cache 
+ * can only be updated in place if the write is the only change 
+ * since it was filled. DB_BEGIN takes the write lock, so no other 
+ * process can commit between the generation read here and the 
+ * commit, which adds one to it if it changed anything. */
+static void db_write_begin() {
+	g.write.ok = (g.txn_depth == 1);
+	g.write.gen = db_generation();
+	g.write.changes = sqlite3_total_changes(g.handle);
+}
+
+static int db_write_in_step(uint32_t *);
+
+static void db_write_end() {
+	g.write.after = g.write.gen 
+		+ (sqlite3_total_changes(g.handle) != g.write.changes);
+	if(g.write.ok != 0 && db_generation() != g.write.after)
+		g.write.ok = 0;
+	/* db_find_or_create_tag keeps it up to date, and db_tag_blob,
+	 * db_find_or_create_blob and db_trash the postings */
+	if(g.tags.valid != 0)
+		db_write_in_step(&g.tags.gen);
+	if(g.postings.valid != 0)
+		db_write_in_step(&g.postings.gen);
+}
+
+/* returns non-zero if a cache of generation *@gen was in step with
+ * the db before the write that just ended, and moves *@gen on to 
+ * the generation after it. */
+static int db_write_in_step(uint32_t *gen) {
+	if(g.write.ok == 0 || *gen != g.write.gen)
+		return 0;
 
+	*gen = g.write.after;
+	return 1;
+}
+
+/* returns non-zero if the recent cache should be updated in place
+ * after a write, otherwise it is dropped */
+static int db_recent_in_step() {
+	if(g.recent.valid != 0 && db_write_in_step(&g.recent.gen) != 0)
+		return 1;
+
+	db_recent_drop();
 	return 0;
 }
 
+static int db_recent_find(int id) {
+	size_t i;
+
+	for(i = 0; i < g.recent.n; i++)
+		if(g.recent.rows[i].id == id)
+			return (int) i;
+
+	return -1;
+}
+
+static void db_recent_remove(int id) {
+	int i;
+
+	if( (i = db_recent_find(id)) < 0)
+		return;
+
+	talloc_free(g.recent.rows[i].data);
+	g.recent.n--;
+	memmove(&g.recent.rows[i], &g.recent.rows[i+1], 
+			(g.recent.n - i)*sizeof(g.recent.rows[0]));
+}
+
+/* reads the value of @row->id into @row. returns non-zero if the
+ * blob is trashed. */
+static int db_recent_fetch(struct db_recent_row *row) {
+	sqlite3_stmt *stmt;
+	const void *data;
+	int status;
+
+	status = -1;
+	DB_STMT_PREP("SELECT value, raw FROM blobs WHERE id = ? AND trash == 0", &stmt);
+	DB_BIND_INT(stmt, 1, row->id);
+	if(db_stmt_step(stmt) != 0)
+		goto done;
+
+	if( (data = sqlite3_column_blob(stmt, 0)) == NULL)
+		err_panic(0, "column data is NULL: %s", sqlite3_errmsg(g.handle));
+	row->size = sqlite3_column_bytes(stmt, 0);
+	row->raw = sqlite3_column_int(stmt, 1);
+	row->data = talloc_array(g.recent.ctx, uint8_t, row->size);
+	memcpy(row->data, data, row->size);
+	status = 0;
+done:
+	DB_STMT_FINALIZE(stmt);
+	return status;
+}
+
+/* moves the blob @id to where @chosen_at puts it in the cache, 
+ * reading it from the db if it wasnt there already */
+static void db_recent_place(int id, int64_t chosen_at) {
+	struct db_recent_row row;
+	size_t i;
+	int k;
+
+	row.data = NULL;
+	if( (k = db_recent_find(id)) >= 0) {
+		row = g.recent.rows[k];
+		g.recent.n--;
+		memmove(&g.recent.rows[k], &g.recent.rows[k+1], 
+				(g.recent.n - k)*sizeof(row));
+	}
+	row.id = id;
+	row.chosen_at = chosen_at;
+
+	for(i = 0; i < g.recent.n; i++)
+		if(db_recent_before(chosen_at, id, &g.recent.rows[i]))
+			break;
+
+	/* somewhere after the cached rows */
+	if(i == g.recent.n && g.recent.complete == 0) {
+		talloc_free(row.data);
+		return;
+	}
+
+	if(row.data == NULL) {
+		/* the overlay of the shared dbs decides whether their 
+		 * blobs are trashed, so they are left to the next fill */
+		if(db_id_source(id) != 0) {
+			db_recent_drop();
+			return;
+		}
+		if(db_recent_fetch(&row) != 0)
+			return;
+	}
+
+	if(g.recent.n == DB_RECENT_MAX) {
+		g.recent.complete = 0;
+		if(i == g.recent.n) {
+			talloc_free(row.data);
+			return;
+		}
+		talloc_free(g.recent.rows[--g.recent.n].data);
+	}
+	memmove(&g.recent.rows[i+1], &g.recent.rows[i], 
+			(g.recent.n - i)*sizeof(row));
+	g.recent.rows[i] = row;
+	g.recent.n++;
+}
+
+/* runs @sql, which updates shared_overlay where db = ?1 and 
+ * blob_id = ?2 and may use ?3 for @val, for the blob of a shared db
+ * with the global id @id. returns non-zero if the recent cache
+ * should be updated in place. */
+static int db_overlay_update(int id, const char *sql, int64_t val) {
+	sqlite3_stmt *stmt;
+	size_t n;
+
+	n = db_id_source(id);
+	if(n < 1 || n > g.nshared)
+		err_panic(0, "no shared db for blob %d", id);
+
+	DB_BEGIN();
+	db_write_begin();
+	DB_STMT_PREP(
+		"INSERT INTO shared_overlay (db, blob_id) VALUES (?, ?)", 
+		&stmt
+	);
+	DB_BIND_TEXT(stmt, 1, g.shared[n-1]);
+	DB_BIND_INT(stmt, 2, id & ((1 << DB_SOURCE_SHIFT) - 1));
+	if(db_stmt_step(stmt) != -1)
+		err_panic(0, "didnt expect statement to return rows");
+	DB_STMT_FINALIZE(stmt);
+
+	DB_STMT_PREP(sql, &stmt);
+	DB_BIND_TEXT(stmt, 1, g.shared[n-1]);
+	DB_BIND_INT(stmt, 2, id & ((1 << DB_SOURCE_SHIFT) - 1));
+	if(sqlite3_bind_parameter_count(stmt) >= 3)
+		DB_BIND_INT64(stmt, 3, val);
+	if(db_stmt_step(stmt) != -1)
+		err_panic(0, "didnt expect statement to return rows");
+	DB_STMT_FINALIZE(stmt);
+	DB_COMMIT();
+	db_write_end();
+
+	return db_recent_in_step();
+}
+
+void db_trash(int bid) {
+	sqlite3_stmt *stmt;
+
+	if(db_id_source(bid) != 0) {
+		if(db_overlay_update(bid, 
+				"UPDATE shared_overlay SET trash = 1 WHERE db = ?1 AND blob_id = ?2", 
+				0) != 0)
+			db_recent_remove(bid);
+		db_postings_trash(bid);
+		return;
+	}
+
+	DB_BEGIN();
+	db_write_begin();
+	/* only counted once, if it wasnt already in the trash */
+	DB_STMT_PREP(
+		"UPDATE blobs "
+			"SET trash = 1 "
+			"WHERE id = ? AND trash == 0", 
+		&stmt
+	);
+	DB_BIND_INT(stmt, 1, bid);
+	if(db_stmt_step(stmt) != -1)
+		err_panic(0, "didnt expect statement to return rows");
+	if(sqlite3_changes(g.handle) > 0) {
+		db_tag_uncount(bid);
+		db_postings_trash(bid);
+	}
+
+	DB_STMT_FINALIZE(stmt);	
+	DB_COMMIT();
+	db_write_end();
+	if(db_recent_in_step() != 0)
+		db_recent_remove(bid);
+}
+
+int db_add(const void *data, size_t bytes, int raw, const char **tags, size_t ntags) {
+	int bid, created, trash;
+	
+	DB_BEGIN();
+	db_write_begin();
+	bid = db_find_or_create_blob(data, bytes, raw, &created, &trash);
+	db_tag_blob(bid, (trash == 0), tags, ntags);
+	DB_COMMIT();
+	db_write_end();
+	/* a new blob has never been chosen */
+	if(db_recent_in_step() != 0 && created != 0)
+		db_recent_place(bid, 0);
+
+	return bid;
+}
+
+void db_bulk_begin() {
+	DB_BEGIN();
+}
+
+void db_bulk_end() {
+	DB_COMMIT();
+}
+
+#define DB_QUERY_COLUMNS "b.value, b.raw, b.id"
+#define DB_QUERY_LIMIT "LIMIT 200 OFFSET @offset"
+/* the LIMIT of DB_QUERY_LIMIT */
+#define DB_QUERY_ROWS 200
+#define DB_NON_TRASH_BLOB "trash == 0"
+
+void db_query_prepare(struct db_query *query, unsigned int offset, const uint8_t **queries, 
+		size_t nqueries, const uint8_t **tags, size_t ntags) {
+
+	if(nqueries < 1 && ntags < 1) {
+		if(db_recent_warm() != 0)
+			g.recent.misses++;
+		else
+			g.recent.hits++;
+
+		if(offset < g.recent.n || g.recent.complete != 0) {
+			query->stmt = NULL;
+			query->match = NULL;
+			query->shape = DB_PROF_SHAPE_QUERY(0, 0);
+			query->ns = 0;
+			query->recent = DB_QUERY_RECENT;
+			query->row = offset;
+			query->offset = offset;
+			return;
+		}
+	}
+
+	db_query_prepare_stmt(query, offset, queries, nqueries, tags, ntags);
+}
+
+/* gives @m the blobs with a tag named by each of the search terms, 
+ * see tagmatch_name. sqlite compares the names, so that LIKE means 
+ * the same for them as it does for the blobs. */
+static void db_query_name_tags(struct tagmatch *m, const uint8_t **queries, 
+		size_t nqueries) {
+	sqlite3_stmt *stmt;
+	const struct tagdict_entry *e;
+	char *sql;
+	size_t i, j;
+
+	for(i = 0; i <= g.nshared && nqueries > 0; i++) {
+		if(g.name_stmts[i] == NULL) {
+			if(i == 0)
+				sql = talloc_strdup(NULL, 
+					"SELECT name FROM main.tags WHERE name LIKE '%'||?1||'%'");
+			else
+				sql = talloc_asprintf(NULL, 
+					"SELECT name FROM shared%d.tags WHERE name LIKE '%%'||?1||'%%'", 
+					(int) i);
+			DB_STMT_PREP(sql, &g.name_stmts[i]);
+			talloc_free(sql);
+		}
+		stmt = g.name_stmts[i];
+		for(j = 0; j < nqueries; j++) {
+			DB_BIND_TEXT(stmt, 1, (const char *) queries[j]);
+			while(db_stmt_step(stmt) == 0) {
+				e = tagdict_find(&g.tags.dict, 
+						(const char *) sqlite3_column_text(stmt, 0));
+				if(e != NULL)
+					tagmatch_name(m, j, e);
+			}
+			DB_STMT_RESET(stmt);
+		}
+	}
+}
+
+static void db_match_release(struct db_match *dm) {
+	tagmatch_free(&dm->m);
+	talloc_free(dm->key);
+	dm->key = NULL;
+	dm->valid = 0;
+	dm->used = 0;
+}
+
+/* frees the cached matches no query is using, and the rest once
+ * their queries are freed */
+static void db_matches_drop() {
+	struct db_match *dm;
+	size_t i;
+
+	for(i = 0; i < DB_MATCH_CACHE; i++) {
+		dm = &g.matches.slots[i];
+		if(dm->key == NULL)
+			continue;
+		if(dm->users > 0)
+			dm->valid = 0;
+		else
+			db_match_release(dm);
+	}
+}
+
+/* the @i'th of the tags and then the search terms of a match */
+static const char *db_match_word(size_t i, const uint8_t **queries, 
+		const uint8_t **tags, size_t ntags) {
+	return (const char *) ((i < ntags)? tags[i] : queries[i - ntags]);
+}
+
+static int db_match_is(const struct db_match *dm, const uint8_t **queries, 
+		size_t nqueries, const uint8_t **tags, size_t ntags) {
+	const char *p;
+	size_t i;
+
+	if(dm->key == NULL || dm->valid == 0 || dm->gen != g.postings.gen
+			|| dm->ntags != ntags || dm->nqueries != nqueries)
+		return 0;
+
+	p = dm->key;
+	for(i = 0; i < ntags + nqueries; i++) {
+		if(strcmp(p, db_match_word(i, queries, tags, ntags)) != 0)
+			return 0;
+		p += strlen(p) + 1;
+	}
+
+	return 1;
+}
+
+/* the match of @tags with the tags named by @queries, which must be
+ * given back to db_match_put. it is one evaluated for an earlier
+ * query if the postings havent changed since, and otherwise takes
+ * the place of the one least recently used. the postings must be 
+ * loaded. */
+static struct tagmatch *db_match_get(const uint8_t **queries, size_t nqueries, 
+		const uint8_t **tags, size_t ntags) {
+	struct db_match *dm, *lru;
+	struct tagmatch *m;
+	size_t i, size;
+	char *p;
+
+	lru = NULL;
+	for(i = 0; i < DB_MATCH_CACHE; i++) {
+		dm = &g.matches.slots[i];
+		if(db_match_is(dm, queries, nqueries, tags, ntags) != 0) {
+			dm->users++;
+			dm->used = ++g.matches.tick;
+			return &dm->m;
+		}
+		if(dm->users < 1 && (lru == NULL || dm->used < lru->used))
+			lru = dm;
+	}
+
+	if(lru == NULL) {
+		/* they are all in use, so this one is only for the query */
+		if( (m = talloc(NULL, struct tagmatch)) == NULL)
+			err_panic(0, "failed to allocate tag match");
+	}
+	else {
+		if(lru->key != NULL)
+			db_match_release(lru);
+		for(size = 0, i = 0; i < ntags + nqueries; i++)
+			size += strlen(db_match_word(i, queries, tags, ntags)) + 1;
+		if( (lru->key = talloc_size(NULL, size)) == NULL)
+			err_panic(0, "failed to allocate the key of a tag match");
+		for(p = lru->key, i = 0; i < ntags + nqueries; i++) {
+			size = strlen(db_match_word(i, queries, tags, ntags)) + 1;
+			memcpy(p, db_match_word(i, queries, tags, ntags), size);
+			p += size;
+		}
+		lru->ntags = ntags;
+		lru->nqueries = nqueries;
+		lru->gen = g.postings.gen;
+		lru->valid = 1;
+		lru->users = 1;
+		lru->used = ++g.matches.tick;
+		m = &lru->m;
+	}
+
+	tagmatch_eval(m, &g.tags.dict, g.postings.all, (const char *const *) tags, ntags);
+	db_query_name_tags(m, queries, nqueries);
+	return m;
+}
+
+static void db_match_put(struct tagmatch *m) {
+	struct db_match *dm;
+	size_t i;
+
+	for(i = 0; i < DB_MATCH_CACHE; i++) {
+		dm = &g.matches.slots[i];
+		if(&dm->m != m)
+			continue;
+		if(--dm->users < 1 && dm->valid == 0)
+			db_match_release(dm);
+		return;
+	}
+
+	tagmatch_free(m);
+	talloc_free(m);
+}
+
+static void db_query_prepare_stmt(struct db_query *query, unsigned int offset, 
+		const uint8_t **queries, size_t nqueries, const uint8_t **tags, size_t ntags) {
+	char *sql;
+	size_t i;
+	int idx, shape;
+	
+	if(nqueries > DB_PROF_MAX_INPUTS)
+		err_panic(0, "too many input values");
+
+	query->match = NULL;
+	if(ntags > 0) {
+		db_postings_check();
+		query->match = db_match_get(queries, nqueries, tags, ntags);
+	}
+
+	shape = DB_PROF_SHAPE_QUERY(nqueries, ntags);
+	if(g.query_stmts[shape] != NULL) {
+		/* reset and cleared by db_query_free */
+		query->stmt = g.query_stmts[shape];
+		g.query_stmts[shape] = NULL;
+	}
+	else if(nqueries < 1 && ntags < 1 && g.nshared < 1) {
+		/* no joins, so the rows are already distinct and 
+		 * blobs_trash_chosen_at gives them in order. chosen_at
+		 * is for the recent cache. */
+		sql = 
+			"SELECT " 
+				DB_QUERY_COLUMNS ", 0 AS score, b.chosen_at AS chosen_at "
+			"FROM blobs b " 
+			"WHERE " DB_NON_TRASH_BLOB " "
+			"ORDER BY b.chosen_at DESC, b.id ASC "
+			DB_QUERY_LIMIT ;
+		DB_STMT_PREP(sql, &query->stmt);
+	}
+	else {
+		db_query_fmt(nqueries, ntags, &sql);
+		DB_STMT_PREP(sql, &query->stmt);
+		talloc_free(sql);
+	}
+
+#define DB_QP_BIND(_idx, _ptr) \
+	DB_BIND_BUF(text, query->stmt, _idx, _ptr, -1, SQLITE_STATIC)
+
+	for(i = 0; i < nqueries; i++) {
+		/*aug_log("bind %s to ?(%d)\n", queries[i], i+1);*/
+		DB_QP_BIND(i+1, (const char *) queries[i]);
+	}
+#undef DB_QP_BIND
+	/* tag_match finds the match by its handle */
+	if(query->match != NULL) {
+		DB_BIND_PRM_IDX(query->stmt, "@match", &idx);
+		DB_BIND_INT64(query->stmt, idx, query->match->handle);
+	}
+
+	DB_BIND_PRM_IDX(query->stmt, "@offset", &idx);
+	DB_BIND_INT(query->stmt, idx, offset);
+	for(i = 0; i < g.nshared; i++)
+		db_bind_shared(query->stmt, i+1);
+
+	query->shape = shape;
+	query->ns = 0;
+	query->recent = DB_QUERY_SQLITE;
+}
+
+/* a query is profiled as one statement from its first step until
+ * it is reset or freed */
+static void db_query_record(struct db_query *query) {
+	if(query->ns > 0) {
+		db_prof_record(query->stmt, query->shape, query->ns);
+		query->ns = 0;
+	}
+}
+
+void db_query_free(struct db_query *query) {
+	if(query->stmt == NULL)
+		return;
+
+	db_query_record(query);
+	if(g.query_stmts[query->shape] == NULL) {
+		DB_STMT_RESET(query->stmt);
+		if(sqlite3_clear_bindings(query->stmt) != SQLITE_OK)
+			err_panic(0, "failed to clear bindings: %s", sqlite3_errmsg(g.handle));
+		g.query_stmts[query->shape] = query->stmt;
+	}
+	else
+		DB_STMT_FINALIZE(query->stmt);
+	query->stmt = NULL;
+	/* the statement is done with it once it is reset */
+	if(query->match != NULL) {
+		db_match_put(query->match);
+		query->match = NULL;
+	}
+}
+
+int db_query_step(struct db_query *query) {
+	int status;
+
+	if(query->recent == DB_QUERY_RECENT) {
+		if(query->row < g.recent.n) {
+			query->row++;
+			return 0;
+		}
+		if(g.recent.complete != 0) {
+			db_query_reset(query);
+			return -1;
+		}
+		/* sqlite takes over after the cached rows */
+		db_query_prepare_stmt(query, query->row, NULL, 0, NULL, 0);
+		query->recent = DB_QUERY_RECENT_AFTER;
+	}
+	if(query->recent == DB_QUERY_RECENT_AFTER) {
+		/* so that the LIMIT still counts from @offset */
+		if(query->row - query->offset >= DB_QUERY_ROWS) {
+			db_query_reset(query);
+			return -1;
+		}
+		query->row++;
+	}
+
+	TRACE_SPAN_BEGIN(TRACE_SPAN_QUERY_STEP, 0);
+	if( (status = db_stmt_step_timed(query->stmt, &query->ns)) != 0)
+		db_query_reset(query);
+	TRACE_SPAN_END(TRACE_SPAN_QUERY_STEP);
+
+	return status;
+}
+
 void db_query_reset(struct db_query *query) {
+	if(query->recent == DB_QUERY_RECENT) {
+		query->row = query->offset;
+		return;
+	}
+
+	db_query_record(query);
 	DB_STMT_RESET(query->stmt);
 }
 
-void db_query_value(struct db_query *query, uint8_t **value, size_t *size, 
-		int *raw, int *id) {
+const char *db_query_sql(struct db_query *query) {
+	struct db_query q;
+
+	if(query->stmt != NULL)
+		return sqlite3_sql(query->stmt);
+
+	/* db_query_free keeps it for the next fill */
+	db_query_prepare_stmt(&q, 0, NULL, 0, NULL, 0);
+	db_query_free(&q);
+	return sqlite3_sql(g.query_stmts[DB_PROF_SHAPE_QUERY(0, 0)]);
+}
+
+void db_query_value_ref(struct db_query *query, const uint8_t **value, 
+		size_t *size, int *raw, int *id) {
+	const struct db_recent_row *row;
 	const void *data;
 	int n;
+
+	if(query->recent == DB_QUERY_RECENT) {
+		row = &g.recent.rows[query->row - 1];
+		*raw = row->raw;
+		*id = row->id;
+		if(value != NULL) {
+			*value = row->data;
+			*size = row->size;
+		}
+		return;
+	}
 	
 	*raw = sqlite3_column_int(query->stmt, 1);
 	*id = sqlite3_column_int(query->stmt, 2);
@@ -575,99 +1836,579 @@ void db_query_value(struct db_query *query, uint8_t **value, size_t *size,
 	if( (n = sqlite3_column_bytes(query->stmt, 0)) < 0)
 		err_panic(0, "value size is negative");
 
+	*value = (const uint8_t *) data;
 	*size = n;
+}
+
+void db_query_value(struct db_query *query, uint8_t **value, size_t *size, 
+		int *raw, int *id) {
+	const uint8_t *data;
+
+	if(value == NULL) {
+		db_query_value_ref(query, NULL, size, raw, id);
+		return;
+	}
+
+	db_query_value_ref(query, &data, size, raw, id);
 	if(*size > 0) {
 		*value = talloc_array(NULL, uint8_t, *size);
 		memcpy(*value, data, *size);
 	}
 }
 
+/* the time is taken here rather than by sqlite so that the recent 
+ * cache can put the blob in the same place */
 void db_update_chosen_at(int id) {
+	db_set_chosen_at(id, (int64_t) time(NULL));
+}
+
+void db_set_chosen_at(int id, int64_t t) {
 	sqlite3_stmt *stmt;
 
+	if(db_id_source(id) != 0) {
+		if(db_overlay_update(id, 
+				"UPDATE shared_overlay SET chosen_at = ?3 "
+					"WHERE db = ?1 AND blob_id = ?2", 
+				t) != 0)
+			db_recent_place(id, t);
+		return;
+	}
+
 	DB_BEGIN();
+	db_write_begin();
 	DB_STMT_PREP(
 		"UPDATE blobs "
-			"SET chosen_at = strftime('%s','now') " 
+			"SET chosen_at = ? " 
 			"WHERE id = ?", 
 		&stmt
 	);
-	DB_BIND_INT(stmt, 1, id);
+	DB_BIND_INT64(stmt, 1, t);
+	DB_BIND_INT(stmt, 2, id);
 	if(db_stmt_step(stmt) != -1)
 		err_panic(0, "didnt expect statement to return rows");
 
 	DB_STMT_FINALIZE(stmt);	
 	DB_COMMIT();
+	db_write_end();
+	if(db_recent_in_step() != 0)
+		db_recent_place(id, t);
 }
 
-static void db_query_fmt(size_t nqueries, size_t ntags, char **result) {
-#define DB_QUERY_MAX_INPUTS 9 /* max 9 queries and 9 tags */
-	char *q_score_fmt, *q_fmt, *t_score_fmt, *t_fmt;
+/* counting scans all of blobs, so the counts are kept until the
+ * main db changes. a transaction hasnt changed the generation yet,
+ * so the counts are neither used nor kept inside one. */
+void db_counts(int *blobs, int *trashed, int *tags) {
+	sqlite3_stmt *stmt;
+	uint32_t gen;
+
+	gen = db_file_generation("main");
+	if(g.counts.valid != 0 && g.counts.gen == gen && g.txn_depth < 1)
+		goto done;
+
+	DB_STMT_PREP(
+		"SELECT "
+			"(SELECT COUNT(*) FROM blobs), "
+			"(SELECT COUNT(*) FROM blobs WHERE trash != 0), "
+			"(SELECT COUNT(*) FROM tags)",
+		&stmt
+	);
+	if(db_stmt_step(stmt) != 0)
+		err_panic(0, "expected a row of counts");
+
+	g.counts.blobs = sqlite3_column_int(stmt, 0);
+	g.counts.trashed = sqlite3_column_int(stmt, 1);
+	g.counts.tags = sqlite3_column_int(stmt, 2);
+	g.counts.valid = (g.txn_depth < 1);
+	g.counts.gen = gen;
+	DB_STMT_FINALIZE(stmt);
+done:
+	*blobs = g.counts.blobs;
+	*trashed = g.counts.trashed;
+	*tags = g.counts.tags;
+}
+
+/* the stats are gathered again once the number of blobs is more 
+ * than a tenth (and DB_STATS_MIN_DRIFT) away from what it was */
+#define DB_STATS_DRIFT 10
+#define DB_STATS_MIN_DRIFT 100
+/* how many virtual machine instructions the refresh runs between
+ * checks of whether it was asked to stop */
+#define DB_REFRESH_PROGRESS_OPS 1000
+
+/* returns 1 if the number of blobs has drifted from the sqlite_stat1
+ * of @handle, 0 if it hasnt and -1 on error. blobs are never deleted
+ * and their ids come from AUTOINCREMENT, so the sequence of blobs is
+ * the number of them without counting them. this is called from the
+ * refresh thread, so it cant panic. */
+static int db_stats_stale(sqlite3 *handle) {
+	sqlite3_stmt *stmt;
+	int64_t blobs, analyzed, drift;
+
+	if(sqlite3_prepare_v2(handle, 
+			"SELECT seq FROM sqlite_sequence WHERE name = 'blobs'", 
+			-1, &stmt, NULL) != SQLITE_OK)
+		return -1;
+	blobs = (sqlite3_step(stmt) == SQLITE_ROW)? sqlite3_column_int64(stmt, 0) : 0;
+	sqlite3_finalize(stmt);
+
+	/* the first number of the stat is the number of rows. there
+	 * is no sqlite_stat1 until the first ANALYZE. */
+	analyzed = -1;
+	if(sqlite3_prepare_v2(handle, 
+			"SELECT stat FROM sqlite_stat1 "
+			"WHERE tbl = 'blobs' AND idx = 'blobs_trash_chosen_at'", 
+			-1, &stmt, NULL) == SQLITE_OK) {
+		if(sqlite3_step(stmt) == SQLITE_ROW)
+			analyzed = strtoll((const char *) sqlite3_column_text(stmt, 0), NULL, 10);
+		sqlite3_finalize(stmt);
+	}
+
+	drift = (analyzed > 0)? analyzed/DB_STATS_DRIFT : 0;
+	if(drift < DB_STATS_MIN_DRIFT)
+		drift = DB_STATS_MIN_DRIFT;
+	return !(analyzed >= 0 && blobs >= analyzed - drift && blobs <= analyzed + drift);
+}
+
+/* a busy refresh gives up as soon as it is asked to stop */
+static int db_refresh_busy_cb(void *user, int n) {
+	if(__atomic_load_n(&g.refresh.stop, __ATOMIC_ACQUIRE) != 0)
+		return 0;
+	return db_busy_cb(user, n);
+}
+
+/* interrupts the statement of the refresh once it is asked to stop */
+static int db_refresh_progress_cb(void *user) {
+	(void)(user);
+	return __atomic_load_n(&g.refresh.stop, __ATOMIC_ACQUIRE);
+}
+
+#define DB_REFRESH_EXEC(_sql) \
+	do { \
+		if(sqlite3_exec(handle, _sql, NULL, NULL, NULL) != SQLITE_OK) \
+			goto rollback; \
+	} while(0)
+
+/* the refresh runs on a connection of its own so that the ui thread
+ * can go on with its queries while sqlite reads every index. */
+static void *db_refresh_thread(void *user) {
+	sqlite3 *handle;
+	int status;
+	(void)(user);
+
+	status = -1;
+	if(sqlite3_open_v2(g.refresh.path, &handle, 
+			SQLITE_OPEN_READWRITE | SQLITE_OPEN_URI, NULL) != SQLITE_OK)
+		goto close;
+	sqlite3_busy_handler(handle, db_refresh_busy_cb, NULL);
+	sqlite3_progress_handler(handle, DB_REFRESH_PROGRESS_OPS, db_refresh_progress_cb, NULL);
+
+	DB_REFRESH_EXEC("BEGIN IMMEDIATE");
+	/* another process may have done it while this one waited for
+	 * the lock */
+	if( (status = db_stats_stale(handle)) != 1)
+		goto rollback;
+	/* the counts can drift when the db is changed by hand, such
+	 * as taking a blob out of the trash */
+	DB_REFRESH_EXEC(
+		"UPDATE tags SET blob_count = (" DB_TAG_BLOB_COUNT ") "
+			"WHERE blob_count != (" DB_TAG_BLOB_COUNT ")"
+	);
+	DB_REFRESH_EXEC("ANALYZE main");
+	DB_REFRESH_EXEC("COMMIT");
+	goto close;
+
+rollback:
+	if(status != 0) {
+		status = -1;
+		snprintf(g.refresh.err, sizeof(g.refresh.err), "%s", sqlite3_errmsg(handle));
+	}
+	/* the rollback mustnt be interrupted */
+	sqlite3_progress_handler(handle, 0, NULL, NULL);
+	sqlite3_exec(handle, "ROLLBACK", NULL, NULL, NULL);
+close:
+	if(status < 0 && g.refresh.err[0] == '\0')
+		snprintf(g.refresh.err, sizeof(g.refresh.err), "%s", sqlite3_errmsg(handle));
+	sqlite3_close(handle);
+	g.refresh.status = status;
+	__atomic_store_n(&g.refresh.done, 1, __ATOMIC_RELEASE);
+	return NULL;
+}
+
+#undef DB_REFRESH_EXEC
+
+int db_refresh_stats() {
+	uint32_t gen;
+	int status;
+
+	if(g.refresh.running != 0 || g.txn_depth > 0)
+		return 0;
+	/* nothing can have drifted if nothing was written */
+	gen = db_generation();
+	if(g.refresh.checked != 0 && g.refresh.gen == gen)
+		return 0;
+	g.refresh.checked = 1;
+	g.refresh.gen = gen;
+	if(db_stats_stale(g.handle) != 1)
+		return 0;
+
+	g.refresh.stop = 0;
+	g.refresh.done = 0;
+	g.refresh.err[0] = '\0';
+	if( (status = pthread_create(&g.refresh.thread, NULL, db_refresh_thread, NULL)) != 0) {
+		err_warn(status, "failed to start the stats refresh");
+		return 0;
+	}
+	g.refresh.running = 1;
+
+	return 1;
+}
+
+int db_refresh_stats_end(int wait) {
+	int status;
+
+	if(g.refresh.running == 0)
+		return 0;
+	if(wait == 0 && __atomic_load_n(&g.refresh.done, __ATOMIC_ACQUIRE) == 0)
+		return 0;
+
+	if( (status = pthread_join(g.refresh.thread, NULL)) != 0)
+		err_panic(status, "failed to join the stats refresh");
+	g.refresh.running = 0;
+
+	status = g.refresh.status;
+	if(status < 0 && g.refresh.stop == 0)
+		err_warn(0, "failed to refresh the db stats: %s", g.refresh.err);
+	if(status > 0) {
+		/* the blob counts of the tags may have been corrected */
+		g.tags.valid = 0;
+		/* so that the queries are planned with the new stats */
+		db_query_stmts_free();
+	}
+
+	return status;
+}
+
+void db_refresh_stats_stop() {
+	if(g.refresh.running != 0)
+		__atomic_store_n(&g.refresh.stop, 1, __ATOMIC_RELEASE);
+}
+
+static int64_t db_pragma_int(const char *sql) {
+	sqlite3_stmt *stmt;
+	int64_t val;
+
+	val = 0;
+	DB_STMT_PREP(sql, &stmt);
+	if(db_stmt_step(stmt) == 0)
+		val = sqlite3_column_int64(stmt, 0);
+	DB_STMT_FINALIZE(stmt);
+	return val;
+}
+
+int64_t db_size_bytes() {
+	return db_pragma_int("PRAGMA page_count") * db_pragma_int("PRAGMA page_size");
+}
+
+uint64_t db_busy_retries() {
+	return __atomic_load_n(&g.busy_retries, __ATOMIC_RELAXED);
+}
+
+/* the file change counter in the db header, which every process 
+ * increments when it commits a change (as long as the db isnt in 
+ * wal mode). it is read through sqlite's own file handle, because 
+ * closing another descriptor of the file would drop sqlite's locks. */
+#define DB_HEADER_CHANGE_COUNTER 24
+
+static uint32_t db_file_generation(const char *name) {
+	sqlite3_file *file;
+	uint8_t buf[4];
+
+	file = NULL;
+	if(sqlite3_file_control(g.handle, name, SQLITE_FCNTL_FILE_POINTER, &file) != SQLITE_OK
+			|| file == NULL || file->pMethods == NULL)
+		return 0;
+	/* a new db has no header yet */
+	if(file->pMethods->xRead(file, buf, sizeof(buf), DB_HEADER_CHANGE_COUNTER) != SQLITE_OK)
+		return 0;
+
+	return ((uint32_t) buf[0] << 24) | ((uint32_t) buf[1] << 16) 
+		| ((uint32_t) buf[2] << 8) | buf[3];
+}
+
+/* the counters only go up, so their sum changes whenever one of
+ * them does */
+uint32_t db_generation() {
+	char name[16];
+	uint32_t gen;
 	size_t i;
-	char query_like[] = 
-		"(b.value LIKE '%%'||?%03d||'%%' OR t.name LIKE '%%'||?%03d||'%%')";
-	char tag_like[] = "(t.name LIKE '%%'||?%03d||'%%')";
-	const char fmt1[] = 
-		"SELECT DISTINCT "
-			DB_QUERY_COLUMNS ", ((%s)*10 + (%s)) AS score "
-		"FROM blobs b " 
-			"INNER JOIN fk_blobs_tags bt ON bt.blob_id = b.id " 
-			"INNER JOIN tags t ON bt.tag_id = t.id "
-		"WHERE " DB_NON_TRASH_BLOB " AND %s AND (%s) "
-		"ORDER BY score DESC, b.chosen_at DESC "
-		DB_QUERY_LIMIT;
 
-	if(nqueries < 1 && ntags < 1)
-		err_panic(0, "must provide at least one query or tag");
-	if(nqueries > DB_QUERY_MAX_INPUTS || ntags > DB_QUERY_MAX_INPUTS)
-		err_panic(0, "too many input values");
+	gen = db_file_generation("main");
+	for(i = 0; i < g.nshared; i++) {
+		snprintf(name, sizeof(name), "shared%d", (int) (i+1));
+		gen += db_file_generation(name);
+	}
 
-	if(nqueries > 0) {
-		char **list = talloc_array(NULL, char *, nqueries+1);
-		list[nqueries] = NULL;
-		for(i = 0; i < nqueries; i++) {
-			list[i] = talloc_asprintf(list, query_like, i+1, i+1);
-		}
-		
-		q_score_fmt = util_tal_join(NULL, list, " AND ");
-		q_fmt = q_score_fmt;
-		talloc_free(list); /* asprintf's are freed here too */
+	return gen;
+}
+
+/* the path as a read-only sqlite uri */
+static char *db_shared_uri(void *ctx, const char *path) {
+	char *uri;
+
+	uri = talloc_strdup(ctx, "file:");
+	for(; *path != '\0'; path++) {
+		if(*path == '%' || *path == '?' || *path == '#')
+			uri = talloc_asprintf_append(uri, "%%%02x", (unsigned char) *path);
+		else
+			uri = talloc_asprintf_append(uri, "%c", *path);
 	}
-	else {
-		q_score_fmt = "0";
-		q_fmt = "1";
+
+	return talloc_asprintf_append(uri, "?mode=ro");
+}
+
+int db_attach_shared(const char *path) {
+	sqlite3_stmt *stmt;
+	void *ctx;
+	char *sql;
+	int version, status, n;
+
+	if(g.nshared >= DB_MAX_SHARED) {
+		err_warn(0, "cant attach more than %d shared dbs", DB_MAX_SHARED);
+		return -1;
 	}
-	/*aug_log("db: q_score_fmt => %s\n", q_score_fmt);*/
-	/*aug_log("db: q_fmt => %s\n", q_fmt);*/
 
-	if(ntags > 0) {
-		char **list = talloc_array(NULL, char *, ntags+1);
-		list[ntags] = NULL;
-		for(i = 0; i < ntags; i++) {
-			list[i] = talloc_asprintf(list, tag_like, nqueries + i+1);
-		}
+	ctx = talloc_new(NULL);
+	n = (int) g.nshared + 1;
+	sql = talloc_asprintf(ctx, "ATTACH DATABASE ? AS shared%d", n);
+	DB_STMT_PREP(sql, &stmt);
+	DB_BIND_TEXT(stmt, 1, db_shared_uri(ctx, path));
+	status = sqlite3_step(stmt);
+	DB_STMT_FINALIZE(stmt);
+	if(status != SQLITE_DONE) {
+		err_warn(0, "failed to attach %s: %s", path, sqlite3_errmsg(g.handle));
+		goto fail;
+	}
+
+	/* it cant be migrated, so it needs the trash column already */
+	version = -1;
+	if(sqlite3_prepare_v2(g.handle, 
+			talloc_asprintf(ctx, "SELECT version FROM shared%d.admin LIMIT 1", n), 
+			-1, &stmt, NULL) == SQLITE_OK) {
+		if(sqlite3_step(stmt) == SQLITE_ROW)
+			version = sqlite3_column_int(stmt, 0);
+		DB_STMT_FINALIZE(stmt);
+	}
+	if(version < 2) {
+		err_warn(0, "%s is not an aug-db db of schema version 2 or later", path);
+		if(sqlite3_exec(g.handle, talloc_asprintf(ctx, "DETACH DATABASE shared%d", n), 
+				NULL, NULL, NULL) != SQLITE_OK)
+			err_warn(0, "failed to detach %s: %s", path, sqlite3_errmsg(g.handle));
+		goto fail;
+	}
+
+	g.shared[g.nshared++] = talloc_strdup(NULL, path);
+	db_query_stmts_free();
+	db_recent_drop();
+	g.tags.valid = 0;
+	talloc_free(ctx);
+	return 0;
+fail:
+	talloc_free(ctx);
+	return -1;
+}
+
+size_t db_shared_count() {
+	return g.nshared;
+}
+
+int db_slow_query_log(const char *path, unsigned int ms) {
+	return db_prof_slow_log(path, ms);
+}
+
+/* the search terms of a query, AND'ed. a term matches the blobs 
+ * that contain it or have a tag that does. without tags each blob is
+ * joined with each of its tags as t, and with them the tag match m 
+ * knows which blobs have a tag named by each term, see 
+ * db_query_name_tags. */
+static char *db_query_fmt_text(void *ctx, size_t nqueries, size_t ntags) {
+	char *sql;
+	size_t i;
+	char like_joined[] = 
+		"(b.value LIKE '%%'||?%03d||'%%' OR t.name LIKE '%%'||?%03d||'%%')";
+	char like_named[] = 
+		"(b.value LIKE '%%'||?%03d||'%%' OR (m.named & %d) != 0)";
+
+	if(nqueries < 1)
+		return talloc_strdup(ctx, "1");
 
-		t_score_fmt = util_tal_join(NULL, list, "+");
-		t_fmt = util_tal_join(NULL, list, " OR ");
-		talloc_free(list); /* asprintf's are freed here too */
+	sql = talloc_strdup(ctx, "");
+	for(i = 0; i < nqueries; i++) {
+		if(i > 0)
+			sql = talloc_asprintf_append(sql, " AND ");
+		if(ntags < 1)
+			sql = talloc_asprintf_append(sql, like_joined, (int) i+1, (int) i+1);
+		else
+			sql = talloc_asprintf_append(sql, like_named, (int) i+1, 1 << i);
+	}
+
+	return sql;
+}
+
+/* the blobs of @schema in the tag match m, which leads to them by 
+ * their ids. that is never slower than a scan of the blobs that 
+ * looks each one up in the match, even when every blob is in it, 
+ * as the search terms cost the same either way. sqlite doesnt know
+ * how many blobs are in the match, so CROSS JOIN fixes the order. */
+#define DB_TAG_MATCH_FROM "tag_match m CROSS JOIN %s.blobs b ON b.id = m.id "
+
+/* which match and which of its sources m is. it goes after the 
+ * search terms, since the first appearance of @match would number 
+ * it ?1 and ?NNN would then be the same parameter. */
+#define DB_TAG_MATCH_COND "m.tagmatch = @match AND m.source = %d"
+
+/* the select of the nth source (0 being the personal db) for 
+ * db_query_fmt_merged. each is limited to the rows that could make
+ * it onto the page so that it can use the indexes of its own db. */
+static char *db_query_fmt_source(void *ctx, size_t n, size_t nqueries, size_t ntags) {
+	char *schema, *id, *sql, *text;
+	const char *chosen_at, *overlay;
+
+	if(n == 0) {
+		schema = talloc_strdup(ctx, "main");
+		id = talloc_strdup(ctx, "b.id");
+		chosen_at = "b.chosen_at";
+		overlay = "";
 	}
 	else {
-		t_score_fmt = "0";
-		t_fmt = "1";
+		schema = talloc_asprintf(ctx, "shared%d", (int) n);
+		id = talloc_asprintf(ctx, "(%d | b.id)", (int) n << DB_SOURCE_SHIFT);
+		chosen_at = "IFNULL(o.chosen_at, 0)";
+		overlay = talloc_asprintf(ctx, 
+			"LEFT JOIN main.shared_overlay o ON o.db = @db%d AND o.blob_id = b.id ", 
+			(int) n);
 	}
-	/*aug_log("db: t_score_fmt => %s\n", t_score_fmt);*/
-	/*aug_log("db: t_fmt => %s\n", t_fmt);*/
-	
-	*result = talloc_asprintf(NULL, fmt1, q_score_fmt, t_score_fmt, q_fmt, t_fmt);
 
-	if(nqueries > 0) 
-		talloc_free(q_score_fmt);
-	
-	if(ntags > 0) {
-		talloc_free(t_score_fmt);
-		talloc_free(t_fmt);
+#define DB_SOURCE_COLUMNS "b.value AS value, b.raw AS raw, %s AS id, %s AS score, %s AS chosen_at "
+#define DB_SOURCE_LIMIT "LIMIT 200 + @offset"
+	if(nqueries < 1 && ntags < 1 && n == 0) 
+		sql = talloc_asprintf(ctx, 
+			"SELECT " DB_SOURCE_COLUMNS
+			"FROM main.blobs b WHERE b.trash == 0 "
+			"ORDER BY b.chosen_at DESC, b.id ASC " DB_SOURCE_LIMIT,
+			id, "0", chosen_at);
+	else if(nqueries < 1 && ntags < 1) 
+		/* the blobs chosen from a shared db come from the overlay 
+		 * in order, and the rest in the order of their ids */
+		sql = talloc_asprintf(ctx, 
+			"SELECT * FROM ("
+				"SELECT " DB_SOURCE_COLUMNS 
+				"FROM main.shared_overlay o CROSS JOIN %s.blobs b ON b.id = o.blob_id "
+				"WHERE o.db = @db%d AND o.chosen_at > 0 AND o.trash == 0 AND b.trash == 0 "
+				"ORDER BY o.chosen_at DESC " DB_SOURCE_LIMIT
+			") UNION ALL SELECT * FROM ("
+				"SELECT " DB_SOURCE_COLUMNS
+				"FROM %s.blobs b WHERE b.trash == 0 AND NOT EXISTS ("
+					"SELECT 1 FROM main.shared_overlay o "
+					"WHERE o.db = @db%d AND o.blob_id = b.id "
+						"AND (o.chosen_at > 0 OR o.trash != 0)"
+				") ORDER BY b.id ASC " DB_SOURCE_LIMIT
+			")",
+			id, "0", "o.chosen_at", schema, (int) n, 
+			id, "0", "0", schema, (int) n);
+	else {
+		/* the same joins as db_query_fmt uses */
+		text = db_query_fmt_text(ctx, nqueries, ntags);
+		if(ntags < 1) {
+			sql = talloc_asprintf(ctx, 
+				"SELECT DISTINCT " DB_SOURCE_COLUMNS "FROM %s.blobs b "
+					"INNER JOIN %s.fk_blobs_tags bt ON bt.blob_id = b.id "
+					"INNER JOIN %s.tags t ON bt.tag_id = t.id ",
+				id, talloc_asprintf(ctx, "(%s)*10", text), chosen_at, 
+				schema, schema, schema);
+		}
+		else {
+			sql = talloc_asprintf(ctx, 
+				"SELECT " DB_SOURCE_COLUMNS "FROM " DB_TAG_MATCH_FROM, 
+				id, "m.hits", chosen_at, schema);
+			text = talloc_asprintf(ctx, "%s AND " DB_TAG_MATCH_COND, text, (int) n);
+		}
+		sql = talloc_asprintf_append(sql, 
+			"%s"
+			"WHERE b.trash == 0 AND %s AND %s "
+			"ORDER BY score DESC, chosen_at DESC " DB_SOURCE_LIMIT,
+			overlay, (n > 0)? "IFNULL(o.trash, 0) == 0" : "1", text);
 	}
+#undef DB_SOURCE_COLUMNS
+#undef DB_SOURCE_LIMIT
+
+	return sql;
+}
+
+/* with shared dbs attached the query runs against each db and the
+ * results are merged. the blobs of a shared db are ordered by the
+ * times they were chosen from this one, see shared_overlay. */
+static char *db_query_fmt_merged(size_t nqueries, size_t ntags) {
+	void *ctx;
+	char *sql;
+	size_t i;
 
-	return;
+	ctx = talloc_new(NULL);
+	sql = talloc_strdup(NULL, "");
+	for(i = 0; i <= g.nshared; i++)
+		sql = talloc_asprintf_append(sql, "%sSELECT * FROM (%s) ", 
+				(i > 0)? "UNION ALL " : "",
+				db_query_fmt_source(ctx, i, nqueries, ntags));
+	sql = talloc_asprintf_append(sql, 
+			"ORDER BY score DESC, chosen_at DESC, id ASC " DB_QUERY_LIMIT);
+
+	talloc_free(ctx);
+	return sql;
 }
 
+/* the search terms are bound to ?1 onwards and a query with tags is
+ * bound to @match, see db_query_prepare_stmt. with tags the blobs 
+ * that match more of their words come first. */
+static void db_query_fmt(size_t nqueries, size_t ntags, char **result) {
+	void *ctx;
+	char *text;
+	const char from_blobs[] = 
+		"blobs b " 
+			"INNER JOIN fk_blobs_tags bt ON bt.blob_id = b.id " 
+			"INNER JOIN tags t ON bt.tag_id = t.id ";
+	const char fmt_text[] = 
+		"SELECT DISTINCT "
+			DB_QUERY_COLUMNS ", ((%s)*10) AS score "
+		"FROM %s"
+		"WHERE " DB_NON_TRASH_BLOB " AND %s "
+		"ORDER BY score DESC, b.chosen_at DESC "
+		DB_QUERY_LIMIT;
+	/* each blob is in the match once, so there is nothing to make
+	 * DISTINCT */
+	const char fmt_tags[] = 
+		"SELECT "
+			DB_QUERY_COLUMNS ", m.hits AS score "
+		"FROM " DB_TAG_MATCH_FROM
+		"WHERE " DB_NON_TRASH_BLOB " AND %s AND " DB_TAG_MATCH_COND " "
+		"ORDER BY score DESC, b.chosen_at DESC "
+		DB_QUERY_LIMIT;
+
+	if(nqueries < 1 && ntags < 1 && g.nshared < 1)
+		err_panic(0, "must provide at least one query or tag");
+	if(nqueries > DB_PROF_MAX_INPUTS)
+		err_panic(0, "too many input values");
+
+	if(g.nshared > 0) {
+		*result = db_query_fmt_merged(nqueries, ntags);
+		return;
+	}
+
+	ctx = talloc_new(NULL);
+	text = db_query_fmt_text(ctx, nqueries, ntags);
+	/*aug_log("db: text => %s\n", text);*/
+	if(ntags < 1)
+		*result = talloc_asprintf(NULL, fmt_text, text, from_blobs, text);
+	else
+		*result = talloc_asprintf(NULL, fmt_tags, "main", text, 0);
+
+	talloc_free(ctx);
+}
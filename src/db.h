@@ -23,17 +23,67 @@
 #include <sqlite3.h>
 #include <ccan/talloc/talloc.h>
 
+struct tagmatch;
+
 struct db_query {
 	sqlite3_stmt *stmt;
+	/* the blobs matching the tags, or NULL. usually one kept by
+	 * the db for the next query with the same tags and search 
+	 * terms, and given back by db_query_free, see tagmatch.h */
+	struct tagmatch *match;
+	/* for db_prof.h */
+	int shape;
+	/* time spent in sqlite3_step since the last reset */
+	uint64_t ns;
+	/* where the rows come from. while they come from the recent
+	 * cache stmt is NULL, @row is the next row and @offset the 
+	 * one the query started at. */
+	enum {
+		DB_QUERY_SQLITE = 0,
+		DB_QUERY_RECENT,
+		/* from sqlite after the cached rows ran out */
+		DB_QUERY_RECENT_AFTER
+	} recent;
+	size_t row;
+	size_t offset;
 };
 
 int db_init(const char *fpath);
 void db_free();
 
-void db_add(const void *data, size_t bytes, int raw, const char **tags, size_t ntags);
+/* the most shared dbs that can be attached */
+#define DB_MAX_SHARED 8
+/* the ids of blobs from the nth shared db have n in the bits from
+ * this one up. the personal db is source 0, so its ids are as they
+ * are in the db. */
+#define DB_SOURCE_SHIFT 27
+
+static inline int db_id_source(int id) {
+	return id >> DB_SOURCE_SHIFT;
+}
+
+/* attaches the aug-db database at @path read-only, so that queries
+ * search it along with the personal db. what is chosen or trashed 
+ * from it is kept in the personal db under @path. returns non-zero
+ * on error. */
+int db_attach_shared(const char *path);
+size_t db_shared_count();
+
+/* returns the id of the (possibly already existing) blob */
+int db_add(const void *data, size_t bytes, int raw, const char **tags, size_t ntags);
 void db_trash(int bid);
 
-/* queries and tags are utf-8 encoded strings */
+/* everything between these is done in a single transaction, which
+ * makes adding lots of blobs much faster. they can be nested. */
+void db_bulk_begin();
+void db_bulk_end();
+
+/* queries and tags are utf-8 encoded strings. a query matches the
+ * blobs which contain it or have a tag that does. a tag matches the
+ * tag of that name, or if there is none every tag which starts 
+ * with it, and can be joined with others by '&' or have a '!' in
+ * front of it, see tagmatch.h. there can be any number of tags but
+ * at most DB_PROF_MAX_INPUTS queries. */
 void db_query_prepare(struct db_query *query, unsigned int offset, const uint8_t **queries, 
 		size_t nqueries, const uint8_t **tags, size_t ntags);
 
@@ -43,10 +93,73 @@ int db_query_step(struct db_query *query);
 /* value will be set to a talloc'd buffer of size *size */
 void db_query_value(struct db_query *query, uint8_t **value, size_t *size, 
 		int *raw, int *id);
+/* like db_query_value but *value points into the current row, so it 
+ * is only valid until the query is stepped, reset or freed */
+void db_query_value_ref(struct db_query *query, const uint8_t **value, 
+		size_t *size, int *raw, int *id);
 void db_query_reset(struct db_query *query);
+/* the sql of the statement behind @query, valid until the next query.
+ * for rows from the recent cache it is the statement the cache is 
+ * filled with. */
+const char *db_query_sql(struct db_query *query);
+/* the statement is kept for the next query of the same shape */
 void db_query_free(struct db_query *query);
 
+/* writes the longest string that every tag starting with @prefix 
+ * starts with into @buf, which holds @size bytes. returns the
+ * number of tags starting with @prefix. */
+size_t db_tag_complete(const char *prefix, char *buf, size_t size);
+/* non-zero if "#@word" in a search names a tag, see tagmatch_word */
+int db_tag_word(const char *word);
+
 void db_update_chosen_at(int id);
+/* like db_update_chosen_at but with an explicit time in seconds
+ * since the epoch, for importing and generating histories */
+void db_set_chosen_at(int id, int64_t t);
+
+/* the number of blobs, trashed blobs and tags in the db */
+void db_counts(int *blobs, int *trashed, int *tags);
+/* starts running ANALYZE and correcting the blob counts of the tags
+ * in a thread of its own, with a connection of its own, if the db
+ * changed since the last check and the number of blobs has moved far
+ * enough from the last ANALYZE. for when the ui is idle. returns 
+ * non-zero if it started. */
+int db_refresh_stats();
+/* finishes a refresh whose thread is done, or waits for it if @wait
+ * is non-zero. returns 1 if the stats were refreshed, -1 if the 
+ * refresh failed or was stopped and 0 otherwise. */
+int db_refresh_stats_end(int wait);
+/* asks a running refresh to stop and roll back, for when the ui is
+ * opened: the refresh holds the write lock, which a choice would 
+ * have to wait for. db_refresh_stats_end still has to be called. */
+void db_refresh_stats_stop();
+
+/* the size of the db file in bytes */
+int64_t db_size_bytes();
+/* the number of times a statement waited because another
+ * process had the db locked */
+uint64_t db_busy_retries();
+/* changes whenever this or any other process commits a change to
+ * the db or to one of the shared dbs. it costs one read of the db file header, so anything 
+ * cached from the db can be checked with it before each query. */
+uint32_t db_generation();
+
+/* the first DB_RECENT_MAX rows of the empty query are kept in
+ * memory, so that the ui can show them without running a query.
+ * writes from this process update the cache in place and writes
+ * from other processes are noticed through db_generation, after
+ * which the next empty query fills it again. */
+#define DB_RECENT_MAX 64
+/* fills the cache if it is empty or stale, so that it is ready for
+ * the next empty query. returns non-zero if it had to be filled. */
+int db_recent_warm();
+/* the number of empty queries answered from the cache and the
+ * number which had to fill it first */
+void db_recent_stats(size_t *hits, size_t *misses);
+
+/* writes statements slower than @ms milliseconds to the file 
+ * at @path, see db_prof.h. returns non-zero on error. */
+int db_slow_query_log(const char *path, unsigned int ms);
 
 #endif
 
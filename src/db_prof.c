@@ -0,0 +1,243 @@
+/* 
+ * Copyright 2013 anthony cantor
+ * This file is part of aug-db.
+ *
+ * aug-db is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * aug-db is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with aug-db.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "db_prof.h"
+
+#include "err.h"
+#include "api_calls.h"
+#include "util.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <pthread.h>
+#include <ccan/talloc/talloc.h>
+
+static struct {
+	sqlite3 *handle;
+	struct hist hists[DB_PROF_SHAPES];
+	/* protects slow_fp and writes to it */
+	pthread_mutex_t slow_mtx;
+	FILE *slow_fp;
+	/* UINT64_MAX when there is no slow query log */
+	uint64_t slow_ns;
+} g = {
+	.slow_mtx = PTHREAD_MUTEX_INITIALIZER,
+	.slow_fp = NULL,
+	.slow_ns = UINT64_MAX
+};
+
+static __thread struct {
+	/* the statement being stepped */
+	sqlite3_stmt *stmt;
+	/* talloc'd sql of expanded_stmt with its bound values, 
+	 * from the trace callback */
+	char *expanded;
+	sqlite3_stmt *expanded_stmt;
+	/* set while writing a query plan, so that the plan
+	 * isnt traced itself */
+	int explaining;
+} g_cur;
+
+static void trace_cb(void *user, const char *sql) {
+	(void)(user);
+
+	if(g_cur.explaining || g_cur.stmt == NULL)
+		return;
+
+	talloc_free(g_cur.expanded);
+	g_cur.expanded = talloc_strdup(NULL, sql);
+	g_cur.expanded_stmt = g_cur.stmt;
+}
+
+void db_prof_init(sqlite3 *handle) {
+	g.handle = handle;
+	if(__atomic_load_n(&g.slow_ns, __ATOMIC_RELAXED) != UINT64_MAX)
+		sqlite3_trace(handle, trace_cb, NULL);
+}
+
+void db_prof_free() {
+	pthread_mutex_lock(&g.slow_mtx);
+	__atomic_store_n(&g.slow_ns, UINT64_MAX, __ATOMIC_RELAXED);
+	if(g.slow_fp != NULL) {
+		if(fclose(g.slow_fp) != 0)
+			err_warn(errno, "failed to close slow query log");
+		g.slow_fp = NULL;
+	}
+	pthread_mutex_unlock(&g.slow_mtx);
+
+	sqlite3_trace(g.handle, NULL, NULL);
+	talloc_free(g_cur.expanded);
+	g_cur.expanded = NULL;
+	g_cur.expanded_stmt = NULL;
+	g_cur.stmt = NULL;
+}
+
+int db_prof_slow_log(const char *path, unsigned int ms) {
+	FILE *fp;
+
+	if( (fp = fopen(path, "a")) == NULL) {
+		err_warn(errno, "failed to open slow query log %s", path);
+		return -1;
+	}
+
+	pthread_mutex_lock(&g.slow_mtx);
+	if(g.slow_fp != NULL)
+		fclose(g.slow_fp);
+	g.slow_fp = fp;
+	__atomic_store_n(&g.slow_ns, ms*1000000ULL, __ATOMIC_RELAXED);
+	pthread_mutex_unlock(&g.slow_mtx);
+
+	sqlite3_trace(g.handle, trace_cb, NULL);
+	return 0;
+}
+
+void db_prof_step_begin(sqlite3_stmt *stmt) {
+	g_cur.stmt = stmt;
+}
+
+static int guess_shape(sqlite3_stmt *stmt) {
+	const char *sql;
+
+	if(stmt == NULL || (sql = sqlite3_sql(stmt)) == NULL)
+		return DB_PROF_OTHER;
+
+	while(*sql == ' ' || *sql == '\t' || *sql == '\n')
+		sql++;
+	if(strncasecmp(sql, "SELECT", 6) == 0)
+		return DB_PROF_LOOKUP;
+	else if(strncasecmp(sql, "INSERT", 6) == 0)
+		return DB_PROF_INSERT;
+	else if(strncasecmp(sql, "UPDATE", 6) == 0)
+		return DB_PROF_UPDATE;
+
+	return DB_PROF_OTHER;
+}
+
+static void write_plan(FILE *fp, const char *sql) {
+	sqlite3_stmt *stmt;
+	char *eqp;
+
+	eqp = talloc_asprintf(NULL, "EXPLAIN QUERY PLAN %s", sql);
+	g_cur.explaining = 1;
+	if(sqlite3_prepare_v2(g.handle, eqp, -1, &stmt, NULL) != SQLITE_OK)
+		fprintf(fp, "--   no query plan: %s\n", sqlite3_errmsg(g.handle));
+	else {
+		/* detail is the last column in every sqlite version */
+		while(sqlite3_step(stmt) == SQLITE_ROW)
+			fprintf(fp, "--   %s\n", 
+				sqlite3_column_text(stmt, sqlite3_column_count(stmt) - 1));
+		sqlite3_finalize(stmt);
+	}
+	g_cur.explaining = 0;
+	talloc_free(eqp);
+}
+
+static void write_slow(sqlite3_stmt *stmt, int shape, uint64_t ns) {
+	char name[32], ts[32];
+	const char *sql;
+	time_t now;
+	struct tm tm;
+
+	pthread_mutex_lock(&g.slow_mtx);
+	if(g.slow_fp == NULL)
+		goto unlock;
+
+	now = time(NULL);
+	strftime(ts, sizeof(ts), "%Y-%m-%d %H:%M:%S", localtime_r(&now, &tm));
+	db_prof_shape_name(shape, name, sizeof(name));
+	fprintf(g.slow_fp, "-- %s %s %.3fms\n", ts, name, ns/1e6);
+	if(stmt == NULL)
+		fprintf(g.slow_fp, "-- (not a statement)\n");
+	else {
+		sql = sqlite3_sql(stmt);
+		fprintf(g.slow_fp, "%s;\n", 
+			(g_cur.expanded_stmt == stmt && g_cur.expanded != NULL)? 
+				g_cur.expanded : sql);
+		write_plan(g.slow_fp, sql);
+	}
+	fflush(g.slow_fp);
+
+unlock:
+	pthread_mutex_unlock(&g.slow_mtx);
+}
+
+void db_prof_record(sqlite3_stmt *stmt, int shape, uint64_t ns) {
+	if(shape < 0)
+		shape = guess_shape(stmt);
+	err_assert(shape < DB_PROF_SHAPES);
+
+	hist_add(&g.hists[shape], ns);
+	if(ns >= __atomic_load_n(&g.slow_ns, __ATOMIC_RELAXED) 
+			&& !g_cur.explaining)
+		write_slow(stmt, shape, ns);
+
+	if(stmt == g_cur.stmt)
+		g_cur.stmt = NULL;
+}
+
+void db_prof_shape_name(int shape, char *buf, size_t n) {
+	int nq, nt;
+
+	switch(shape) {
+	case DB_PROF_OTHER:
+		snprintf(buf, n, "other");
+		break;
+	case DB_PROF_LOOKUP:
+		snprintf(buf, n, "lookup");
+		break;
+	case DB_PROF_INSERT:
+		snprintf(buf, n, "insert");
+		break;
+	case DB_PROF_UPDATE:
+		snprintf(buf, n, "update");
+		break;
+	case DB_PROF_COMMIT:
+		snprintf(buf, n, "commit");
+		break;
+	default:
+		nq = (shape - DB_PROF_QUERY) / 2;
+		nt = (shape - DB_PROF_QUERY) % 2;
+		if(nq == 0 && nt == 0)
+			snprintf(buf, n, "query_empty");
+		else
+			snprintf(buf, n, "query_%dq%s", nq, nt? "_tags" : "");
+	}
+}
+
+void db_prof_hist(int shape, struct hist *h) {
+	err_assert(shape >= 0 && shape < DB_PROF_SHAPES);
+	hist_copy(h, &g.hists[shape]);
+}
+
+void db_prof_log() {
+	struct hist h;
+	char name[32];
+	int i;
+
+	for(i = 0; i < DB_PROF_SHAPES; i++) {
+		db_prof_hist(i, &h);
+		if(h.count < 1)
+			continue;
+
+		db_prof_shape_name(i, name, sizeof(name));
+		aug_log("db %s: n=%llu mean=%.3fms p50<=%.3fms p99<=%.3fms max=%.3fms\n",
+			name, (unsigned long long) h.count, h.total/1e6/h.count,
+			hist_pct(&h, 50)/1e6, hist_pct(&h, 99)/1e6, h.max/1e6);
+	}
+}
@@ -0,0 +1,89 @@
+/* 
+ * Copyright 2013 anthony cantor
+ * This file is part of aug-db.
+ *
+ * aug-db is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * aug-db is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with aug-db.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef AUG_DB_DB_PROF_H
+#define AUG_DB_DB_PROF_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sqlite3.h>
+
+#include "hist.h"
+
+/* statement profiling for db.c. db.c times each sqlite3_step and
+ * the time a statement spent in sqlite is kept in a log2 histogram
+ * for the shape of the statement. statements slower than a threshold
+ * can also be written, with their bound values and query plan, to a
+ * slow query log. the bound values come from the sqlite trace 
+ * callback, which is only registered while the log is open.
+ *
+ * the sqlite profile callback isnt used: in the sqlite version we
+ * build against it has millisecond resolution and isnt called for
+ * statements that are finalized before they are done, which is how
+ * the ui stops reading results once the screen is full.
+ *
+ * the histograms live as long as the process, so they add up over
+ * all the handles db_init opens. */
+
+/* the most search terms a ui query can have */
+#define DB_PROF_MAX_INPUTS 9
+
+enum {
+	DB_PROF_OTHER = 0,
+	/* SELECTs other than the ui queries */
+	DB_PROF_LOOKUP,
+	DB_PROF_INSERT,
+	DB_PROF_UPDATE,
+	DB_PROF_COMMIT,
+	/* the ui queries, see DB_PROF_SHAPE_QUERY */
+	DB_PROF_QUERY
+};
+
+/* the shape of a ui query with @_nq search terms, and with tags 
+ * if @_tags is non-zero. the sql doesnt depend on the number of 
+ * tags, so neither does the shape. the empty query is 
+ * DB_PROF_SHAPE_QUERY(0, 0). */
+#define DB_PROF_SHAPE_QUERY(_nq, _tags) \
+	(DB_PROF_QUERY + (_nq)*2 + ((_tags) != 0))
+#define DB_PROF_SHAPES \
+	DB_PROF_SHAPE_QUERY(DB_PROF_MAX_INPUTS+1, 0)
+
+void db_prof_init(sqlite3 *handle);
+/* closes the slow query log */
+void db_prof_free();
+
+/* starts writing statements that take at least @ms milliseconds
+ * to the file at @path. returns non-zero if it cant be opened. */
+int db_prof_slow_log(const char *path, unsigned int ms);
+
+/* db.c calls this before each sqlite3_step so that the trace 
+ * callback knows which statement it is called for */
+void db_prof_step_begin(sqlite3_stmt *stmt);
+/* records that @stmt spent @ns nanoseconds in sqlite3_step. a 
+ * @shape of -1 means the shape is guessed from the sql of @stmt.
+ * @stmt can be NULL for things that arent statements, like 
+ * DB_PROF_COMMIT. */
+void db_prof_record(sqlite3_stmt *stmt, int shape, uint64_t ns);
+
+/* writes the name of @shape into @buf */
+void db_prof_shape_name(int shape, char *buf, size_t n);
+/* copies the histogram of @shape, in nanoseconds, into @h */
+void db_prof_hist(int shape, struct hist *h);
+/* aug_log's a line for each shape that has been seen */
+void db_prof_log();
+
+#endif /* AUG_DB_DB_PROF_H */
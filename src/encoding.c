@@ -24,11 +24,17 @@
 
 struct {
 	iconv_t cd;
+	/* the other way, utf-8 to wchar */
+	iconv_t cd_wchar;
 } g;
 
 int encoding_init() {
 	if( (g.cd = iconv_open("UTF8", "WCHAR_T")) == ((iconv_t) -1) )
 		return -1;
+	if( (g.cd_wchar = iconv_open("WCHAR_T", "UTF8")) == ((iconv_t) -1) ) {
+		iconv_close(g.cd);
+		return -1;
+	}
 
 	return 0;
 }
@@ -36,6 +42,8 @@ int encoding_init() {
 void encoding_free() {
 	if(iconv_close(g.cd) != 0)
 		err_warn(errno, "failed to close iconv descriptor");
+	if(iconv_close(g.cd_wchar) != 0)
+		err_warn(errno, "failed to close iconv descriptor");
 }
 
 size_t encoding_wchar_to_utf8(uint8_t *utf8_data, size_t utf8_len,
@@ -54,4 +62,20 @@ size_t encoding_wchar_to_utf8(uint8_t *utf8_data, size_t utf8_len,
 		err_panic(errno, "failed to convert data from wchar to utf-8");
 
 	return obl;
-}
\ No newline at end of file
+}
+
+size_t encoding_utf8_to_wchar(uint32_t *wchar_data, size_t wchar_len,
+		const uint8_t *utf8_data, size_t utf8_len) {
+	size_t status, ibl, obl;
+	char *ip, *op; 
+
+	ip = (char *) utf8_data;
+	op = (char *) wchar_data;
+	ibl = utf8_len;
+	obl = wchar_len*sizeof(uint32_t);
+
+	if( (status = iconv(g.cd_wchar, &ip, &ibl, &op, &obl)) == ((size_t) -1) )
+		err_panic(errno, "failed to convert data from utf-8 to wchar");
+
+	return obl/sizeof(uint32_t);
+}
@@ -26,5 +26,8 @@ void encoding_free();
 /* returns the number of bytes left in utf8_data */
 size_t encoding_wchar_to_utf8(uint8_t *utf8_data, size_t utf8_len,
 		const uint32_t *wchar_data, size_t wchar_len);
+/* returns the number of characters left in wchar_data */
+size_t encoding_utf8_to_wchar(uint32_t *wchar_data, size_t wchar_len,
+		const uint8_t *utf8_data, size_t utf8_len);
 
 #endif /* AUG_DB_ENCODING_H */
@@ -0,0 +1,255 @@
+/* 
+ * Copyright 2013 anthony cantor
+ * This file is part of aug-db.
+ *
+ * aug-db is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * aug-db is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with aug-db.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "evloop.h"
+
+#include "err.h"
+#include "util.h"
+#include "lock.h"
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <errno.h>
+#include <ccan/array_size/array_size.h>
+
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
+
+#define EVLOOP_LOCK(_loop, _status) \
+	AUG_DB_LOCK(&(_loop)->mtx, _status, "failed to lock event loop mutex")
+#define EVLOOP_UNLOCK(_loop, _status) \
+	AUG_DB_UNLOCK(&(_loop)->mtx, _status, "failed to unlock event loop mutex")
+
+#define NS_PER_MS 1000000ULL
+
+static int open_fds(struct evloop *loop) {
+#ifdef __linux__
+	if( (loop->rfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0)
+		return -1;
+	loop->wfd = loop->rfd;
+#else
+	int fds[2];
+
+	if(pipe(fds) != 0)
+		return -1;
+	if(fcntl(fds[0], F_SETFL, O_NONBLOCK) != 0 
+			|| fcntl(fds[1], F_SETFL, O_NONBLOCK) != 0) {
+		close(fds[0]);
+		close(fds[1]);
+		return -1;
+	}
+	loop->rfd = fds[0];
+	loop->wfd = fds[1];
+#endif
+	return 0;
+}
+
+int evloop_init(struct evloop *loop) {
+	size_t i;
+	int status;
+
+	if( (status = pthread_mutex_init(&loop->mtx, NULL)) != 0) {
+		err_warn(status, "failed to init event loop mutex");
+		return -1;
+	}
+	if(open_fds(loop) != 0) {
+		err_warn(errno, "failed to create event loop file descriptor");
+		pthread_mutex_destroy(&loop->mtx);
+		return -1;
+	}
+
+	fifo_init(&loop->queue, loop->buf, sizeof(struct evloop_event), 
+			ARRAY_SIZE(loop->buf));
+	loop->signaled = 0;
+	for(i = 0; i < ARRAY_SIZE(loop->timers); i++)
+		loop->timers[i].active = 0;
+
+	return 0;
+}
+
+void evloop_free(struct evloop *loop) {
+	int status;
+
+	if(close(loop->rfd) != 0)
+		err_warn(errno, "failed to close event loop file descriptor");
+	if(loop->wfd != loop->rfd && close(loop->wfd) != 0)
+		err_warn(errno, "failed to close event loop file descriptor");
+	if( (status = pthread_mutex_destroy(&loop->mtx)) != 0)
+		err_warn(status, "failed to destroy event loop mutex");
+}
+
+static void evloop_signal(struct evloop *loop) {
+#ifdef __linux__
+	uint64_t val = 1;
+#else
+	uint8_t val = 1;
+#endif
+
+	/* EAGAIN means the consumer already has a wakeup pending */
+	if(write(loop->wfd, &val, sizeof(val)) < 0 && errno != EAGAIN)
+		err_panic(errno, "failed to signal event loop");
+}
+
+static void evloop_drain(struct evloop *loop) {
+	uint64_t buf[8];
+	ssize_t amt;
+
+	while( (amt = read(loop->rfd, buf, sizeof(buf))) > 0)
+		;
+	if(amt < 0 && errno != EAGAIN)
+		err_panic(errno, "failed to read event loop file descriptor");
+}
+
+int evloop_push(struct evloop *loop, const struct evloop_event *ev) {
+	int status, do_signal;
+
+	EVLOOP_LOCK(loop, status);
+	if(fifo_avail(&loop->queue) < 1) {
+		EVLOOP_UNLOCK(loop, status);
+		return -1;
+	}
+	fifo_push(&loop->queue, ev);
+	do_signal = (loop->signaled == 0);
+	/* atomic so that evloop_pending can read it without the lock */
+	__atomic_store_n(&loop->signaled, 1, __ATOMIC_RELEASE);
+	EVLOOP_UNLOCK(loop, status);
+
+	if(do_signal)
+		evloop_signal(loop);
+
+	return 0;
+}
+
+/* must be called with loop->mtx locked. fills @evs with the
+ * events of expired timers and returns the number of events
+ * written. *timeout is set to the milliseconds until the next
+ * timer expires or -1 if no timers are active. */
+static size_t expire_timers(struct evloop *loop, struct evloop_event *evs, 
+		size_t n, int *timeout) {
+	size_t i, amt;
+	uint64_t now;
+	int64_t left;
+
+	amt = 0;
+	*timeout = -1;
+	now = util_now_ns();
+	for(i = 0; i < ARRAY_SIZE(loop->timers); i++) {
+		if(loop->timers[i].active == 0)
+			continue;
+		
+		if(loop->timers[i].deadline <= now && amt < n) {
+			evs[amt].type = EVLOOP_TIMER;
+			evs[amt].ch = 0;
+			evs[amt].timer = i;
+			amt++;
+			if(loop->timers[i].periodic)
+				loop->timers[i].deadline = now + loop->timers[i].ms*NS_PER_MS;
+			else {
+				loop->timers[i].active = 0;
+				continue;
+			}
+		}
+
+		left = (int64_t) (loop->timers[i].deadline - now);
+		if(left < 0)
+			left = 0;
+		/* round up so that poll doesnt wake us up early */
+		left = (left + NS_PER_MS - 1)/NS_PER_MS;
+		if(*timeout < 0 || left < *timeout)
+			*timeout = left;
+	}
+
+	return amt;
+}
+
+static size_t evloop_take(struct evloop *loop, struct evloop_event *evs, 
+		size_t n, int *timeout) {
+	size_t amt;
+	int status;
+
+	EVLOOP_LOCK(loop, status);
+	if( (amt = fifo_amt(&loop->queue)) > n)
+		amt = n;
+	fifo_consume(&loop->queue, evs, amt);
+	/* the next push has to signal us again */
+	if(fifo_amt(&loop->queue) < 1)
+		__atomic_store_n(&loop->signaled, 0, __ATOMIC_RELEASE);
+
+	amt += expire_timers(loop, evs+amt, n-amt, timeout);
+	EVLOOP_UNLOCK(loop, status);
+
+	return amt;
+}
+
+int evloop_pending(struct evloop *loop) {
+	return __atomic_load_n(&loop->signaled, __ATOMIC_ACQUIRE);
+}
+
+size_t evloop_poll(struct evloop *loop, struct evloop_event *evs, size_t n) {
+	int timeout;
+
+	return evloop_take(loop, evs, n, &timeout);
+}
+
+size_t evloop_wait(struct evloop *loop, struct evloop_event *evs, size_t n) {
+	size_t amt;
+	int timeout, status;
+	struct pollfd pfd;
+
+	err_assert(n > 0);
+	while( (amt = evloop_take(loop, evs, n, &timeout)) < 1) {
+		pfd.fd = loop->rfd;
+		pfd.events = POLLIN;
+		if( (status = poll(&pfd, 1, timeout)) < 0) {
+			if(errno == EINTR)
+				continue;
+			err_panic(errno, "failed to poll event loop");
+		}
+
+		if(status > 0)
+			evloop_drain(loop);
+	}
+
+	return amt;
+}
+
+void evloop_timer_set(struct evloop *loop, int timer, unsigned int ms, int periodic) {
+	int status;
+
+	err_assert(timer >= 0 && timer < (int) ARRAY_SIZE(loop->timers));
+	EVLOOP_LOCK(loop, status);
+	loop->timers[timer].active = 1;
+	loop->timers[timer].periodic = periodic;
+	loop->timers[timer].ms = ms;
+	loop->timers[timer].deadline = util_now_ns() + ms*NS_PER_MS;
+	EVLOOP_UNLOCK(loop, status);
+
+	/* the consumer may be in poll with a timeout computed 
+	 * before this timer existed */
+	evloop_signal(loop);
+}
+
+void evloop_timer_clear(struct evloop *loop, int timer) {
+	int status;
+
+	err_assert(timer >= 0 && timer < (int) ARRAY_SIZE(loop->timers));
+	EVLOOP_LOCK(loop, status);
+	loop->timers[timer].active = 0;
+	EVLOOP_UNLOCK(loop, status);
+}
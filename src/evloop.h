@@ -0,0 +1,97 @@
+/* 
+ * Copyright 2013 anthony cantor
+ * This file is part of aug-db.
+ *
+ * aug-db is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * aug-db is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with aug-db.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef AUG_DB_EVLOOP_H
+#define AUG_DB_EVLOOP_H
+
+#include "fifo.h"
+
+#include <stdint.h>
+#include <pthread.h>
+
+/* an event queue with a single consumer thread. any thread can
+ * push typed events; the consumer blocks in evloop_wait on a single
+ * file descriptor (an eventfd on linux, a pipe elsewhere) which is
+ * only written when the queue goes from empty to non-empty. timers
+ * are implemented with the poll timeout, so they cost nothing
+ * until they expire.
+ */
+typedef enum {
+	EVLOOP_KEY = 0,
+	EVLOOP_CMD_KEY,
+	EVLOOP_RESIZE,
+	EVLOOP_SHUTDOWN,
+	EVLOOP_TIMER
+} evloop_type;
+
+struct evloop_event {
+	evloop_type type;
+	/* the input character of an EVLOOP_KEY event */
+	uint32_t ch;
+	/* the timer id of an EVLOOP_TIMER event */
+	int timer;
+};
+
+#define EVLOOP_QUEUE_SIZE 1024
+#define EVLOOP_MAX_TIMERS 8
+
+struct evloop {
+	pthread_mutex_t mtx;
+	/* these are protected by mtx */
+	struct evloop_event buf[EVLOOP_QUEUE_SIZE];
+	struct fifo queue;
+	/* non-zero if wfd has been written since the consumer 
+	 * last found the queue empty. see evloop_pending */
+	int signaled;
+	struct {
+		int active;
+		int periodic;
+		unsigned int ms;
+		/* nanoseconds on the util_now_ns clock */
+		uint64_t deadline;
+	} timers[EVLOOP_MAX_TIMERS];
+
+	int rfd;
+	int wfd;
+};
+
+int evloop_init(struct evloop *loop);
+void evloop_free(struct evloop *loop);
+
+/* may be called by any thread. returns -1 if the queue is full */
+int evloop_push(struct evloop *loop, const struct evloop_event *ev);
+
+/* these are only to be called by the consumer thread */
+
+/* blocks until at least one event is available, then copies at most
+ * @n events into @evs and returns how many were copied. */
+size_t evloop_wait(struct evloop *loop, struct evloop_event *evs, size_t n);
+/* same as evloop_wait but returns 0 instead of blocking */
+size_t evloop_poll(struct evloop *loop, struct evloop_event *evs, size_t n);
+/* returns non-zero if events have been pushed since the queue was
+ * last emptied. this doesnt take the lock and doesnt look at timers,
+ * so it is cheap enough to call in the middle of a long operation. */
+int evloop_pending(struct evloop *loop);
+
+/* timers may be set by any thread. an EVLOOP_TIMER event for
+ * @timer will be delivered after @ms milliseconds, and then again
+ * every @ms milliseconds if @periodic is non-zero. setting an active
+ * timer restarts it, which makes it easy to debounce something. */
+void evloop_timer_set(struct evloop *loop, int timer, unsigned int ms, int periodic);
+void evloop_timer_clear(struct evloop *loop, int timer);
+
+#endif /* AUG_DB_EVLOOP_H */
@@ -0,0 +1,69 @@
+/* 
+ * Copyright 2013 anthony cantor
+ * This file is part of aug-db.
+ *
+ * aug-db is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * aug-db is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with aug-db.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "hist.h"
+
+void hist_add(struct hist *h, uint64_t val) {
+	unsigned int b;
+	uint64_t max;
+
+	b = (val > 0)? 63 - __builtin_clzll(val) : 0;
+	if(b >= HIST_BUCKETS)
+		b = HIST_BUCKETS - 1;
+
+	__atomic_add_fetch(&h->count, 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&h->total, val, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&h->buckets[b], 1, __ATOMIC_RELAXED);
+	__atomic_store_n(&h->last, val, __ATOMIC_RELAXED);
+	max = __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+	while(val > max && !__atomic_compare_exchange_n(&h->max, &max, val, 0, 
+			__ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		; /* max was updated by someone else, try again */
+}
+
+void hist_copy(struct hist *dst, const struct hist *src) {
+	int i;
+
+	dst->count = __atomic_load_n(&src->count, __ATOMIC_RELAXED);
+	dst->total = __atomic_load_n(&src->total, __ATOMIC_RELAXED);
+	dst->max = __atomic_load_n(&src->max, __ATOMIC_RELAXED);
+	dst->last = __atomic_load_n(&src->last, __ATOMIC_RELAXED);
+	for(i = 0; i < HIST_BUCKETS; i++)
+		dst->buckets[i] = __atomic_load_n(&src->buckets[i], __ATOMIC_RELAXED);
+}
+
+uint64_t hist_pct(const struct hist *h, double pct) {
+	uint64_t total, want, bound;
+	int i;
+
+	/* count may be ahead of the buckets in a copy */
+	for(total = 0, i = 0; i < HIST_BUCKETS; i++)
+		total += h->buckets[i];
+	if(total < 1)
+		return 0;
+
+	want = (uint64_t) (pct/100.0 * total + 0.5);
+	if(want < 1)
+		want = 1;
+	for(total = 0, i = 0; i < HIST_BUCKETS - 1; i++) {
+		if( (total += h->buckets[i]) >= want)
+			break;
+	}
+
+	bound = (i < HIST_BUCKETS - 1)? (2ULL << i) : h->max;
+	return (bound < h->max)? bound : h->max;
+}
@@ -0,0 +1,44 @@
+/* 
+ * Copyright 2013 anthony cantor
+ * This file is part of aug-db.
+ *
+ * aug-db is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * aug-db is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with aug-db.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef AUG_DB_HIST_H
+#define AUG_DB_HIST_H
+
+#include <stdint.h>
+
+/* log2 latency histograms. hist_add can be called from any thread
+ * without a lock; readers take a copy with hist_copy. */
+
+/* bucket i counts values in [2^i, 2^(i+1)), the last one also
+ * counts everything bigger */
+#define HIST_BUCKETS 40
+
+struct hist {
+	uint64_t count;
+	uint64_t total;
+	uint64_t max;
+	/* the most recently added value */
+	uint64_t last;
+	uint64_t buckets[HIST_BUCKETS];
+};
+
+void hist_add(struct hist *h, uint64_t val);
+void hist_copy(struct hist *dst, const struct hist *src);
+/* an upper bound on the @pct percentile of @h */
+uint64_t hist_pct(const struct hist *h, double pct);
+
+#endif /* AUG_DB_HIST_H */
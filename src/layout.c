@@ -0,0 +1,342 @@
+/* 
+ * Copyright 2013 anthony cantor
+ * This file is part of aug-db.
+ *
+ * aug-db is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * aug-db is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with aug-db.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/* for wcwidth */
+#ifndef _XOPEN_SOURCE
+#	define _XOPEN_SOURCE 700
+#endif
+#include "layout.h"
+
+#include "err.h"
+#include "mem.h"
+
+#include <string.h>
+#include <ccan/talloc/talloc.h>
+
+struct entry {
+	/* NULL if the entry is empty. parent of everything in l */
+	void *ctx;
+	/* talloc_total_size of ctx */
+	size_t bytes;
+	struct layout l;
+};
+
+static struct {
+	struct entry entries[LAYOUT_CACHE_SIZE];
+	size_t hits;
+	size_t misses;
+	/* total bytes of every entry */
+	size_t bytes;
+	/* our id with the memory accountant */
+	int mem_id;
+} g;
+
+/* lines refer to the text of a builder by offset until the
+ * end because the text is reallocated as it grows */
+struct builder_line {
+	size_t off;
+	size_t len;
+	int width;
+};
+
+/* collects the lines of a blob */
+struct builder {
+	void *ctx;
+	int cols;
+	size_t max_lines;
+	wchar_t *text;
+	uint8_t *widths;
+	size_t len;
+	size_t cap;
+	struct builder_line *lines;
+	size_t n;
+	size_t lines_cap;
+	/* screen column of the end of the current line */
+	int x;
+	int truncated;
+};
+
+static void entry_free(struct entry *e) {
+	if(e->ctx == NULL)
+		return;
+
+	talloc_free(e->ctx);
+	e->ctx = NULL;
+	g.bytes -= e->bytes;
+	e->bytes = 0;
+}
+
+static size_t usage(void *user) {
+	(void)(user);
+	return g.bytes;
+}
+
+static void evict(void *user, size_t want) {
+	size_t i, before;
+	(void)(user);
+
+	before = g.bytes;
+	for(i = 0; i < LAYOUT_CACHE_SIZE && before - g.bytes < want; i++)
+		entry_free(&g.entries[i]);
+}
+
+void layout_init() {
+	memset(&g, 0, sizeof(g));
+	g.mem_id = mem_register("layout", MEM_PRIO_LAYOUT, usage, 
+			evict, NULL);
+}
+
+void layout_free() {
+	layout_clear();
+	mem_unregister(g.mem_id);
+	g.mem_id = -1;
+}
+
+void layout_clear() {
+	size_t i;
+
+	for(i = 0; i < LAYOUT_CACHE_SIZE; i++)
+		entry_free(&g.entries[i]);
+}
+
+void layout_stats(size_t *hits, size_t *misses) {
+	*hits = g.hits;
+	*misses = g.misses;
+}
+
+/* start a new line. returns -1 if that would exceed max_lines */
+static int builder_newline(struct builder *b) {
+	if(b->n >= b->max_lines) {
+		b->truncated = 1;
+		return -1;
+	}
+
+	if(b->n >= b->lines_cap) {
+		b->lines_cap *= 2;
+		b->lines = talloc_realloc(b->ctx, b->lines, 
+				struct builder_line, b->lines_cap);
+	}
+	b->lines[b->n].off = b->len;
+	b->lines[b->n].len = 0;
+	b->lines[b->n].width = 0;
+	b->n++;
+	b->x = 0;
+
+	return 0;
+}
+
+/* append @amt characters each taking up @cells screen cells, 
+ * wrapping to a new line if they dont fit. a line never has
+ * more than twice as many characters as columns (which leaves room
+ * for combining characters). returns -1 if there is no more space. */
+static int builder_put(struct builder *b, const wchar_t *wcs, 
+		size_t amt, int cells) {
+	size_t i;
+
+	if(b->x + (int) amt*cells > b->cols 
+			|| b->lines[b->n-1].len + amt > (size_t) b->cols*2) {
+		if(builder_newline(b) != 0)
+			return -1;
+	}
+
+	if(b->len + amt > b->cap) {
+		while(b->len + amt > b->cap)
+			b->cap *= 2;
+		b->text = talloc_realloc(b->ctx, b->text, wchar_t, b->cap);
+		b->widths = talloc_realloc(b->ctx, b->widths, uint8_t, b->cap);
+	}
+
+	for(i = 0; i < amt; i++) {
+		b->text[b->len] = wcs[i];
+		b->widths[b->len] = (uint8_t) cells;
+		b->len++;
+	}
+	b->lines[b->n-1].len += amt;
+	b->lines[b->n-1].width += amt*cells;
+	b->x += amt*cells;
+
+	return 0;
+}
+
+/* decode the utf-8 sequence at the start of @data into @wc. returns
+ * the length of the sequence or 0 if it is invalid or truncated. */
+static size_t utf8_decode(const uint8_t *data, size_t size, wchar_t *wc) {
+	size_t len, i;
+	uint32_t cp, min;
+
+	if(data[0] < 0x80) {
+		*wc = data[0];
+		return 1;
+	}
+	else if( (data[0] & 0xe0) == 0xc0) {
+		len = 2;
+		cp = data[0] & 0x1f;
+		min = 0x80;
+	}
+	else if( (data[0] & 0xf0) == 0xe0) {
+		len = 3;
+		cp = data[0] & 0x0f;
+		min = 0x800;
+	}
+	else if( (data[0] & 0xf8) == 0xf0) {
+		len = 4;
+		cp = data[0] & 0x07;
+		min = 0x10000;
+	}
+	else
+		return 0;
+
+	if(len > size)
+		return 0;
+	for(i = 1; i < len; i++) {
+		if( (data[i] & 0xc0) != 0x80)
+			return 0;
+		cp = (cp << 6) | (data[i] & 0x3f);
+	}
+	if(cp < min || cp > 0x10ffff || (cp >= 0xd800 && cp <= 0xdfff) )
+		return 0;
+
+	*wc = (wchar_t) cp;
+	return len;
+}
+
+static int put_escaped(struct builder *b, uint8_t ch) {
+	static const char hex[] = "0123456789abcdef";
+	wchar_t esc[4];
+
+	esc[0] = L'\\';
+	esc[1] = L'x';
+	esc[2] = hex[ch >> 4];
+	esc[3] = hex[ch & 0x0f];
+	return builder_put(b, esc, 4, 1);
+}
+
+static void build(struct builder *b, const uint8_t *data, size_t size, int raw) {
+	size_t i, len;
+	int w;
+	uint8_t ch;
+	wchar_t wc, esc[2];
+
+	if(builder_newline(b) != 0)
+		return;
+
+	for(i = 0; i < size; i += len) {
+		ch = data[i];
+		len = 1;
+		if(raw != 0) {
+			if(ch >= 0x20 && ch <= 0x7e) {
+				wc = ch;
+				if(builder_put(b, &wc, 1, 1) != 0)
+					return;
+			}
+			else if(put_escaped(b, ch) != 0)
+				return;
+		}
+		else if(ch == '\n') {
+			if(builder_newline(b) != 0)
+				return;
+		}
+		else if(ch == '\t') {
+			wc = L' ';
+			do {
+				if(builder_put(b, &wc, 1, 1) != 0)
+					return;
+			} while(b->x % 8 != 0 && b->x < b->cols);
+		}
+		else if(ch < 0x20 || ch == 0x7f) {
+			esc[0] = L'^';
+			esc[1] = (ch == 0x7f)? L'?' : ch + '@';
+			if(builder_put(b, esc, 2, 1) != 0)
+				return;
+		}
+		else if( (len = utf8_decode(data + i, size - i, &wc)) == 0) {
+			/* not utf-8, show the byte like a raw blob would */
+			len = 1;
+			if(put_escaped(b, ch) != 0)
+				return;
+		}
+		else if( (w = wcwidth(wc)) < 0) {
+			wc = 0xfffd;
+			if(builder_put(b, &wc, 1, 1) != 0)
+				return;
+		}
+		else if(builder_put(b, &wc, 1, w) != 0)
+			return;
+	}
+
+	/* a trailing newline (or an empty blob) doesnt need a line */
+	if(b->lines[b->n-1].len == 0)
+		b->n--;
+}
+
+static void layout_blob(struct entry *e, int id, int cols, size_t max_lines,
+		const uint8_t *data, size_t size, int raw) {
+	struct builder b;
+	size_t i;
+
+	e->ctx = talloc_new(NULL);
+	b.ctx = e->ctx;
+	b.cols = cols;
+	b.max_lines = max_lines;
+	b.cap = 64;
+	b.len = 0;
+	b.text = talloc_array(b.ctx, wchar_t, b.cap);
+	b.widths = talloc_array(b.ctx, uint8_t, b.cap);
+	b.lines_cap = 8;
+	b.lines = talloc_array(b.ctx, struct builder_line, b.lines_cap);
+	b.n = 0;
+	b.x = 0;
+	b.truncated = 0;
+
+	build(&b, data, size, raw);
+
+	e->l.id = id;
+	e->l.cols = cols;
+	e->l.truncated = b.truncated;
+	e->l.n = b.n;
+	e->l.lines = talloc_array(e->ctx, struct layout_line, (b.n > 0)? b.n : 1);
+	for(i = 0; i < b.n; i++) {
+		e->l.lines[i].text = b.text + b.lines[i].off;
+		e->l.lines[i].widths = b.widths + b.lines[i].off;
+		e->l.lines[i].len = b.lines[i].len;
+		e->l.lines[i].width = b.lines[i].width;
+	}
+	talloc_free(b.lines);
+}
+
+const struct layout *layout_get(int id, int cols, size_t max_lines,
+		const uint8_t *data, size_t size, int raw) {
+	struct entry *e;
+
+	err_assert(cols > 0);
+	err_assert(max_lines > 0);
+
+	e = &g.entries[((unsigned int) id) & (LAYOUT_CACHE_SIZE-1)];
+	if(e->ctx != NULL && e->l.id == id && e->l.cols == cols
+			&& (e->l.truncated == 0 || e->l.n >= max_lines) ) {
+		g.hits++;
+		return &e->l;
+	}
+
+	g.misses++;
+	entry_free(e);
+	layout_blob(e, id, cols, max_lines, data, size, raw);
+	e->bytes = talloc_total_size(e->ctx);
+	g.bytes += e->bytes;
+
+	return &e->l;
+}
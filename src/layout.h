@@ -0,0 +1,69 @@
+/* 
+ * Copyright 2013 anthony cantor
+ * This file is part of aug-db.
+ *
+ * aug-db is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * aug-db is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with aug-db.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef AUG_DB_LAYOUT_H
+#define AUG_DB_LAYOUT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <wchar.h>
+
+/* a cache of blobs laid out into display lines for a given
+ * number of columns. a blob is wrapped, tabs are expanded,
+ * control characters and invalid utf-8 are escaped and the
+ * screen width of every character is measured once, so that
+ * rendering an unchanged result is just a copy.
+ *
+ * this is only used by the ui thread, so it isnt locked.
+ */
+
+struct layout_line {
+	const wchar_t *text;
+	/* screen cells taken up by each character of text */
+	const uint8_t *widths;
+	size_t len;
+	/* screen cells taken up by the whole line */
+	int width;
+};
+
+struct layout {
+	int id;
+	int cols;
+	/* non-zero if the blob has more lines than are in @lines */
+	int truncated;
+	size_t n;
+	struct layout_line *lines;
+};
+
+/* the size of the cache. must be a power of 2 */
+#define LAYOUT_CACHE_SIZE 256
+
+void layout_init();
+void layout_free();
+
+/* returns the layout of the blob with @id wrapped to @cols columns,
+ * laying out the blob from @data if it isnt cached. at least @max_lines
+ * lines (if the blob has that many) are laid out. the result is valid
+ * until the next call to any function in this module. */
+const struct layout *layout_get(int id, int cols, size_t max_lines,
+		const uint8_t *data, size_t size, int raw);
+/* forget every layout, e.g. because the window was resized */
+void layout_clear();
+
+void layout_stats(size_t *hits, size_t *misses);
+
+#endif /* AUG_DB_LAYOUT_H */
@@ -19,45 +19,56 @@
 #define AUG_DB_LOCK_H
 
 #include <pthread.h>
-#include "api_calls.h"
+#include "trace.h"
 
-static inline int fprint_tid(const char *src, const char *func, int lineno, 
-		pthread_t pt, const char *suffix, ...) {
-	va_list args;
-	size_t k;
-#define FPRINT_TID_BUFLEN ( sizeof(pthread_t)*2 + 1 )
-	unsigned char *ptc;
-	char buf[FPRINT_TID_BUFLEN];
-	char suf_buf[512];
-
-	ptc = (unsigned char*)(void*)(&pt);
-	for(k = 0; k < sizeof(pthread_t); k++) 
-		snprintf(buf+k*2, 3, "%02x", (unsigned)(ptc[k]));
-
-	buf[FPRINT_TID_BUFLEN-1] = '\0';
-#undef FPRINT_TID_BUFLEN
+/* lock/unlock events are recorded in the trace ring at fine
+ * trace level. the "locked" event follows the lock event once
+ * the mutex is acquired, so the decoder can show wait times.
+ *
+ * if AUG_DB_LOCK_PROFILE is defined every use of AUG_DB_LOCK also
+ * records how long it waited for the mutex and how long the mutex
+ * was then held into histograms for that file:line, see lock_prof.h.
+ * otherwise these are just pthread_mutex_lock and unlock.
+ */
+#ifdef AUG_DB_LOCK_PROFILE
+#include "lock_prof.h"
+#include "util.h"
 
-	va_start(args, suffix);
-	vsnprintf(suf_buf, sizeof(suf_buf), suffix, args);
-	va_end(args);
+#define AUG_DB_LOCK(mtx_ptr, status, msg) \
+	do { \
+		static struct lock_site _lock_site = {.file = __FILE__, .line = __LINE__}; \
+		uint64_t _lock_t0; \
+		TRACE_FINE(TRACE_EV_LOCK, mtx_ptr, __LINE__); \
+		_lock_t0 = util_now_ns(); \
+		if( (status = pthread_mutex_lock(mtx_ptr)) != 0) \
+			{ err_panic(status, msg); } \
+		lock_prof_locked(&_lock_site, mtx_ptr, _lock_t0); \
+		TRACE_FINE(TRACE_EV_LOCKED, mtx_ptr, __LINE__); \
+	} while(0)
 
-	return aug_log("(0x%s)%s#%s@%d=> %s\n", buf, src, func, lineno, suf_buf);
-}
+#define AUG_DB_UNLOCK(mtx_ptr, status, msg) \
+	do { \
+		TRACE_FINE(TRACE_EV_UNLOCK, mtx_ptr, __LINE__); \
+		lock_prof_unlock(mtx_ptr); \
+		if( (status = pthread_mutex_unlock(mtx_ptr)) != 0) \
+			{ err_panic(status, msg); } \
+	} while(0)
 
+#else
 #define AUG_DB_LOCK(mtx_ptr, status, msg) \
 	do { \
-		fprint_tid(__FILE__, __func__, __LINE__, pthread_self(), \
-			":lock " stringify(mtx_ptr) ); \
+		TRACE_FINE(TRACE_EV_LOCK, mtx_ptr, __LINE__); \
 		if( (status = pthread_mutex_lock(mtx_ptr)) != 0) \
 			{ err_panic(status, msg); } \
+		TRACE_FINE(TRACE_EV_LOCKED, mtx_ptr, __LINE__); \
 	} while(0)
 
 #define AUG_DB_UNLOCK(mtx_ptr, status, msg) \
 	do { \
-		fprint_tid(__FILE__, __func__, __LINE__, pthread_self(), \
-			":unlock " stringify(mtx_ptr) ); \
+		TRACE_FINE(TRACE_EV_UNLOCK, mtx_ptr, __LINE__); \
 		if( (status = pthread_mutex_unlock(mtx_ptr)) != 0) \
 			{ err_panic(status, msg); } \
 	} while(0)
+#endif /* AUG_DB_LOCK_PROFILE */
 
 #endif /* AUG_DB_LOCK_H */
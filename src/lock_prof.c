@@ -0,0 +1,127 @@
+/* 
+ * Copyright 2013 anthony cantor
+ * This file is part of aug-db.
+ *
+ * aug-db is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * aug-db is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with aug-db.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "lock_prof.h"
+
+#include "api_calls.h"
+#include "util.h"
+
+#include <string.h>
+#include <ccan/talloc/talloc.h>
+
+static struct {
+	struct lock_site *sites;
+} g;
+
+/* the mutexes held by this thread, innermost last */
+static __thread struct {
+	size_t n;
+	struct {
+		pthread_mutex_t *mtx;
+		struct lock_site *site;
+		uint64_t t;
+	} held[LOCK_PROF_MAX_HELD];
+} g_held;
+
+void lock_prof_locked(struct lock_site *site, pthread_mutex_t *mtx, uint64_t t0) {
+	uint64_t now;
+
+	if(__atomic_exchange_n(&site->registered, 1, __ATOMIC_ACQ_REL) == 0) {
+		site->next = __atomic_load_n(&g.sites, __ATOMIC_ACQUIRE);
+		while(!__atomic_compare_exchange_n(&g.sites, &site->next, site, 0,
+				__ATOMIC_RELEASE, __ATOMIC_ACQUIRE))
+			; /* site->next was updated to the current list head, try again */
+	}
+
+	now = util_now_ns();
+	hist_add(&site->wait, now - t0);
+	if(g_held.n < LOCK_PROF_MAX_HELD) {
+		g_held.held[g_held.n].mtx = mtx;
+		g_held.held[g_held.n].site = site;
+		g_held.held[g_held.n].t = now;
+	}
+	/* count past the end so that the unlocks still match up */
+	g_held.n++;
+}
+
+void lock_prof_unlock(pthread_mutex_t *mtx) {
+	size_t i, n;
+
+	if(g_held.n < 1)
+		return;
+
+	/* mutexes are almost always unlocked in the reverse order
+	 * they were locked, so start at the innermost */
+	n = (g_held.n < LOCK_PROF_MAX_HELD)? g_held.n : LOCK_PROF_MAX_HELD;
+	for(i = n; i > 0; i--)
+		if(g_held.held[i-1].mtx == mtx)
+			break;
+
+	if(i > 0) {
+		hist_add(&g_held.held[i-1].site->hold, util_now_ns() - g_held.held[i-1].t);
+		memmove(&g_held.held[i-1], &g_held.held[i], (n - i)*sizeof(g_held.held[0]));
+	}
+	g_held.n--;
+}
+
+const struct lock_site *lock_prof_sites() {
+	return __atomic_load_n(&g.sites, __ATOMIC_ACQUIRE);
+}
+
+static const char *site_file(const struct lock_site *site) {
+	const char *s;
+
+	return ( (s = strrchr(site->file, '/')) != NULL)? s+1 : site->file;
+}
+
+static char *site_line(const void *ctx, const struct lock_site *site) {
+	struct hist wait, hold;
+
+	hist_copy(&wait, &site->wait);
+	hist_copy(&hold, &site->hold);
+	return talloc_asprintf(ctx, "%s:%d n=%llu wait p50=%.1fus p99=%.1fus "
+			"max=%.1fus hold p50=%.1fus p99=%.1fus max=%.1fus",
+		site_file(site), site->line, (unsigned long long) wait.count,
+		hist_pct(&wait, 50)/1e3, hist_pct(&wait, 99)/1e3, wait.max/1e3,
+		hist_pct(&hold, 50)/1e3, hist_pct(&hold, 99)/1e3, hold.max/1e3);
+}
+
+void lock_prof_log() {
+	const struct lock_site *site;
+	char *line;
+
+	for(site = lock_prof_sites(); site != NULL; site = site->next) {
+		line = site_line(NULL, site);
+		aug_log("lock %s\n", line);
+		talloc_free(line);
+	}
+}
+
+char **lock_prof_report(const void *ctx, size_t *n) {
+	const struct lock_site *site;
+	char **lines;
+	size_t i;
+
+	for(i = 0, site = lock_prof_sites(); site != NULL; site = site->next)
+		i++;
+
+	lines = talloc_array(ctx, char *, (i > 0)? i : 1);
+	for(*n = 0, site = lock_prof_sites(); site != NULL && *n < i; site = site->next)
+		lines[(*n)++] = site_line(lines, site);
+
+	return lines;
+}
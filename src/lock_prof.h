@@ -0,0 +1,62 @@
+/* 
+ * Copyright 2013 anthony cantor
+ * This file is part of aug-db.
+ *
+ * aug-db is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * aug-db is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with aug-db.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef AUG_DB_LOCK_PROF_H
+#define AUG_DB_LOCK_PROF_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "hist.h"
+
+/* wait and hold time histograms for each AUG_DB_LOCK site, which
+ * are only recorded if AUG_DB_LOCK_PROFILE is defined (see lock.h).
+ * each site is a static struct lock_site declared by the macro, so
+ * recording never allocates or takes a lock. */
+
+struct lock_site {
+	const char *file;
+	int line;
+	/* set once the site is on the list of sites */
+	int registered;
+	struct lock_site *next;
+	/* nanoseconds spent in pthread_mutex_lock */
+	struct hist wait;
+	/* nanoseconds from acquiring the mutex at this site 
+	 * until it was unlocked */
+	struct hist hold;
+};
+
+/* the number of mutexes a thread can hold at once and still have
+ * their hold time recorded */
+#define LOCK_PROF_MAX_HELD 8
+
+/* these are only for lock.h */
+void lock_prof_locked(struct lock_site *site, pthread_mutex_t *mtx, uint64_t t0);
+void lock_prof_unlock(pthread_mutex_t *mtx);
+
+/* the sites which have been locked at least once. the list is
+ * only ever prepended to, so it can be walked by any thread. */
+const struct lock_site *lock_prof_sites();
+/* aug_log's a line for each site */
+void lock_prof_log();
+/* formats a line for each site into an array of *n talloc'd 
+ * lines, which is a child of @ctx */
+char **lock_prof_report(const void *ctx, size_t *n);
+
+#endif /* AUG_DB_LOCK_PROF_H */
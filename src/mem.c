@@ -0,0 +1,162 @@
+/* 
+ * Copyright 2013 anthony cantor
+ * This file is part of aug-db.
+ *
+ * aug-db is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * aug-db is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with aug-db.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "mem.h"
+
+#include "err.h"
+#include "api_calls.h"
+
+#include <sqlite3.h>
+#include <ccan/array_size/array_size.h>
+#include <ccan/talloc/talloc.h>
+
+static struct {
+	size_t budget;
+	struct {
+		/* NULL if the slot is free */
+		const char *name;
+		int priority;
+		mem_usage_fn usage;
+		mem_evict_fn evict;
+		void *user;
+	} users[MEM_MAX_USERS];
+	/* number of times mem_enforce had to evict */
+	size_t evictions;
+} g;
+
+void mem_init() {
+	g.evictions = 0;
+	mem_set_budget(0);
+}
+
+void mem_free() {
+	mem_set_budget(0);
+}
+
+int mem_register(const char *name, int priority, mem_usage_fn usage, 
+		mem_evict_fn evict, void *user) {
+	size_t i;
+
+	err_assert(name != NULL);
+	for(i = 0; i < ARRAY_SIZE(g.users); i++) {
+		if(g.users[i].name == NULL) {
+			g.users[i].name = name;
+			g.users[i].priority = priority;
+			g.users[i].usage = usage;
+			g.users[i].evict = evict;
+			g.users[i].user = user;
+			return (int) i;
+		}
+	}
+
+	err_warn(0, "too many memory users to register %s", name);
+	return -1;
+}
+
+void mem_unregister(int id) {
+	if(id < 0)
+		return;
+
+	err_assert(id < (int) ARRAY_SIZE(g.users));
+	g.users[id].name = NULL;
+}
+
+void mem_set_budget(size_t bytes) {
+	g.budget = bytes;
+	sqlite3_soft_heap_limit64( (sqlite3_int64) (bytes/100*MEM_SQLITE_SHARE) );
+}
+
+size_t mem_budget() {
+	return g.budget;
+}
+
+size_t mem_usage() {
+	size_t i, total;
+
+	for(total = 0, i = 0; i < ARRAY_SIZE(g.users); i++)
+		if(g.users[i].name != NULL)
+			total += (*g.users[i].usage)(g.users[i].user);
+
+	return total;
+}
+
+size_t mem_enforce() {
+	size_t i, usage, before, after;
+	int prio, next;
+
+	if(g.budget == 0 || (usage = mem_usage()) <= g.budget)
+		return 0;
+
+	g.evictions++;
+	before = usage;
+	/* visit each priority in ascending order */
+	for(prio = -1; usage > g.budget; prio = next) {
+		next = -1;
+		for(i = 0; i < ARRAY_SIZE(g.users); i++) {
+			if(g.users[i].name == NULL || g.users[i].evict == NULL
+					|| g.users[i].priority <= prio)
+				continue;
+			if(next < 0 || g.users[i].priority < next)
+				next = g.users[i].priority;
+		}
+		if(next < 0)
+			break;
+
+		for(i = 0; i < ARRAY_SIZE(g.users) && usage > g.budget; i++) {
+			if(g.users[i].name == NULL || g.users[i].evict == NULL
+					|| g.users[i].priority != next)
+				continue;
+			(*g.users[i].evict)(g.users[i].user, usage - g.budget);
+			usage = mem_usage();
+		}
+	}
+
+	after = usage;
+	if(after > g.budget)
+		aug_log("memory usage of %zu bytes is still over the budget of %zu "
+			"bytes after evicting every cache\n", after, g.budget);
+
+	return (after < before)? before - after : 0;
+}
+
+size_t mem_talloc_usage(void *ctx) {
+	return (ctx != NULL)? talloc_total_size(ctx) : 0;
+}
+
+char **mem_report(const void *ctx, size_t *n) {
+	char **lines;
+	size_t i, total, usage;
+
+	lines = talloc_array(ctx, char *, MEM_MAX_USERS + 1);
+	*n = 0;
+	total = mem_usage();
+	if(g.budget > 0)
+		lines[(*n)++] = talloc_asprintf(lines, "%zukB of %zukB budget, "
+			"evicted %zu times", total/1024, g.budget/1024, g.evictions);
+	else
+		lines[(*n)++] = talloc_asprintf(lines, "%zukB, no budget", total/1024);
+
+	for(i = 0; i < ARRAY_SIZE(g.users); i++) {
+		if(g.users[i].name == NULL)
+			continue;
+		usage = (*g.users[i].usage)(g.users[i].user);
+		lines[(*n)++] = talloc_asprintf(lines, "  %-8s %zukB", 
+			g.users[i].name, usage/1024);
+	}
+
+	return lines;
+}
@@ -0,0 +1,88 @@
+/* 
+ * Copyright 2013 anthony cantor
+ * This file is part of aug-db.
+ *
+ * aug-db is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * aug-db is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with aug-db.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef AUG_DB_MEM_H
+#define AUG_DB_MEM_H
+
+#include <stddef.h>
+
+/* a memory accountant for the whole process. caches and other
+ * big users of memory register a function which reports how many
+ * bytes they are using and, if they can give memory back, a
+ * function which frees some of it. when the total is over the
+ * budget, mem_enforce evicts caches from the lowest priority up
+ * until it is under the budget again.
+ *
+ * sqlite's own heap is registered by db_init, which gives back the
+ * page cache of the db when it is evicted, and sqlite's soft heap 
+ * limit is set to a share of the budget so that it gives back
+ * page cache on its own.
+ *
+ * registering and enforcing is not locked, so these are only to
+ * be called by the ui thread or before it starts.
+ */
+
+/* returns the bytes in use */
+typedef size_t (*mem_usage_fn)(void *user);
+/* frees memory, at least @want bytes if it can */
+typedef void (*mem_evict_fn)(void *user, size_t want);
+
+#define MEM_MAX_USERS 8
+/* the default budget in kilobytes */
+#define MEM_DEFAULT_BUDGET_KB 32768
+/* the share of the budget sqlite can use before it starts
+ * giving back its page cache, in percent */
+#define MEM_SQLITE_SHARE 50
+
+/* priorities of the registered users. lower ones are evicted first */
+#define MEM_PRIO_LAYOUT 10
+#define MEM_PRIO_SQLITE 20
+/* the rows the ui shows first, see db_recent_warm */
+#define MEM_PRIO_RECENT 30
+/* the postings of the tags, which take a read of every tag of every
+ * blob to build again */
+#define MEM_PRIO_POSTINGS 40
+/* users which cant be evicted are only counted */
+#define MEM_PRIO_NONE 100
+
+void mem_init();
+void mem_free();
+
+/* @name must be a static string. @evict may be NULL if the memory
+ * cant be given back. returns an id for mem_unregister or -1 if
+ * there are already MEM_MAX_USERS users. */
+int mem_register(const char *name, int priority, mem_usage_fn usage, 
+		mem_evict_fn evict, void *user);
+void mem_unregister(int id);
+
+/* a budget of 0 is unlimited */
+void mem_set_budget(size_t bytes);
+size_t mem_budget();
+/* the total of every registered user */
+size_t mem_usage();
+/* evicts until mem_usage is under the budget. returns the number 
+ * of bytes that were freed */
+size_t mem_enforce();
+
+/* a usage function for a talloc context */
+size_t mem_talloc_usage(void *ctx);
+
+/* formats the usage of each user into an array of *n talloc'd
+ * lines, which is a child of @ctx */
+char **mem_report(const void *ctx, size_t *n);
+
+#endif /* AUG_DB_MEM_H */
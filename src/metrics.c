@@ -0,0 +1,251 @@
+/* 
+ * Copyright 2013 anthony cantor
+ * This file is part of aug-db.
+ *
+ * aug-db is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * aug-db is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with aug-db.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "metrics.h"
+
+#include "err.h"
+#include "ui.h"
+#include "db.h"
+#include "db_prof.h"
+#include "stats.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sqlite3.h>
+#include <ccan/talloc/talloc.h>
+
+static struct {
+	/* talloc'd path of this process's metrics file or NULL */
+	char *path;
+	int timer;
+	/* the label on every sample, see write_metrics */
+	char pid[32];
+} g = {
+	.path = NULL,
+	.timer = -1
+};
+
+/* counting the blobs and reading the histograms would hold up the
+ * keystrokes waiting behind the timer, so the file isnt written 
+ * while the window is open. metrics_write warns about failures. */
+static void on_timer(void *user) {
+	(void)(user);
+
+	if(ui_interacting() != 0)
+		return;
+	metrics_write(g.path);
+}
+
+/* @path with the pid before the extension of its file name, so
+ * that every process writes a file of its own */
+static char *pid_path(const char *path) {
+	const char *base, *ext;
+
+	base = ((base = strrchr(path, '/')) == NULL)? path : base+1;
+	if( (ext = strrchr(base, '.')) == NULL || ext == base)
+		return talloc_asprintf(NULL, "%s.%d", path, (int) getpid());
+
+	return talloc_asprintf(NULL, "%.*s.%d%s", (int) (ext - path), path, 
+		(int) getpid(), ext);
+}
+
+int metrics_init(const char *path, unsigned int ms) {
+	g.path = pid_path(path);
+	if( (g.timer = ui_timer_start(ms, 1, on_timer, NULL)) < 0) {
+		talloc_free(g.path);
+		g.path = NULL;
+		return -1;
+	}
+
+	return 0;
+}
+
+void metrics_free() {
+	if(g.path == NULL)
+		return;
+
+	g.timer = -1;
+	if(remove(g.path) != 0 && errno != ENOENT)
+		err_warn(errno, "failed to remove metrics file %s", g.path);
+	talloc_free(g.path);
+	g.path = NULL;
+}
+
+#define METRICS_FPRINTF(_fp, ...) \
+	do { \
+		if(fprintf(_fp, __VA_ARGS__) < 0) \
+			return -1; \
+	} while(0)
+
+static int write_header(FILE *fp, const char *name, const char *type, const char *help) {
+	METRICS_FPRINTF(fp, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+	return 0;
+}
+
+static int write_gauge(FILE *fp, const char *name, const char *help, double val) {
+	if(write_header(fp, name, "gauge", help) != 0)
+		return -1;
+	METRICS_FPRINTF(fp, "%s{%s} %.17g\n", name, g.pid, val);
+	return 0;
+}
+
+/* every histogram has the same buckets so that they can be summed
+ * across hosts. they are every other log2 bucket of struct hist 
+ * from about a microsecond up to about a minute. */
+#define METRICS_FIRST_BUCKET 9
+#define METRICS_LAST_BUCKET 35
+
+/* writes the samples of a histogram of nanoseconds in seconds,
+ * each with the pid and the comma separated @labels */
+static int write_hist(FILE *fp, const char *name, const char *labels, 
+		const struct hist *h) {
+	uint64_t total;
+	int i;
+
+	for(total = 0, i = 0; i < HIST_BUCKETS; i++) {
+		total += h->buckets[i];
+		if(i < METRICS_FIRST_BUCKET || i > METRICS_LAST_BUCKET
+				|| (i - METRICS_FIRST_BUCKET) % 2 != 0)
+			continue;
+		/* bucket i counts values less than 2^(i+1) */
+		METRICS_FPRINTF(fp, "%s_bucket{%s,%s,le=\"%.9g\"} %llu\n", name, g.pid, labels, 
+			(2ULL << i)/1e9, (unsigned long long) total);
+	}
+	METRICS_FPRINTF(fp, "%s_bucket{%s,%s,le=\"+Inf\"} %llu\n", name, g.pid, labels, 
+		(unsigned long long) total);
+	METRICS_FPRINTF(fp, "%s_sum{%s,%s} %.9f\n", name, g.pid, labels, h->total/1e9);
+	METRICS_FPRINTF(fp, "%s_count{%s,%s} %llu\n", name, g.pid, labels, 
+		(unsigned long long) total);
+	return 0;
+}
+
+static int write_metrics(FILE *fp) {
+	struct hist h;
+	char name[32], labels[64];
+	int i, blobs, trashed, tags;
+	size_t val, cap;
+	long rss;
+
+	/* the files of all the processes on a host are collected
+	 * together, so their samples need a label to tell them apart */
+	snprintf(g.pid, sizeof(g.pid), "pid=\"%d\"", (int) getpid());
+	if(write_header(fp, "aug_db_query_duration_seconds", "histogram",
+			"Time spent in sqlite by each kind of statement.") != 0)
+		return -1;
+	for(i = 0; i < DB_PROF_SHAPES; i++) {
+		db_prof_hist(i, &h);
+		if(h.count < 1)
+			continue;
+		db_prof_shape_name(i, name, sizeof(name));
+		snprintf(labels, sizeof(labels), "shape=\"%s\"", name);
+		if(write_hist(fp, "aug_db_query_duration_seconds", labels, &h) != 0)
+			return -1;
+	}
+
+	if(write_header(fp, "aug_db_ui_duration_seconds", "histogram",
+			"Time taken to fetch results and to render the ui.") != 0)
+		return -1;
+	stats_latency_hist(STATS_LAT_QUERY, &h);
+	if(write_hist(fp, "aug_db_ui_duration_seconds", "stage=\"query\"", &h) != 0)
+		return -1;
+	stats_latency_hist(STATS_LAT_RENDER, &h);
+	if(write_hist(fp, "aug_db_ui_duration_seconds", "stage=\"render\"", &h) != 0)
+		return -1;
+
+	db_counts(&blobs, &trashed, &tags);
+	if(write_gauge(fp, "aug_db_blobs", "Number of blobs in the database.", blobs) != 0
+			|| write_gauge(fp, "aug_db_trashed_blobs", 
+				"Number of blobs in the trash.", trashed) != 0
+			|| write_gauge(fp, "aug_db_tags", "Number of tags in the database.", tags) != 0
+			|| write_gauge(fp, "aug_db_database_bytes", 
+				"Size of the database file.", db_size_bytes()) != 0)
+		return -1;
+
+	if(write_header(fp, "aug_db_sqlite_busy_retries_total", "counter",
+			"Statements retried because another process had the database locked.") != 0)
+		return -1;
+	METRICS_FPRINTF(fp, "aug_db_sqlite_busy_retries_total{%s} %llu\n", g.pid,
+		(unsigned long long) db_busy_retries());
+
+	if(write_header(fp, "aug_db_queue_high_water", "gauge",
+			"Most entries ever waiting in a ui queue.") != 0)
+		return -1;
+	val = stats_high_water_value(STATS_HW_EVENTS, &cap);
+	METRICS_FPRINTF(fp, "aug_db_queue_high_water{%s,queue=\"events\"} %zu\n", g.pid, val);
+	val = stats_high_water_value(STATS_HW_INPUT, &cap);
+	METRICS_FPRINTF(fp, "aug_db_queue_high_water{%s,queue=\"input\"} %zu\n", g.pid, val);
+
+	if(write_gauge(fp, "aug_db_sqlite_memory_bytes", 
+				"Memory allocated by sqlite.", sqlite3_memory_used()) != 0
+			|| write_gauge(fp, "aug_db_sqlite_memory_high_water_bytes", 
+				"Most memory ever allocated by sqlite.", sqlite3_memory_highwater(0)) != 0)
+		return -1;
+	if( (rss = stats_rss_kb()) >= 0
+			&& write_gauge(fp, "aug_db_resident_bytes", 
+				"Resident set size of the process.", rss*1024.0) != 0)
+		return -1;
+
+	return 0;
+}
+
+int metrics_write(const char *path) {
+	FILE *fp;
+	char *tmp;
+	int status, fd;
+
+	status = -1;
+	/* a name of its own, in case another process writes to the
+	 * same path */
+	tmp = talloc_asprintf(NULL, "%s.XXXXXX", path);
+	if( (fd = mkstemp(tmp)) < 0) {
+		err_warn(errno, "failed to create a temporary file for %s", path);
+		goto done;
+	}
+	/* mkstemp makes it readable only by us */
+	if(fchmod(fd, 0644) != 0 || (fp = fdopen(fd, "w")) == NULL) {
+		err_warn(errno, "failed to open metrics file %s", tmp);
+		close(fd);
+		goto unlink;
+	}
+
+	if(write_metrics(fp) != 0) {
+		err_warn(errno, "failed to write metrics file %s", tmp);
+		fclose(fp);
+		goto unlink;
+	}
+	if(fclose(fp) != 0) {
+		err_warn(errno, "failed to close metrics file %s", tmp);
+		goto unlink;
+	}
+
+	if(rename(tmp, path) != 0) {
+		err_warn(errno, "failed to rename metrics file %s to %s", tmp, path);
+		goto unlink;
+	}
+
+	status = 0;
+	goto done;
+unlink:
+	remove(tmp);
+done:
+	talloc_free(tmp);
+	return status;
+}
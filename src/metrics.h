@@ -0,0 +1,43 @@
+/* 
+ * Copyright 2013 anthony cantor
+ * This file is part of aug-db.
+ *
+ * aug-db is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * aug-db is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with aug-db.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef AUG_DB_METRICS_H
+#define AUG_DB_METRICS_H
+
+/* a metrics file in the prometheus text exposition format, for
+ * collecting the health of aug-db from many hosts with something
+ * like the node exporter textfile collector. the file is written
+ * to a temporary file and renamed over the old one, so a reader
+ * never sees a partial file. every aug process on a host writes
+ * a file of its own, with its pid in the name and as a label. */
+
+/* the default number of milliseconds between writes */
+#define METRICS_DEFAULT_MS 15000
+
+/* writes the metrics file at @path, with the pid put before the 
+ * extension (aug-db.prom becomes aug-db.<pid>.prom), every @ms 
+ * milliseconds from a ui timer while the ui window is closed. must
+ * be called after ui_init. returns non-zero on error */
+int metrics_init(const char *path, unsigned int ms);
+/* removes the file, as nothing will update it anymore. must be 
+ * called after ui_free, which stops the timer. */
+void metrics_free();
+
+/* writes the metrics to @path now. returns non-zero on error */
+int metrics_write(const char *path);
+
+#endif /* AUG_DB_METRICS_H */
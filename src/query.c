@@ -20,6 +20,7 @@
 #include "api_calls.h"
 #include "err.h"
 #include "encoding.h"
+#include "trace.h"
 
 #include <ccan/array_size/array_size.h>
 
@@ -91,6 +92,36 @@ int query_add_ch(struct query *q, uint32_t ch) {
 	return 0;
 }
 
+int query_complete_tag(struct query *q) {
+	size_t start, obl, len, room;
+	uint8_t *rest;
+
+	for(start = q->n; start > 0 && q->value[start-1] != ' '; start--)
+		;
+	if(start == q->n || q->value[start] != '#')
+		return 0;
+
+	/* utf8 and text are only used while a query is prepared, and 
+	 * utf8 can hold the whole value */
+	obl = encoding_wchar_to_utf8(q->utf8, sizeof(q->utf8)-1, 
+			q->value + start + 1, q->n - start - 1);
+	q->utf8[sizeof(q->utf8)-1-obl] = '\0';
+	if(db_tag_complete((const char *) q->utf8, (char *) q->text, sizeof(q->text)) < 1)
+		return 0;
+
+	/* a name with a space in it cant be typed as one word */
+	rest = q->text + strlen((const char *) q->utf8);
+	for(len = 0; rest[len] != '\0' && rest[len] != ' '; len++)
+		;
+	room = ARRAY_SIZE(q->value) - q->n;
+	if(len < 1 || len > room)
+		return 0;
+
+	q->n += room - encoding_utf8_to_wchar(q->value + q->n, room, rest, len);
+	q->offset = 0;
+	return 1;
+}
+
 /*int query_first_result(struct query *q, uint8_t **data, 
 		size_t *n, int *raw, int *id) {
 	
@@ -99,21 +130,68 @@ int query_add_ch(struct query *q, uint32_t ch) {
 	}
 }*/
 
+/* moves each word of q->utf8 that starts with '#' and names a tag
+ * into q->tags (without the '#') and the rest of the text into 
+ * q->text, so that "#include" is searched for like any other text 
+ * unless there is a tag by that name. the spaces before a tag are 
+ * dropped along with it, and so are the ones after it if nothing 
+ * comes before it. */
+static void query_parse(struct query *q) {
+	uint8_t *p, *word, *out, end;
+	size_t ws, lost;
+
+	q->ntags = 0;
+	out = q->text;
+	p = q->utf8;
+	/* the space after a tag, which its nul took the place of */
+	lost = 0;
+	while(*p != '\0') {
+		for(ws = 0; p[ws] == ' '; ws++)
+			;
+		word = p + ws;
+		for(p = word; *p != '\0' && *p != ' '; p++)
+			;
+
+		if(word[0] == '#' && p - word > 1 && q->ntags < ARRAY_SIZE(q->tags)) {
+			end = *p;
+			*p = '\0';
+			if(db_tag_word((const char *) word + 1) != 0) {
+				q->tags[q->ntags++] = word + 1;
+				lost = (end != '\0');
+				if(end != '\0')
+					p++;
+				continue;
+			}
+			*p = end;
+		}
+
+		ws += lost;
+		lost = 0;
+		if(out > q->text || q->ntags == 0) {
+			memset(out, ' ', ws);
+			out += ws;
+		}
+		memcpy(out, word, p - word);
+		out += p - word;
+	}
+	*out = '\0';
+}
+
 static void query_prepare_from_value(struct query *q) {
 	size_t obl;
-	size_t vlen = q->n*8+1;
-	/* utf-8 should be able to represent any code point in less than 8 bytes */
-	uint8_t value[vlen]; 
 	const uint8_t *queries[1];
 
-	obl = encoding_wchar_to_utf8(value, vlen-1, q->value, q->n);
-	value[vlen-1-obl] = '\0';
-	queries[0] = value;
-	db_query_prepare(&q->result, q->offset, queries, 1, NULL, 0);
+	obl = encoding_wchar_to_utf8(q->utf8, sizeof(q->utf8)-1, q->value, q->n);
+	q->utf8[sizeof(q->utf8)-1-obl] = '\0';
+	query_parse(q);
+	queries[0] = q->text;
+	db_query_prepare(&q->result, q->offset, queries, (q->text[0] != '\0')? 1 : 0, 
+			q->tags, q->ntags);
 }
 
 void query_prepare(struct query *q) {
 
+	TRACE_SPAN_BEGIN(TRACE_SPAN_QUERY_PREPARE, q->n);
 	if(q->n > 0) {
 		query_prepare_from_value(q);
 	}
@@ -121,6 +199,7 @@ void query_prepare(struct query *q) {
 		db_query_prepare(&q->result, q->offset, NULL, 0, NULL, 0);
 
 	q->page_size = 0;
+	TRACE_SPAN_END(TRACE_SPAN_QUERY_PREPARE);
 }
 
 int query_next(struct query *q, uint8_t **tal_data, size_t *n, 
@@ -143,19 +222,21 @@ int query_finalize(struct query *q) {
 }
 
 int query_foreach_result(struct query *q, 
-		int (*fn)(uint8_t *data, size_t n, int raw, int id, int i, void *user),
+		int (*fn)(const uint8_t *data, size_t n, int raw, int id, int i, void *user),
 		void *user) {
-	uint8_t *data;
+	const uint8_t *data;
 	size_t n;
-	int raw, id, i, status;
+	int raw, id, i;
 
 	query_prepare(q);
 
+	/* the rows are passed straight from sqlite rather than 
+	 * copied like query_next does */
 	i = 0;
-	while(query_next(q, &data, &n, &raw, &id) == 0) {
-		status = (*fn)(data, n, raw, id, i++, user);
-		talloc_free(data);
-		if(status != 0)
+	while(db_query_step(&q->result) == 0) {
+		db_query_value_ref(&q->result, &data, &n, &raw, &id);
+		q->page_size += 1;
+		if((*fn)(data, n, raw, id, i++, user) != 0)
 			break;
 	}
 	query_finalize(q);
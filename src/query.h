@@ -20,10 +20,22 @@
 
 #include "db.h"
 
+/* a #tag word takes at least two characters and a space, so this
+ * is room for as many as a query can have */
+#define QUERY_MAX_TAGS (1024/3 + 1)
+
 struct query {
 	uint32_t value[1024];
 	/* the size of the data in value */
 	size_t n;
+	/* value encoded for the db by query_prepare. utf-8 should be
+	 * able to represent any code point in less than 8 bytes */
+	uint8_t utf8[1024*8+1];
+	/* utf8 without the #tag words, whose names are left in utf8,
+	 * see query_parse */
+	uint8_t text[1024*8+1];
+	const uint8_t *tags[QUERY_MAX_TAGS];
+	size_t ntags;
 	/* result db_query object from db.c */
 	struct db_query	result;
 	/* current offset into the sql query */
@@ -48,6 +60,10 @@ int query_offset_incr(struct query *q);
 int query_offset_reset(struct query *q);
 /* returns non-zero if char was added */
 int query_add_ch(struct query *q, uint32_t ch);
+/* if the query ends in a #tag word, extends it as far as the names
+ * of the tags starting with it agree. returns non-zero if anything
+ * was added. */
+int query_complete_tag(struct query *q);
 
 
 /* only public for use in foreach macro */
@@ -57,9 +73,10 @@ int query_next(struct query *q, uint8_t **tal_data, size_t *n,
 		int *raw, int *id);
 int query_finalize(struct query *q);
 
-/* returns the number of times @fn was called */
+/* returns the number of times @fn was called. @data is only valid
+ * during the call, so @fn has to copy anything it wants to keep */
 int query_foreach_result(struct query *q, 
-		int (*fn)(uint8_t *data, size_t n, int raw, int id, int i, void *user),
+		int (*fn)(const uint8_t *data, size_t n, int raw, int id, int i, void *user),
 		void *user);
 
 /* make sure to call talloc_free(*tal_data) when done.
@@ -0,0 +1,150 @@
+/* 
+ * Copyright 2013 anthony cantor
+ * This file is part of aug-db.
+ *
+ * aug-db is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * aug-db is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with aug-db.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "stats.h"
+
+#include "db.h"
+#include "layout.h"
+#include "trace.h"
+#include "lock_prof.h"
+#include "mem.h"
+
+#include <stdio.h>
+#include <unistd.h>
+#include <sqlite3.h>
+#include <ccan/array_size/array_size.h>
+#include <ccan/talloc/talloc.h>
+
+static struct {
+	struct hist latency[STATS_LAT_COUNT];
+	struct {
+		size_t val;
+		size_t cap;
+	} high_water[STATS_HW_COUNT];
+} g;
+
+void stats_latency_add(stats_latency which, uint64_t ns) {
+	hist_add(&g.latency[which], ns);
+}
+
+void stats_latency_hist(stats_latency which, struct hist *h) {
+	hist_copy(h, &g.latency[which]);
+}
+
+void stats_high_water_update(stats_high_water which, size_t val, size_t cap) {
+	size_t cur;
+
+	g.high_water[which].cap = cap;
+	cur = __atomic_load_n(&g.high_water[which].val, __ATOMIC_RELAXED);
+	while(val > cur && !__atomic_compare_exchange_n(&g.high_water[which].val, 
+			&cur, val, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		; /* raised by someone else, try again */
+}
+
+size_t stats_high_water_value(stats_high_water which, size_t *cap) {
+	*cap = g.high_water[which].cap;
+	return __atomic_load_n(&g.high_water[which].val, __ATOMIC_RELAXED);
+}
+
+long stats_rss_kb() {
+	FILE *f;
+	long size, resident, page;
+	int status;
+
+	if( (f = fopen("/proc/self/statm", "r")) == NULL)
+		return -1;
+	status = fscanf(f, "%ld %ld", &size, &resident);
+	fclose(f);
+	if(status != 2 || (page = sysconf(_SC_PAGESIZE)) < 1)
+		return -1;
+
+	return resident * (page/1024);
+}
+
+static char *fmt_ns(const void *ctx, uint64_t ns) {
+	if(ns < 1000000)
+		return talloc_asprintf(ctx, "%.1fus", ns/1000.0);
+
+	return talloc_asprintf(ctx, "%.2fms", ns/1000000.0);
+}
+
+static char *latency_line(const void *ctx, const char *name, stats_latency which) {
+	struct hist h;
+
+	stats_latency_hist(which, &h);
+	return talloc_asprintf(ctx, "%-8s last %s, p99 %s, max %s (n=%llu)", name,
+		fmt_ns(ctx, h.last), fmt_ns(ctx, hist_pct(&h, 99)), fmt_ns(ctx, h.max), 
+		(unsigned long long) h.count);
+}
+
+static char *high_water_line(const void *ctx, const char *name, stats_high_water which) {
+	size_t val, cap;
+
+	val = stats_high_water_value(which, &cap);
+	return talloc_asprintf(ctx, "%-8s high-water %zu of %zu", name, val, cap);
+}
+
+char **stats_report(const void *ctx, size_t *n) {
+	char **lines, **locks, **mems;
+	size_t i, k, nlocks, nmems, hits, misses;
+	int blobs, trashed, tags;
+	long rss;
+
+	lines = talloc_array(ctx, char *, 16);
+	i = 0;
+
+	lines[i++] = talloc_strdup(lines, "aug-db statistics (any key to return)");
+	db_counts(&blobs, &trashed, &tags);
+	lines[i++] = talloc_asprintf(lines, "corpus   %d blobs (%d in trash), %d tags", 
+		blobs, trashed, tags);
+	lines[i++] = latency_line(lines, "query", STATS_LAT_QUERY);
+	lines[i++] = latency_line(lines, "render", STATS_LAT_RENDER);
+
+	layout_stats(&hits, &misses);
+	lines[i++] = talloc_asprintf(lines, "layout   %zu hits, %zu misses (%.1f%% hit)",
+		hits, misses, (hits+misses > 0)? 100.0*hits/(hits+misses) : 0.0);
+	db_recent_stats(&hits, &misses);
+	lines[i++] = talloc_asprintf(lines, "recent   %zu hits, %zu misses (%.1f%% hit)",
+		hits, misses, (hits+misses > 0)? 100.0*hits/(hits+misses) : 0.0);
+
+	lines[i++] = high_water_line(lines, "events", STATS_HW_EVENTS);
+	lines[i++] = high_water_line(lines, "input", STATS_HW_INPUT);
+
+	lines[i++] = talloc_asprintf(lines, "sqlite   %lldkB in use, %lldkB high-water",
+		(long long) sqlite3_memory_used()/1024, 
+		(long long) sqlite3_memory_highwater(0)/1024);
+	if( (rss = stats_rss_kb()) >= 0)
+		lines[i++] = talloc_asprintf(lines, "rss      %ldkB", rss);
+
+	mems = mem_report(lines, &nmems);
+	locks = lock_prof_report(lines, &nlocks);
+	lines = talloc_realloc(ctx, lines, char *, i + nmems + nlocks + 1);
+	for(k = 0; k < nmems; k++)
+		lines[i++] = talloc_asprintf(lines, "%s %s", (k == 0)? "memory  " : "        ", 
+			mems[k]);
+	for(k = 0; k < nlocks; k++)
+		lines[i++] = talloc_asprintf(lines, "lock     %s", locks[k]);
+	talloc_free(mems);
+	talloc_free(locks);
+
+	if(trace_spans_path() != NULL)
+		lines[i++] = talloc_asprintf(lines, "spans    press d to write %s", 
+			trace_spans_path());
+
+	*n = i;
+	return lines;
+}
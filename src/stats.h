@@ -0,0 +1,64 @@
+/* 
+ * Copyright 2013 anthony cantor
+ * This file is part of aug-db.
+ *
+ * aug-db is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * aug-db is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with aug-db.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef AUG_DB_STATS_H
+#define AUG_DB_STATS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "hist.h"
+
+/* counters for the statistics screen. the hot paths only add to
+ * histograms and bump high-water marks, which are lock free; the 
+ * expensive numbers (counts from the db, memory usage) are only
+ * gathered by stats_report while the screen is open. */
+
+typedef enum {
+	/* fetching a frame of results from the db */
+	STATS_LAT_QUERY = 0,
+	/* a whole call to window_render */
+	STATS_LAT_RENDER,
+	STATS_LAT_COUNT
+} stats_latency;
+
+typedef enum {
+	/* events taken from the event loop at once */
+	STATS_HW_EVENTS = 0,
+	/* characters waiting in the ui input ring */
+	STATS_HW_INPUT,
+	STATS_HW_COUNT
+} stats_high_water;
+
+void stats_latency_add(stats_latency which, uint64_t ns);
+/* copies the histogram of @which into @h */
+void stats_latency_hist(stats_latency which, struct hist *h);
+
+/* raises the high-water mark of @which to @val if it is higher. 
+ * @cap is the capacity @val is measured against. */
+void stats_high_water_update(stats_high_water which, size_t val, size_t cap);
+size_t stats_high_water_value(stats_high_water which, size_t *cap);
+
+/* the resident set size of this process in kilobytes, or -1
+ * if it cant be found out */
+long stats_rss_kb();
+
+/* formats every statistic into an array of *n talloc'd lines, 
+ * which is a child of @ctx. */
+char **stats_report(const void *ctx, size_t *n);
+
+#endif /* AUG_DB_STATS_H */
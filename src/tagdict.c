@@ -0,0 +1,188 @@
+/* 
+ * Copyright 2013 anthony cantor
+ * This file is part of aug-db.
+ *
+ * aug-db is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * aug-db is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with aug-db.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "tagdict.h"
+
+#include "err.h"
+
+#include <string.h>
+#include <ccan/talloc/talloc.h>
+
+#define TAGDICT_MIN_CAP 64
+
+void tagdict_init(struct tagdict *d) {
+	d->ctx = talloc_new(NULL);
+	d->entries = NULL;
+	d->n = 0;
+	d->cap = 0;
+	d->blobs = 0;
+}
+
+void tagdict_free(struct tagdict *d) {
+	talloc_free(d->ctx);
+	d->ctx = NULL;
+	d->entries = NULL;
+	d->n = d->cap = 0;
+	d->blobs = 0;
+}
+
+void tagdict_clear(struct tagdict *d) {
+	tagdict_free(d);
+	tagdict_init(d);
+}
+
+/* the index of the first entry not less than @name */
+static size_t lower_bound(const struct tagdict *d, const char *name) {
+	size_t lo, hi, mid;
+
+	lo = 0;
+	hi = d->n;
+	while(lo < hi) {
+		mid = lo + (hi - lo)/2;
+		if(strcmp(d->entries[mid].name, name) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+void tagdict_add(struct tagdict *d, const char *name, int id) {
+	size_t i;
+
+	/* names from the db come in order, so check the end first */
+	if(d->n > 0 && strcmp(d->entries[d->n-1].name, name) >= 0)
+		i = lower_bound(d, name);
+	else
+		i = d->n;
+
+	if(i < d->n && strcmp(d->entries[i].name, name) == 0) {
+		if(id != 0)
+			d->entries[i].id = id;
+		return;
+	}
+
+	if(d->n == d->cap) {
+		d->cap = (d->cap < TAGDICT_MIN_CAP)? TAGDICT_MIN_CAP : d->cap*2;
+		d->entries = talloc_realloc(d->ctx, d->entries, struct tagdict_entry, d->cap);
+		if(d->entries == NULL)
+			err_panic(0, "failed to grow tag dictionary to %zu", d->cap);
+	}
+
+	memmove(&d->entries[i+1], &d->entries[i], (d->n - i)*sizeof(d->entries[0]));
+	d->entries[i].name = talloc_strdup(d->ctx, name);
+	d->entries[i].id = id;
+	d->entries[i].blobs = 0;
+	d->entries[i].postings = NULL;
+	d->n++;
+}
+
+void tagdict_count(struct tagdict *d, const char *name, long delta) {
+	size_t i;
+
+	i = lower_bound(d, name);
+	if(i >= d->n || strcmp(d->entries[i].name, name) != 0)
+		return;
+
+	if(delta < 0 && (size_t) -delta > d->entries[i].blobs)
+		delta = -(long) d->entries[i].blobs;
+	d->entries[i].blobs += delta;
+	d->blobs += delta;
+}
+
+size_t tagdict_blobs(const struct tagdict *d, size_t first, size_t n) {
+	size_t i, total;
+
+	for(total = 0, i = first; i < first + n && i < d->n; i++)
+		total += d->entries[i].blobs;
+
+	return total;
+}
+
+const struct tagdict_entry *tagdict_find(const struct tagdict *d, const char *name) {
+	size_t i;
+
+	i = lower_bound(d, name);
+	if(i < d->n && strcmp(d->entries[i].name, name) == 0)
+		return &d->entries[i];
+
+	return NULL;
+}
+
+size_t tagdict_prefix(const struct tagdict *d, const char *prefix, size_t *first) {
+	size_t lo, hi, mid, len;
+
+	/* cutting the sorted names to the length of the prefix keeps
+	 * them sorted, so the end of the run is found the same way */
+	len = strlen(prefix);
+	*first = lower_bound(d, prefix);
+	lo = *first;
+	hi = d->n;
+	while(lo < hi) {
+		mid = lo + (hi - lo)/2;
+		if(strncmp(d->entries[mid].name, prefix, len) <= 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo - *first;
+}
+
+size_t tagdict_resolve(const struct tagdict *d, const char *name, size_t *first) {
+	const struct tagdict_entry *e;
+
+	if( (e = tagdict_find(d, name)) != NULL) {
+		*first = e - d->entries;
+		return 1;
+	}
+
+	return tagdict_prefix(d, name, first);
+}
+
+size_t tagdict_complete(const struct tagdict *d, const char *prefix, 
+		char *buf, size_t size) {
+	const char *a, *b;
+	size_t n, first, len;
+
+	if(size < 1)
+		return 0;
+
+	if( (n = tagdict_prefix(d, prefix, &first)) < 1) {
+		a = prefix;
+		len = strlen(prefix);
+	}
+	else {
+		/* the names are sorted, so what the first and last 
+		 * share every one between them shares too */
+		a = d->entries[first].name;
+		b = d->entries[first + n - 1].name;
+		for(len = 0; a[len] != '\0' && a[len] == b[len]; len++)
+			;
+	}
+
+	if(len > size - 1)
+		len = size - 1;
+	memcpy(buf, a, len);
+	buf[len] = '\0';
+	return n;
+}
+
+size_t tagdict_usage(const struct tagdict *d) {
+	return (d->ctx != NULL)? talloc_total_size(d->ctx) : 0;
+}
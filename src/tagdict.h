@@ -0,0 +1,80 @@
+/* 
+ * Copyright 2013 anthony cantor
+ * This file is part of aug-db.
+ *
+ * aug-db is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * aug-db is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with aug-db.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef AUG_DB_TAGDICT_H
+#define AUG_DB_TAGDICT_H
+
+#include <stddef.h>
+
+struct bitmap;
+
+/* the names of the tags in the db, kept sorted the way sqlite 
+ * compares them (by their bytes), so that the tags with a prefix 
+ * are next to each other. each name is stored once. */
+struct tagdict_entry {
+	const char *name;
+	/* the id in the personal db, or 0 for a tag only the shared 
+	 * dbs have */
+	int id;
+	/* the number of blobs in the personal db outside the trash 
+	 * which have the tag, see tagdict_count */
+	size_t blobs;
+	/* the ids of the blobs with the tag, trashed or not, or NULL.
+	 * the dictionary only moves it along with the entry, so it is
+	 * up to whoever sets it to free it. */
+	struct bitmap *postings;
+};
+
+struct tagdict {
+	/* talloc parent of the names and entries */
+	void *ctx;
+	struct tagdict_entry *entries;
+	size_t n;
+	size_t cap;
+	/* the total of the blob counts of the entries */
+	size_t blobs;
+};
+
+void tagdict_init(struct tagdict *d);
+void tagdict_free(struct tagdict *d);
+void tagdict_clear(struct tagdict *d);
+/* adds @name with a blob count of zero, or gives an existing one 
+ * the id @id if it isnt 0. adding in sorted order is fastest. */
+void tagdict_add(struct tagdict *d, const char *name, int id);
+/* adds @delta to the blob count of @name if there is such an entry.
+ * the count doesnt go below zero. */
+void tagdict_count(struct tagdict *d, const char *name, long delta);
+/* the total of the blob counts of d->entries[@first] and the @n
+ * entries after it */
+size_t tagdict_blobs(const struct tagdict *d, size_t first, size_t n);
+/* the entry named @name or NULL */
+const struct tagdict_entry *tagdict_find(const struct tagdict *d, const char *name);
+/* the entries whose names start with @prefix are d->entries[*first]
+ * onwards. returns how many there are. */
+size_t tagdict_prefix(const struct tagdict *d, const char *prefix, size_t *first);
+/* the entry named @name if there is one, otherwise the entries
+ * starting with it, like tagdict_prefix */
+size_t tagdict_resolve(const struct tagdict *d, const char *name, size_t *first);
+/* writes the longest string that every name starting with @prefix
+ * starts with into @buf (at most @size bytes including the nul). 
+ * returns the number of names starting with @prefix. */
+size_t tagdict_complete(const struct tagdict *d, const char *prefix, 
+		char *buf, size_t size);
+/* bytes held, for mem.h */
+size_t tagdict_usage(const struct tagdict *d);
+
+#endif /* AUG_DB_TAGDICT_H */
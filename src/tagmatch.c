@@ -0,0 +1,558 @@
+/* 
+ * Copyright 2013 anthony cantor
+ * This file is part of aug-db.
+ *
+ * aug-db is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * aug-db is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with aug-db.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "tagmatch.h"
+
+#include "err.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <ccan/talloc/talloc.h>
+
+/* the live matches, which tag_match finds by their handles instead
+ * of trusting an address that came through sql. a handle is the 
+ * slot plus one in its lower 32 bits and the generation of the slot
+ * in its upper ones, so the handle of a freed match doesnt find the
+ * next one to take its slot. like the db, they are only used from
+ * one thread. */
+/* the most closed cursors of tag_match kept for the next statements */
+#define TAGMATCH_SPARE_CURSORS 16
+
+struct tagmatch_cursor;
+
+static struct {
+	const struct tagmatch *live[TAGMATCH_MAX_LIVE];
+	uint32_t gen[TAGMATCH_MAX_LIVE];
+	/* each query with tags opens a cursor for each source, so
+	 * they are kept instead of allocated for every keystroke */
+	struct tagmatch_cursor *spare[TAGMATCH_SPARE_CURSORS];
+	size_t nspare;
+} g;
+
+static int64_t slot_take(const struct tagmatch *m) {
+	size_t i;
+
+	for(i = 0; i < TAGMATCH_MAX_LIVE; i++) {
+		if(g.live[i] != NULL)
+			continue;
+		g.live[i] = m;
+		if(++g.gen[i] == 0)
+			g.gen[i] = 1;
+		return ((int64_t) g.gen[i] << 32) | (int64_t) (i + 1);
+	}
+
+	err_panic(0, "more than %d tag matches in use", TAGMATCH_MAX_LIVE);
+	return 0;
+}
+
+static void slot_give(const struct tagmatch *m) {
+	size_t i;
+
+	i = (size_t) (m->handle & 0xffffffff) - 1;
+	if(i < TAGMATCH_MAX_LIVE && g.live[i] == m)
+		g.live[i] = NULL;
+}
+
+/* the live match with @handle or NULL */
+static const struct tagmatch *slot_find(int64_t handle) {
+	uint64_t i;
+
+	i = (uint64_t) (handle & 0xffffffff) - 1;
+	if(i >= TAGMATCH_MAX_LIVE || g.live[i] == NULL
+			|| g.gen[i] != (uint32_t) ((uint64_t) handle >> 32))
+		return NULL;
+
+	return g.live[i];
+}
+
+/* a tag of a term */
+struct factor {
+	const char *name;
+	/* set for a tag with a '!' */
+	int neg;
+	/* the entries it resolves to and their blob counts */
+	size_t first;
+	size_t n;
+	size_t blobs;
+};
+
+/* the tags without a '!' first, the ones on the fewest blobs first */
+static int factor_cmp(const void *a, const void *b) {
+	const struct factor *x, *y;
+
+	x = a;
+	y = b;
+	if(x->neg != y->neg)
+		return x->neg - y->neg;
+
+	return (x->blobs > y->blobs) - (x->blobs < y->blobs);
+}
+
+static void factor_or(struct bitmap *dst, const struct tagdict *d, const struct factor *f) {
+	size_t i;
+
+	for(i = f->first; i < f->first + f->n; i++)
+		if(d->entries[i].postings != NULL)
+			bitmap_or(dst, d->entries[i].postings);
+}
+
+static void factor_and(struct bitmap *dst, const struct tagdict *d, const struct factor *f) {
+	struct bitmap tmp;
+
+	if(f->n == 1 && d->entries[f->first].postings != NULL) {
+		bitmap_and(dst, d->entries[f->first].postings);
+		return;
+	}
+
+	bitmap_init(&tmp);
+	factor_or(&tmp, d, f);
+	bitmap_and(dst, &tmp);
+	bitmap_free(&tmp);
+}
+
+static void factor_andnot(struct bitmap *dst, const struct tagdict *d, const struct factor *f) {
+	size_t i;
+
+	for(i = f->first; i < f->first + f->n; i++)
+		if(d->entries[i].postings != NULL)
+			bitmap_andnot(dst, d->entries[i].postings);
+}
+
+/* puts the blobs of the term @word into @dst, which is empty. returns
+ * 1 if it has a tag without a '!', 0 if it only has tags with one (and
+ * @dst is the blobs they are on) and -1 if it has no tags at all. */
+static int term_eval(struct bitmap *dst, const struct tagdict *d, const char *word) {
+	const struct tagdict_entry *e;
+	struct factor *f;
+	char *buf, *p, *name;
+	size_t i, n, npos;
+
+	if( (e = tagdict_find(d, word)) != NULL) {
+		if(e->postings != NULL)
+			bitmap_or(dst, e->postings);
+		return 1;
+	}
+
+	buf = talloc_strdup(NULL, word);
+	for(n = 1, p = buf; *p != '\0'; p++)
+		n += (*p == '&');
+	if( (f = talloc_array(buf, struct factor, n)) == NULL)
+		err_panic(0, "failed to allocate the tags of a term");
+
+	for(n = 0, p = buf; p != NULL; ) {
+		name = p;
+		if( (p = strchr(p, '&')) != NULL)
+			*p++ = '\0';
+		f[n].neg = (name[0] == '!');
+		f[n].name = name + f[n].neg;
+		if(f[n].name[0] == '\0')
+			continue;
+		f[n].n = tagdict_resolve(d, f[n].name, &f[n].first);
+		f[n].blobs = tagdict_blobs(d, f[n].first, f[n].n);
+		n++;
+	}
+
+	/* the intersection starts from the rarest tag, as far as the 
+	 * blob counts of the personal db tell, and stops once it is 
+	 * empty */
+	qsort(f, n, sizeof(*f), factor_cmp);
+	for(npos = 0; npos < n && f[npos].neg == 0; npos++)
+		;
+	for(i = 0; i < npos; i++) {
+		if(i == 0)
+			factor_or(dst, d, &f[i]);
+		else
+			factor_and(dst, d, &f[i]);
+		if(bitmap_count(dst) == 0)
+			break;
+	}
+	for(i = npos; i < n; i++) {
+		if(npos > 0)
+			factor_andnot(dst, d, &f[i]);
+		else
+			factor_or(dst, d, &f[i]);
+	}
+
+	talloc_free(buf);
+	if(n < 1)
+		return -1;
+	return (npos > 0)? 1 : 0;
+}
+
+int tagmatch_word(const struct tagdict *d, const char *word) {
+	char *buf, *p, *name;
+	size_t first;
+	int found;
+
+	if(tagdict_find(d, word) != NULL)
+		return 1;
+
+	buf = talloc_strdup(NULL, word);
+	for(found = 0, p = buf; p != NULL && found == 0; ) {
+		name = p;
+		if( (p = strchr(p, '&')) != NULL)
+			*p++ = '\0';
+		name += (name[0] == '!');
+		if(name[0] != '\0' && tagdict_resolve(d, name, &first) > 0)
+			found = 1;
+	}
+
+	talloc_free(buf);
+	return found;
+}
+
+void tagmatch_eval(struct tagmatch *m, const struct tagdict *d, 
+		const struct bitmap *all, const char *const *words, size_t nwords) {
+	struct bitmap term, out;
+	size_t i;
+	int status;
+
+	bitmap_init(&m->ids);
+	m->nterms = 0;
+	m->named = NULL;
+	m->nnamed = 0;
+	m->handle = slot_take(m);
+	if( (m->terms = talloc_array(NULL, struct bitmap, (nwords > 0)? nwords : 1)) == NULL)
+		err_panic(0, "failed to allocate the terms of a tag match");
+
+	bitmap_init(&out);
+	for(i = 0; i < nwords; i++) {
+		bitmap_init(&term);
+		if( (status = term_eval(&term, d, words[i])) > 0) {
+			bitmap_or(&m->ids, &term);
+			m->terms[m->nterms++] = term;
+			continue;
+		}
+
+		if(status == 0)
+			bitmap_or(&out, &term);
+		bitmap_free(&term);
+	}
+
+	/* with nothing to start from the tags with a '!' are taken 
+	 * out of every blob */
+	if(m->nterms < 1)
+		bitmap_copy(&m->ids, all);
+	else
+		bitmap_and(&m->ids, all);
+	bitmap_andnot(&m->ids, &out);
+	bitmap_free(&out);
+}
+
+void tagmatch_free(struct tagmatch *m) {
+	size_t i;
+
+	slot_give(m);
+	m->handle = 0;
+	for(i = 0; i < m->nterms; i++)
+		bitmap_free(&m->terms[i]);
+	talloc_free(m->terms);
+	m->terms = NULL;
+	m->nterms = 0;
+	for(i = 0; i < m->nnamed; i++)
+		bitmap_free(&m->named[i]);
+	talloc_free(m->named);
+	m->named = NULL;
+	m->nnamed = 0;
+	bitmap_free(&m->ids);
+}
+
+int tagmatch_hits(const struct tagmatch *m, uint32_t id) {
+	size_t i;
+	int hits;
+
+	for(hits = 0, i = 0; i < m->nterms; i++)
+		hits += (bitmap_contains(&m->terms[i], id) != 0);
+
+	return hits;
+}
+
+void tagmatch_name(struct tagmatch *m, size_t term, const struct tagdict_entry *e) {
+	if(term >= m->nnamed) {
+		m->named = talloc_realloc(NULL, m->named, struct bitmap, term + 1);
+		if(m->named == NULL)
+			err_panic(0, "failed to allocate the named blobs of a tag match");
+		for(; m->nnamed <= term; m->nnamed++)
+			bitmap_init(&m->named[m->nnamed]);
+	}
+
+	if(e->postings != NULL)
+		bitmap_or(&m->named[term], e->postings);
+}
+
+uint64_t tagmatch_named(const struct tagmatch *m, uint32_t id) {
+	uint64_t bits;
+	size_t i;
+
+	for(bits = 0, i = 0; i < m->nnamed && i < 64; i++)
+		if(bitmap_contains(&m->named[i], id) != 0)
+			bits |= (uint64_t) 1 << i;
+
+	return bits;
+}
+
+/* the virtual table. sqlite 3.7 has no way to bind a pointer or 
+ * an array, so the match is bound as the integer handle. */
+enum {
+	TAGMATCH_COL_ID = 0,
+	TAGMATCH_COL_HITS,
+	TAGMATCH_COL_NAMED,
+	TAGMATCH_COL_MATCH,
+	TAGMATCH_COL_SOURCE,
+	TAGMATCH_COLS
+};
+
+struct tagmatch_vtab {
+	sqlite3_vtab base;
+	int shift;
+};
+
+struct tagmatch_cursor {
+	sqlite3_vtab_cursor base;
+	const struct tagmatch *m;
+	struct bitmap_iter it;
+	/* the ids of the source are from @lo up to @hi */
+	uint64_t lo;
+	uint64_t hi;
+	uint32_t id;
+	int eof;
+	/* set if the id was looked up, which is the only row */
+	int lookup;
+};
+
+static int vt_connect(sqlite3 *handle, void *aux, int argc, const char *const *argv, 
+		sqlite3_vtab **out, char **errmsg) {
+	struct tagmatch_vtab *vt;
+	int status;
+
+	(void)(argc);
+	(void)(argv);
+	(void)(errmsg);
+
+	/* in the order of the TAGMATCH_COL's */
+	status = sqlite3_declare_vtab(handle, 
+			"CREATE TABLE x(id INTEGER, hits INTEGER, named INTEGER, "
+				"tagmatch HIDDEN, source HIDDEN)");
+	if(status != SQLITE_OK)
+		return status;
+	if( (vt = talloc_zero(NULL, struct tagmatch_vtab)) == NULL)
+		return SQLITE_NOMEM;
+
+	vt->shift = (int) (intptr_t) aux;
+	*out = &vt->base;
+	return SQLITE_OK;
+}
+
+static int vt_disconnect(sqlite3_vtab *vt) {
+	talloc_free(vt);
+	return SQLITE_OK;
+}
+
+/* the constraints given to vt_filter are those of idx_num, in the
+ * order of their columns */
+static int vt_best_index(sqlite3_vtab *vt, sqlite3_index_info *info) {
+	int i, col, n, which[TAGMATCH_COLS];
+
+	(void)(vt);
+
+	for(col = 0; col < TAGMATCH_COLS; col++)
+		which[col] = -1;
+	for(i = 0; i < info->nConstraint; i++) {
+		if(info->aConstraint[i].usable == 0 
+				|| info->aConstraint[i].op != SQLITE_INDEX_CONSTRAINT_EQ)
+			continue;
+		col = info->aConstraint[i].iColumn;
+		if(col == TAGMATCH_COL_ID || col == TAGMATCH_COL_MATCH 
+				|| col == TAGMATCH_COL_SOURCE)
+			which[col] = i;
+	}
+
+	info->idxNum = 0;
+	for(n = 0, col = 0; col < TAGMATCH_COLS; col++) {
+		if(which[col] < 0)
+			continue;
+		info->aConstraintUsage[which[col]].argvIndex = ++n;
+		info->aConstraintUsage[which[col]].omit = 1;
+		info->idxNum |= 1 << col;
+	}
+
+	/* without a match there are no rows at all, but it shouldnt 
+	 * be chosen over a plan with one */
+	if(which[TAGMATCH_COL_MATCH] < 0)
+		info->estimatedCost = 1e12;
+	else if(which[TAGMATCH_COL_ID] >= 0)
+		info->estimatedCost = 1;
+	else
+		info->estimatedCost = 1e5;
+
+	return SQLITE_OK;
+}
+
+static int vt_open(sqlite3_vtab *vt, sqlite3_vtab_cursor **out) {
+	struct tagmatch_cursor *cur;
+
+	(void)(vt);
+
+	if(g.nspare > 0) {
+		cur = g.spare[--g.nspare];
+		memset(cur, 0, sizeof(*cur));
+	}
+	else if( (cur = talloc_zero(NULL, struct tagmatch_cursor)) == NULL)
+		return SQLITE_NOMEM;
+
+	cur->eof = 1;
+	*out = &cur->base;
+	return SQLITE_OK;
+}
+
+static int vt_close(sqlite3_vtab_cursor *cur) {
+	if(g.nspare < TAGMATCH_SPARE_CURSORS)
+		g.spare[g.nspare++] = (struct tagmatch_cursor *) cur;
+	else
+		talloc_free(cur);
+	return SQLITE_OK;
+}
+
+static int vt_next(sqlite3_vtab_cursor *base) {
+	struct tagmatch_cursor *cur;
+	uint32_t x;
+
+	cur = (struct tagmatch_cursor *) base;
+	if(cur->lookup != 0 || bitmap_iter_next(&cur->it, &x) != 0 || x >= cur->hi)
+		cur->eof = 1;
+	else
+		cur->id = x;
+
+	return SQLITE_OK;
+}
+
+static int vt_filter(sqlite3_vtab_cursor *base, int idx_num, const char *idx_str,
+		int argc, sqlite3_value **argv) {
+	struct tagmatch_cursor *cur;
+	int shift, i;
+	int64_t id;
+
+	(void)(idx_str);
+	(void)(argc);
+
+	cur = (struct tagmatch_cursor *) base;
+	shift = ((struct tagmatch_vtab *) base->pVtab)->shift;
+	cur->m = NULL;
+	cur->lo = 0;
+	cur->hi = (uint64_t) 1 << 32;
+	cur->lookup = 0;
+	cur->eof = 1;
+
+	i = 0;
+	id = 0;
+	if(idx_num & (1 << TAGMATCH_COL_ID)) {
+		cur->lookup = 1;
+		id = sqlite3_value_int64(argv[i++]);
+	}
+	if(idx_num & (1 << TAGMATCH_COL_MATCH)) {
+		if( (cur->m = slot_find(sqlite3_value_int64(argv[i++]))) == NULL) {
+			sqlite3_free(base->pVtab->zErrMsg);
+			base->pVtab->zErrMsg = sqlite3_mprintf("no such tag match");
+			return SQLITE_ERROR;
+		}
+	}
+	if(idx_num & (1 << TAGMATCH_COL_SOURCE)) {
+		cur->lo = (uint64_t) sqlite3_value_int64(argv[i++]) << shift;
+		cur->hi = cur->lo + ((uint64_t) 1 << shift);
+	}
+	if(cur->m == NULL)
+		return SQLITE_OK;
+
+	if(cur->lookup != 0) {
+		if(id < 0 || (uint64_t) id >= cur->hi - cur->lo)
+			return SQLITE_OK;
+		cur->id = (uint32_t) (cur->lo + id);
+		cur->eof = (bitmap_contains(&cur->m->ids, cur->id) == 0);
+		return SQLITE_OK;
+	}
+
+	if(cur->lo >= ((uint64_t) 1 << 32))
+		return SQLITE_OK;
+	cur->eof = 0;
+	bitmap_iter_init(&cur->it, &cur->m->ids, (uint32_t) cur->lo);
+	return vt_next(base);
+}
+
+static int vt_eof(sqlite3_vtab_cursor *base) {
+	return ((struct tagmatch_cursor *) base)->eof;
+}
+
+static int vt_column(sqlite3_vtab_cursor *base, sqlite3_context *ctx, int col) {
+	struct tagmatch_cursor *cur;
+
+	cur = (struct tagmatch_cursor *) base;
+
+	switch(col) {
+	case TAGMATCH_COL_ID:
+		sqlite3_result_int64(ctx, cur->id - cur->lo);
+		break;
+	case TAGMATCH_COL_HITS:
+		sqlite3_result_int(ctx, tagmatch_hits(cur->m, cur->id));
+		break;
+	case TAGMATCH_COL_NAMED:
+		sqlite3_result_int64(ctx, (sqlite3_int64) tagmatch_named(cur->m, cur->id));
+		break;
+	case TAGMATCH_COL_SOURCE:
+		sqlite3_result_int64(ctx, cur->lo >> ((struct tagmatch_vtab *) base->pVtab)->shift);
+		break;
+	default:
+		sqlite3_result_null(ctx);
+	}
+
+	return SQLITE_OK;
+}
+
+static int vt_rowid(sqlite3_vtab_cursor *base, sqlite3_int64 *rowid) {
+	*rowid = ((struct tagmatch_cursor *) base)->id;
+	return SQLITE_OK;
+}
+
+static const sqlite3_module g_module = {
+	.iVersion = 0,
+	.xCreate = vt_connect,
+	.xConnect = vt_connect,
+	.xBestIndex = vt_best_index,
+	.xDisconnect = vt_disconnect,
+	.xDestroy = vt_disconnect,
+	.xOpen = vt_open,
+	.xClose = vt_close,
+	.xFilter = vt_filter,
+	.xNext = vt_next,
+	.xEof = vt_eof,
+	.xColumn = vt_column,
+	.xRowid = vt_rowid
+};
+
+int tagmatch_register(sqlite3 *handle, int source_shift) {
+	if(sqlite3_create_module(handle, "aug_tag_match", &g_module, 
+			(void *) (intptr_t) source_shift) != SQLITE_OK) {
+		err_warn(0, "failed to register the tag match module: %s", sqlite3_errmsg(handle));
+		return -1;
+	}
+	if(sqlite3_exec(handle, "CREATE VIRTUAL TABLE temp.tag_match USING aug_tag_match", 
+			NULL, NULL, NULL) != SQLITE_OK) {
+		err_warn(0, "failed to create the tag match table: %s", sqlite3_errmsg(handle));
+		return -1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,92 @@
+/* 
+ * Copyright 2013 anthony cantor
+ * This file is part of aug-db.
+ *
+ * aug-db is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * aug-db is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with aug-db.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef AUG_DB_TAGMATCH_H
+#define AUG_DB_TAGMATCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sqlite3.h>
+
+#include "bitmap.h"
+#include "tagdict.h"
+
+/* the blobs matching the #tag words of a query, worked out from the
+ * postings of the tags (the ids of the blobs with each tag, see 
+ * struct tagdict_entry) instead of by sqlite, so there can be any 
+ * number of them.
+ *
+ * each word is a term and a blob matches if it matches any of the
+ * terms. a term is one or more tags joined by '&', which the blob
+ * must all have, and a tag with a '!' in front is one it mustnt 
+ * have: "#git&!wip" is the blobs tagged git but not wip. a term of
+ * only '!' tags takes its blobs out of the whole match instead, so 
+ * "#git #!wip" is the same thing. each tag resolves like 
+ * tagdict_resolve, but a word that is the name of a tag is always
+ * that tag, even if it has a '&' or '!' in it. */
+/* the most matches that can be evaluated and not yet freed at once */
+#define TAGMATCH_MAX_LIVE 64
+
+struct tagmatch {
+	/* the matching blobs */
+	struct bitmap ids;
+	/* the blobs of each term that has a tag without a '!', to
+	 * count the terms a blob matches */
+	struct bitmap *terms;
+	size_t nterms;
+	/* the blobs with a tag whose name contains each search term
+	 * of the query, see tagmatch_name */
+	struct bitmap *named;
+	size_t nnamed;
+	/* what a statement binds to the tagmatch column of tag_match
+	 * to read this match, see tagmatch_register */
+	int64_t handle;
+};
+
+/* @all is every blob outside the trash. @m must stay where it is
+ * until tagmatch_free, since tag_match finds it by its handle. 
+ * panics if more than TAGMATCH_MAX_LIVE matches are in use. */
+void tagmatch_eval(struct tagmatch *m, const struct tagdict *d, 
+		const struct bitmap *all, const char *const *words, size_t nwords);
+void tagmatch_free(struct tagmatch *m);
+/* non-zero if @word names a tag the way tagmatch_eval reads it, 
+ * which decides whether "#word" is a tag or just text to search for.
+ * it only needs one of the tags of a term to exist, so "#git&!wip" 
+ * is a tag word if either does. */
+int tagmatch_word(const struct tagdict *d, const char *word);
+/* the number of terms @id matches */
+int tagmatch_hits(const struct tagmatch *m, uint32_t id);
+/* adds the blobs with the tag @e to those named by the search term
+ * @term. a search term matches a blob through the name of any of its
+ * tags, and this way sqlite doesnt have to look up the tags of each
+ * blob in the match to find out. */
+void tagmatch_name(struct tagmatch *m, size_t term, const struct tagdict_entry *e);
+/* a bit for each of the first 64 search terms naming a tag of @id */
+uint64_t tagmatch_named(const struct tagmatch *m, uint32_t id);
+
+/* registers the aug_tag_match virtual table module with @handle 
+ * and creates temp.tag_match, through which sqlite reads a match.
+ * a statement binds the handle of a struct tagmatch to its hidden
+ * column "tagmatch" and the source to read to its hidden "source", 
+ * and gets a row of (id, hits, named) for each id in the source: 
+ * the ids are split into sources at bit @source_shift and "id" is 
+ * the id within the source. a constraint on "id" looks it up instead. 
+ * a handle which isnt that of a live match is an error. 
+ * returns non-zero on error. */
+int tagmatch_register(sqlite3 *handle, int source_shift);
+
+#endif /* AUG_DB_TAGMATCH_H */
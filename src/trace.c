@@ -0,0 +1,364 @@
+/* 
+ * Copyright 2013 anthony cantor
+ * This file is part of aug-db.
+ *
+ * aug-db is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * aug-db is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with aug-db.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "trace.h"
+
+#include "err.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <ccan/array_size/array_size.h>
+
+/* trace_dump file format (native byte order):
+ *		char[8] magic "AUGDBTRC"
+ *		uint32 version
+ *		uint32 byte order mark 0x01020304
+ *		uint32 size of a struct trace_event
+ *		uint32 number of event names
+ *		for each event name: uint16 length, char[length] name
+ *		uint64 number of events
+ *		struct trace_event[number of events]
+ *		uint32 number of sql texts
+ *		for each sql text: uint64 id, uint32 length, char[length] sql
+ */
+#define TRACE_MAGIC "AUGDBTRC"
+#define TRACE_VERSION 2
+#define TRACE_BOM 0x01020304
+
+__thread struct trace_ring *G_trace_ring;
+int G_trace_spans;
+
+const char *const g_trace_event_names[] = {
+	"lock",
+	"locked",
+	"unlock",
+	"db_execute",
+	"db_begin",
+	"db_commit",
+	"db_rollback",
+	"db_prep",
+	"db_step",
+	"db_reset",
+	"db_finalize",
+	"db_exec",
+	"span_begin",
+	"span_end"
+};
+
+const char *const g_trace_span_names[] = {
+	"on_input",
+	"ui_on_input",
+	"ui_state_consume",
+	"query_prepare",
+	"db_query_step",
+	"window_render_query",
+	"aug_doupdate"
+};
+
+static struct {
+	struct trace_ring *rings;
+	uint32_t next_tid;
+	/* malloc'd path given to trace_spans_enable */
+	char *span_path;
+	/* an open addressed table of the ids from trace_sql and their
+	 * malloc'd texts. an id of 0 is a free slot. a slot is taken 
+	 * by setting its id, and its text is set after that, so a 
+	 * text can be NULL for a moment (or for good if strdup fails). */
+	struct {
+		uint64_t id;
+		char *text;
+	} sql[TRACE_MAX_SQL];
+} g;
+
+void trace_init() {
+	err_assert(ARRAY_SIZE(g_trace_event_names) == TRACE_EV_COUNT);
+	err_assert(ARRAY_SIZE(g_trace_span_names) == TRACE_SPAN_COUNT);
+}
+
+/* no other thread may record events once this is called */
+void trace_free() {
+	struct trace_ring *r, *next;
+	size_t i;
+
+	r = __atomic_exchange_n(&g.rings, NULL, __ATOMIC_ACQ_REL);
+	for(; r != NULL; r = next) {
+		next = r->next;
+		free(r);
+	}
+	G_trace_ring = NULL;
+	G_trace_spans = 0;
+	free(g.span_path);
+	g.span_path = NULL;
+	for(i = 0; i < ARRAY_SIZE(g.sql); i++) {
+		free(g.sql[i].text);
+		g.sql[i].text = NULL;
+		g.sql[i].id = 0;
+	}
+}
+
+struct trace_ring *trace_ring_attach() {
+	struct trace_ring *r;
+
+	if( (r = malloc(sizeof(*r))) == NULL)
+		return NULL;
+
+	r->head = 0;
+	r->tid = __atomic_add_fetch(&g.next_tid, 1, __ATOMIC_RELAXED);
+	r->next = __atomic_load_n(&g.rings, __ATOMIC_ACQUIRE);
+	while(!__atomic_compare_exchange_n(&g.rings, &r->next, r, 0,
+			__ATOMIC_RELEASE, __ATOMIC_ACQUIRE))
+		; /* r->next was updated to the current list head, try again */
+
+	G_trace_ring = r;
+	return r;
+}
+
+const char *trace_event_name(uint16_t id) {
+	if(id >= ARRAY_SIZE(g_trace_event_names))
+		return "unknown";
+
+	return g_trace_event_names[id];
+}
+
+const char *trace_span_name(uint64_t id) {
+	if(id >= ARRAY_SIZE(g_trace_span_names))
+		return "unknown";
+
+	return g_trace_span_names[id];
+}
+
+/* 64 bit FNV-1a */
+static uint64_t sql_hash(const char *sql) {
+	uint64_t h;
+
+	for(h = 0xcbf29ce484222325ULL; *sql != '\0'; sql++)
+		h = (h ^ (uint8_t) *sql) * 0x100000001b3ULL;
+
+	return (h != 0)? h : 1;
+}
+
+uint64_t trace_sql(const char *sql) {
+	uint64_t id, cur;
+	size_t i, n;
+	char *text;
+
+	id = sql_hash(sql);
+	for(i = id % TRACE_MAX_SQL, n = 0; n < TRACE_MAX_SQL; 
+			i = (i+1) % TRACE_MAX_SQL, n++) {
+		cur = __atomic_load_n(&g.sql[i].id, __ATOMIC_ACQUIRE);
+		if(cur == id)
+			break;
+		if(cur != 0)
+			continue;
+		if(!__atomic_compare_exchange_n(&g.sql[i].id, &cur, id, 0,
+				__ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+			if(cur == id)
+				break;
+			continue;
+		}
+		text = strdup(sql);
+		__atomic_store_n(&g.sql[i].text, text, __ATOMIC_RELEASE);
+		break;
+	}
+
+	/* if the table is full the text wont be in the dump */
+	return id;
+}
+
+const char *trace_sql_text(uint64_t id) {
+	size_t i, n;
+	uint64_t cur;
+
+	for(i = id % TRACE_MAX_SQL, n = 0; n < TRACE_MAX_SQL; 
+			i = (i+1) % TRACE_MAX_SQL, n++) {
+		if( (cur = __atomic_load_n(&g.sql[i].id, __ATOMIC_ACQUIRE)) == id)
+			return __atomic_load_n(&g.sql[i].text, __ATOMIC_ACQUIRE);
+		if(cur == 0)
+			break;
+	}
+
+	return NULL;
+}
+
+void trace_spans_enable(const char *path) {
+	free(g.span_path);
+	if( (g.span_path = strdup(path)) == NULL)
+		err_panic(errno, "failed to copy span trace path");
+	G_trace_spans = 1;
+}
+
+const char *trace_spans_path() {
+	return g.span_path;
+}
+
+int trace_spans_dump() {
+	if(g.span_path == NULL)
+		return -1;
+
+	return trace_dump_chrome(g.span_path);
+}
+
+#define TRACE_FWRITE(_ptr, _size, _fp) \
+	do { \
+		if(fwrite(_ptr, _size, 1, _fp) != 1) \
+			goto fail; \
+	} while(0)
+
+/* rings that are being written to while this runs may contribute
+ * a few torn events at their oldest end. */
+int trace_dump(const char *path) {
+	FILE *fp;
+	struct trace_ring *r;
+	uint64_t head, start, total, i;
+	uint32_t u32, len32;
+	uint16_t len;
+	size_t k;
+	const char *text;
+
+	if( (fp = fopen(path, "w")) == NULL) {
+		err_warn(errno, "failed to open trace file %s", path);
+		return -1;
+	}
+
+	TRACE_FWRITE(TRACE_MAGIC, 8, fp);
+	u32 = TRACE_VERSION;
+	TRACE_FWRITE(&u32, sizeof(u32), fp);
+	u32 = TRACE_BOM;
+	TRACE_FWRITE(&u32, sizeof(u32), fp);
+	u32 = sizeof(struct trace_event);
+	TRACE_FWRITE(&u32, sizeof(u32), fp);
+	u32 = ARRAY_SIZE(g_trace_event_names);
+	TRACE_FWRITE(&u32, sizeof(u32), fp);
+	for(k = 0; k < ARRAY_SIZE(g_trace_event_names); k++) {
+		len = strlen(g_trace_event_names[k]);
+		TRACE_FWRITE(&len, sizeof(len), fp);
+		TRACE_FWRITE(g_trace_event_names[k], len, fp);
+	}
+
+	total = 0;
+	for(r = __atomic_load_n(&g.rings, __ATOMIC_ACQUIRE); r != NULL; r = r->next) {
+		head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+		total += (head > TRACE_RING_SIZE)? TRACE_RING_SIZE : head;
+	}
+	TRACE_FWRITE(&total, sizeof(total), fp);
+
+	/* a ring could have grown since we counted, so write exactly
+	 * as many events as were counted above */
+	for(r = __atomic_load_n(&g.rings, __ATOMIC_ACQUIRE); r != NULL && total > 0; r = r->next) {
+		head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+		start = (head > TRACE_RING_SIZE)? head - TRACE_RING_SIZE : 0;
+		for(i = start; i < head && total > 0; i++, total--)
+			TRACE_FWRITE(&r->ev[i & (TRACE_RING_SIZE-1)], sizeof(struct trace_event), fp);
+	}
+
+	for(u32 = 0, k = 0; k < ARRAY_SIZE(g.sql); k++)
+		if(__atomic_load_n(&g.sql[k].text, __ATOMIC_ACQUIRE) != NULL)
+			u32++;
+	TRACE_FWRITE(&u32, sizeof(u32), fp);
+	/* like the events, exactly as many as were counted */
+	for(k = 0; k < ARRAY_SIZE(g.sql) && u32 > 0; k++) {
+		if( (text = __atomic_load_n(&g.sql[k].text, __ATOMIC_ACQUIRE)) == NULL)
+			continue;
+		TRACE_FWRITE(&g.sql[k].id, sizeof(g.sql[k].id), fp);
+		len32 = strlen(text);
+		TRACE_FWRITE(&len32, sizeof(len32), fp);
+		TRACE_FWRITE(text, len32, fp);
+		u32--;
+	}
+
+	if(fclose(fp) != 0) {
+		err_warn(errno, "failed to close trace file %s", path);
+		return -1;
+	}
+
+	return 0;
+fail:
+	err_warn(errno, "failed to write trace file %s", path);
+	fclose(fp);
+	return -1;
+}
+
+#define TRACE_FPRINTF(_fp, ...) \
+	do { \
+		if(fprintf(_fp, __VA_ARGS__) < 0) \
+			goto fail; \
+	} while(0)
+
+int trace_dump_chrome(const char *path) {
+	FILE *fp;
+	struct trace_ring *r;
+	struct trace_event *e;
+	uint64_t head, start, i;
+	int pid, depth;
+	const char *sep;
+
+	if( (fp = fopen(path, "w")) == NULL) {
+		err_warn(errno, "failed to open trace file %s", path);
+		return -1;
+	}
+
+	pid = (int) getpid();
+	sep = "";
+	TRACE_FPRINTF(fp, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+	for(r = __atomic_load_n(&g.rings, __ATOMIC_ACQUIRE); r != NULL; r = r->next) {
+		head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+		start = (head > TRACE_RING_SIZE)? head - TRACE_RING_SIZE : 0;
+		depth = 0;
+		for(i = start; i < head; i++) {
+			e = &r->ev[i & (TRACE_RING_SIZE-1)];
+			TRACE_FPRINTF(fp, "%s\n{\"pid\":%d,\"tid\":%u,\"ts\":%llu.%03u,",
+				sep, pid, (unsigned int) e->tid, 
+				(unsigned long long) (e->ts/1000), (unsigned int) (e->ts%1000));
+			sep = ",";
+			switch(e->id) {
+			case TRACE_EV_SPAN_BEGIN:
+				depth++;
+				TRACE_FPRINTF(fp, "\"ph\":\"B\",\"name\":\"%s\",\"args\":{\"arg\":%llu}}",
+					trace_span_name(e->args[0]), (unsigned long long) e->args[1]);
+				break;
+			case TRACE_EV_SPAN_END:
+				/* the begin may have been overwritten, which would
+				 * confuse the viewer, so write an instant instead */
+				if(depth > 0) {
+					depth--;
+					TRACE_FPRINTF(fp, "\"ph\":\"E\"}");
+					break;
+				}
+				/* fall through */
+			default:
+				TRACE_FPRINTF(fp, "\"ph\":\"i\",\"s\":\"t\",\"name\":\"%s\","
+					"\"args\":{\"arg0\":\"0x%llx\",\"arg1\":\"0x%llx\"}}",
+					trace_event_name(e->id), (unsigned long long) e->args[0], 
+					(unsigned long long) e->args[1]);
+			}
+		}
+	}
+	TRACE_FPRINTF(fp, "\n]}\n");
+
+	if(fclose(fp) != 0) {
+		err_warn(errno, "failed to close trace file %s", path);
+		return -1;
+	}
+
+	return 0;
+fail:
+	err_warn(errno, "failed to write trace file %s", path);
+	fclose(fp);
+	return -1;
+}
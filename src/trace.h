@@ -0,0 +1,196 @@
+/* 
+ * Copyright 2013 anthony cantor
+ * This file is part of aug-db.
+ *
+ * aug-db is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * aug-db is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with aug-db.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef AUG_DB_TRACE_H
+#define AUG_DB_TRACE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "util.h"
+
+/* binary event tracing. each thread records fixed size events
+ * into its own ring buffer, so recording an event never takes
+ * a lock or formats a string. the rings are written to a file
+ * by trace_dump and decoded offline by script/aug-db-trace.
+ *
+ * events are filtered at compile time: an event whose level is
+ * greater than AUG_DB_TRACE_LEVEL compiles to nothing.
+ */
+#define TRACE_LEVEL_OFF 0
+/* transactions and other events that happen once per user action */
+#define TRACE_LEVEL_COARSE 1
+/* locks, statement steps and other per row/per char events */
+#define TRACE_LEVEL_FINE 2
+
+#ifndef AUG_DB_TRACE_LEVEL
+#define AUG_DB_TRACE_LEVEL TRACE_LEVEL_OFF
+#endif
+
+/* the names of these are in g_trace_event_names in trace.c,
+ * so keep them in sync. */
+typedef enum {
+	TRACE_EV_LOCK = 0,
+	TRACE_EV_LOCKED,
+	TRACE_EV_UNLOCK,
+	TRACE_EV_DB_EXECUTE,
+	TRACE_EV_DB_BEGIN,
+	TRACE_EV_DB_COMMIT,
+	TRACE_EV_DB_ROLLBACK,
+	TRACE_EV_DB_PREP,
+	TRACE_EV_DB_STEP,
+	TRACE_EV_DB_RESET,
+	TRACE_EV_DB_FINALIZE,
+	TRACE_EV_DB_EXEC,
+	TRACE_EV_SPAN_BEGIN,
+	TRACE_EV_SPAN_END,
+	TRACE_EV_COUNT
+} trace_event_id;
+
+/* spans are the stages of handling a keystroke, from aug's input
+ * thread to the screen update. they are recorded as span_begin and
+ * span_end events with the span id as the first argument, but only
+ * once trace_spans_enable has been called, so that they cost a
+ * single branch when tracing is off. the names of these are in 
+ * g_trace_span_names in trace.c, so keep them in sync. */
+typedef enum {
+	TRACE_SPAN_ON_INPUT = 0,
+	TRACE_SPAN_UI_ON_INPUT,
+	TRACE_SPAN_CONSUME,
+	TRACE_SPAN_QUERY_PREPARE,
+	TRACE_SPAN_QUERY_STEP,
+	TRACE_SPAN_RENDER_QUERY,
+	TRACE_SPAN_DOUPDATE,
+	TRACE_SPAN_COUNT
+} trace_span_id;
+
+/* this is also the on-disk record format of trace_dump */
+struct trace_event {
+	/* nanoseconds from an arbitrary (but fixed) point */
+	uint64_t ts;
+	uint64_t args[2];
+	/* small integer assigned to a thread by its first event */
+	uint32_t tid;
+	uint16_t id;
+	uint16_t pad;
+};
+
+/* must be a power of 2 */
+#define TRACE_RING_SIZE 4096
+
+struct trace_ring {
+	/* rings are never freed until trace_free, so this list
+	 * can be walked without a lock */
+	struct trace_ring *next;
+	uint32_t tid;
+	/* total number of events written. only the owning thread
+	 * writes this. */
+	uint64_t head;
+	struct trace_event ev[TRACE_RING_SIZE];
+};
+
+extern __thread struct trace_ring *G_trace_ring;
+/* non-zero if spans are being recorded */
+extern int G_trace_spans;
+
+void trace_init();
+void trace_free();
+/* only exposed for trace_event. returns NULL if a
+ * ring could not be allocated */
+struct trace_ring *trace_ring_attach();
+/* write all rings to the file at @path. returns non-zero on error */
+int trace_dump(const char *path);
+const char *trace_event_name(uint16_t id);
+const char *trace_span_name(uint64_t id);
+
+/* the most distinct sql texts that trace_dump writes */
+#define TRACE_MAX_SQL 256
+
+/* returns an id of @sql for the argument of an event, which is the
+ * same in every process. the text is kept the first time it is seen
+ * so that trace_dump can write it and script/aug-db-trace can map
+ * the id back to it. */
+uint64_t trace_sql(const char *sql);
+/* the text trace_sql kept for @id or NULL */
+const char *trace_sql_text(uint64_t id);
+
+/* start recording spans. trace_spans_dump writes them to the
+ * file at @path. this should be called before any other thread
+ * is started. */
+void trace_spans_enable(const char *path);
+/* the path given to trace_spans_enable or NULL */
+const char *trace_spans_path();
+/* writes the rings to the file given to trace_spans_enable. returns
+ * non-zero on error or if spans are not enabled. */
+int trace_spans_dump();
+/* write all rings to the file at @path in the chrome trace_event
+ * json format, which can be opened in chrome://tracing or perfetto.
+ * spans become duration events and every other event becomes an 
+ * instant event. returns non-zero on error */
+int trace_dump_chrome(const char *path);
+
+static inline uint64_t trace_now() {
+	return util_now_ns();
+}
+
+static inline void trace_event(uint16_t id, uint64_t arg0, uint64_t arg1) {
+	struct trace_ring *r;
+	struct trace_event *e;
+
+	if( (r = G_trace_ring) == NULL && (r = trace_ring_attach()) == NULL)
+		return;
+
+	e = &r->ev[r->head & (TRACE_RING_SIZE-1)];
+	e->ts = trace_now();
+	e->args[0] = arg0;
+	e->args[1] = arg1;
+	e->tid = r->tid;
+	e->id = id;
+	/* publish the event to trace_dump after it is fully written */
+	__atomic_store_n(&r->head, r->head+1, __ATOMIC_RELEASE);
+}
+
+#define TRACE_ARG(_x) ((uint64_t)(uintptr_t)(_x))
+
+#if AUG_DB_TRACE_LEVEL >= TRACE_LEVEL_COARSE
+#define TRACE_COARSE(_id, _arg0, _arg1) \
+		trace_event(_id, TRACE_ARG(_arg0), TRACE_ARG(_arg1))
+#else
+#define TRACE_COARSE(_id, _arg0, _arg1) do {} while(0)
+#endif
+
+#if AUG_DB_TRACE_LEVEL >= TRACE_LEVEL_FINE
+#define TRACE_FINE(_id, _arg0, _arg1) \
+		trace_event(_id, TRACE_ARG(_arg0), TRACE_ARG(_arg1))
+#else
+#define TRACE_FINE(_id, _arg0, _arg1) do {} while(0)
+#endif
+
+#if AUG_DB_TRACE_LEVEL >= TRACE_LEVEL_COARSE
+#define TRACE_SPAN(_ev, _span, _arg) \
+	do { \
+		if(__builtin_expect(G_trace_spans != 0, 0)) \
+			trace_event(_ev, _span, TRACE_ARG(_arg)); \
+	} while(0)
+#else
+#define TRACE_SPAN(_ev, _span, _arg) do {} while(0)
+#endif
+
+#define TRACE_SPAN_BEGIN(_span, _arg) TRACE_SPAN(TRACE_EV_SPAN_BEGIN, _span, _arg)
+#define TRACE_SPAN_END(_span) TRACE_SPAN(TRACE_EV_SPAN_END, _span, 0)
+
+#endif /* AUG_DB_TRACE_H */
@@ -23,8 +23,11 @@
 #include "window.h"
 #include "fifo.h"
 #include "ui_state.h"
-#include "lock.h"
+#include "evloop.h"
 #include "db.h"
+#include "stats.h"
+#include "trace.h"
+#include "mem.h"
 
 #include <pthread.h>
 #include <errno.h>
@@ -37,58 +40,70 @@
  * ui_t_* functions are expected to only be called by
  * the ui thread */
 
+/* the max number of events taken from the event loop at once */
+#define UI_EVENTS_MAX 64
+/* how often the statistics screen is redrawn */
+#define UI_STATS_MS 1000
+/* how often the open window checks whether another process 
+ * changed the db */
+#define UI_DB_POLL_MS 500
+/* the recent cache is filled soon after the plugin loads and then
+ * checked this often, so that the first frame after the command
+ * key rarely has to wait for sqlite */
+#define UI_RECENT_FIRST_MS 10
+#define UI_RECENT_MS 5000
+/* how often the db's stats are checked, see db_refresh_stats. a
+ * refresh isnt started while the window is open, and opening it 
+ * stops a running one. */
+#define UI_IDLE_MS 60000
+
 static struct {
 	pthread_t tid;
-	pthread_mutex_t mtx;
-	pthread_cond_t wakeup;
+	struct evloop loop;
+	/* only the ui thread touches these. key events are moved 
+	 * from the event loop into input_pipe in the order they
+	 * arrived. */
 	int shutdown;
-	int waiting;
-	int sig_cmd_key;
-	int sig_dims_changed;
-	int input_buf[1024];
+	uint32_t input_buf[1024];
 	struct fifo input_pipe;
-	pthread_mutex_t pipe_mtx;
 	iconv_t cd;
+	struct {
+		void (*fn)(void *);
+		void *user;
+	} timers[EVLOOP_MAX_TIMERS];
+	/* the timer which redraws the statistics screen, or -1 */
+	int stats_timer;
+	int stats_tick;
+	/* the timer which polls db_generation during interaction, 
+	 * the generation the last frame was rendered from and 
+	 * whether it has changed since */
+	int db_timer;
+	uint32_t db_gen;
+	int db_changed;
+	int recent_timer;
+	/* set while interact runs */
+	int interacting;
 } g;
 
 static void *ui_t_run(void *);
-
-#define DEF_SET_SIG_FN(_sig) \
-	static void set_sig_ ## _sig () { g.sig_ ## _sig = 1; }
-#define DEF_CLR_SIG_FN(_sig) \
-	static void clr_sig_ ## _sig () { g.sig_ ## _sig = 0; }
-
-DEF_SET_SIG_FN(cmd_key)
-DEF_CLR_SIG_FN(cmd_key)
-DEF_SET_SIG_FN(dims_changed)
-DEF_CLR_SIG_FN(dims_changed)
-
-#define UI_LOCK(_status) \
-	AUG_DB_LOCK(&g.mtx, _status, "failed to lock ui mutex")
-#define UI_UNLOCK(_status) \
-	AUG_DB_UNLOCK(&g.mtx, _status, "failed to unlock ui mutex")
-
-#define UI_LOCK_PIPE(_status) \
-	AUG_DB_LOCK(&g.pipe_mtx, _status, "failed to lock pipe mutex")
-#define UI_UNLOCK_PIPE(_status) \
-	AUG_DB_UNLOCK(&g.pipe_mtx, _status, "failed to unlock pipe mutex")
+static void ui_t_recent_warm(void *);
+static void ui_t_idle(void *);
 
 int ui_init() {
-	int status;
+	size_t i;
 
 	g.shutdown = 0;
-	g.waiting = 0;
-	clr_sig_cmd_key();
-	clr_sig_dims_changed();
-	if(pthread_mutex_init(&g.mtx, NULL) != 0)
+	g.interacting = 0;
+	g.stats_timer = -1;
+	g.db_timer = -1;
+	for(i = 0; i < ARRAY_SIZE(g.timers); i++)
+		g.timers[i].fn = NULL;
+
+	if(evloop_init(&g.loop) != 0)
 		return -1;
-	if(pthread_mutex_init(&g.pipe_mtx, NULL) != 0)
-		goto cleanup_mtx;
-	if(pthread_cond_init(&g.wakeup, NULL) != 0)
-		goto cleanup_both_mtx;
 
 	if( (g.cd = iconv_open("WCHAR_T", "UTF8")) == ((iconv_t) -1) )
-		goto cleanup_cond;
+		goto cleanup_loop;
 
 	if(ui_state_init() != 0)
 		goto cleanup_iconv;
@@ -96,20 +111,14 @@ int ui_init() {
 		goto cleanup_ui_state;
 
 	fifo_init(&g.input_pipe, g.input_buf, sizeof(uint32_t), ARRAY_SIZE(g.input_buf));
+	g.recent_timer = ui_timer_start(UI_RECENT_FIRST_MS, 0, ui_t_recent_warm, NULL);
+	ui_timer_start(UI_IDLE_MS, 1, ui_t_idle, NULL);
 
+	/* events pushed before the thread runs just wait in the queue,
+	 * so there is no need to wait for the thread to be ready */
 	if(pthread_create(&g.tid, NULL, ui_t_run, NULL) != 0)
 		goto cleanup_window;
 
-	while(1) {
-		UI_LOCK(status);
-		if(g.waiting == 1) {
-			UI_UNLOCK(status);
-			break;
-		}
-		UI_UNLOCK(status);
-		util_usleep(0, 10000);
-	}
-
 	return 0;
 
 cleanup_window:
@@ -119,31 +128,31 @@ cleanup_ui_state:
 cleanup_iconv:
 	if(iconv_close(g.cd) != 0)
 		err_warn(errno, "failed to close iconv descriptor");
-cleanup_cond:
-	pthread_cond_destroy(&g.wakeup);
-cleanup_both_mtx:
-	pthread_mutex_destroy(&g.pipe_mtx);
-cleanup_mtx:
-	pthread_mutex_destroy(&g.mtx);
+cleanup_loop:
+	evloop_free(&g.loop);
 
 	return -1;
 }
 
+static int push_event(evloop_type type, uint32_t ch) {
+	struct evloop_event ev;
+
+	ev.type = type;
+	ev.ch = ch;
+	ev.timer = -1;
+	return evloop_push(&g.loop, &ev);
+}
+
 /* this should not be called by ui thread */
 void ui_free() {
 	int status;
 
 	aug_log("ui free\n");
 	aug_log("shutdown ui thread\n");
-	ui_lock();
-	g.shutdown = 1;
-	if(g.waiting != 0) {
-		aug_log("signal ui thread\n");
-		if( (status = pthread_cond_signal(&g.wakeup)) != 0)
-			err_panic(status, "failed to signal condition");
-	}
-	/* else if ui is not waiting, it should see the g.shutdown flag set */
-	ui_unlock();
+	/* the queue only stays full while the ui thread is busy
+	 * consuming it, so keep trying */
+	while(push_event(EVLOOP_SHUTDOWN, 0) != 0)
+		util_usleep(0, 1000);
 
 	aug_log("join ui thread\n");
 	if( (status = pthread_join(g.tid, NULL)) != 0)
@@ -155,92 +164,74 @@ void ui_free() {
 	ui_state_free();
 	if(iconv_close(g.cd) != 0)
 		err_warn(errno, "failed to close iconv descriptor");
-	if( (status = pthread_cond_destroy(&g.wakeup)) != 0)
-		err_warn(status, "failed to destroy ui condition");
-	if( (status = pthread_mutex_destroy(&g.pipe_mtx)) != 0)
-		err_warn(status, "failed to destroy pipe mutex");
-	if( (status = pthread_mutex_destroy(&g.mtx)) != 0)
-		err_warn(status, "failed to destroy ui mutex");
-
+	evloop_free(&g.loop);
 }
 
-void ui_lock() {
-	int status;
-	UI_LOCK(status);
+int ui_timer_start(unsigned int ms, int periodic, void (*fn)(void *), void *user) {
+	size_t i;
+
+	for(i = 0; i < ARRAY_SIZE(g.timers); i++) {
+		if(g.timers[i].fn == NULL) {
+			g.timers[i].fn = fn;
+			g.timers[i].user = user;
+			evloop_timer_set(&g.loop, i, ms, periodic);
+			return i;
+		}
+	}
+
+	return -1;
 }
-void ui_unlock() {
-	int status;
-	UI_UNLOCK(status);
+
+void ui_timer_restart(int timer, unsigned int ms, int periodic) {
+	err_assert(g.timers[timer].fn != NULL);
+	evloop_timer_set(&g.loop, timer, ms, periodic);
 }
 
-static void wakeup_ui_thread(void (*callback)()) {
-	int status;
+void ui_timer_stop(int timer) {
+	evloop_timer_clear(&g.loop, timer);
+	g.timers[timer].fn = NULL;
+}
 
-	ui_lock();
-	if(callback != NULL)
-		(*callback)();
-	if(g.waiting != 0)
-		if( (status = pthread_cond_signal(&g.wakeup)) != 0) 
-			err_panic(status, "failed to signal cond");
-	ui_unlock();
+int ui_interacting() {
+	return g.interacting;
 }
 
 void ui_on_cmd_key() { 
 	aug_log("ui: on_cmd_key\n");
-	wakeup_ui_thread(set_sig_cmd_key);
+	if(push_event(EVLOOP_CMD_KEY, 0) != 0)
+		err_warn(0, "ui event queue is full, dropped command key");
 }
 
 int ui_on_input(const uint32_t *ch) {
 	int status;
 	/*aug_log("ui_on_input: 0x%04x\n", *ch);*/
 
+	TRACE_SPAN_BEGIN(TRACE_SPAN_UI_ON_INPUT, *ch);
+	status = 0;
 	if(window_off() != 0) {
 		/*aug_log("ui_on_input: window is off. ignore input\n");*/
-		return 1;
+		status = 1;
 	}
-
-	UI_LOCK_PIPE(status);
-	if(fifo_avail(&g.input_pipe) < 1) {
-		aug_log("ui_on_input: no space available in fifo\n");
-		UI_UNLOCK_PIPE(status);
-		return -1;
+	else if(push_event(EVLOOP_KEY, *ch) != 0) {
+		aug_log("ui_on_input: no space available in event queue\n");
+		status = -1;
 	}
-	fifo_push(&g.input_pipe, ch);
-	UI_UNLOCK_PIPE(status);
-	wakeup_ui_thread(NULL);	
 
 	/*aug_log("ui_on_input: successfully pushed input\n");*/
-	return 0;
+	TRACE_SPAN_END(TRACE_SPAN_UI_ON_INPUT);
+	return status;
 }
 
 void ui_on_dims_change(int rows, int cols) {
 	(void)(rows);
 	(void)(cols);
 
-	wakeup_ui_thread(set_sig_dims_changed);	
+	if(push_event(EVLOOP_RESIZE, 0) != 0)
+		err_warn(0, "ui event queue is full, dropped resize");
 }
 
 #define WINDOW_TOO_SMALL_MSG "window is too small to fit aug-db interface\n"
 
-static int render() {
-	int status;
-
-	UI_LOCK(status);
-	if(g.sig_dims_changed) {
-		clr_sig_dims_changed();
-		window_end();
-		if(window_start() != 0) {
-			aug_log(WINDOW_TOO_SMALL_MSG);
-			UI_UNLOCK(status);
-			return -1;
-		}
-	}
-	UI_UNLOCK(status);
-
-	window_render();
-	return 0;
-}
-
 static void write_data_to_term(const uint8_t *data, size_t dsize, int raw, 
 		uint32_t run_ch) {
 	int written;
@@ -316,16 +307,87 @@ static void act_on_state(int *interact_off, int *do_render) {
 		aug_log("act on state: help query\n");
 		*do_render = 1;
 		break;
+	case UI_STATE_STATS:
+		*do_render = 1;
+		break;
 	default:
 		err_warn(0, "unhandled state in act_on_state");
 	} /* switch(ui state) */
 }
 
-/* mtx is unlocked upon entry to this function.
- * this function should return with mtx unlocked.
- */
+static void ui_t_stats_tick(void *user) {
+	(void)(user);
+	g.stats_tick = 1;
+}
+
+/* the statistics screen is redrawn every UI_STATS_MS while it is
+ * open. nothing else runs the timer, so it costs nothing otherwise. */
+static void ui_t_stats_timer_update() {
+	if(ui_state_current() == UI_STATE_STATS) {
+		if(g.stats_timer < 0)
+			g.stats_timer = ui_timer_start(UI_STATS_MS, 1, ui_t_stats_tick, NULL);
+	}
+	else if(g.stats_timer >= 0) {
+		ui_timer_stop(g.stats_timer);
+		g.stats_timer = -1;
+	}
+}
+
+static void ui_t_db_poll(void *user) {
+	(void)(user);
+	if(db_generation() != g.db_gen)
+		g.db_changed = 1;
+}
+
+static void ui_t_recent_warm(void *user) {
+	(void)(user);
+	if(db_recent_warm() != 0)
+		aug_log("filled the recent cache\n");
+	ui_timer_restart(g.recent_timer, UI_RECENT_MS, 1);
+}
+
+static void ui_t_idle(void *user) {
+	(void)(user);
+	if(db_refresh_stats_end(0) > 0)
+		aug_log("refreshed the db stats\n");
+	if(g.interacting != 0)
+		return;
+	if(db_refresh_stats() != 0)
+		aug_log("refreshing the db stats\n");
+}
+
+static void ui_t_on_timer(int timer) {
+	if(g.timers[timer].fn != NULL)
+		(*g.timers[timer].fn)(g.timers[timer].user);
+}
+
+/* a frame is stale once there are events waiting that it
+ * doesnt reflect */
+static int ui_t_frame_stale() {
+	return evloop_pending(&g.loop);
+}
+
+/* returns 0 if the frame was completely rendered */
+static int ui_t_render() {
+	uint64_t t0;
+	int status;
+
+	t0 = util_now_ns();
+	g.db_gen = db_generation();
+	g.db_changed = 0;
+	if( (status = window_render(ui_t_frame_stale)) == 0) {
+		stats_latency_add(STATS_LAT_RENDER, util_now_ns() - t0);
+		/* the caches only grow while rendering */
+		mem_enforce();
+	}
+
+	return status;
+}
+
 static void interact() {
-	int status, amt, do_render, brk;
+	struct evloop_event evs[UI_EVENTS_MAX];
+	size_t i, n;
+	int amt, do_render, brk, done, resized;
 	
 	aug_log("interact: begin\n");
 	if(window_start() != 0) {
@@ -334,119 +396,125 @@ static void interact() {
 	}
 
 	do_render = 1;
-	/*g.waiting = 0; shouldnt need this, ui_t_run already sets this to 0 */
 	brk = 0;
+	done = 0;
+	g.interacting = 1;
+	db_refresh_stats_stop();
+	g.db_timer = ui_timer_start(UI_DB_POLL_MS, 1, ui_t_db_poll, NULL);
 	while(1) {
-		UI_LOCK(status);
-		if(g.sig_cmd_key != 0 || g.shutdown != 0) {
-			clr_sig_cmd_key();
-			UI_UNLOCK(status);
-			break; 
+		/* an abandoned frame is rendered again after the
+		 * events that interrupted it are handled */
+		if(do_render && ui_t_render() == 0)
+			do_render = 0;
+
+		n = evloop_wait(&g.loop, evs, ARRAY_SIZE(evs));
+		stats_high_water_update(STATS_HW_EVENTS, n, ARRAY_SIZE(evs));
+		resized = 0;
+		g.stats_tick = 0;
+		for(i = 0; i < n; i++) {
+			switch(evs[i].type) {
+			case EVLOOP_KEY:
+				if(fifo_avail(&g.input_pipe) < 1)
+					err_warn(0, "ui input buffer is full, dropped key");
+				else {
+					fifo_push(&g.input_pipe, &evs[i].ch);
+					stats_high_water_update(STATS_HW_INPUT, 
+						fifo_amt(&g.input_pipe), ARRAY_SIZE(g.input_buf));
+				}
+				break;
+			case EVLOOP_SHUTDOWN:
+				g.shutdown = 1;
+				/* fall through */
+			case EVLOOP_CMD_KEY:
+				done = 1;
+				break;
+			case EVLOOP_RESIZE:
+				resized = 1;
+				break;
+			case EVLOOP_TIMER:
+				ui_t_on_timer(evs[i].timer);
+				break;
+			}
 		}
 
-		/* both branches unlock g.mtx */
-		if(g.sig_dims_changed != 0) {
-			clr_sig_dims_changed();
-			UI_UNLOCK(status);
+		if(done != 0)
+			break;
+
+		if(g.stats_tick != 0 || g.db_changed != 0)
+			do_render = 1;
 
+		if(resized != 0) {
 			window_end();
 			ui_state_dims_changed();
 			if(window_start() != 0) {
 				aug_log(WINDOW_TOO_SMALL_MSG);
-				/* UI should be unlocked at refresh, so leave lock state as is */
-				goto refresh; 
+				goto refresh; /* the window is already ended */
 			}
 			do_render = 1;
 		}
-		else {
-			UI_UNLOCK(status);
-		}
 
 		while(fifo_amt(&g.input_pipe) > 0) {
-			UI_LOCK_PIPE(status);
 			aug_log("consume input\n");
-			/* no aug API calls in this function, so we shouldnt be in danger of 
-			 * circular dependencies */
 			amt = ui_state_consume(&g.input_pipe);
-			UI_UNLOCK_PIPE(status);
 
 			/* we render on amt > 0, so if it is 0 and act_on_state
 			 * sets it to 1 we will render. */
 			aug_log("act on state\n");
 			act_on_state(&brk, &amt);
 			if(brk != 0)
-				break; /* breaking here leaves g.mtx unlocked */
-			if(amt > 0) {
-				if(render() != 0) {
-					/* jumps to the end of the function leaving g.mtx unlocked */
-					goto refresh;  /* window_end() was called by render() so we can skip it */
-				}
-				do_render = 0;
-			}
+				break;
+			if(amt > 0)
+				do_render = 1;
 		} /* while(data in fifo) */
 		
-		if(do_render) {
-			if(render() != 0) {
-				/* jumps to the end of the function leaving g.mtx unlocked */
-				goto refresh;  /* window_end() was called by render() */
-			}
-			do_render = 0;
-		}
-
 		if(brk != 0)
-			break; /* breaking here leaves g.mtx unlocked */
-
-		UI_LOCK_PIPE(status);
-		if(fifo_amt(&g.input_pipe) > 0) {
-			UI_UNLOCK_PIPE(status);
-			continue;
-		}
-		UI_UNLOCK_PIPE(status);
-
-		/*aug_log("interact: wait\n");*/
-		UI_LOCK(status);
-		g.waiting = 1;
-		if( (status = pthread_cond_wait(&g.wakeup, &g.mtx)) != 0)
-			err_panic(status, "error in condition wait");
-		g.waiting = 0;
-		UI_UNLOCK(status);
-		/*aug_log("interact: wokeup\n");*/
+			break;
+		ui_t_stats_timer_update();
+		window_frame_end();
 	} /* while(1) */
 	ui_state_interact_end();
+	ui_t_stats_timer_update();
 		
 	window_end();
 refresh:
+	if(g.db_timer >= 0)
+		ui_timer_stop(g.db_timer);
+	g.interacting = 0;
 	window_refresh();
 	aug_log("interact: end\n");
 } /* interact */
 
 static void *ui_t_run(void *user) {
-	int status;
+	struct evloop_event evs[UI_EVENTS_MAX];
+	size_t i, n;
+	int toggled;
 
 	(void)(user);
 
-	UI_LOCK(status);
-	while(1) {
-		g.waiting = 1;
-		if( (status = pthread_cond_wait(&g.wakeup, &g.mtx) ) != 0)
-			err_panic(status, "error in condition wait");
-		g.waiting = 0;
+	while(g.shutdown == 0) {
+		n = evloop_wait(&g.loop, evs, ARRAY_SIZE(evs));
+		toggled = 0;
+		for(i = 0; i < n; i++) {
+			switch(evs[i].type) {
+			case EVLOOP_SHUTDOWN:
+				g.shutdown = 1;
+				break;
+			case EVLOOP_CMD_KEY:
+				/* two presses before we woke up open and close the ui */
+				toggled = !toggled;
+				break;
+			case EVLOOP_TIMER:
+				ui_t_on_timer(evs[i].timer);
+				break;
+			default:
+				/* keys and resizes only matter during interaction */
+				;
+			}
+		}
 
-		if(g.shutdown != 0)
-			break;
-		else if(g.sig_cmd_key != 0) {
-			clr_sig_cmd_key();
-			UI_UNLOCK(status);
+		if(g.shutdown == 0 && toggled != 0)
 			interact();
-			UI_LOCK(status);
-			/* shut down might be signaled during interaction */
-			if(g.shutdown != 0)
-				break;	
-		}
-		/* else "spurious wakeup". do nothing */
 	}
-	UI_UNLOCK(status);
 
 	return 0;
 }
-
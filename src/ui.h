@@ -22,10 +22,20 @@
 
 int ui_init();
 void ui_free();
-void ui_lock();
-void ui_unlock();
 void ui_on_cmd_key();
 int ui_on_input(const uint32_t *ch);
 void ui_on_dims_change(int rows, int cols);
 
+/* timer callbacks run on the ui thread, whether or not the ui
+ * window is open. these are not thread safe with each other, so
+ * only call them from the main thread or from a timer callback.
+ * returns a timer id or -1 if there are no free timers. */
+int ui_timer_start(unsigned int ms, int periodic, void (*fn)(void *), void *user);
+/* restart a started timer; this can be used to debounce work */
+void ui_timer_restart(int timer, unsigned int ms, int periodic);
+void ui_timer_stop(int timer);
+/* non-zero while the ui window is open, for timer callbacks to put
+ * off work that would hold up the keystrokes */
+int ui_interacting();
+
 #endif /* AUG_DB_UI_H */
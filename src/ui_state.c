@@ -22,6 +22,8 @@
 #include "query.h"
 #include "db.h"
 #include "encoding.h"
+#include "layout.h"
+#include "trace.h"
 
 #include <ccan/array_size/array_size.h>
 
@@ -54,11 +56,14 @@ const char *const g_query_cmds[] = {
 	"^G", "clear the value of the search term.",
 	"^N", "select the result below the current result.",
 	"^P", "select the result above the current result.",
-	"^]", "move selected result to trash."
+	"^]", "move selected result to trash.",
+	"^I", "complete the #tag at the end of the search term.",
+	"^T", "show statistics."
 };
 
 static int ui_state_consume_query(struct fifo *);
 static int ui_state_consume_help_query(struct fifo *);
+static int ui_state_consume_stats(struct fifo *);
 
 static void reset_query_selected() {
 	if(g.query_state.selected.data != NULL) 
@@ -88,6 +93,8 @@ void ui_state_free() {
 
 int ui_state_consume(struct fifo *input) {
 	int amt;
+
+	TRACE_SPAN_BEGIN(TRACE_SPAN_CONSUME, g.current);
 	switch(g.current) {
 	case UI_STATE_QUERY:
 		amt = ui_state_consume_query(input);
@@ -95,9 +102,13 @@ int ui_state_consume(struct fifo *input) {
 	case UI_STATE_HELP_QUERY:
 		amt = ui_state_consume_help_query(input);
 		break;
+	case UI_STATE_STATS:
+		amt = ui_state_consume_stats(input);
+		break;
 	default:
 		err_panic(0, "invalid state: %d", g.current);
 	}
+	TRACE_SPAN_END(TRACE_SPAN_CONSUME);
 
 	return amt;
 }
@@ -117,6 +128,22 @@ static int ui_state_consume_help_query(struct fifo *input) {
 	return amt+1;
 }
 
+static int ui_state_consume_stats(struct fifo *input) {
+	size_t amt;
+	uint32_t ch;
+	
+	if( (amt = fifo_amt(input)) > 0) {
+		fifo_pop(input, &ch);
+		if(ch == 'd' && trace_spans_path() != NULL) {
+			if(trace_spans_dump() == 0)
+				aug_log("wrote span trace to %s\n", trace_spans_path());
+		}
+		g.current = UI_STATE_QUERY;
+	} 
+
+	return amt+1;
+}
+
 static int ui_state_consume_query(struct fifo *input) {
 	size_t i, amt;
 	uint32_t ch;
@@ -153,6 +180,19 @@ static int ui_state_consume_query(struct fifo *input) {
 			g.current = UI_STATE_HELP_QUERY;
 			brk = 1;
 			break;
+		case 0x14: /* ^T */
+			aug_log("transition to stats state\n");
+			g.current = UI_STATE_STATS;
+			brk = 1;
+			break;
+		case 0x09: /* tab */
+			/* otherwise it chooses like any other key */
+			if(query_complete_tag(&g.query_state.q) != 0)
+				break;
+			g.query_state.cmd = UI_QUERY_CMD_CHOOSE;
+			g.query_state.run_ch = ch;
+			brk = 1;
+			break;
 		case 0x1d: /* ^] */
 			g.query_state.cmd = UI_QUERY_CMD_TRASH;
 			brk = 1;
@@ -240,7 +280,7 @@ int ui_state_query_run_cmd() {
 }
 
 int ui_state_query_foreach_result(
-		int (*fn)(uint8_t *data, size_t n, int raw, int id, int i, void *user),
+		int (*fn)(const uint8_t *data, size_t n, int raw, int id, int i, void *user),
 		void *user) {
 
 	return query_foreach_result(&g.query_state.q, fn, user);
@@ -277,6 +317,9 @@ void ui_state_help_query_value(const char **key, const char **desc) {
 }
 
 void ui_state_dims_changed() {
+	/* every blob will wrap differently */
+	layout_clear();
+
 	switch(g.current) {
 	case UI_STATE_HELP_QUERY:
 		ui_state_help_query_reset();
@@ -288,7 +331,8 @@ void ui_state_dims_changed() {
 
 void ui_state_interact_end() {
 	switch(g.current) {
-	case UI_STATE_HELP_QUERY:
+	case UI_STATE_HELP_QUERY: /* fall through */
+	case UI_STATE_STATS:
 		g.current = UI_STATE_QUERY;
 		break;
 	default:
@@ -26,7 +26,8 @@
 typedef enum {
 	UI_STATE_QUERY = 0,
 	UI_STATE_HELP_QUERY,
-	UI_STATE_EDIT
+	UI_STATE_EDIT,
+	UI_STATE_STATS
 } ui_state_name;
 
 typedef enum {
@@ -56,7 +57,7 @@ int ui_state_query_selected_result(const uint8_t **data, size_t *size,
 int ui_state_query_run_cmd();
 
 int ui_state_query_foreach_result(
-		int (*fn)(uint8_t *data, size_t n, int raw, int id, int i, void *user),
+		int (*fn)(const uint8_t *data, size_t n, int raw, int id, int i, void *user),
 		void *user);
 
 void ui_state_help_query_reset();
@@ -19,6 +19,9 @@
 #define AUG_DB_UTIL_H
 
 #include <wordexp.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/time.h>
 #include <ccan/str_talloc/str_talloc.h>
 #include <ccan/talloc/talloc.h>
 
@@ -30,5 +33,20 @@ char *util_tal_join(const void *ctx, char **strings,
 char *util_tal_multiply(const void *ctx, const char *s, 
 		const char *delim, size_t n);
 
+/* nanoseconds on a monotonic clock */
+static inline uint64_t util_now_ns() {
+#ifdef __APPLE__
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return ((uint64_t) tv.tv_sec)*1000000000 + ((uint64_t) tv.tv_usec)*1000;
+#else
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t) ts.tv_sec)*1000000000 + ts.tv_nsec;
+#endif
+}
+
 
 #endif /* AUG_DB_UTIL_H */
@@ -15,11 +15,23 @@
  * You should have received a copy of the GNU General Public License
  * along with aug-db.  If not, see <http://www.gnu.org/licenses/>.
  */
+/* for wcwidth */
+#ifndef _XOPEN_SOURCE
+#	define _XOPEN_SOURCE 700
+#endif
 #include "window.h"
 
+#include <wchar.h>
+
 #include "err.h"
 #include "ui_state.h"
 #include "lock.h"
+#include "layout.h"
+#include "arena.h"
+#include "stats.h"
+#include "mem.h"
+#include "util.h"
+#include "trace.h"
 
 static struct {
 	PANEL *panel;
@@ -28,10 +40,85 @@ static struct {
 	WINDOW *win;
 	WINDOW *search_win;
 	WINDOW *result_win;
+	/* our id with the memory accountant */
+	int mem_id;
 } g;
 
+/* a query result copied out of the db, so that the query can
+ * run before the screen is locked */
+struct window_result {
+	uint8_t *data;
+	size_t size;
+	int raw;
+	int id;
+};
+
+/* the frame arena starts out this big and grows to fit the
+ * biggest frame */
+#define WINDOW_FRAME_ARENA_SIZE (16*1024)
+
+struct window_frame {
+	/* the results and their data are in g_frame */
+	struct window_result *results;
+	size_t n;
+	size_t max;
+	/* returns non-zero if the frame should be abandoned */
+	int (*stale)();
+	int abandoned;
+};
+
+/* the rows of the result window as they are (or will be) on
+ * the screen. rendering lays results out into one of these
+ * and then only paints the rows that differ from the one
+ * that was painted last. */
+struct window_lines {
+	int rows;
+	int cols;
+	/* characters available for each row in buf */
+	size_t stride;
+	wchar_t *buf;
+	/* characters used by each row */
+	size_t *len;
+	/* screen cells used by each row */
+	int *width;
+	/* number of rows in use */
+	int n;
+};
+
+/* what is currently on the screen. this is only touched
+ * by the ui thread so it isnt protected by g.mtx. */
+static struct {
+	/* zero if the screen contents are unknown, e.g. because
+	 * the window was just created or the help screen was drawn */
+	int valid;
+	/* parent of everything below. allocated in window_start */
+	void *ctx;
+	uint32_t *query;
+	size_t query_n;
+	/* query only grows, so that it isnt reallocated every frame */
+	size_t query_cap;
+	/* zero if painting was abandoned part way through, in which
+	 * case the front lines are still right but the ids are not */
+	int ids_valid;
+	int *ids;
+	size_t ids_n;
+	/* lines[front] is on the screen, the other is scratch space */
+	struct window_lines lines[2];
+	int front;
+} g_painted;
+
+/* memory that only has to last until the end of the current 
+ * frame, see window_frame_end. only touched by the ui thread. */
+static struct arena g_frame;
+
 static void window_reset_vars();
-static void render_results(WINDOW *);
+static void painted_alloc(int, int);
+static void painted_free();
+static size_t painted_usage(void *);
+static void fetch_results(struct window_frame *, int);
+static int layout_results(struct window_lines *, const struct window_frame *);
+static int paint_results(WINDOW *, const struct window_lines *, 
+		const struct window_lines *, int (*)(), int *);
 
 int window_init() {
 	int status;
@@ -41,6 +128,10 @@ int window_init() {
 	}
 	g.off = 1;
 	window_reset_vars();
+	layout_init();
+	arena_init(&g_frame, WINDOW_FRAME_ARENA_SIZE);
+	/* the painted lines are needed, so they are only counted */
+	g.mem_id = mem_register("window", MEM_PRIO_NONE, painted_usage, NULL, NULL);
 
 	return 0;
 }
@@ -52,6 +143,10 @@ static void window_reset_vars() {
 
 void window_free() {
 	int status;
+
+	mem_unregister(g.mem_id);
+	layout_free();
+	arena_free(&g_frame);
 	if( (status = pthread_mutex_destroy(&g.mtx)) != 0)
 		err_warn(status, "failed to destroy window mutex");
 }
@@ -116,6 +211,9 @@ int window_start() {
 #undef WIN_COLS
 #undef WIN_SEARCH_ROW
 
+	getmaxyx(g.result_win, rows, cols);
+	painted_alloc(rows, cols);
+
 	/* TODO: turning this on causes keys to be
 	 * interpreted as unicode characters. at some 
 	 * point this should be turned off and we should
@@ -155,6 +253,7 @@ void window_end() {
 	aug_unlock_screen();
 
 	aug_screen_panel_dealloc(g.panel);
+	painted_free();
 
 	window_reset_vars();
 	WINDOW_LOCK(status);
@@ -162,13 +261,52 @@ void window_end() {
 	WINDOW_UNLOCK(status);
 }
 
+static void lines_alloc(struct window_lines *lines, int rows, int cols) {
+	lines->rows = rows;
+	lines->cols = cols;
+	/* same limit as the lines of a layout */
+	lines->stride = (size_t) cols*2;
+	lines->buf = talloc_array(g_painted.ctx, wchar_t, lines->stride*rows);
+	lines->len = talloc_zero_array(g_painted.ctx, size_t, rows);
+	lines->width = talloc_zero_array(g_painted.ctx, int, rows);
+	lines->n = 0;
+}
+
+static void painted_alloc(int rows, int cols) {
+	g_painted.ctx = talloc_new(NULL);
+	g_painted.valid = 0;
+	g_painted.ids_valid = 0;
+	g_painted.query = NULL;
+	g_painted.query_n = 0;
+	g_painted.query_cap = 0;
+	/* every result takes at least two rows, see fetch_results */
+	g_painted.ids = talloc_array(g_painted.ctx, int, (rows > 1)? (rows+1)/2 : 1);
+	g_painted.ids_n = 0;
+	lines_alloc(&g_painted.lines[0], rows, cols);
+	lines_alloc(&g_painted.lines[1], rows, cols);
+	g_painted.front = 0;
+}
+
+static void painted_free() {
+	talloc_free(g_painted.ctx);
+	g_painted.ctx = NULL;
+	g_painted.valid = 0;
+}
+
+static size_t painted_usage(void *user) {
+	(void)(user);
+	return mem_talloc_usage(g_painted.ctx) + arena_usage(&g_frame);
+}
+
 void window_ncwin(WINDOW **win) {
 	*win = g.win;
 }
 
 static inline void aug_doupdate() {
+	TRACE_SPAN_BEGIN(TRACE_SPAN_DOUPDATE, 0);
 	aug_screen_panel_update();
 	aug_screen_doupdate();
+	TRACE_SPAN_END(TRACE_SPAN_DOUPDATE);
 }
 
 void window_refresh() {
@@ -183,11 +321,16 @@ static inline void wsync(WINDOW *win) {
 	wcursyncup(win);
 }
 
-#define WADDCH(_win, _ch) \
+#define WADDNSTR(_win, _str, _n) \
 	do { \
-		if(waddch(_win, _ch) == ERR) { err_warn(0, "failed to write char to window"); } \
+		if(waddnstr(_win, _str, _n) == ERR) { err_warn(0, "failed to write string to window"); } \
 	} while(0)
-	
+
+#define WADDNWSTR(_win, _str, _n) \
+	do { \
+		if(waddnwstr(_win, _str, _n) == ERR) { err_warn(0, "failed to write string to window"); } \
+	} while(0)
+
 #define WPRINTW(_win, ...) \
 	do { \
 		if(wprintw(_win, __VA_ARGS__) == ERR) { err_warn(0, "failed to printw to window"); } \
@@ -208,8 +351,8 @@ static inline void wsync(WINDOW *win) {
 	} while(0)
 
 static void window_render_help_query() {
-	size_t amt, remain, i;
-	int y, x, rows, cols;
+	size_t amt, remain;
+	int y, x, rows, cols, avail;
 	const char *key, *desc;
 
 	/*aug_log("render help query\n");*/
@@ -237,18 +380,12 @@ static void window_render_help_query() {
 		/* there should always be enough columns for this
 		 * b.c. window_start asserts cols >= 20 */
 		WPRINTW(g.win, "%s\t", key);
+		getyx(g.win, y, x);
+		/* dont write the last cell of the window */
+		avail = (y == rows-1)? cols-1-x : cols-x;
 		amt = strlen(desc);
-		for(i = 0; i < amt; i++) {
-			getyx(g.win, y, x);
-			if(x == cols-1) {
-				WADDCH(g.win, desc[i]);
-				break;
-			}
-			else if(x > cols-1)
-				break;
-				
-			WADDCH(g.win, desc[i]);
-		}
+		if(avail > 0)
+			WADDNSTR(g.win, desc, (amt < (size_t) avail)? (int) amt : avail);
 
 		y += 1;
 		if(y >= rows)
@@ -262,134 +399,379 @@ static void window_render_help_query() {
 	aug_doupdate();
 unlock:
 	aug_unlock_screen();
+	/* the whole window was erased */
+	g_painted.valid = 0;
+}
+
+static void window_render_stats() {
+	size_t i, n, amt;
+	int rows, cols, avail;
+	char **lines;
+
+	/* this runs a few queries, so do it before taking the lock */
+	lines = stats_report(NULL, &n);
+	aug_lock_screen();
+
+	WERASE(g.win);
+	getmaxyx(g.win, rows, cols);
+	for(i = 0; i < n && (int) i < rows; i++) {
+		/* dont write the last cell of the window */
+		avail = ((int) i == rows-1)? cols-1 : cols;
+		amt = strlen(lines[i]);
+		WMOVE(g.win, (int) i, 0);
+		if(avail > 0)
+			WADDNSTR(g.win, lines[i], (amt < (size_t) avail)? (int) amt : avail);
+	}
+
+	wsync(g.win);
+	aug_doupdate();
+	aug_unlock_screen();
+	talloc_free(lines);
+	/* the whole window was erased */
+	g_painted.valid = 0;
+}
+
+#define SEARCH_PREFIX L"(search)`"
+#define SEARCH_SUFFIX L"':"
+
+static void render_search(WINDOW *win, const uint32_t *query, size_t n) {
+	size_t i, len, plen, slen;
+	int rows, cols, x, w;
+	wchar_t *line;
+
+	getmaxyx(win, rows, cols);
+	(void)(rows);
+	plen = wcslen(SEARCH_PREFIX);
+	slen = wcslen(SEARCH_SUFFIX);
+	line = arena_array(&g_frame, wchar_t, plen + n + slen);
+
+	wmemcpy(line, SEARCH_PREFIX, plen);
+	len = plen;
+	x = (int) plen;
+	for(i = 0; i < n; i++) {
+		if( (w = wcwidth((wchar_t) query[i])) < 0)
+			w = 1;
+		/* leave room for the suffix and never use the last cell */
+		if(x + w > cols - 1 - (int) slen) {
+			aug_log("exceeded window width of %d\n", cols);
+			break;
+		}
+		line[len++] = (wchar_t) query[i];
+		x += w;
+	}
+	wmemcpy(line + len, SEARCH_SUFFIX, slen);
+	len += slen;
+
+	WMOVE(win, 0, 0);
+	WADDNWSTR(win, line, (int) len);
+	wclrtoeol(win);
+}
+
+#undef SEARCH_PREFIX
+#undef SEARCH_SUFFIX
+
+static int query_changed(const uint32_t *query, size_t n) {
+	if(!g_painted.valid || n != g_painted.query_n)
+		return 1;
+
+	return n > 0 && memcmp(query, g_painted.query, n*sizeof(*query)) != 0;
+}
+
+static int results_changed(const struct window_frame *frame) {
+	size_t i;
+
+	if(!g_painted.valid || !g_painted.ids_valid || frame->n != g_painted.ids_n)
+		return 1;
+
+	/* blobs are never edited, so the same ids means the same text */
+	for(i = 0; i < frame->n; i++)
+		if(frame->results[i].id != g_painted.ids[i])
+			return 1;
+
+	return 0;
+}
+
+static inline wchar_t *lines_row(const struct window_lines *lines, int y) {
+	return lines->buf + lines->stride*y;
+}
+
+/* the first @rows rows of @src have been painted over @dst */
+static void lines_copy_rows(struct window_lines *dst, 
+		const struct window_lines *src, int rows) {
+	int y;
+
+	for(y = 0; y < rows; y++) {
+		if(y < src->n) {
+			wmemcpy(lines_row(dst, y), lines_row(src, y), src->len[y]);
+			dst->len[y] = src->len[y];
+			dst->width[y] = src->width[y];
+		}
+		else
+			dst->len[y] = dst->width[y] = 0;
+	}
+
+	/* rows after @rows are still the old ones */
+	if(dst->n <= rows)
+		dst->n = (src->n < rows)? src->n : rows;
 }
 
-static void window_render_query() {
+/* returns -1 if the frame was abandoned because @stale returned
+ * non-zero before it was completely painted */
+static int window_render_query(int (*stale)()) {
 	const uint32_t *query;
 	size_t n, i;
-	int rows, cols, x, y;
-	cchar_t cch;
-	attr_t attr, *ap;
-	short pair, *pp;
+	int rows, cols, q_changed, r_changed, status, stop;
+	uint64_t t0;
+	struct window_frame frame;
+	struct window_lines *front, *back;
 
 	/*aug_log("render query\n");*/
 	err_assert(g.win != NULL);
 
+	/* the window is only resized by this thread, so its
+	 * dimensions can be read without the screen lock */
+	getmaxyx(g.result_win, rows, cols);
+	(void)(cols);
+	frame.stale = stale;
+	t0 = util_now_ns();
+	fetch_results(&frame, rows);
+	status = -1;
+	if(frame.abandoned != 0)
+		goto done;
+	stats_latency_add(STATS_LAT_QUERY, util_now_ns() - t0);
+
 	ui_state_query_value(&query, &n);
+	q_changed = query_changed(query, n);
+	r_changed = results_changed(&frame);
+	status = 0;
+	if(!q_changed && !r_changed)
+		goto done;
+
+	front = &g_painted.lines[g_painted.front];
+	back = &g_painted.lines[!g_painted.front];
+	status = -1;
+	if(r_changed && layout_results(back, &frame) != 0)
+		goto done;
+
 	aug_lock_screen();
 
-	WERASE(g.search_win);
-	WMOVE(g.search_win, 0, 0);
-	getmaxyx(g.search_win, rows, cols);
-	WPRINTW(g.search_win, "(search)`");
-	if(n > 0) 
-		for(i = 0; i < n; i++) {
-			getyx(g.search_win, y, x);
-			/* if x >= cols-1-2 then the WPRINTW will fail */
-			if(y >= rows || x >= (cols-1-2) ) {
-				aug_log("exceeded window size of %d,%d\n", rows, cols);
-				break;
-			}
-
-			ap = &attr;
-			pp = &pair;
-			if(wattr_get(g.search_win, ap, pp, NULL) == ERR)
-				err_panic(0, "wattr_get failed");
-			if(setcchar(&cch, (wchar_t *)&query[i], attr, pair, NULL) == ERR)
-				err_panic(0, "setcchar failed");
-			if(wadd_wch(g.search_win, &cch) == ERR)
-				err_panic(0, "wadd_wch failed");
+	if(q_changed)
+		render_search(g.search_win, query, n);
+	if(!g_painted.valid)
+		/* paint_results will erase the window */
+		front->n = 0;
+	if(r_changed && paint_results(g.result_win, back, 
+			g_painted.valid? front : NULL, stale, &stop) != 0) {
+		/* leave the update to the next frame */
+		aug_unlock_screen();
+		lines_copy_rows(front, back, stop);
+		g_painted.ids_valid = 0;
+	}
+	else {
+		/* update. the search window is synced last so that
+		 * the cursor ends up in the search bar */
+		wsync(g.result_win);
+		wsync(g.search_win);
+		aug_doupdate();
+		
+		aug_unlock_screen();	
+
+		if(r_changed) {
+			for(i = 0; i < frame.n; i++)
+				g_painted.ids[i] = frame.results[i].id;
+			g_painted.ids_n = frame.n;
+			g_painted.ids_valid = 1;
+			g_painted.front = !g_painted.front;
 		}
+		status = 0;
+	}
 
-	WPRINTW(g.search_win, "':");
+	if(q_changed) {
+		if(n+1 > g_painted.query_cap) {
+			g_painted.query_cap = (n+1 > 64)? (n+1)*2 : 64;
+			g_painted.query = talloc_realloc(g_painted.ctx, g_painted.query, 
+					uint32_t, g_painted.query_cap);
+		}
+		memcpy(g_painted.query, query, n*sizeof(*query));
+		g_painted.query_n = n;
+	}
+	g_painted.valid = 1;
+done:
+	return status;
+}
 
-	render_results(g.result_win);
+static int layout_result(struct window_lines *lines, int *y, 
+		const struct window_result *r) {
+	const struct layout *l;
+	const struct layout_line *line;
+	size_t i, len;
+	int j, width;
 
-	/* update */
-	wsync(g.result_win);
-	wsync(g.search_win);
-	aug_doupdate();
-	
-	aug_unlock_screen();	
+	if(*y >= lines->rows - 1)
+		return -1;
+
+	for(j = 0; j < lines->cols; j++)
+		lines_row(lines, *y)[j] = L'-';
+	lines->len[*y] = lines->cols;
+	lines->width[*y] = lines->cols;
+	lines->n = *y + 1;
+	*y += 1;
+
+	l = layout_get(r->id, lines->cols, lines->rows - *y, 
+			r->data, r->size, r->raw);
+	for(i = 0; i < l->n; i++) {
+		if(*y >= lines->rows)
+			return -1;
+
+		line = &l->lines[i];
+		len = line->len;
+		width = line->width;
+		/* the last cell of the last row is never used so 
+		 * that curses doesnt try to scroll the window */
+		if(*y == lines->rows - 1)
+			while(len > 0 && width > lines->cols - 1)
+				width -= line->widths[--len];
+
+		wmemcpy(lines_row(lines, *y), line->text, len);
+		lines->len[*y] = len;
+		lines->width[*y] = width;
+		lines->n = *y + 1;
+		*y += 1;
+	}
+
+	return (l->truncated != 0)? -1 : 0;
 }
 
-static int result_cb_fn(uint8_t *result, size_t rsize, int raw, int id, int idx, void *user) {
-	int j, rows, cols, x, y;
+/* returns -1 if the frame is stale */
+static int layout_results(struct window_lines *lines, const struct window_frame *frame) {
 	size_t i;
-	char esc[5];
-	WINDOW *win;
-	(void)(idx);
-	(void)(id);
+	int y;
+
+	lines->n = 0;
+	y = 0;
+	for(i = 0; i < frame->n; i++) {
+		if( (*frame->stale)() != 0)
+			return -1;
+		if(layout_result(lines, &y, &frame->results[i]) != 0)
+			break;
+	}
+
+	return 0;
+}
 
-	win = (WINDOW *) user;
+static int row_equal(const struct window_lines *a, const struct window_lines *b, int y) {
+	int an, bn;
 
-#define CHECK_FOR_SPACE() \
-	do { \
-		getyx(win, y, x); \
-		if(y >= rows - 1 && x >= cols - 1) { \
-			return -1; \
-		} \
-	} while(0)
+	an = (y < a->n)? a->width[y] : 0;
+	bn = (y < b->n)? b->width[y] : 0;
+	if(an == 0 && bn == 0)
+		return 1;
+	if(y >= a->n || y >= b->n || a->len[y] != b->len[y])
+		return 0;
 
+	return wmemcmp(lines_row(a, y), lines_row(b, y), a->len[y]) == 0;
+}
 
-	getmaxyx(win, rows, cols);
+/* must be called with the screen locked. paints the rows of @lines
+ * that differ from @prev, or the whole window if @prev is NULL. 
+ * if @stale returns non-zero before a row is painted, *stop is set
+ * to that row and -1 is returned. */
+static int paint_results(WINDOW *win, const struct window_lines *lines,
+		const struct window_lines *prev, int (*stale)(), int *stop) {
+	int y, n;
+	/*aug_log("window: paint results\n");*/
+
+	if(prev == NULL)
+		WERASE(win);
+
+	n = lines->n;
+	if(prev != NULL && prev->n > n)
+		n = prev->n;
+
+	for(y = 0; y < n; y++) {
+		if(prev == NULL) {
+			if(y >= lines->n || lines->width[y] == 0)
+				continue;
+		}
+		else if(row_equal(lines, prev, y))
+			continue;
 
-	/*aug_log("window: render query result\n");*/
-	getyx(win, y, x); 
-	if(y >= rows - 1)
-		return -1;
+		if( (*stale)() != 0) {
+			*stop = y;
+			return -1;
+		}
 
-	for(j = 0; j < cols; j++) {
-		WADDCH(win, '-');
+		WMOVE(win, y, 0);
+		if(y < lines->n && lines->len[y] > 0)
+			WADDNWSTR(win, lines_row(lines, y), (int) lines->len[y]);
+		/* a full row leaves the cursor on the next row */
+		if(y >= lines->n || lines->width[y] < lines->cols)
+			wclrtoeol(win);
 	}
 
-	for(i = 0; i < rsize; i++) {
-		CHECK_FOR_SPACE();
+	return 0;
+}
 
-		if(raw == 0) {
-			if(result[i] == '\n' && y >= rows - 1)
-				return -1;
-			WADDCH(win, result[i]);
-		}
-		else {
-			if(result[i] >= 0x20 && result[i] <= 0x7e)
-				WADDCH(win, result[i]);
-			else {
-				snprintf(esc, 5, "\\x%02x", result[i]);
-				for(j = 0; j < 4; j++) {
-					CHECK_FOR_SPACE();
-					WADDCH(win, esc[j]);
-				}
-			}
-		}
+static int fetch_cb_fn(const uint8_t *result, size_t rsize, int raw, int id, int idx, void *user) {
+	struct window_frame *frame;
+	struct window_result *r;
+	(void)(idx);
+
+	frame = (struct window_frame *) user;
+	if( (*frame->stale)() != 0) {
+		frame->abandoned = 1;
+		return -1;
 	}
-	waddch(win, '\n');
 
-#undef CHECK_FOR_SPACE
-	return 0;
+	r = &frame->results[frame->n++];
+	r->size = rsize;
+	r->raw = raw;
+	r->id = id;
+	r->data = NULL;
+	if(rsize > 0) {
+		r->data = arena_array(&g_frame, uint8_t, rsize);
+		memcpy(r->data, result, rsize);
+	}
+
+	return (frame->n < frame->max)? 0 : -1;
 }
 
-static void render_results(WINDOW *win) {
-	/*aug_log("window: render results\n");*/
+/* run the query and copy out as many results as could
+ * fit in @rows rows of the result window. every result takes
+ * at least a separator row and one row of data. */
+static void fetch_results(struct window_frame *frame, int rows) {
+	frame->max = (rows > 1)? (rows+1)/2 : 1;
+	frame->n = 0;
+	frame->abandoned = 0;
+	frame->results = arena_array(&g_frame, struct window_result, frame->max);
 
-	WERASE(win);
-	WMOVE(win, 0, 0);
+	ui_state_query_foreach_result(fetch_cb_fn, frame);
+}
 
-	ui_state_query_foreach_result(result_cb_fn, win);
+void window_frame_end() {
+	arena_reset(&g_frame);
 }
 
-void window_render() {
+int window_render(int (*stale)()) {
 	ui_state_name state;
+	int status;
 
 	switch( (state = ui_state_current()) ) {
 	case UI_STATE_QUERY:
-		window_render_query();
-		break;
+		TRACE_SPAN_BEGIN(TRACE_SPAN_RENDER_QUERY, 0);
+		status = window_render_query(stale);
+		TRACE_SPAN_END(TRACE_SPAN_RENDER_QUERY);
+		return status;
 	case UI_STATE_HELP_QUERY:
 		window_render_help_query();
 		break;
+	case UI_STATE_STATS:
+		window_render_stats();
+		break;
 	default:
 		err_panic(0, "invalid ui state %d", state);
 	}
+
+	return 0;
 }
 
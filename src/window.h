@@ -28,7 +28,15 @@ int window_off();
 int window_start();
 void window_end();
 void window_refresh();
-void window_render();
+/* renders the current ui state. rendering checks @stale every so
+ * often and gives up on the frame (returning -1) once it returns 
+ * non-zero, e.g. because there is newer input that will change 
+ * what needs to be rendered anyway. */
+int window_render(int (*stale)());
+/* gives back the memory used by the frames rendered so far. 
+ * nothing from a frame is used after it has been rendered, so
+ * this can be called any time between frames. */
+void window_frame_end();
 void window_ncwin(WINDOW **win);
 
 #endif /* AUG_DB_WINDOW_H */
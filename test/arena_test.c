@@ -0,0 +1,89 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ccan/tap/tap.h>
+#include <ccan/array_size/array_size.h>
+#include <locale.h>
+
+#include "test.h"
+#include "arena.h"
+
+struct test {
+	void (*fn)();
+	int amt;
+};
+
+void test1() {
+	struct arena a;
+	uint8_t *p, *q;
+
+	diag("++++test1++++");
+	arena_init(&a, 64);
+	p = arena_alloc(&a, 3);
+	q = arena_alloc(&a, 3);
+	ok1(p >= a.buf && p < a.buf + a.size);
+	ok1( ((uintptr_t) q) % 16 == 0 && q == p + 16);
+
+	/* reset hands out the same memory again */
+	arena_reset(&a);
+	ok1(arena_alloc(&a, 3) == p);
+	arena_free(&a);
+#define TEST1AMT 3
+	diag("----test1----\n#");
+}
+
+void test2() {
+	struct arena a;
+	uint8_t *p;
+	size_t size;
+
+	diag("++++test2++++");
+	arena_init(&a, 32);
+	size = a.size;
+	arena_alloc(&a, 16);
+	/* doesnt fit, so it comes from talloc */
+	p = arena_alloc(&a, 100);
+	ok1(p < a.buf || p >= a.buf + a.size);
+	memset(p, 0xaa, 100);
+	ok1(a.overflow != NULL);
+
+	/* after the reset the whole frame fits */
+	arena_reset(&a);
+	ok1(a.overflow == NULL);
+	ok(a.size >= 16 + 112 && a.size > size, "arena grew to %zu", a.size);
+	arena_alloc(&a, 16);
+	p = arena_alloc(&a, 100);
+	ok1(p >= a.buf && p + 100 <= a.buf + a.size);
+	ok1(a.overflow == NULL);
+	ok1(arena_usage(&a) >= a.size);
+	arena_free(&a);
+#define TEST2AMT 7
+	diag("----test2----\n#");
+}
+
+int main()
+{
+	int i, len, total_tests;
+#define TESTN(_num) {test##_num, TEST##_num##AMT}
+	struct test tests[] = {
+		TESTN(1),
+		TESTN(2)
+	};
+
+	setlocale(LC_ALL,"");
+	total_tests = 0;
+	len = ARRAY_SIZE(tests);
+	for(i = 0; i < len; i++) {
+		total_tests += tests[i].amt;
+	}
+
+	plan_tests(total_tests);
+
+	test_init_api();
+	for(i = 0; i < len; i++) {
+		(*tests[i].fn)();
+	}
+	test_free_api();
+
+	return exit_status();
+}
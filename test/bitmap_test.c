@@ -0,0 +1,198 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ccan/tap/tap.h>
+#include <ccan/array_size/array_size.h>
+#include <locale.h>
+
+#include "test.h"
+#include "bitmap.h"
+
+struct test {
+	void (*fn)();
+	int amt;
+};
+
+/* ids up to this are compared with a plain array of flags. it 
+ * spans a few containers. */
+#define RANGE (3*65536 + 1000)
+
+static uint64_t g_rng = 88172645463325252ULL;
+
+static uint32_t rnd() {
+	g_rng ^= g_rng << 13;
+	g_rng ^= g_rng >> 7;
+	g_rng ^= g_rng << 17;
+	return (uint32_t) g_rng;
+}
+
+/* puts @n random ids below RANGE into @b and @flags */
+static void fill(struct bitmap *b, char *flags, size_t n) {
+	size_t i;
+	uint32_t x;
+
+	memset(flags, 0, RANGE);
+	for(i = 0; i < n; i++) {
+		x = rnd() % RANGE;
+		bitmap_add(b, x);
+		flags[x] = 1;
+	}
+}
+
+/* returns non-zero if @b holds the ids set in @flags, in order */
+static int same(const struct bitmap *b, const char *flags) {
+	struct bitmap_iter it;
+	uint32_t x, expect;
+	size_t n;
+
+	bitmap_iter_init(&it, b, 0);
+	for(n = 0, expect = 0; bitmap_iter_next(&it, &x) == 0; n++, expect = x + 1) {
+		for(; expect < RANGE && flags[expect] == 0; expect++)
+			;
+		if(x != expect)
+			return 0;
+	}
+	for(; expect < RANGE && flags[expect] == 0; expect++)
+		;
+
+	return expect == RANGE && n == bitmap_count(b);
+}
+
+void test1() {
+	struct bitmap b;
+	struct bitmap_iter it;
+	uint32_t i, x;
+	int ok;
+
+	diag("++++test1++++");
+	bitmap_init(&b);
+	ok1(bitmap_add(&b, 7) == 1 && bitmap_add(&b, 7) == 0);
+	ok1(bitmap_add(&b, 1u << 31) == 1 && bitmap_add(&b, 3) == 1);
+	ok1(bitmap_contains(&b, 3) && bitmap_contains(&b, 1u << 31) && !bitmap_contains(&b, 8));
+	ok1(bitmap_count(&b) == 3);
+
+	bitmap_iter_init(&it, &b, 0);
+	ok1(bitmap_iter_next(&it, &x) == 0 && x == 3);
+	ok1(bitmap_iter_next(&it, &x) == 0 && x == 7);
+	ok1(bitmap_iter_next(&it, &x) == 0 && x == (1u << 31));
+	ok1(bitmap_iter_next(&it, &x) == -1);
+
+	ok1(bitmap_remove(&b, 7) == 1 && bitmap_remove(&b, 7) == 0);
+	ok1(bitmap_remove(&b, 1u << 31) == 1 && b.n == 1);
+
+	/* every other id of a container turns it into a bitset, and 
+	 * removing most of them back into an array */
+	for(i = 0; i < 65536; i += 2)
+		bitmap_add(&b, 65536 + i);
+	ok1(b.n == 2 && b.c[1].bits != 0 && bitmap_count(&b) == 1 + 32768);
+	for(ok = 1, i = 0; i < 65536; i++)
+		if( (bitmap_contains(&b, 65536 + i) != 0) != (i % 2 == 0) )
+			ok = 0;
+	ok1(ok);
+	for(i = 0; i < 65536 - 2*100; i += 2)
+		bitmap_remove(&b, 65536 + i);
+	ok1(b.c[1].bits == 0 && b.c[1].n == 100);
+	bitmap_iter_init(&it, &b, 65536 + 65000);
+	ok1(bitmap_iter_next(&it, &x) == 0 && x == 65536 + 65336);
+
+	bitmap_clear(&b);
+	ok1(bitmap_count(&b) == 0 && b.n == 0);
+	bitmap_free(&b);
+#define TEST1AMT 4 + 4 + 2 + 5
+	diag("----test1----\n#");
+}
+
+void test2() {
+	struct bitmap a, b, c;
+	char *fa, *fb, *fc;
+	/* sparse and dense, so that every kind of container meets 
+	 * every other */
+	static const size_t sizes[][2] = {
+		{50, 50}, {50, 150000}, {150000, 50}, {150000, 150000}, {5000, 9000}
+	};
+	size_t i, j;
+	int ok_or, ok_and, ok_andnot, ok_copy;
+
+	diag("++++test2++++");
+	fa = malloc(RANGE);
+	fb = malloc(RANGE);
+	fc = malloc(RANGE);
+	bitmap_init(&a);
+	bitmap_init(&b);
+	bitmap_init(&c);
+	ok_or = ok_and = ok_andnot = ok_copy = 1;
+	for(i = 0; i < ARRAY_SIZE(sizes); i++) {
+		bitmap_clear(&a);
+		bitmap_clear(&b);
+		fill(&a, fa, sizes[i][0]);
+		fill(&b, fb, sizes[i][1]);
+
+		bitmap_copy(&c, &a);
+		if(!same(&c, fa))
+			ok_copy = 0;
+
+		bitmap_or(&c, &b);
+		for(j = 0; j < RANGE; j++)
+			fc[j] = fa[j] | fb[j];
+		if(!same(&c, fc))
+			ok_or = 0;
+
+		bitmap_copy(&c, &a);
+		bitmap_and(&c, &b);
+		for(j = 0; j < RANGE; j++)
+			fc[j] = fa[j] & fb[j];
+		if(!same(&c, fc))
+			ok_and = 0;
+
+		bitmap_copy(&c, &a);
+		bitmap_andnot(&c, &b);
+		for(j = 0; j < RANGE; j++)
+			fc[j] = fa[j] & !fb[j];
+		if(!same(&c, fc))
+			ok_andnot = 0;
+	}
+	ok1(ok_copy);
+	ok1(ok_or);
+	ok1(ok_and);
+	ok1(ok_andnot);
+
+	/* the source is left alone */
+	ok1(same(&b, fb));
+	ok1(bitmap_usage(&b) > 0);
+
+	bitmap_free(&a);
+	bitmap_free(&b);
+	bitmap_free(&c);
+	free(fa);
+	free(fb);
+	free(fc);
+#define TEST2AMT 4 + 2
+	diag("----test2----\n#");
+}
+
+int main()
+{
+	int i, len, total_tests;
+#define TESTN(_num) {test##_num, TEST##_num##AMT}
+	struct test tests[] = {
+		TESTN(1),
+		TESTN(2)
+	};
+
+	setlocale(LC_ALL,"");
+	total_tests = 0;
+	len = ARRAY_SIZE(tests);
+	for(i = 0; i < len; i++) {
+		total_tests += tests[i].amt;
+	}
+
+	plan_tests(total_tests);
+
+	test_init_api();
+	for(i = 0; i < len; i++) {
+		(*tests[i].fn)();
+	}
+	test_free_api();
+
+	return exit_status();
+}
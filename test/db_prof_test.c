@@ -0,0 +1,163 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <ccan/tap/tap.h>
+#include <ccan/array_size/array_size.h>
+#include <ccan/str/str.h>
+#include <unistd.h>
+#include <locale.h>
+
+#include "test.h"
+#include "db.h"
+#include "db_prof.h"
+
+struct test {
+	void (*fn)();
+	int amt;
+};
+
+const char *FILENAME = "/tmp/db_prof_test.sqlite";
+const char *LOGNAME = "/tmp/db_prof_test.log";
+
+static const char *g_tags[] = {"awk", "cmdline examples"};
+
+static uint64_t count(int shape) {
+	struct hist h;
+
+	db_prof_hist(shape, &h);
+	return h.count;
+}
+
+static int run_query(const char *query, size_t max_rows) {
+	const char *queries[] = {query};
+	struct db_query q;
+	size_t i;
+
+	db_query_prepare(&q, 0, (const uint8_t **) queries, (query != NULL)? 1 : 0, NULL, 0);
+	for(i = 0; i < max_rows && db_query_step(&q) == 0; i++)
+		;
+	db_query_free(&q);
+	return i;
+}
+
+void test1() {
+	struct hist h;
+	uint64_t inserts, commits, q1, q0;
+	char name[32];
+
+	diag("++++test1++++");
+	unlink(FILENAME);
+	ok1(db_init(FILENAME) == 0);
+
+	inserts = count(DB_PROF_INSERT);
+	commits = count(DB_PROF_COMMIT);
+	db_add("awk '{ print }' /etc/passwd", 27, 0, g_tags, ARRAY_SIZE(g_tags));
+	db_add("awk -F: '{ print $1 }' /etc/passwd", 35, 0, g_tags, ARRAY_SIZE(g_tags));
+	db_add("sed -i 's/a/b/' file", 20, 0, g_tags, 1);
+	/* one insert for each blob and blob/tag pair, the tags 
+	 * are only inserted once */
+	ok1(count(DB_PROF_INSERT) - inserts == 3 + 5 + 2);
+	ok1(count(DB_PROF_COMMIT) - commits == 3);
+
+	/* stepped to the end and stopped early both count once */
+	q1 = count(DB_PROF_SHAPE_QUERY(1, 0));
+	q0 = count(DB_PROF_SHAPE_QUERY(0, 0));
+	ok1(run_query("passwd", 100) == 2);
+	ok1(run_query("awk", 1) == 1);
+	ok1(count(DB_PROF_SHAPE_QUERY(1, 0)) - q1 == 2);
+	ok1(run_query(NULL, 100) == 3);
+	ok1(count(DB_PROF_SHAPE_QUERY(0, 0)) - q0 == 1);
+
+	db_prof_hist(DB_PROF_SHAPE_QUERY(1, 0), &h);
+	ok1(h.total > 0);
+	ok1(hist_pct(&h, 50) > 0);
+	ok1(hist_pct(&h, 50) <= hist_pct(&h, 99));
+	ok1(hist_pct(&h, 100) == h.max);
+
+	db_prof_shape_name(DB_PROF_SHAPE_QUERY(0, 0), name, sizeof(name));
+	ok1(strcmp(name, "query_empty") == 0);
+	db_prof_shape_name(DB_PROF_SHAPE_QUERY(2, 0), name, sizeof(name));
+	ok1(strcmp(name, "query_2q") == 0);
+	ok1(DB_PROF_SHAPE_QUERY(2, 3) == DB_PROF_SHAPE_QUERY(2, 1));
+	db_prof_shape_name(DB_PROF_SHAPE_QUERY(DB_PROF_MAX_INPUTS, 1), 
+			name, sizeof(name));
+	ok1(DB_PROF_SHAPE_QUERY(DB_PROF_MAX_INPUTS, 1) < DB_PROF_SHAPES);
+	ok1(strcmp(name, "query_9q_tags") == 0);
+
+	db_free();
+#define TEST1AMT 1 + 2 + 5 + 4 + 5
+	diag("----test1----\n#");
+}
+
+void test2() {
+	FILE *fp;
+	char buf[8192];
+	size_t n;
+
+	diag("++++test2++++");
+	unlink(LOGNAME);
+	ok1(db_init(FILENAME) == 0);
+
+	/* everything is slow */
+	ok1(db_slow_query_log(LOGNAME, 0) == 0);
+	ok1(run_query("passwd", 100) == 2);
+	db_free();
+
+	n = 0;
+	if( (fp = fopen(LOGNAME, "r")) != NULL) {
+		n = fread(buf, 1, sizeof(buf)-1, fp);
+		fclose(fp);
+	}
+	buf[n] = '\0';
+	diag("slow query log:\n%s", buf);
+	ok1(n > 0);
+	ok1(strstr(buf, "query_1q") != NULL);
+	/* the bound value */
+	ok1(strstr(buf, "'passwd'") != NULL);
+	/* a line of the query plan */
+	ok1(strstr(buf, "--   ") != NULL);
+
+	/* the log was closed by db_free */
+	ok1(db_init(FILENAME) == 0);
+	ok1(run_query("passwd", 100) == 2);
+	db_free();
+	if( (fp = fopen(LOGNAME, "r")) != NULL) {
+		ok1(fread(buf, 1, sizeof(buf)-1, fp) == n);
+		fclose(fp);
+	}
+	else
+		fail("failed to open %s", LOGNAME);
+
+	unlink(LOGNAME);
+	unlink(FILENAME);
+#define TEST2AMT 3 + 4 + 3
+	diag("----test2----\n#");
+}
+
+int main()
+{
+	int i, len, total_tests;
+#define TESTN(_num) {test##_num, TEST##_num##AMT}
+	struct test tests[] = {
+		TESTN(1),
+		TESTN(2)
+	};
+
+	setlocale(LC_ALL,"");
+	total_tests = 0;
+	len = ARRAY_SIZE(tests);
+	for(i = 0; i < len; i++) {
+		total_tests += tests[i].amt;
+	}
+
+	plan_tests(total_tests);
+
+	test_init_api();
+	for(i = 0; i < len; i++) {
+		(*tests[i].fn)();
+	}
+	test_free_api();
+
+	return exit_status();
+}
@@ -8,6 +8,7 @@
 #include <time.h>
 #include <unistd.h>
 #include <locale.h>
+#include <sys/wait.h>
 
 #include "test.h"
 #include "db.h"
@@ -152,6 +153,409 @@ void test4() {
 	db_free();
 }
 
+/* another process holds the write lock for @ms milliseconds. 
+ * returns once it has the lock. */
+static pid_t hold_lock(int ms) {
+	sqlite3 *handle;
+	int fds[2];
+	pid_t pid;
+	char ch;
+
+	if(pipe(fds) != 0 || (pid = fork()) < 0)
+		return -1;
+
+	if(pid == 0) {
+		close(fds[0]);
+		if(sqlite3_open(FILENAME, &handle) != SQLITE_OK
+				|| sqlite3_exec(handle, "BEGIN IMMEDIATE", NULL, NULL, NULL) != SQLITE_OK)
+			_exit(1);
+		if(write(fds[1], "x", 1) != 1)
+			_exit(1);
+		usleep(ms*1000);
+		sqlite3_exec(handle, "UPDATE blobs SET chosen_at = 1", NULL, NULL, NULL);
+		sqlite3_exec(handle, "COMMIT", NULL, NULL, NULL);
+		sqlite3_close(handle);
+		_exit(0);
+	}
+
+	close(fds[1]);
+	if(read(fds[0], &ch, 1) != 1)
+		pid = -1;
+	close(fds[0]);
+	return pid;
+}
+
+void test5() {
+	uint32_t gen;
+	uint64_t retries;
+	pid_t pid;
+	int status;
+	const char *tags[] = {"test5"};
+
+	db_init(FILENAME);
+	diag("++++test5++++");	
+
+	/* our own writes change the generation, reads dont */
+	gen = db_generation();
+	ok1(gen != 0);
+	db_counts(&status, &status, &status);
+	ok1(db_generation() == gen);
+	db_add("echo test5", 10, 0, tags, 1);
+	ok1(db_generation() != gen);
+
+	/* a write from another process waits for the lock and
+	 * then changes the generation too */
+	gen = db_generation();
+	retries = db_busy_retries();
+	ok1( (pid = hold_lock(100)) > 0);
+	db_trash(1);
+	ok(db_busy_retries() > retries, "waited %d times", 
+			(int) (db_busy_retries() - retries));
+	ok1(waitpid(pid, &status, 0) == pid && WIFEXITED(status) && WEXITSTATUS(status) == 0);
+	ok1(db_generation() != gen);
+
+#define TEST5AMT 3 + 4
+	diag("----test5----\n#");
+	db_free();
+}
+
+/* the ids of the first @max results of @query ("" for none) */
+static size_t query_ids(const char *query, int *ids, size_t max) {
+	const uint8_t *queries[1];
+	struct db_query q;
+	size_t n;
+	int raw;
+
+	queries[0] = (const uint8_t *) query;
+	db_query_prepare(&q, 0, queries, (query[0] != '\0')? 1 : 0, NULL, 0);
+	for(n = 0; n < max && db_query_step(&q) == 0; n++)
+		db_query_value(&q, NULL, NULL, &raw, &ids[n]);
+	db_query_free(&q);
+
+	return n;
+}
+
+/* the number of results of @query (or none) with the #tag words
+ * @tags */
+static size_t tags_query_count(const char *query, const char **tags, size_t ntags) {
+	const uint8_t *queries[1];
+	struct db_query q;
+	size_t n;
+
+	queries[0] = (const uint8_t *) query;
+	db_query_prepare(&q, 0, queries, (query != NULL)? 1 : 0, 
+			(const uint8_t **) tags, ntags);
+	for(n = 0; db_query_step(&q) == 0; n++)
+		;
+	db_query_free(&q);
+
+	return n;
+}
+
+/* the number of results of @query with the tag @tag */
+static size_t tag_query_count(const char *query, const char *tag) {
+	return tags_query_count(query, &tag, 1);
+}
+
+void test6() {
+	const char *shared_path = "/tmp/db_test_shared.sqlite";
+	const char *tags[] = {"shared"};
+	int ids[16], shared_id, i;
+	size_t n;
+
+	diag("++++test6++++");	
+	unlink(shared_path);
+	db_init(shared_path);
+	db_add("awk 'shared one'", 16, 0, tags, 1);
+	db_add("awk 'shared two'", 16, 0, tags, 1);
+	db_free();
+
+	db_init(FILENAME);
+	ok1(db_attach_shared("/nonexistent/shared.sqlite") != 0);
+	ok1(db_attach_shared(shared_path) == 0);
+	ok1(db_shared_count() == 1);
+
+	/* test1 added 3 awk entries and test5 trashed one of them,
+	 * the shared db has 2 more */
+	n = query_ids("awk", ids, ARRAY_SIZE(ids));
+	ok(n == 4, "%d results for awk", (int) n);
+	for(shared_id = -1, i = 0; i < (int) n; i++)
+		if(db_id_source(ids[i]) == 1)
+			shared_id = ids[i];
+	ok1(shared_id > 0);
+	ok1(tag_query_count("awk", "shared") == 2);
+
+	/* choosing it puts it before the personal entries in the
+	 * empty query, without writing to the shared db */
+	db_set_chosen_at(shared_id, time(NULL) + 3600);
+	n = query_ids("", ids, ARRAY_SIZE(ids));
+	ok1(n > 0 && ids[0] == shared_id);
+
+	db_trash(shared_id);
+	n = query_ids("shared", ids, ARRAY_SIZE(ids));
+	ok(n == 1 && ids[0] != shared_id, "%d results after trash", (int) n);
+	ok1(tag_query_count("awk", "shared") == 1);
+	db_free();
+
+	/* the shared db didnt change */
+	db_init(shared_path);
+	n = query_ids("shared", ids, ARRAY_SIZE(ids));
+	ok1(n == 2);
+	db_free();
+	unlink(shared_path);
+
+#define TEST6AMT 3 + 3 + 4
+	diag("----test6----\n#");
+}
+
+/* the ids of the empty query as another connection sees them */
+static size_t sqlite_ids(int *ids, size_t max) {
+	sqlite3 *handle;
+	sqlite3_stmt *stmt;
+	size_t n;
+
+	n = 0;
+	if(sqlite3_open(FILENAME, &handle) != SQLITE_OK)
+		return 0;
+	if(sqlite3_prepare_v2(handle, "SELECT id FROM blobs WHERE trash == 0 "
+			"ORDER BY chosen_at DESC, id ASC", -1, &stmt, NULL) == SQLITE_OK) {
+		while(n < max && sqlite3_step(stmt) == SQLITE_ROW)
+			ids[n++] = sqlite3_column_int(stmt, 0);
+		sqlite3_finalize(stmt);
+	}
+	sqlite3_close(handle);
+	return n;
+}
+
+/* compares the empty query with sqlite_ids */
+static int recent_matches() {
+	int ids[128], expect[128];
+	size_t n;
+
+	n = query_ids("", ids, ARRAY_SIZE(ids));
+	return n == sqlite_ids(expect, ARRAY_SIZE(expect)) 
+		&& memcmp(ids, expect, n*sizeof(*ids)) == 0;
+}
+
+void test7() {
+	const char *tags[] = {"test7"};
+	char buf[32];
+	size_t hits, misses, hits0, misses0;
+	int ids[128], id, status;
+	size_t n, i;
+	pid_t pid;
+
+	db_init(FILENAME);
+	diag("++++test7++++");	
+
+	ok1(db_recent_warm() != 0);
+	db_recent_stats(&hits0, &misses0);
+	ok1(recent_matches());
+
+	/* choosing, adding and trashing update the cache in place */
+	n = query_ids("", ids, ARRAY_SIZE(ids));
+	id = ids[n-1];
+	db_update_chosen_at(id);
+	ok1(recent_matches());
+	n = query_ids("", ids, ARRAY_SIZE(ids));
+	ok1(ids[0] == id);
+	db_add("echo test7", 10, 0, tags, 1);
+	ok1(recent_matches());
+	db_trash(id);
+	ok1(recent_matches());
+	db_recent_stats(&hits, &misses);
+	ok(misses == misses0 && hits > hits0, "%d hits, %d misses", 
+			(int) (hits - hits0), (int) (misses - misses0));
+
+	/* a write from another process is noticed */
+	ok1( (pid = hold_lock(0)) > 0);
+	ok1(waitpid(pid, &status, 0) == pid && WIFEXITED(status) && WEXITSTATUS(status) == 0);
+	ok1(recent_matches());
+	db_recent_stats(&hits, &misses);
+	ok1(misses == misses0 + 1);
+
+	/* sqlite carries on after the cached rows */
+	db_bulk_begin();
+	for(i = 0; i < DB_RECENT_MAX + 16; i++) {
+		snprintf(buf, sizeof(buf), "echo test7 %d", (int) i);
+		db_add(buf, strlen(buf), 0, tags, 1);
+	}
+	db_bulk_end();
+	ok1(query_ids("", ids, ARRAY_SIZE(ids)) > DB_RECENT_MAX);
+	ok1(recent_matches());
+
+	/* the tag matches kept for the next queries see the writes */
+	n = tag_query_count(NULL, "test7");
+	ok1(tag_query_count(NULL, "test7") == n);
+	db_add("echo test7 match", 16, 0, tags, 1);
+	ok1(tag_query_count(NULL, "test7") == n + 1);
+	ok1(tag_query_count("match", "test7") == 1);
+
+#define TEST7AMT 2 + 5 + 4 + 2 + 3
+	diag("----test7----\n#");
+	db_free();
+}
+
+/* runs @sql on another connection and returns the int it gives,
+ * or -1 */
+static int sqlite_int(const char *sql) {
+	sqlite3 *handle;
+	sqlite3_stmt *stmt;
+	int result;
+
+	result = -1;
+	if(sqlite3_open(FILENAME, &handle) != SQLITE_OK)
+		return -1;
+	if(sqlite3_prepare_v2(handle, sql, -1, &stmt, NULL) == SQLITE_OK) {
+		if(sqlite3_step(stmt) == SQLITE_ROW)
+			result = sqlite3_column_int(stmt, 0);
+		sqlite3_finalize(stmt);
+	}
+	sqlite3_close(handle);
+	return result;
+}
+
+static int tag_count(const char *name) {
+	char sql[128];
+
+	snprintf(sql, sizeof(sql), "SELECT blob_count FROM tags WHERE name = '%s'", name);
+	return sqlite_int(sql);
+}
+
+/* the number of tags whose blob_count is wrong */
+static int tag_counts_wrong() {
+	return sqlite_int(
+		"SELECT COUNT(*) FROM tags WHERE blob_count != ("
+			"SELECT COUNT(*) FROM fk_blobs_tags bt "
+			"INNER JOIN blobs b ON b.id = bt.blob_id "
+			"WHERE bt.tag_id = tags.id AND b.trash == 0)"
+	);
+}
+
+void test8() {
+	const char *tags1[] = {"test8", "test8b"};
+	const char *tags2[] = {"test8", "test8c", "test8"};
+	const char *tags3[] = {"test8d"};
+	char sql[64];
+	int id, status;
+
+	db_init(FILENAME);
+	diag("++++test8++++");	
+
+	/* after everything the other tests did */
+	ok1(tag_counts_wrong() == 0);
+
+	id = db_add("echo test8 a", 12, 0, tags1, 2);
+	ok1(tag_count("test8") == 1 && tag_count("test8b") == 1);
+	/* tags it already has arent counted again */
+	db_add("echo test8 a", 12, 0, tags2, 3);
+	ok1(tag_count("test8") == 1 && tag_count("test8c") == 1);
+	db_add("echo test8 b", 12, 0, tags1, 1);
+	ok1(tag_count("test8") == 2);
+	ok1(tag_query_count("echo", "test8") == 2);
+
+	/* trashing twice only counts once */
+	db_trash(id);
+	db_trash(id);
+	ok1(tag_count("test8") == 1 && tag_count("test8b") == 0);
+	ok1(tag_query_count("echo", "test8") == 1);
+	/* a blob in the trash doesnt count for its new tags */
+	db_add("echo test8 a", 12, 0, tags3, 1);
+	ok1(tag_count("test8d") == 0);
+	ok1(tag_counts_wrong() == 0);
+
+	/* taking it out of the trash by hand isnt counted until the
+	 * stats are refreshed, which the first time always happens */
+	snprintf(sql, sizeof(sql), "UPDATE blobs SET trash = 0 WHERE id = %d", id);
+	ok1(sqlite_int(sql) == -1);
+	ok1(tag_counts_wrong() > 0);
+	ok1(db_refresh_stats_end(1) == 0);
+	ok1(db_refresh_stats() != 0);
+	/* only one runs at a time */
+	ok1(db_refresh_stats() == 0);
+	ok1(db_refresh_stats_end(1) == 1);
+	ok1(tag_counts_wrong() == 0);
+	ok1(tag_query_count("echo", "test8") == 2);
+	/* nothing was written since the last check */
+	ok1(db_refresh_stats() == 0);
+	ok1(db_refresh_stats_end(0) == 0);
+
+	/* a stopped refresh leaves the counts as they were, unless it
+	 * finished before it was stopped */
+	ok1(sqlite_int("DELETE FROM sqlite_stat1") == -1);
+	snprintf(sql, sizeof(sql), "UPDATE tags SET blob_count = 7 WHERE name = 'test8'");
+	ok1(sqlite_int(sql) == -1);
+	ok1(db_refresh_stats() != 0);
+	db_refresh_stats_stop();
+	status = db_refresh_stats_end(1);
+	ok1(status != 0);
+	ok1( (status > 0)? tag_counts_wrong() == 0 : tag_count("test8") == 7);
+
+#define TEST8AMT 1 + 4 + 4 + 10 + 5
+	diag("----test8----\n#");
+	db_free();
+}
+
+void test9() {
+	const char *tags[3], *words[12];
+	char data[12][32], names[12][32];
+	int i, id;
+
+	db_init(FILENAME);
+	diag("++++test9++++");	
+
+	/* test9a on the odd ones, test9b on every third and a tag of 
+	 * its own on each */
+	for(i = 0; i < 12; i++) {
+		snprintf(data[i], sizeof(data[i]), "echo test9 %d", i);
+		snprintf(names[i], sizeof(names[i]), "test9_%d", i);
+		tags[0] = names[i];
+		tags[1] = (i % 2 == 1)? "test9a" : names[i];
+		tags[2] = (i % 3 == 0)? "test9b" : names[i];
+		id = db_add(data[i], strlen(data[i]), 0, tags, 3);
+		words[i] = names[i];
+	}
+
+	words[0] = "test9a&test9b";
+	ok1(tags_query_count(NULL, words, 1) == 2);
+	ok1(tags_query_count("echo", words, 1) == 2);
+	words[0] = "test9a&!test9b";
+	ok1(tags_query_count(NULL, words, 1) == 4);
+	words[0] = "test9a";
+	words[1] = "!test9b";
+	ok1(tags_query_count("test9", words, 2) == 4);
+	ok1(tags_query_count("test9", words + 1, 1) == 8);
+	/* the search text can be in the name of another tag */
+	words[0] = "test9b";
+	ok1(tags_query_count("test9_3", words, 1) == 1);
+	ok1(tags_query_count("test9_1", words, 1) == 0);
+	words[0] = names[0];
+	words[1] = names[1];
+
+	/* more tags than there are shapes of queries */
+	ok1(tags_query_count(NULL, words, 12) == 12);
+	ok1(tags_query_count("test9", words, 12) == 12);
+
+	/* the postings keep up with the writes */
+	words[0] = names[11];
+	db_trash(id);
+	ok1(tags_query_count(NULL, words, 1) == 0);
+	tags[0] = "test9a";
+	tags[1] = "test9b";
+	id = db_add("echo test9 new", 14, 0, tags, 2);
+	words[0] = "test9a&test9b";
+	ok1(tags_query_count(NULL, words, 1) == 3);
+	db_trash(id);
+	ok1(tags_query_count(NULL, words, 1) == 2);
+	/* a new tag of a blob that was already there */
+	db_add(data[0], strlen(data[0]), 0, tags, 1);
+	ok1(tags_query_count(NULL, words, 1) == 3);
+
+#define TEST9AMT 5 + 2 + 2 + 4
+	diag("----test9----\n#");
+	db_free();
+}
+
 int main()
 {
 	int i, len, total_tests;
@@ -160,7 +564,12 @@ int main()
 		TESTN(1),	
 		TESTN(2),
 		TESTN(3),
-		TESTN(4)
+		TESTN(4),
+		TESTN(5),
+		TESTN(6),
+		TESTN(7),
+		TESTN(8),
+		TESTN(9)
 	};
 
 	setlocale(LC_ALL,"");
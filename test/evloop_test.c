@@ -0,0 +1,185 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <ccan/tap/tap.h>
+#include <ccan/array_size/array_size.h>
+#include <pthread.h>
+#include <locale.h>
+
+#include "test.h"
+#include "evloop.h"
+#include "util.h"
+
+struct test {
+	void (*fn)();
+	int amt;
+};
+
+static struct evloop g_loop;
+
+void test1() {
+	struct evloop_event ev, evs[8];
+	size_t i;
+	int full;
+
+	diag("++++test1++++");
+	ok1(evloop_init(&g_loop) == 0);
+	ok1(evloop_poll(&g_loop, evs, ARRAY_SIZE(evs)) == 0);
+	ok1(evloop_pending(&g_loop) == 0);
+
+	ev.type = EVLOOP_KEY;
+	ev.timer = -1;
+	for(i = 0; i < 3; i++) {
+		ev.ch = 'a' + i;
+		evloop_push(&g_loop, &ev);
+	}
+	ev.type = EVLOOP_RESIZE;
+	evloop_push(&g_loop, &ev);
+
+	ok1(evloop_pending(&g_loop) != 0);
+
+	ok1(evloop_wait(&g_loop, evs, 2) == 2);
+	ok1(evs[0].type == EVLOOP_KEY && evs[0].ch == 'a');
+	ok1(evs[1].type == EVLOOP_KEY && evs[1].ch == 'b');
+	/* two events are still queued */
+	ok1(evloop_pending(&g_loop) != 0);
+	ok1(evloop_wait(&g_loop, evs, ARRAY_SIZE(evs)) == 2);
+	ok1(evs[0].type == EVLOOP_KEY && evs[0].ch == 'c');
+	ok1(evs[1].type == EVLOOP_RESIZE);
+	ok1(evloop_pending(&g_loop) == 0);
+	ok1(evloop_poll(&g_loop, evs, ARRAY_SIZE(evs)) == 0);
+
+	full = 0;
+	ev.type = EVLOOP_KEY;
+	for(i = 0; i < EVLOOP_QUEUE_SIZE+1; i++)
+		if(evloop_push(&g_loop, &ev) != 0)
+			full++;
+	ok1(full == 1);
+	for(i = 0; i < EVLOOP_QUEUE_SIZE; i += ARRAY_SIZE(evs))
+		evloop_wait(&g_loop, evs, ARRAY_SIZE(evs));
+	ok1(evloop_poll(&g_loop, evs, ARRAY_SIZE(evs)) == 0);
+
+	evloop_free(&g_loop);
+
+#define TEST1AMT 15
+	diag("----test1----\n#");
+}
+
+static void *producer(void *user) {
+	struct evloop_event ev;
+	uint32_t i;
+	(void)(user);
+
+	ev.type = EVLOOP_KEY;
+	ev.timer = -1;
+	for(i = 0; i < 10000; i++) {
+		ev.ch = i;
+		while(evloop_push(&g_loop, &ev) != 0)
+			util_usleep(0, 100);
+	}
+
+	ev.type = EVLOOP_SHUTDOWN;
+	while(evloop_push(&g_loop, &ev) != 0)
+		util_usleep(0, 100);
+
+	return NULL;
+}
+
+void test2() {
+	struct evloop_event evs[16];
+	pthread_t tid;
+	size_t i, n;
+	uint32_t expect;
+	int in_order, done;
+
+	diag("++++test2++++");
+	ok1(evloop_init(&g_loop) == 0);
+	ok1(pthread_create(&tid, NULL, producer, NULL) == 0);
+
+	in_order = 1;
+	expect = 0;
+	done = 0;
+	while(done == 0) {
+		n = evloop_wait(&g_loop, evs, ARRAY_SIZE(evs));
+		for(i = 0; i < n; i++) {
+			if(evs[i].type == EVLOOP_SHUTDOWN)
+				done = 1;
+			else if(evs[i].ch != expect++)
+				in_order = 0;
+		}
+	}
+	ok1(in_order);
+	ok1(expect == 10000);
+	ok1(pthread_join(tid, NULL) == 0);
+	evloop_free(&g_loop);
+
+#define TEST2AMT 5
+	diag("----test2----\n#");
+}
+
+void test3() {
+	struct evloop_event evs[8];
+	uint64_t start, elapsed;
+	size_t n;
+	int i;
+
+	diag("++++test3++++");
+	ok1(evloop_init(&g_loop) == 0);
+
+	start = util_now_ns();
+	evloop_timer_set(&g_loop, 2, 50, 0);
+	n = evloop_wait(&g_loop, evs, ARRAY_SIZE(evs));
+	elapsed = (util_now_ns() - start)/1000000;
+	ok1(n == 1);
+	ok1(evs[0].type == EVLOOP_TIMER && evs[0].timer == 2);
+	ok1(elapsed >= 50);
+	diag("one shot timer fired after %dms", (int) elapsed);
+	/* a one shot timer does not fire again */
+	util_usleep(0, 60000);
+	ok1(evloop_poll(&g_loop, evs, ARRAY_SIZE(evs)) == 0);
+
+	evloop_timer_set(&g_loop, 0, 10, 1);
+	for(i = 0; i < 3; i++) {
+		n = evloop_wait(&g_loop, evs, ARRAY_SIZE(evs));
+		if(n != 1 || evs[0].type != EVLOOP_TIMER || evs[0].timer != 0)
+			break;
+	}
+	ok1(i == 3);
+	evloop_timer_clear(&g_loop, 0);
+	util_usleep(0, 20000);
+	ok1(evloop_poll(&g_loop, evs, ARRAY_SIZE(evs)) == 0);
+	evloop_free(&g_loop);
+
+#define TEST3AMT 7
+	diag("----test3----\n#");
+}
+
+int main()
+{
+	int i, len, total_tests;
+#define TESTN(_num) {test##_num, TEST##_num##AMT}
+	struct test tests[] = {
+		TESTN(1),
+		TESTN(2),
+		TESTN(3)
+	};
+
+	setlocale(LC_ALL,"");
+	total_tests = 0;
+	len = ARRAY_SIZE(tests);
+	for(i = 0; i < len; i++) {
+		total_tests += tests[i].amt;
+	}
+
+	plan_tests(total_tests);
+
+	test_init_api();
+	for(i = 0; i < len; i++) {
+		(*tests[i].fn)();
+	}
+	test_free_api();
+
+	return exit_status();
+}
+
@@ -0,0 +1,179 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <ccan/tap/tap.h>
+#include <ccan/array_size/array_size.h>
+#include <locale.h>
+
+#include "test.h"
+#include "layout.h"
+
+struct test {
+	void (*fn)();
+	int amt;
+};
+
+static int line_is(const struct layout_line *line, const char *s) {
+	size_t i, len;
+
+	len = strlen(s);
+	if(line->len != len)
+		return 0;
+	for(i = 0; i < len; i++)
+		if(line->text[i] != (wchar_t) s[i])
+			return 0;
+
+	return 1;
+}
+
+#define LAYOUT(_id, _cols, _max, _s, _raw) \
+	layout_get(_id, _cols, _max, (const uint8_t *) _s, sizeof(_s)-1, _raw)
+
+void test1() {
+	const struct layout *l;
+
+	diag("++++test1++++");
+	layout_init();
+
+	l = LAYOUT(1, 10, 10, "hello world, this", 0);
+	ok1(l->n == 2);
+	ok1(l->truncated == 0);
+	ok1(line_is(&l->lines[0], "hello worl"));
+	ok1(l->lines[0].width == 10);
+	ok1(line_is(&l->lines[1], "d, this"));
+
+	l = LAYOUT(2, 10, 10, "a\tb", 0);
+	ok1(l->n == 1);
+	ok1(line_is(&l->lines[0], "a       b"));
+	ok1(l->lines[0].width == 9);
+
+	l = LAYOUT(3, 10, 10, "x\x01y\x7f", 0);
+	ok1(l->n == 1);
+	ok1(line_is(&l->lines[0], "x^Ay^?"));
+
+	l = LAYOUT(4, 10, 10, "ab\n", 0);
+	ok1(l->n == 1);
+	ok1(line_is(&l->lines[0], "ab"));
+
+	l = LAYOUT(5, 10, 10, "a\n\nb", 0);
+	ok1(l->n == 3);
+	ok1(line_is(&l->lines[1], ""));
+	ok1(line_is(&l->lines[2], "b"));
+
+	l = LAYOUT(6, 10, 10, "", 0);
+	ok1(l->n == 0);
+
+	layout_free();
+#define TEST1AMT 5 + 3 + 2 + 2 + 3 + 1
+	diag("----test1----\n#");
+}
+
+void test2() {
+	const struct layout *l;
+	size_t i;
+
+	diag("++++test2++++");
+	layout_init();
+
+	l = LAYOUT(1, 20, 10, "\x01z\n", 1);
+	ok1(l->n == 1);
+	ok1(line_is(&l->lines[0], "\\x01z\\x0a"));
+	ok1(l->lines[0].width == 9);
+	for(i = 0; i < l->lines[0].len; i++)
+		if(l->lines[0].widths[i] != 1)
+			break;
+	ok1(i == l->lines[0].len);
+
+	/* an escape is never split across lines */
+	l = LAYOUT(2, 6, 10, "abc\x02", 1);
+	ok1(l->n == 2);
+	ok1(line_is(&l->lines[0], "abc"));
+	ok1(line_is(&l->lines[1], "\\x02"));
+
+	/* invalid utf-8 is escaped */
+	l = LAYOUT(3, 20, 10, "a\xff\xc3", 0);
+	ok1(l->n == 1);
+	ok1(line_is(&l->lines[0], "a\\xff\\xc3"));
+
+	layout_free();
+#define TEST2AMT 4 + 3 + 2
+	diag("----test2----\n#");
+}
+
+void test3() {
+	const struct layout *l;
+	size_t hits, misses;
+
+	diag("++++test3++++");
+	layout_init();
+
+	LAYOUT(1, 10, 10, "abc", 0);
+	l = LAYOUT(1, 10, 10, "abc", 0);
+	layout_stats(&hits, &misses);
+	ok1(hits == 1 && misses == 1);
+	ok1(l->id == 1 && l->cols == 10);
+
+	l = LAYOUT(1, 2, 10, "abc", 0);
+	layout_stats(&hits, &misses);
+	ok1(misses == 2);
+	ok1(l->n == 2);
+
+	layout_clear();
+	LAYOUT(1, 2, 10, "abc", 0);
+	layout_stats(&hits, &misses);
+	ok1(hits == 1 && misses == 3);
+
+	l = LAYOUT(2, 10, 2, "1\n2\n3\n4\n5", 0);
+	ok1(l->n == 2);
+	ok1(l->truncated != 0);
+	l = LAYOUT(2, 10, 2, "1\n2\n3\n4\n5", 0);
+	layout_stats(&hits, &misses);
+	ok1(hits == 2 && misses == 4);
+	l = LAYOUT(2, 10, 5, "1\n2\n3\n4\n5", 0);
+	layout_stats(&hits, &misses);
+	ok1(misses == 5);
+	ok1(l->n == 5);
+	ok1(l->truncated == 0);
+	ok1(line_is(&l->lines[4], "5"));
+
+	/* ids that share a slot evict each other */
+	LAYOUT(3, 10, 10, "abc", 0);
+	LAYOUT(3 + LAYOUT_CACHE_SIZE, 10, 10, "def", 0);
+	l = LAYOUT(3, 10, 10, "abc", 0);
+	layout_stats(&hits, &misses);
+	ok1(misses == 8);
+	ok1(line_is(&l->lines[0], "abc"));
+
+	layout_free();
+#define TEST3AMT 2 + 2 + 1 + 3 + 4 + 2
+	diag("----test3----\n#");
+}
+
+int main()
+{
+	int i, len, total_tests;
+#define TESTN(_num) {test##_num, TEST##_num##AMT}
+	struct test tests[] = {
+		TESTN(1),
+		TESTN(2),
+		TESTN(3)
+	};
+
+	setlocale(LC_ALL,"");
+	total_tests = 0;
+	len = ARRAY_SIZE(tests);
+	for(i = 0; i < len; i++) {
+		total_tests += tests[i].amt;
+	}
+
+	plan_tests(total_tests);
+
+	test_init_api();
+	for(i = 0; i < len; i++) {
+		(*tests[i].fn)();
+	}
+	test_free_api();
+
+	return exit_status();
+}
@@ -0,0 +1,129 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <ccan/tap/tap.h>
+#include <ccan/array_size/array_size.h>
+#include <pthread.h>
+#include <locale.h>
+
+#ifndef AUG_DB_LOCK_PROFILE
+#	define AUG_DB_LOCK_PROFILE
+#endif
+#include "test.h"
+#include "err.h"
+#include "lock.h"
+
+struct test {
+	void (*fn)();
+	int amt;
+};
+
+static pthread_mutex_t g_mtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t g_inner = PTHREAD_MUTEX_INITIALIZER;
+
+#define ITERS 1000
+
+static const struct lock_site *find_site(int line) {
+	const struct lock_site *site;
+
+	for(site = lock_prof_sites(); site != NULL; site = site->next)
+		if(site->line == line)
+			return site;
+
+	return NULL;
+}
+
+static void *thread_fn(void *user) {
+	int status, i;
+
+	for(i = 0; i < ITERS; i++) {
+		AUG_DB_LOCK(&g_mtx, status, "failed to lock"); *(int *) user = __LINE__;
+		util_usleep(0, 10);
+		AUG_DB_UNLOCK(&g_mtx, status, "failed to unlock");
+	}
+
+	return NULL;
+}
+
+void test1() {
+	const struct lock_site *site;
+	int status, line, inner_line;
+
+	diag("++++test1++++");
+	ok1(lock_prof_sites() == NULL);
+
+	AUG_DB_LOCK(&g_mtx, status, "failed to lock"); line = __LINE__;
+	AUG_DB_LOCK(&g_inner, status, "failed to lock"); inner_line = __LINE__;
+	util_usleep(0, 2000);
+	/* out of order */
+	AUG_DB_UNLOCK(&g_mtx, status, "failed to unlock");
+	AUG_DB_UNLOCK(&g_inner, status, "failed to unlock");
+
+	ok1( (site = find_site(line)) != NULL);
+	ok1(site != NULL && site->wait.count == 1 && site->hold.count == 1);
+	ok1(site != NULL && site->hold.max >= 2000000);
+	ok1(site != NULL && strstr(site->file, "lock_test.c") != NULL);
+	ok1( (site = find_site(inner_line)) != NULL);
+	ok1(site != NULL && site->hold.count == 1 && site->hold.max >= 2000000);
+
+#define TEST1AMT 7
+	diag("----test1----\n#");
+}
+
+void test2() {
+	pthread_t tids[2];
+	const struct lock_site *site;
+	int lines[2], i;
+	char **report;
+	size_t n;
+
+	diag("++++test2++++");
+	for(i = 0; i < 2; i++)
+		ok1(pthread_create(&tids[i], NULL, thread_fn, &lines[i]) == 0);
+	for(i = 0; i < 2; i++)
+		pthread_join(tids[i], NULL);
+
+	/* both threads used the same site */
+	ok1(lines[0] == lines[1]);
+	ok1( (site = find_site(lines[0])) != NULL);
+	ok1(site != NULL && site->wait.count == 2*ITERS && site->hold.count == 2*ITERS);
+	ok1(site != NULL && site->wait.total > 0);
+
+	report = lock_prof_report(NULL, &n);
+	ok1(n == 3);
+	for(i = 0; i < (int) n; i++)
+		diag("%s", report[i]);
+	ok1(n > 0 && strncmp(report[0], "lock_test.c:", 12) == 0);
+	talloc_free(report);
+
+#define TEST2AMT 2 + 6
+	diag("----test2----\n#");
+}
+
+int main()
+{
+	int i, len, total_tests;
+#define TESTN(_num) {test##_num, TEST##_num##AMT}
+	struct test tests[] = {
+		TESTN(1),
+		TESTN(2)
+	};
+
+	setlocale(LC_ALL,"");
+	total_tests = 0;
+	len = ARRAY_SIZE(tests);
+	for(i = 0; i < len; i++) {
+		total_tests += tests[i].amt;
+	}
+
+	plan_tests(total_tests);
+
+	test_init_api();
+	for(i = 0; i < len; i++) {
+		(*tests[i].fn)();
+	}
+	test_free_api();
+
+	return exit_status();
+}
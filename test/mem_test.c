@@ -0,0 +1,175 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <ccan/tap/tap.h>
+#include <ccan/array_size/array_size.h>
+#include <ccan/talloc/talloc.h>
+#include <locale.h>
+#include <unistd.h>
+#include <sqlite3.h>
+
+#include "test.h"
+#include "mem.h"
+#include "layout.h"
+#include "db.h"
+
+const char *FILENAME = "/tmp/mem_test.sqlite";
+
+struct test {
+	void (*fn)();
+	int amt;
+};
+
+struct fake {
+	size_t bytes;
+	int evicted;
+};
+
+static size_t fake_usage(void *user) {
+	return ((struct fake *) user)->bytes;
+}
+
+static void fake_evict(void *user, size_t want) {
+	struct fake *f = user;
+
+	f->bytes -= (want < f->bytes)? want : f->bytes;
+	f->evicted++;
+}
+
+void test1() {
+	struct fake a = {1000, 0}, b = {500, 0}, c = {300, 0};
+	int ids[3];
+	char **lines;
+	size_t n;
+
+	diag("++++test1++++");
+	/* register out of priority order */
+	ids[0] = mem_register("b", 20, fake_usage, fake_evict, &b);
+	ids[1] = mem_register("c", MEM_PRIO_NONE, fake_usage, NULL, &c);
+	ids[2] = mem_register("a", 10, fake_usage, fake_evict, &a);
+	ok1(ids[0] >= 0 && ids[1] >= 0 && ids[2] >= 0);
+	ok1(mem_usage() == 1800);
+
+	/* no budget, nothing is evicted */
+	mem_set_budget(0);
+	ok1(mem_enforce() == 0);
+	ok1(a.evicted == 0 && b.evicted == 0);
+
+	/* the lowest priority gives back just enough */
+	mem_set_budget(1500);
+	ok1(mem_enforce() == 300);
+	ok1(a.bytes == 700 && b.bytes == 500);
+	ok1(mem_enforce() == 0);
+
+	/* then the next priority */
+	mem_set_budget(500);
+	ok1(mem_enforce() == 1000);
+	ok1(a.bytes == 0 && b.bytes == 200 && b.evicted == 1);
+
+	/* c cant be evicted, so this is as low as it goes */
+	mem_set_budget(100);
+	ok1(mem_enforce() == 200);
+	ok1(mem_usage() == 300 && c.bytes == 300);
+
+	lines = mem_report(NULL, &n);
+	ok1(n == 4);
+	ok1(strcmp(lines[0], "0kB of 0kB budget, evicted 3 times") == 0);
+	talloc_free(lines);
+
+	mem_unregister(ids[0]);
+	mem_unregister(ids[1]);
+	mem_unregister(ids[2]);
+	ok1(mem_usage() == 0);
+	mem_set_budget(0);
+
+#define TEST1AMT 14
+	diag("----test1----\n#");
+}
+
+void test2() {
+	const char *blob = "for i in 1 2 3; do echo $i; done";
+	size_t hits, misses;
+	int i;
+
+	diag("++++test2++++");
+	layout_init();
+	for(i = 0; i < 10; i++)
+		layout_get(i, 20, 10, (const uint8_t *) blob, strlen(blob), 0);
+	ok1(mem_usage() > 10*strlen(blob));
+
+	/* the layout cache is evicted when over budget */
+	mem_set_budget(1);
+	ok1(mem_enforce() > 0);
+	ok1(mem_usage() == 0);
+
+	layout_get(0, 20, 10, (const uint8_t *) blob, strlen(blob), 0);
+	layout_stats(&hits, &misses);
+	ok1(hits == 0 && misses == 11);
+	mem_set_budget(0);
+	layout_free();
+	ok1(mem_usage() == 0);
+
+#define TEST2AMT 5
+	diag("----test2----\n#");
+}
+
+void test3() {
+	const char *tags[] = {"test3"};
+	char buf[128];
+	int64_t before;
+	size_t i;
+	int n;
+
+	diag("++++test3++++");
+	unlink(FILENAME);
+	mem_init();
+	ok1(db_init(FILENAME) == 0);
+	db_bulk_begin();
+	for(i = 0; i < 2000; i++) {
+		n = snprintf(buf, sizeof(buf), "echo %d %0*d", (int) i, 80, 0);
+		db_add(buf, n, 0, tags, 1);
+	}
+	db_bulk_end();
+
+	/* evicting sqlite gives back the page cache of the db */
+	before = sqlite3_memory_used();
+	mem_set_budget(1);
+	ok1(mem_enforce() > 0);
+	ok(sqlite3_memory_used() < before, "sqlite used %lld bytes and then %lld", 
+			(long long) before, (long long) sqlite3_memory_used());
+	db_free();
+	mem_free();
+	ok1(mem_usage() == 0);
+
+#define TEST3AMT 4
+	diag("----test3----\n#");
+}
+
+int main()
+{
+	int i, len, total_tests;
+#define TESTN(_num) {test##_num, TEST##_num##AMT}
+	struct test tests[] = {
+		TESTN(1),
+		TESTN(2),
+		TESTN(3)
+	};
+
+	setlocale(LC_ALL,"");
+	total_tests = 0;
+	len = ARRAY_SIZE(tests);
+	for(i = 0; i < len; i++) {
+		total_tests += tests[i].amt;
+	}
+
+	plan_tests(total_tests);
+
+	test_init_api();
+	for(i = 0; i < len; i++) {
+		(*tests[i].fn)();
+	}
+	test_free_api();
+
+	return exit_status();
+}
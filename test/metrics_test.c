@@ -0,0 +1,152 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <ccan/tap/tap.h>
+#include <ccan/array_size/array_size.h>
+#include <ccan/talloc/talloc.h>
+#include <unistd.h>
+#include <locale.h>
+#include <glob.h>
+
+#include "test.h"
+#include "db.h"
+#include "stats.h"
+#include "metrics.h"
+
+struct test {
+	void (*fn)();
+	int amt;
+};
+
+const char *FILENAME = "/tmp/metrics_test.sqlite";
+const char *METRICS = "/tmp/metrics_test.prom";
+
+static const char *g_tags[] = {"awk", "cmdline examples"};
+
+static char *read_file(const char *path) {
+	FILE *f;
+	char *buf;
+	size_t n;
+
+	buf = talloc_zero_array(NULL, char, 1 << 16);
+	if( (f = fopen(path, "r")) != NULL) {
+		n = fread(buf, 1, (1 << 16) - 1, f);
+		buf[n] = '\0';
+		fclose(f);
+	}
+
+	return buf;
+}
+
+/* returns non-zero if @text has a line starting with @prefix */
+static int has_line(const char *text, const char *prefix) {
+	const char *s;
+	size_t n;
+
+	n = strlen(prefix);
+	if(strncmp(text, prefix, n) == 0)
+		return 1;
+	for(s = strchr(text, '\n'); s != NULL; s = strchr(s+1, '\n'))
+		if(strncmp(s+1, prefix, n) == 0)
+			return 1;
+
+	diag("no line starting with %s", prefix);
+	return 0;
+}
+
+/* returns non-zero if @text has a sample of @name with the pid 
+ * label followed by @rest */
+static int has_sample(const char *text, const char *name, const char *rest) {
+	char prefix[256];
+
+	snprintf(prefix, sizeof(prefix), "%s{pid=\"%d\"%s", name, (int) getpid(), rest);
+	return has_line(text, prefix);
+}
+
+void test1() {
+	const char *queries[] = {"awk"};
+	struct db_query q;
+	glob_t gl;
+	char *text;
+	int id;
+
+	diag("++++test1++++");
+	unlink(FILENAME);
+	unlink(METRICS);
+	ok1(db_init(FILENAME) == 0);
+	db_add("awk '{print $1}'", 16, 0, g_tags, 2);
+	db_add("ls -la", 6, 0, NULL, 0);
+	id = db_add("rm -rf /", 8, 0, NULL, 0);
+	db_trash(id);
+	db_query_prepare(&q, 0, (const uint8_t **) queries, 1, NULL, 0);
+	while(db_query_step(&q) == 0)
+		;
+	db_query_free(&q);
+	stats_latency_add(STATS_LAT_RENDER, 1500);
+
+	ok1(metrics_write(METRICS) == 0);
+	ok1(access(METRICS, R_OK) == 0);
+	/* the temporary file was renamed */
+	ok1(glob("/tmp/metrics_test.prom.*", 0, NULL, &gl) == GLOB_NOMATCH);
+
+	text = read_file(METRICS);
+	ok1(has_line(text, "# TYPE aug_db_query_duration_seconds histogram\n"));
+	ok1(has_sample(text, "aug_db_query_duration_seconds_count", ",shape=\"query_1q\"} 1\n"));
+	ok1(has_sample(text, "aug_db_query_duration_seconds_bucket", 
+		",shape=\"query_1q\",le=\"+Inf\"} 1\n"));
+	ok1(has_sample(text, "aug_db_ui_duration_seconds_bucket", 
+		",stage=\"render\",le=\"4.096e-06\"} 1\n"));
+	ok1(has_sample(text, "aug_db_ui_duration_seconds_count", ",stage=\"query\"} 0\n"));
+	ok1(has_sample(text, "aug_db_blobs", "} 3\n"));
+	ok1(has_sample(text, "aug_db_trashed_blobs", "} 1\n"));
+	ok1(has_sample(text, "aug_db_tags", "} 2\n"));
+	ok1(has_sample(text, "aug_db_database_bytes", "} "));
+	ok1(has_sample(text, "aug_db_sqlite_busy_retries_total", "} 0\n"));
+	ok1(has_sample(text, "aug_db_queue_high_water", ",queue=\"input\"} 0\n"));
+	ok1(has_sample(text, "aug_db_sqlite_memory_bytes", "} "));
+	talloc_free(text);
+
+	/* the counts are kept until the db changes */
+	db_add("ls -l", 5, 0, NULL, 0);
+	ok1(metrics_write(METRICS) == 0);
+	text = read_file(METRICS);
+	ok1(has_sample(text, "aug_db_blobs", "} 4\n"));
+	talloc_free(text);
+
+	/* a file that cant be written is left alone */
+	ok1(metrics_write("/nonexistent/metrics.prom") != 0);
+
+	db_free();
+	unlink(FILENAME);
+	unlink(METRICS);
+
+#define TEST1AMT 1 + 3 + 12 + 2 + 1
+	diag("----test1----\n#");
+}
+
+int main()
+{
+	int i, len, total_tests;
+#define TESTN(_num) {test##_num, TEST##_num##AMT}
+	struct test tests[] = {
+		TESTN(1)
+	};
+
+	setlocale(LC_ALL,"");
+	total_tests = 0;
+	len = ARRAY_SIZE(tests);
+	for(i = 0; i < len; i++) {
+		total_tests += tests[i].amt;
+	}
+
+	plan_tests(total_tests);
+
+	test_init_api();
+	for(i = 0; i < len; i++) {
+		(*tests[i].fn)();
+	}
+	test_free_api();
+
+	return exit_status();
+}
@@ -0,0 +1,352 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <ccan/tap/tap.h>
+#include <ccan/array_size/array_size.h>
+#include <ccan/talloc/talloc.h>
+#include <unistd.h>
+#include <locale.h>
+#include <sqlite3.h>
+#include <err.h>
+
+#include "test.h"
+#include "db.h"
+#include "db_prof.h"
+#include "tagmatch.h"
+
+/* checks the EXPLAIN QUERY PLAN of every statement db_query_prepare
+ * can make, so that a change to the sql or the schema cant quietly
+ * bring back full table scans. the plan text changed between sqlite
+ * versions ("SCAN TABLE blobs AS b (~1000 rows)" became "SCAN b"),
+ * so the checks only look at the words they need. */
+
+struct test {
+	void (*fn)();
+	int amt;
+};
+
+const char *FILENAME = "/tmp/plan_test.sqlite";
+
+static sqlite3 *g_handle;
+
+/* the aliases db.c uses */
+static const char *const g_aliases[][2] = {
+	{"b", "blobs"},
+	{"bt", "fk_blobs_tags"},
+	{"t", "tags"},
+	{"m", "tag_match"}
+};
+
+static void populate() {
+	const char *tags[2];
+	char buf[64], tag0[16], tag1[16];
+	int i, id;
+
+	tags[0] = tag0;
+	tags[1] = tag1;
+	db_bulk_begin();
+	for(i = 0; i < 500; i++) {
+		snprintf(buf, sizeof(buf), "cmd%d --arg %d /some/path", i % 37, i);
+		snprintf(tag0, sizeof(tag0), "tag%d", i % 11);
+		snprintf(tag1, sizeof(tag1), "tag%d", i % 7);
+		id = db_add(buf, strlen(buf), 0, tags, 2);
+		if(i % 3 == 0)
+			db_set_chosen_at(id, 1000000 + i);
+		if(i % 50 == 0)
+			db_trash(id);
+	}
+	db_bulk_end();
+}
+
+/* the table a line of a plan is about, or NULL */
+static const char *plan_table(const char *detail) {
+	static char word[64];
+	const char *p;
+	size_t i, n;
+
+	if(strncmp(detail, "SCAN ", 5) == 0)
+		p = detail + 5;
+	else if(strncmp(detail, "SEARCH ", 7) == 0)
+		p = detail + 7;
+	else
+		return NULL;
+	if(strncmp(p, "TABLE ", 6) == 0)
+		p += 6;
+	/* "blobs AS b" names the alias */
+	if( (n = strcspn(p, " ")) > 0 && strncmp(p + n, " AS ", 4) == 0)
+		p += n + 4;
+
+	n = strcspn(p, " ");
+	if(n >= sizeof(word))
+		n = sizeof(word) - 1;
+	memcpy(word, p, n);
+	word[n] = '\0';
+
+	for(i = 0; i < ARRAY_SIZE(g_aliases); i++)
+		if(strcmp(word, g_aliases[i][0]) == 0)
+			return g_aliases[i][1];
+
+	return word;
+}
+
+/* a scan of every row of @table, as opposed to a scan of an index */
+static int full_scan(const char *detail, const char *table) {
+	const char *t;
+
+	if(strncmp(detail, "SCAN ", 5) != 0)
+		return 0;
+	if( (t = plan_table(detail)) == NULL || strcmp(t, table) != 0)
+		return 0;
+
+	return strstr(detail, "INDEX") == NULL;
+}
+
+/* the plan of @sql as talloc'd lines separated by newlines */
+static char *plan(const char *sql) {
+	sqlite3_stmt *stmt;
+	char *eqp, *result;
+
+	eqp = talloc_asprintf(NULL, "EXPLAIN QUERY PLAN %s", sql);
+	if(sqlite3_prepare_v2(g_handle, eqp, -1, &stmt, NULL) != SQLITE_OK)
+		errx(1, "failed to prepare %s: %s", eqp, sqlite3_errmsg(g_handle));
+
+	result = talloc_strdup(NULL, "");
+	while(sqlite3_step(stmt) == SQLITE_ROW)
+		result = talloc_asprintf_append(result, "%s\n", 
+			sqlite3_column_text(stmt, sqlite3_column_count(stmt) - 1));
+	sqlite3_finalize(stmt);
+	talloc_free(eqp);
+
+	return result;
+}
+
+/* returns non-zero if any line of @p satisfies @fn */
+static int plan_any(const char *p, int (*fn)(const char *, const char *), 
+		const char *arg) {
+	char line[512];
+	size_t n;
+
+	for(; *p != '\0'; p += n + 1) {
+		n = strcspn(p, "\n");
+		snprintf(line, sizeof(line), "%.*s", (int) n, p);
+		if((*fn)(line, arg))
+			return 1;
+		if(p[n] == '\0')
+			break;
+	}
+
+	return 0;
+}
+
+static int has_text(const char *line, const char *text) {
+	return strstr(line, text) != NULL;
+}
+
+/* the table the first line of @p is about, which is the one the
+ * other tables are looked up from */
+static int plan_leads(const char *p, const char *table) {
+	char line[512];
+	const char *t;
+
+	snprintf(line, sizeof(line), "%.*s", (int) strcspn(p, "\n"), p);
+	return (t = plan_table(line)) != NULL && strcmp(t, table) == 0;
+}
+
+/* the plan of the statement db_query_prepare makes for @nq search
+ * terms and @nt copies of @tag */
+static char *query_plan_tag(size_t nq, size_t nt, const char *tag, 
+		unsigned int offset) {
+	const uint8_t *queries[DB_PROF_MAX_INPUTS], *tags[DB_PROF_MAX_INPUTS];
+	struct db_query q;
+	size_t i;
+	char *result;
+
+	for(i = 0; i < nq; i++)
+		queries[i] = (const uint8_t *) "arg";
+	for(i = 0; i < nt; i++)
+		tags[i] = (const uint8_t *) tag;
+
+	db_query_prepare(&q, offset, queries, nq, tags, nt);
+	result = plan(db_query_sql(&q));
+	db_query_free(&q);
+
+	return result;
+}
+
+/* every tag of the test db starts with "tag", so this matches all
+ * of the blobs */
+static char *query_plan(size_t nq, size_t nt, unsigned int offset) {
+	return query_plan_tag(nq, nt, "tag", offset);
+}
+
+void test1() {
+	char *p;
+
+	diag("++++test1++++");
+
+	/* the ui runs this every time it opens */
+	p = query_plan(0, 0, 0);
+	diag("empty query plan:\n%s", p);
+	ok1(plan_any(p, has_text, "blobs_trash_chosen_at"));
+	ok1(!plan_any(p, full_scan, "blobs"));
+	ok1(!plan_any(p, has_text, "TEMP B-TREE FOR ORDER BY"));
+	ok1(!plan_any(p, has_text, "TEMP B-TREE FOR DISTINCT"));
+	talloc_free(p);
+
+	p = query_plan(0, 0, 400);
+	ok1(!plan_any(p, full_scan, "blobs"));
+	ok1(!plan_any(p, has_text, "TEMP B-TREE FOR ORDER BY"));
+	talloc_free(p);
+
+#define TEST1AMT 4 + 2
+	diag("----test1----\n#");
+}
+
+void test2() {
+	char *p;
+	size_t nq, nt;
+	int blobs_scans, tag_scans;
+
+	diag("++++test2++++");
+
+	p = query_plan(1, 0, 0);
+	diag("one search term plan:\n%s", p);
+	talloc_free(p);
+	p = query_plan(0, 1, 0);
+	diag("one tag plan:\n%s", p);
+	talloc_free(p);
+
+	/* a search term has to be compared with every blob, but that 
+	 * can still be done through an index or by primary key. with
+	 * only tags the matching tags lead to their blobs. */
+	blobs_scans = tag_scans = 0;
+	for(nq = 0; nq <= DB_PROF_MAX_INPUTS; nq++) {
+		for(nt = 0; nt <= DB_PROF_MAX_INPUTS; nt++) {
+			if(nq == 0 && nt == 0)
+				continue;
+
+			p = query_plan(nq, nt, 0);
+			if(plan_any(p, full_scan, "blobs")) {
+				diag("%dq %dt scans blobs:\n%s", (int) nq, (int) nt, p);
+				blobs_scans++;
+			}
+			if(nq == 0 && plan_any(p, full_scan, "fk_blobs_tags")) {
+				diag("%dq %dt scans fk_blobs_tags:\n%s", (int) nq, (int) nt, p);
+				tag_scans++;
+			}
+			talloc_free(p);
+		}
+	}
+	ok(blobs_scans == 0, "no query shape scans the blobs table");
+	ok(tag_scans == 0, "no tag only query shape scans fk_blobs_tags");
+
+	/* the matching ids lead to blobs */
+	p = query_plan(0, 3, 0);
+	diag("three tag plan:\n%s", p);
+	ok1(plan_leads(p, "tag_match"));
+	ok1(!plan_any(p, has_text, "blobs_trash_chosen_at"));
+	ok1(!plan_any(p, has_text, "fk_blobs_tags"));
+	talloc_free(p);
+
+#define TEST2AMT 2 + 3
+	diag("----test2----\n#");
+}
+
+/* the number of query shapes whose plan scans the blobs table */
+static int blobs_scans() {
+	char *p;
+	size_t nq, nt;
+	int n;
+
+	n = 0;
+	for(nq = 0; nq <= DB_PROF_MAX_INPUTS; nq++) {
+		for(nt = 0; nt <= DB_PROF_MAX_INPUTS; nt++) {
+			if(nq == 0 && nt == 0)
+				continue;
+			p = query_plan(nq, nt, 0);
+			if(plan_any(p, full_scan, "blobs")) {
+				diag("%dq %dt scans blobs:\n%s", (int) nq, (int) nt, p);
+				n++;
+			}
+			talloc_free(p);
+		}
+	}
+
+	return n;
+}
+
+void test3() {
+	char *p;
+
+	diag("++++test3++++");
+
+	/* with a search term the match still leads to its blobs, 
+	 * whether it has a few of them or every one */
+	p = query_plan_tag(1, 1, "tag3", 0);
+	diag("one search term and tag plan:\n%s", p);
+	ok1(plan_leads(p, "tag_match"));
+	talloc_free(p);
+	p = query_plan(1, 1, 0);
+	ok1(plan_leads(p, "tag_match"));
+	ok1(!plan_any(p, has_text, "blobs_trash_chosen_at"));
+	talloc_free(p);
+
+	/* sqlite_stat1 changes what sqlite makes of the indexes, but 
+	 * the plans shouldnt get any worse */
+	ok1(db_refresh_stats() != 0 && db_refresh_stats_end(1) == 1);
+	p = query_plan(0, 0, 0);
+	diag("empty query plan after ANALYZE:\n%s", p);
+	ok1(plan_any(p, has_text, "blobs_trash_chosen_at"));
+	ok1(!plan_any(p, has_text, "TEMP B-TREE FOR ORDER BY"));
+	talloc_free(p);
+	p = query_plan(0, 3, 0);
+	ok1(plan_leads(p, "tag_match"));
+	talloc_free(p);
+	ok(blobs_scans() == 0, "no query shape scans the blobs table after ANALYZE");
+
+#define TEST3AMT 3 + 5
+	diag("----test3----\n#");
+}
+
+int main()
+{
+	int i, len, total_tests;
+#define TESTN(_num) {test##_num, TEST##_num##AMT}
+	struct test tests[] = {
+		TESTN(1),
+		TESTN(2),
+		TESTN(3)
+	};
+
+	setlocale(LC_ALL,"");
+	total_tests = 0;
+	len = ARRAY_SIZE(tests);
+	for(i = 0; i < len; i++) {
+		total_tests += tests[i].amt;
+	}
+
+	plan_tests(total_tests);
+
+	test_init_api();
+	unlink(FILENAME);
+	if(db_init(FILENAME) != 0)
+		errx(1, "failed to init db");
+	populate();
+	if(sqlite3_open(FILENAME, &g_handle) != SQLITE_OK)
+		errx(1, "failed to open %s", FILENAME);
+	/* the statements of tag queries read from db.c's tag_match */
+	if(tagmatch_register(g_handle, DB_SOURCE_SHIFT) != 0)
+		errx(1, "failed to register tag_match");
+
+	for(i = 0; i < len; i++) {
+		(*tests[i].fn)();
+	}
+
+	sqlite3_close(g_handle);
+	db_free();
+	unlink(FILENAME);
+	test_free_api();
+
+	return exit_status();
+}
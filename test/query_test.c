@@ -169,7 +169,7 @@ void test2() {
 }
 
 static int g_count;
-int cb_fn(uint8_t *data, size_t n, int raw, int id, int i, void *user) {
+int cb_fn(const uint8_t *data, size_t n, int raw, int id, int i, void *user) {
 	ok1(g_count == i);
 	ok1(raw == 0);
 	ok1(id == i+1);
@@ -233,6 +233,104 @@ void test4() {
 	test_suf();
 }
 
+/* the search text and tags of @value after query_parse */
+static void parse(struct query *q, const char *value) {
+	size_t i;
+
+	query_clear(q);
+	for(i = 0; value[i] != '\0'; i++)
+		query_add_ch(q, value[i]);
+	query_prepare(q);
+	query_finalize(q);
+}
+
+/* the value of @q as ascii */
+static const char *value_str(const struct query *q, char *buf) {
+	size_t i;
+
+	for(i = 0; i < q->n; i++)
+		buf[i] = (char) q->value[i];
+	buf[i] = '\0';
+	return buf;
+}
+
+void test5() {
+	struct query q;
+	char buf[64];
+	uint8_t *data;
+	size_t size;
+	int raw, id, id2;
+	const char *tags[] = {"header files"};
+
+	test_pre();
+	diag("++++test5++++");	
+	diag("test #tag words and completion");
+
+	memset(&q, 0, sizeof(q));
+	query_init(&q);
+
+	parse(&q, "ls #awk -la");
+	ok1(q.ntags == 1 && strcmp((const char *) q.tags[0], "awk") == 0);
+	ok(strcmp((const char *) q.text, "ls -la") == 0, "text: %s", q.text);
+	parse(&q, "#awk  print #cmd ");
+	ok1(q.ntags == 2 && strcmp((const char *) q.tags[1], "cmd") == 0);
+	ok(strcmp((const char *) q.text, "print") == 0, "text: %s", q.text);
+	/* there is no tag named "#" */
+	parse(&q, "# 1 ##");
+	ok1(q.ntags == 0);
+	ok(strcmp((const char *) q.text, "# 1 ##") == 0, "text: %s", q.text);
+
+	/* a tag is the tag of that name or else the ones starting with it */
+	parse(&q, "#sed");
+	ok1(query_first_result(&q, &data, &size, &raw, &id) == 0 && id == 4);
+	talloc_free(data);
+	parse(&q, "guest #cmdl");
+	ok1(query_first_result(&q, &data, &size, &raw, &id) == 0 && id == 3);
+	talloc_free(data);
+	parse(&q, "#cmd&!awk");
+	ok1(query_first_result(&q, &data, &size, &raw, &id) == 0 && id == 4);
+	talloc_free(data);
+	/* any number of them, and the blob matching the most comes 
+	 * first */
+	parse(&q, "#a #aw #awk #c #cm #cmd #cmdl #i #in #s #se #sed");
+	ok1(q.ntags == 12 && q.text[0] == '\0');
+	ok1(query_first_result(&q, &data, &size, &raw, &id) == 0 && id == 4);
+	talloc_free(data);
+
+	/* "in place sed" has a space, so it stops before it */
+	parse(&q, "ls #i");
+	ok1(query_complete_tag(&q) != 0);
+	ok(strcmp(value_str(&q, buf), "ls #in") == 0, "completed to %s", buf);
+	parse(&q, "#c");
+	ok1(query_complete_tag(&q) != 0);
+	ok(strcmp(value_str(&q, buf), "#cmdline") == 0, "completed to %s", buf);
+	/* nothing to complete */
+	ok1(query_complete_tag(&q) == 0);
+	parse(&q, "#x");
+	ok1(query_complete_tag(&q) == 0);
+	parse(&q, "awk");
+	ok1(query_complete_tag(&q) == 0);
+
+	/* a #word that names no tag is just text */
+	id = db_add("#include <stdio.h>", 18, 0, tags, 1);
+	parse(&q, "#include");
+	ok1(q.ntags == 0 && strcmp((const char *) q.text, "#include") == 0);
+	ok1(query_first_result(&q, &data, &size, &raw, &id2) == 0 && id2 == id);
+	talloc_free(data);
+	parse(&q, "#header #include");
+	ok1(q.ntags == 1 && strcmp((const char *) q.text, "#include") == 0);
+	ok1(query_first_result(&q, &data, &size, &raw, &id2) == 0 && id2 == id);
+	talloc_free(data);
+	/* and so is one whose tags dont exist even with a '!' */
+	parse(&q, "#!/bin/sh");
+	ok1(q.ntags == 0 && strcmp((const char *) q.text, "#!/bin/sh") == 0);
+	ok1(query_first_result(&q, &data, &size, &raw, &id2) != 0);
+
+#define TEST5AMT 6 + 2 + 3 + 5 + 2 + 6
+	diag("----test5----\n#");
+	test_suf();
+}
+
 int main()
 {
 	int i, len, total_tests;
@@ -241,7 +339,8 @@ int main()
 		TESTN(1),
 		TESTN(2),
 		TESTN(3),
-		TESTN(4)
+		TESTN(4),
+		TESTN(5)
 	};
 
 	setlocale(LC_ALL,"");
@@ -0,0 +1,173 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ccan/tap/tap.h>
+#include <ccan/array_size/array_size.h>
+#include <locale.h>
+
+#include "test.h"
+#include "tagdict.h"
+
+struct test {
+	void (*fn)();
+	int amt;
+};
+
+void test1() {
+	struct tagdict d;
+	const struct tagdict_entry *e;
+	size_t i;
+	int sorted;
+
+	diag("++++test1++++");
+	tagdict_init(&d);
+	/* out of order, twice and with a utf-8 name */
+	tagdict_add(&d, "sed", 3);
+	tagdict_add(&d, "awk", 1);
+	tagdict_add(&d, "\xc3\xa9t\xc3\xa9", 0);
+	tagdict_add(&d, "cmdline examples", 2);
+	tagdict_add(&d, "awk", 0);
+	tagdict_add(&d, "cmd", 0);
+	ok1(d.n == 5);
+	for(sorted = 1, i = 1; i < d.n; i++)
+		if(strcmp(d.entries[i-1].name, d.entries[i].name) >= 0)
+			sorted = 0;
+	ok1(sorted);
+	/* the utf-8 one sorts by its bytes, like sqlite */
+	ok1(d.entries[d.n-1].name[0] == '\xc3');
+
+	ok1( (e = tagdict_find(&d, "awk")) != NULL && e->id == 1);
+	ok1(tagdict_find(&d, "aw") == NULL);
+	/* an id for a name that didnt have one */
+	tagdict_add(&d, "cmd", 7);
+	ok1( (e = tagdict_find(&d, "cmd")) != NULL && e->id == 7);
+
+	tagdict_free(&d);
+#define TEST1AMT 3 + 3
+	diag("----test1----\n#");
+}
+
+void test2() {
+	struct tagdict d;
+	char buf[64];
+	size_t first;
+
+	diag("++++test2++++");
+	tagdict_init(&d);
+	tagdict_add(&d, "cmd", 0);
+	tagdict_add(&d, "cmdline", 0);
+	tagdict_add(&d, "cmdline examples", 0);
+	tagdict_add(&d, "docker", 0);
+	tagdict_add(&d, "git", 0);
+
+	ok1(tagdict_prefix(&d, "cmd", &first) == 3 && first == 0);
+	ok1(tagdict_prefix(&d, "d", &first) == 1 && strcmp(d.entries[first].name, "docker") == 0);
+	ok1(tagdict_prefix(&d, "x", &first) == 0);
+	ok1(tagdict_prefix(&d, "", &first) == 5);
+
+	/* an exact name wins over the names it is a prefix of */
+	ok1(tagdict_resolve(&d, "cmd", &first) == 1 && strcmp(d.entries[first].name, "cmd") == 0);
+	ok1(tagdict_resolve(&d, "cmdl", &first) == 2);
+
+	ok1(tagdict_complete(&d, "cmdl", buf, sizeof(buf)) == 2);
+	ok(strcmp(buf, "cmdline") == 0, "completed to %s", buf);
+	ok1(tagdict_complete(&d, "g", buf, sizeof(buf)) == 1 && strcmp(buf, "git") == 0);
+	ok1(tagdict_complete(&d, "x", buf, sizeof(buf)) == 0 && strcmp(buf, "x") == 0);
+	/* cut to fit */
+	ok1(tagdict_complete(&d, "do", buf, 4) == 1 && strcmp(buf, "doc") == 0);
+
+	tagdict_clear(&d);
+	ok1(d.n == 0 && tagdict_find(&d, "git") == NULL);
+	tagdict_free(&d);
+#define TEST2AMT 4 + 2 + 5 + 1
+	diag("----test2----\n#");
+}
+
+void test3() {
+	struct tagdict d;
+	char name[16];
+	size_t i, first;
+	int ok;
+
+	diag("++++test3++++");
+	tagdict_init(&d);
+	/* backwards, so that every add goes in at the front */
+	for(i = 1000; i > 0; i--) {
+		snprintf(name, sizeof(name), "tag%04u", (unsigned int) i);
+		tagdict_add(&d, name, (int) i);
+	}
+	ok1(d.n == 1000);
+	for(ok = 1, i = 1; i <= 1000; i++) {
+		snprintf(name, sizeof(name), "tag%04u", (unsigned int) i);
+		if(tagdict_find(&d, name) == NULL || tagdict_find(&d, name)->id != (int) i)
+			ok = 0;
+	}
+	ok1(ok);
+	ok1(tagdict_prefix(&d, "tag01", &first) == 100);
+	ok1(tagdict_usage(&d) > 1000*sizeof(struct tagdict_entry));
+
+	tagdict_free(&d);
+#define TEST3AMT 4
+	diag("----test3----\n#");
+}
+
+void test4() {
+	struct tagdict d;
+	size_t n, first;
+
+	diag("++++test4++++");
+	tagdict_init(&d);
+	tagdict_add(&d, "cmd", 1);
+	tagdict_add(&d, "cmdline", 2);
+	tagdict_add(&d, "git", 3);
+	tagdict_count(&d, "cmd", 4);
+	tagdict_count(&d, "cmdline", 2);
+	tagdict_count(&d, "git", 10);
+	/* not in the dictionary */
+	tagdict_count(&d, "sed", 5);
+	ok1(d.blobs == 16);
+
+	n = tagdict_prefix(&d, "cmd", &first);
+	ok1(tagdict_blobs(&d, first, n) == 6);
+	/* doesnt go below zero */
+	tagdict_count(&d, "cmdline", -3);
+	ok1(tagdict_find(&d, "cmdline")->blobs == 0 && d.blobs == 14);
+	/* adding a known name again keeps its count */
+	tagdict_add(&d, "git", 3);
+	ok1(tagdict_find(&d, "git")->blobs == 10);
+
+	tagdict_clear(&d);
+	ok1(d.blobs == 0);
+	tagdict_free(&d);
+#define TEST4AMT 2 + 2 + 1
+	diag("----test4----\n#");
+}
+
+int main()
+{
+	int i, len, total_tests;
+#define TESTN(_num) {test##_num, TEST##_num##AMT}
+	struct test tests[] = {
+		TESTN(1),
+		TESTN(2),
+		TESTN(3),
+		TESTN(4)
+	};
+
+	setlocale(LC_ALL,"");
+	total_tests = 0;
+	len = ARRAY_SIZE(tests);
+	for(i = 0; i < len; i++) {
+		total_tests += tests[i].amt;
+	}
+
+	plan_tests(total_tests);
+
+	test_init_api();
+	for(i = 0; i < len; i++) {
+		(*tests[i].fn)();
+	}
+	test_free_api();
+
+	return exit_status();
+}
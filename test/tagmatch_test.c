@@ -0,0 +1,321 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <ccan/tap/tap.h>
+#include <ccan/array_size/array_size.h>
+#include <ccan/talloc/talloc.h>
+#include <locale.h>
+#include <sqlite3.h>
+
+#include "test.h"
+#include "tagmatch.h"
+
+struct test {
+	void (*fn)();
+	int amt;
+};
+
+/* ids end at 0 */
+static void bitmap_set(struct bitmap *b, ...) {
+	va_list ap;
+	int id;
+
+	va_start(ap, b);
+	while( (id = va_arg(ap, int)) != 0)
+		bitmap_add(b, (uint32_t) id);
+	va_end(ap);
+}
+
+/* gives the tag @name the postings of the ids after it */
+static void postings(struct tagdict *d, const char *name, ...) {
+	va_list ap;
+	struct bitmap *b;
+	size_t i;
+	int id;
+
+	for(i = 0; i < d->n; i++)
+		if(strcmp(d->entries[i].name, name) == 0)
+			break;
+	if(i >= d->n)
+		return;
+
+	b = talloc(d->entries, struct bitmap);
+	bitmap_init(b);
+	talloc_steal(b, b->ctx);
+	va_start(ap, name);
+	while( (id = va_arg(ap, int)) != 0)
+		bitmap_add(b, (uint32_t) id);
+	va_end(ap);
+	d->entries[i].postings = b;
+}
+
+/* the ids of @b as "1 2 3" */
+static const char *ids(const struct bitmap *b) {
+	static char buf[256];
+	struct bitmap_iter it;
+	uint32_t x;
+	size_t len;
+
+	buf[0] = '\0';
+	len = 0;
+	bitmap_iter_init(&it, b, 0);
+	while(bitmap_iter_next(&it, &x) == 0 && len < sizeof(buf))
+		len += snprintf(buf + len, sizeof(buf) - len, "%s%u",
+				(len > 0)? " " : "", (unsigned int) x);
+
+	return buf;
+}
+
+static struct tagdict g_dict;
+static struct bitmap g_all;
+
+/* the ids matching @words */
+static const char *match(const char **words, size_t nwords) {
+	struct tagmatch m;
+	const char *s;
+
+	tagmatch_eval(&m, &g_dict, &g_all, words, nwords);
+	s = ids(&m.ids);
+	tagmatch_free(&m);
+	return s;
+}
+
+#define MATCH(...) \
+	match((const char *[]){__VA_ARGS__}, ARRAY_SIZE(((const char *[]){__VA_ARGS__})))
+
+/* blob 5 is in the trash */
+static void dict_init() {
+	tagdict_init(&g_dict);
+	tagdict_add(&g_dict, "git", 1);
+	tagdict_add(&g_dict, "wip", 2);
+	tagdict_add(&g_dict, "docker", 3);
+	tagdict_add(&g_dict, "docs", 4);
+	tagdict_add(&g_dict, "a&b", 5);
+	tagdict_add(&g_dict, "unused", 6);
+	postings(&g_dict, "git", 1, 2, 3, 4, 0);
+	postings(&g_dict, "wip", 2, 4, 5, 0);
+	postings(&g_dict, "docker", 3, 5, 0);
+	postings(&g_dict, "docs", 6, 0);
+	postings(&g_dict, "a&b", 7, 0);
+
+	bitmap_init(&g_all);
+	bitmap_set(&g_all, 1, 2, 3, 4, 6, 7, 8, 0);
+}
+
+static void dict_free() {
+	bitmap_free(&g_all);
+	tagdict_free(&g_dict);
+}
+
+void test1() {
+	diag("++++test1++++");
+	dict_init();
+
+	ok1(strcmp(MATCH("git"), "1 2 3 4") == 0);
+	/* a prefix is every tag starting with it, outside the trash */
+	ok1(strcmp(MATCH("doc"), "3 6") == 0);
+	ok1(strcmp(MATCH("git", "docs"), "1 2 3 4 6") == 0);
+	ok1(strcmp(MATCH("nosuchtag"), "") == 0);
+	ok1(strcmp(MATCH("git", "nosuchtag"), "1 2 3 4") == 0);
+	ok1(strcmp(MATCH("unused"), "") == 0);
+
+	ok1(strcmp(MATCH("git&wip"), "2 4") == 0);
+	ok1(strcmp(MATCH("wip&git"), "2 4") == 0);
+	ok1(strcmp(MATCH("git&wip&docker"), "") == 0);
+	ok1(strcmp(MATCH("git&nosuchtag"), "") == 0);
+	/* the empty tags of "git&" and "&" are skipped */
+	ok1(strcmp(MATCH("git&"), "1 2 3 4") == 0);
+	ok1(strcmp(MATCH("&"), "1 2 3 4 6 7 8") == 0);
+
+	dict_free();
+#define TEST1AMT 6 + 6
+	diag("----test1----\n#");
+}
+
+void test2() {
+	diag("++++test2++++");
+	dict_init();
+
+	ok1(strcmp(MATCH("git&!wip"), "1 3") == 0);
+	ok1(strcmp(MATCH("!wip&git"), "1 3") == 0);
+	/* a term of only '!' tags comes out of the whole match */
+	ok1(strcmp(MATCH("git", "!wip"), "1 3") == 0);
+	ok1(strcmp(MATCH("git", "docs", "!wip&!docker"), "1 6") == 0);
+	/* or every blob if there is nothing else */
+	ok1(strcmp(MATCH("!wip"), "1 3 6 7 8") == 0);
+	ok1(strcmp(MATCH("!nosuchtag"), "1 2 3 4 6 7 8") == 0);
+	/* a name with '&' or '!' in it is that tag */
+	ok1(strcmp(MATCH("a&b"), "7") == 0);
+	/* while anything else is split: "a" is a prefix of it and
+	 * there is no "b" to take out */
+	ok1(strcmp(MATCH("a&!b"), "7") == 0);
+
+	/* what a "#word" needs to be a tag instead of text */
+	ok1(tagmatch_word(&g_dict, "doc") && tagmatch_word(&g_dict, "a&b"));
+	ok1(tagmatch_word(&g_dict, "!wip") && tagmatch_word(&g_dict, "nosuchtag&git"));
+	ok1(!tagmatch_word(&g_dict, "include") && !tagmatch_word(&g_dict, "!/bin/sh"));
+	ok1(!tagmatch_word(&g_dict, "&") && !tagmatch_word(&g_dict, "!"));
+
+	dict_free();
+#define TEST2AMT 5 + 3 + 4
+	diag("----test2----\n#");
+}
+
+void test3() {
+	struct tagmatch m;
+	const char *words[40];
+	size_t i;
+
+	diag("++++test3++++");
+	dict_init();
+
+	words[0] = "git";
+	words[1] = "wip";
+	words[2] = "doc";
+	words[3] = "!nosuchtag";
+	tagmatch_eval(&m, &g_dict, &g_all, words, 4);
+	ok1(strcmp(ids(&m.ids), "1 2 3 4 6") == 0);
+	/* the negative term doesnt count */
+	ok1(m.nterms == 3);
+	ok1(tagmatch_hits(&m, 1) == 1);
+	ok1(tagmatch_hits(&m, 2) == 2);
+	ok1(tagmatch_hits(&m, 3) == 2);
+	ok1(tagmatch_hits(&m, 7) == 0);
+	/* the blobs named by the search terms arent limited to the 
+	 * match, which limits the blobs anyway */
+	ok1(tagmatch_named(&m, 2) == 0);
+	tagmatch_name(&m, 1, tagdict_find(&g_dict, "wip"));
+	tagmatch_name(&m, 1, tagdict_find(&g_dict, "docs"));
+	tagmatch_name(&m, 0, tagdict_find(&g_dict, "unused"));
+	ok1(tagmatch_named(&m, 2) == 2 && tagmatch_named(&m, 5) == 2);
+	ok1(tagmatch_named(&m, 6) == 2 && tagmatch_named(&m, 1) == 0);
+	tagmatch_name(&m, 0, tagdict_find(&g_dict, "git"));
+	ok1(tagmatch_named(&m, 2) == 3);
+	tagmatch_free(&m);
+
+	/* there is no limit on the number of words */
+	for(i = 0; i < ARRAY_SIZE(words); i++)
+		words[i] = (i % 2 == 0)? "git&!wip" : "a&b";
+	tagmatch_eval(&m, &g_dict, &g_all, words, ARRAY_SIZE(words));
+	ok1(strcmp(ids(&m.ids), "1 3 7") == 0);
+	ok1(tagmatch_hits(&m, 3) == (int) ARRAY_SIZE(words)/2);
+
+	tagmatch_free(&m);
+	dict_free();
+#define TEST3AMT 6 + 4 + 2
+	diag("----test3----\n#");
+}
+
+/* the rows of @sql run with the match handle @match and source 
+ * @source bound, as "id:hits", or "error" */
+static const char *rows(sqlite3 *handle, const char *sql,
+		int64_t match, int source) {
+	static char buf[256];
+	sqlite3_stmt *stmt;
+	size_t len;
+	int status;
+
+	buf[0] = '\0';
+	if(sqlite3_prepare_v2(handle, sql, -1, &stmt, NULL) != SQLITE_OK) {
+		diag("failed to prepare %s: %s", sql, sqlite3_errmsg(handle));
+		return "error";
+	}
+	sqlite3_bind_int64(stmt, 1, match);
+	sqlite3_bind_int(stmt, 2, source);
+	for(len = 0; (status = sqlite3_step(stmt)) == SQLITE_ROW && len < sizeof(buf); )
+		len += snprintf(buf + len, sizeof(buf) - len, "%s%d:%d",
+				(len > 0)? " " : "", sqlite3_column_int(stmt, 0),
+				sqlite3_column_int(stmt, 1));
+	sqlite3_finalize(stmt);
+
+	return (status == SQLITE_DONE)? buf : "error";
+}
+
+void test4() {
+	sqlite3 *handle;
+	struct tagmatch m;
+	const char *words[2];
+	int64_t stale;
+	const char all[] =
+		"SELECT id, hits FROM tag_match WHERE tagmatch = ?1 AND source = ?2";
+	const char one[] =
+		"SELECT id, hits FROM tag_match WHERE tagmatch = ?1 AND source = ?2 AND id = 3";
+	const char joined[] =
+		"SELECT b.id, m.hits FROM b CROSS JOIN tag_match m ON m.id = b.id "
+		"WHERE m.tagmatch = ?1 AND m.source = ?2 ORDER BY b.id DESC";
+	const char named[] =
+		"SELECT id, named FROM tag_match WHERE tagmatch = ?1 AND source = ?2 "
+			"AND named != 0";
+
+	diag("++++test4++++");
+	dict_init();
+	/* sources of 16 ids each, and 19 is the 3 of source 1 */
+	postings(&g_dict, "docker", 3, 5, 19, 0);
+	bitmap_add(&g_all, 19);
+
+	ok1(sqlite3_open(":memory:", &handle) == SQLITE_OK);
+	ok1(tagmatch_register(handle, 4) == 0);
+	ok1(sqlite3_exec(handle, "CREATE TABLE b (id INTEGER PRIMARY KEY); "
+			"INSERT INTO b VALUES (1); INSERT INTO b VALUES (3); "
+			"INSERT INTO b VALUES (4);", NULL, NULL, NULL) == SQLITE_OK);
+
+	words[0] = "git";
+	words[1] = "docker";
+	tagmatch_eval(&m, &g_dict, &g_all, words, 2);
+	ok1(strcmp(rows(handle, all, m.handle, 0), "1:1 2:1 3:2 4:1") == 0);
+	ok1(strcmp(rows(handle, all, m.handle, 1), "3:1") == 0);
+	ok1(strcmp(rows(handle, all, m.handle, 2), "") == 0);
+	/* an id is looked up */
+	ok1(strcmp(rows(handle, one, m.handle, 0), "3:2") == 0);
+	ok1(strcmp(rows(handle, one, m.handle, 1), "3:1") == 0);
+	ok1(strcmp(rows(handle, joined, m.handle, 0), "4:1 3:2 1:1") == 0);
+	tagmatch_name(&m, 1, tagdict_find(&g_dict, "wip"));
+	ok1(strcmp(rows(handle, named, m.handle, 0), "2:2 4:2") == 0);
+	/* a handle that isnt a live match is an error */
+	stale = m.handle;
+	ok1(strcmp(rows(handle, all, 0, 0), "error") == 0);
+	ok1(strcmp(rows(handle, all, (int64_t) (intptr_t) &m, 0), "error") == 0);
+	ok1(strcmp(rows(handle, all, m.handle + ((int64_t) 1 << 32), 0), "error") == 0);
+	tagmatch_free(&m);
+	ok1(strcmp(rows(handle, all, stale, 0), "error") == 0);
+	/* nor does another match in its slot take the handle */
+	tagmatch_eval(&m, &g_dict, &g_all, words, 2);
+	ok1(m.handle != stale && strcmp(rows(handle, all, stale, 0), "error") == 0);
+	ok1(strcmp(rows(handle, one, m.handle, 0), "3:2") == 0);
+	tagmatch_free(&m);
+
+	sqlite3_close(handle);
+	dict_free();
+#define TEST4AMT 3 + 7 + 6
+	diag("----test4----\n#");
+}
+
+int main()
+{
+	int i, len, total_tests;
+#define TESTN(_num) {test##_num, TEST##_num##AMT}
+	struct test tests[] = {
+		TESTN(1),
+		TESTN(2),
+		TESTN(3),
+		TESTN(4)
+	};
+
+	setlocale(LC_ALL,"");
+	total_tests = 0;
+	len = ARRAY_SIZE(tests);
+	for(i = 0; i < len; i++) {
+		total_tests += tests[i].amt;
+	}
+
+	plan_tests(total_tests);
+
+	test_init_api();
+	for(i = 0; i < len; i++) {
+		(*tests[i].fn)();
+	}
+	test_free_api();
+
+	return exit_status();
+}
@@ -4,4 +4,19 @@
 void test_init_api();
 void test_free_api();
 
+#include <stdint.h>
+
+/* the number of malloc, calloc and realloc calls this process has
+ * made, or -1 if this build cant count them. counting is done by
+ * wrapping those functions at link time, see ALLOC_WRAP_LIB in the
+ * Makefile. */
+int64_t test_allocs();
+/* the number of allocations sqlite has made since test_sqlite_count,
+ * or -1 if this build cant count them */
+int64_t test_sqlite_allocs();
+/* makes sqlite count its allocations in test_sqlite_allocs instead 
+ * of test_allocs, so that test_allocs only counts aug-db's own. has
+ * to be called before the first db_init. returns non-zero on error. */
+int test_sqlite_count();
+
 #endif /* AUG_DB_TEST_H */
\ No newline at end of file
@@ -1,4 +1,5 @@
 #include "aug.h"
+#include "test.h"
 #include <string.h>
 #include <stdarg.h>
 #include <stdio.h>
@@ -34,3 +35,103 @@ void test_free_api() {
 	free( (struct aug_api *) G_api);
 }
 
+
+#ifdef AUG_DB_TEST_ALLOCS
+#include <sqlite3.h>
+
+/* defined by the linker when given --wrap=malloc etc. */
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t nmemb, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+static int64_t g_allocs;
+static int64_t g_sqlite_allocs;
+
+void *__wrap_malloc(size_t size) {
+	__atomic_add_fetch(&g_allocs, 1, __ATOMIC_RELAXED);
+	return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t nmemb, size_t size) {
+	__atomic_add_fetch(&g_allocs, 1, __ATOMIC_RELAXED);
+	return __real_calloc(nmemb, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size) {
+	__atomic_add_fetch(&g_allocs, 1, __ATOMIC_RELAXED);
+	return __real_realloc(ptr, size);
+}
+
+int64_t test_allocs() {
+	return __atomic_load_n(&g_allocs, __ATOMIC_RELAXED);
+}
+
+int64_t test_sqlite_allocs() {
+	return __atomic_load_n(&g_sqlite_allocs, __ATOMIC_RELAXED);
+}
+
+/* like sqlite's own allocator, the size of each allocation is 
+ * kept in front of it */
+static void *sqlite_malloc(int n) {
+	int64_t *p;
+
+	__atomic_add_fetch(&g_sqlite_allocs, 1, __ATOMIC_RELAXED);
+	if( (p = __real_malloc(n + sizeof(*p))) == NULL)
+		return NULL;
+	p[0] = n;
+	return p + 1;
+}
+
+static void sqlite_free(void *ptr) {
+	if(ptr != NULL)
+		free( (int64_t *) ptr - 1);
+}
+
+static void *sqlite_realloc(void *ptr, int n) {
+	int64_t *p;
+
+	__atomic_add_fetch(&g_sqlite_allocs, 1, __ATOMIC_RELAXED);
+	if( (p = __real_realloc( (int64_t *) ptr - 1, n + sizeof(*p))) == NULL)
+		return NULL;
+	p[0] = n;
+	return p + 1;
+}
+
+static int sqlite_size(void *ptr) {
+	return (ptr != NULL)? (int) ((int64_t *) ptr)[-1] : 0;
+}
+
+static int sqlite_roundup(int n) {
+	return (n + 7) & ~7;
+}
+
+static int sqlite_init(void *user) {
+	(void)(user);
+	return SQLITE_OK;
+}
+
+static void sqlite_shutdown(void *user) {
+	(void)(user);
+}
+
+int test_sqlite_count() {
+	static const sqlite3_mem_methods methods = {
+		sqlite_malloc, sqlite_free, sqlite_realloc, sqlite_size,
+		sqlite_roundup, sqlite_init, sqlite_shutdown, NULL
+	};
+
+	return (sqlite3_config(SQLITE_CONFIG_MALLOC, &methods) == SQLITE_OK)? 0 : -1;
+}
+#else
+int64_t test_allocs() {
+	return -1;
+}
+
+int64_t test_sqlite_allocs() {
+	return -1;
+}
+
+int test_sqlite_count() {
+	return 0;
+}
+#endif /* AUG_DB_TEST_ALLOCS */
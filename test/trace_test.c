@@ -0,0 +1,237 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <ccan/tap/tap.h>
+#include <ccan/array_size/array_size.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <locale.h>
+
+#include "test.h"
+#include "trace.h"
+
+struct test {
+	void (*fn)();
+	int amt;
+};
+
+const char *FILENAME = "/tmp/trace_test.trace";
+
+/* size of the dump file with the current event names, no events
+ * and no sql texts */
+static size_t header_size() {
+	size_t i, size;
+
+	size = 8 + 4*4 + 8 + 4;
+	for(i = 0; i < TRACE_EV_COUNT; i++)
+		size += 2 + strlen(trace_event_name(i));
+
+	return size;
+}
+
+static off_t file_size(const char *path) {
+	struct stat st;
+
+	if(stat(path, &st) != 0)
+		return -1;
+
+	return st.st_size;
+}
+
+void test1() {
+	struct trace_ring *r;
+	struct trace_event *e;
+	uint64_t before;
+
+	diag("++++test1++++");
+	trace_init();
+	before = trace_now();
+	trace_event(TRACE_EV_DB_STEP, 0xdead, 101);
+	ok1( (r = G_trace_ring) != NULL);
+	ok1(r->head == 1);
+	e = &r->ev[0];
+	ok1(e->id == TRACE_EV_DB_STEP);
+	ok1(e->args[0] == 0xdead && e->args[1] == 101);
+	ok1(e->ts >= before);
+	ok1(strcmp(trace_event_name(TRACE_EV_DB_STEP), "db_step") == 0);
+	ok1(strcmp(trace_event_name(TRACE_EV_COUNT), "unknown") == 0);
+
+	unlink(FILENAME);
+	ok1(trace_dump(FILENAME) == 0);
+	ok1(file_size(FILENAME) == (off_t) (header_size() + sizeof(struct trace_event)) );
+	trace_free();
+	ok1(G_trace_ring == NULL);
+
+#define TEST1AMT 10
+	diag("----test1----\n#");
+}
+
+static void *thread_fn(void *user) {
+	size_t i;
+	(void)(user);
+
+	for(i = 0; i < 10; i++)
+		trace_event(TRACE_EV_LOCK, i, 0);
+
+	return (void *) G_trace_ring;
+}
+
+void test2() {
+	size_t i;
+	pthread_t tid;
+	struct trace_ring *r, *tr;
+
+	diag("++++test2++++");
+	trace_init();
+	for(i = 0; i < TRACE_RING_SIZE + 5; i++)
+		trace_event(TRACE_EV_UNLOCK, i, 0);
+
+	r = G_trace_ring;
+	ok1(r->head == TRACE_RING_SIZE + 5);
+	/* the oldest events were overwritten */
+	ok1(r->ev[0].args[0] == TRACE_RING_SIZE);
+	ok1(r->ev[4].args[0] == TRACE_RING_SIZE + 4);
+	ok1(r->ev[5].args[0] == 5);
+
+	ok1(pthread_create(&tid, NULL, thread_fn, NULL) == 0);
+	ok1(pthread_join(tid, (void **) &tr) == 0);
+	ok1(tr != NULL && tr != r);
+	ok1(tr->tid != r->tid);
+	ok1(tr->head == 10);
+
+	unlink(FILENAME);
+	ok1(trace_dump(FILENAME) == 0);
+	ok1(file_size(FILENAME) == 
+		(off_t) (header_size() + (TRACE_RING_SIZE + 10)*sizeof(struct trace_event)) );
+	trace_free();
+	unlink(FILENAME);
+
+#define TEST2AMT 11
+	diag("----test2----\n#");
+}
+
+static char *read_file(const char *path) {
+	FILE *f;
+	char *buf;
+	size_t n;
+
+	buf = calloc(1, 1 << 16);
+	if( (f = fopen(path, "r")) != NULL) {
+		n = fread(buf, 1, (1 << 16) - 1, f);
+		buf[n] = '\0';
+		fclose(f);
+	}
+
+	return buf;
+}
+
+void test3() {
+	struct trace_ring *r;
+	char *json;
+
+	diag("++++test3++++");
+	trace_init();
+	trace_event(TRACE_EV_DB_STEP, 0, 0);
+	r = G_trace_ring;
+
+	/* spans are off until they are enabled */
+	ok1(trace_spans_path() == NULL);
+	TRACE_SPAN_BEGIN(TRACE_SPAN_CONSUME, 1);
+	ok1(r->head == 1);
+	ok1(trace_spans_dump() != 0);
+
+	unlink(FILENAME);
+	trace_spans_enable(FILENAME);
+	ok1(strcmp(trace_spans_path(), FILENAME) == 0);
+	/* an end without a begin, as if the begin was overwritten */
+	TRACE_SPAN_END(TRACE_SPAN_DOUPDATE);
+	TRACE_SPAN_BEGIN(TRACE_SPAN_CONSUME, 7);
+	TRACE_SPAN_END(TRACE_SPAN_CONSUME);
+	ok1(r->head == 4);
+	ok1(r->ev[2].id == TRACE_EV_SPAN_BEGIN && r->ev[2].args[0] == TRACE_SPAN_CONSUME);
+	ok1(strcmp(trace_span_name(TRACE_SPAN_CONSUME), "ui_state_consume") == 0);
+	ok1(strcmp(trace_span_name(TRACE_SPAN_COUNT), "unknown") == 0);
+
+	ok1(trace_spans_dump() == 0);
+	json = read_file(FILENAME);
+	ok1(strncmp(json, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n{", 41) == 0);
+	ok1(strstr(json, "\"ph\":\"B\",\"name\":\"ui_state_consume\",\"args\":{\"arg\":7}}") != NULL);
+	ok1(strstr(json, "\"ph\":\"E\"}") != NULL);
+	ok1(strstr(json, "\"name\":\"span_end\"") != NULL);
+	ok1(strstr(json, "\"name\":\"db_step\"") != NULL);
+	ok1(strcmp(json + strlen(json) - 4, "\n]}\n") == 0);
+	free(json);
+
+	trace_free();
+	ok1(trace_spans_path() == NULL && G_trace_spans == 0);
+	unlink(FILENAME);
+
+#define TEST3AMT 16
+	diag("----test3----\n#");
+}
+
+void test4() {
+	const char *sql = "SELECT id FROM blobs";
+	char copy[64];
+	uint64_t id;
+	struct trace_ring *r;
+
+	diag("++++test4++++");
+	trace_init();
+	id = trace_sql(sql);
+	ok1(id != 0);
+	/* the id is of the text, not of where it is */
+	strcpy(copy, sql);
+	ok1(trace_sql(copy) == id);
+	ok1(trace_sql("SELECT id FROM tags") != id);
+	ok1(strcmp(trace_sql_text(id), sql) == 0);
+	ok1(trace_sql_text(id+1) == NULL);
+
+	trace_event(TRACE_EV_DB_EXECUTE, id, 0);
+	r = G_trace_ring;
+	ok1(r->ev[0].args[0] == id);
+
+	unlink(FILENAME);
+	ok1(trace_dump(FILENAME) == 0);
+	ok1(file_size(FILENAME) == (off_t) (header_size() + sizeof(struct trace_event)
+		+ 2*(8 + 4) + strlen(sql) + strlen("SELECT id FROM tags")) );
+
+	trace_free();
+	ok1(trace_sql_text(id) == NULL);
+	unlink(FILENAME);
+
+#define TEST4AMT 9
+	diag("----test4----\n#");
+}
+
+int main()
+{
+	int i, len, total_tests;
+#define TESTN(_num) {test##_num, TEST##_num##AMT}
+	struct test tests[] = {
+		TESTN(1),
+		TESTN(2),
+		TESTN(3),
+		TESTN(4)
+	};
+
+	setlocale(LC_ALL,"");
+	total_tests = 0;
+	len = ARRAY_SIZE(tests);
+	for(i = 0; i < len; i++) {
+		total_tests += tests[i].amt;
+	}
+
+	plan_tests(total_tests);
+
+	test_init_api();
+	for(i = 0; i < len; i++) {
+		(*tests[i].fn)();
+	}
+	test_free_api();
+
+	return exit_status();
+}
+
@@ -0,0 +1,565 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <ccan/tap/tap.h>
+#include <ccan/array_size/array_size.h>
+#include <ccan/talloc/talloc.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <errno.h>
+#include <err.h>
+#include <sys/time.h>
+#include <locale.h>
+
+#include "test.h"
+#include "api_calls.h"
+#include "ui.h"
+#include "db.h"
+#include "util.h"
+
+/* drives the whole ui (ui.c, ui_state.c, window.c) through the
+ * same entry points aug uses, against an offscreen curses terminal.
+ * the aug screen api is implemented here with a mutex for the
+ * screen lock and full screen panels, and every doupdate is
+ * counted so the time from a keystroke to the screen update that
+ * reflects it can be measured.
+ *
+ * set AUG_DB_UI_SESSION to the path of a file and its bytes will
+ * be typed into the ui as an extra test, e.g. to measure a recorded
+ * session. */
+
+struct test {
+	void (*fn)();
+	int amt;
+};
+
+const char *FILENAME = "/tmp/ui_test.sqlite";
+
+#define SCREEN_ROWS 24
+#define SCREEN_COLS 80
+/* how long a keystroke may take to show up on the screen */
+#define UPDATE_TIMEOUT_MS 5000
+#define MAX_KEYS 4096
+
+static struct {
+	pthread_mutex_t screen;
+	pthread_mutex_t mtx;
+	pthread_cond_t cond;
+	/* these are protected by mtx */
+	int updates;
+	char input[4096];
+	size_t input_n;
+	/* latency of each keystroke in nanoseconds */
+	uint64_t lat[MAX_KEYS];
+	size_t nlat;
+} g;
+
+static void stub_lock_screen(struct aug_plugin *plugin) {
+	(void)(plugin);
+	pthread_mutex_lock(&g.screen);
+}
+
+static void stub_unlock_screen(struct aug_plugin *plugin) {
+	(void)(plugin);
+	pthread_mutex_unlock(&g.screen);
+}
+
+static void stub_screen_panel_alloc(struct aug_plugin *plugin, int nlines, 
+		int ncols, int begin_y, int begin_x, PANEL **panel) {
+	(void)(plugin);
+	(void)(nlines);
+	(void)(ncols);
+	(void)(begin_y);
+	(void)(begin_x);
+
+	pthread_mutex_lock(&g.screen);
+	*panel = new_panel(newwin(LINES, COLS, 0, 0));
+	pthread_mutex_unlock(&g.screen);
+}
+
+static void stub_screen_panel_dealloc(struct aug_plugin *plugin, PANEL *panel) {
+	WINDOW *win;
+	(void)(plugin);
+
+	pthread_mutex_lock(&g.screen);
+	win = panel_window(panel);
+	del_panel(panel);
+	delwin(win);
+	pthread_mutex_unlock(&g.screen);
+}
+
+static void stub_screen_panel_update(struct aug_plugin *plugin) {
+	(void)(plugin);
+	update_panels();
+}
+
+static int stub_screen_doupdate(struct aug_plugin *plugin) {
+	(void)(plugin);
+
+	doupdate();
+	pthread_mutex_lock(&g.mtx);
+	g.updates++;
+	pthread_cond_broadcast(&g.cond);
+	pthread_mutex_unlock(&g.mtx);
+	return 0;
+}
+
+static int stub_primary_input(struct aug_plugin *plugin, const uint32_t *data, size_t n) {
+	size_t i;
+	(void)(plugin);
+
+	pthread_mutex_lock(&g.mtx);
+	for(i = 0; i < n && g.input_n < sizeof(g.input); i++)
+		g.input[g.input_n++] = (char) data[i];
+	pthread_mutex_unlock(&g.mtx);
+	return n;
+}
+
+static int stub_primary_input_chars(struct aug_plugin *plugin, const char *data, size_t n) {
+	size_t i;
+	(void)(plugin);
+
+	pthread_mutex_lock(&g.mtx);
+	for(i = 0; i < n && g.input_n < sizeof(g.input); i++)
+		g.input[g.input_n++] = data[i];
+	pthread_mutex_unlock(&g.mtx);
+	return n;
+}
+
+static int updates() {
+	int n;
+
+	pthread_mutex_lock(&g.mtx);
+	n = g.updates;
+	pthread_mutex_unlock(&g.mtx);
+	return n;
+}
+
+/* returns 0 once there have been more than @n updates, or -1 if
+ * that didnt happen within @ms milliseconds */
+static int wait_updates(int n, int ms) {
+	struct timeval tv;
+	struct timespec ts;
+	int status;
+
+	gettimeofday(&tv, NULL);
+	ts.tv_sec = tv.tv_sec + ms/1000;
+	ts.tv_nsec = tv.tv_usec*1000 + (ms%1000)*1000000;
+	if(ts.tv_nsec >= 1000000000) {
+		ts.tv_sec++;
+		ts.tv_nsec -= 1000000000;
+	}
+
+	status = 0;
+	pthread_mutex_lock(&g.mtx);
+	while(g.updates <= n && status != ETIMEDOUT)
+		status = pthread_cond_timedwait(&g.cond, &g.mtx, &ts);
+	status = (g.updates > n)? 0 : -1;
+	pthread_mutex_unlock(&g.mtx);
+
+	return status;
+}
+
+static void clear_input() {
+	pthread_mutex_lock(&g.mtx);
+	g.input_n = 0;
+	pthread_mutex_unlock(&g.mtx);
+}
+
+static int input_is(const char *s) {
+	int result;
+
+	pthread_mutex_lock(&g.mtx);
+	result = (g.input_n == strlen(s) && memcmp(g.input, s, g.input_n) == 0);
+	pthread_mutex_unlock(&g.mtx);
+	return result;
+}
+
+/* copies what is on the (virtual) terminal at row @y into @buf
+ * with the inner window border stripped and trailing spaces removed */
+static void screen_row(int y, char *buf, size_t n) {
+	char line[SCREEN_COLS+1];
+	size_t len;
+
+	pthread_mutex_lock(&g.screen);
+	if(mvwinnstr(curscr, y, 1, line, SCREEN_COLS-2) == ERR)
+		line[0] = '\0';
+	pthread_mutex_unlock(&g.screen);
+
+	len = strlen(line);
+	while(len > 0 && line[len-1] == ' ')
+		len--;
+	line[len] = '\0';
+	snprintf(buf, n, "%s", line);
+}
+
+static int row_is(int y, const char *s) {
+	char buf[SCREEN_COLS+1];
+
+	screen_row(y, buf, sizeof(buf));
+	if(strcmp(buf, s) == 0)
+		return 1;
+
+	diag("row %d is '%s', expected '%s'", y, buf, s);
+	return 0;
+}
+
+/* types @ch and waits until the screen is updated. returns 0 
+ * if an update happened within @ms milliseconds */
+static int type_key(uint32_t ch, int ms) {
+	int n;
+	uint64_t t0;
+
+	/* the ui thread may not have opened the window yet */
+	n = updates();
+	t0 = util_now_ns();
+	while(ui_on_input(&ch) == 1)
+		util_usleep(0, 1000);
+	if(wait_updates(n, ms) != 0)
+		return -1;
+
+	pthread_mutex_lock(&g.mtx);
+	if(g.nlat < ARRAY_SIZE(g.lat))
+		g.lat[g.nlat++] = util_now_ns() - t0;
+	pthread_mutex_unlock(&g.mtx);
+	return 0;
+}
+
+/* returns the number of keys which didnt update the screen */
+static int type_str(const char *s, int ms) {
+	int missed;
+
+	for(missed = 0; *s != '\0'; s++)
+		if(type_key((uint8_t) *s, ms) != 0)
+			missed++;
+
+	return missed;
+}
+
+static int open_ui() {
+	int n;
+
+	n = updates();
+	ui_on_cmd_key();
+	return wait_updates(n, UPDATE_TIMEOUT_MS);
+}
+
+/* waits for the window to close, which refreshes the screen */
+static int close_ui(uint32_t ch) {
+	int n;
+
+	n = updates();
+	while(ui_on_input(&ch) == 1)
+		util_usleep(0, 1000);
+	return wait_updates(n, UPDATE_TIMEOUT_MS);
+}
+
+static int cmp_u64(const void *a, const void *b) {
+	uint64_t x = *(const uint64_t *) a;
+	uint64_t y = *(const uint64_t *) b;
+
+	return (x > y) - (x < y);
+}
+
+static void report_latency(const char *name) {
+	size_t n;
+	uint64_t *lat;
+
+	pthread_mutex_lock(&g.mtx);
+	n = g.nlat;
+	lat = g.lat;
+	qsort(lat, n, sizeof(*lat), cmp_u64);
+	if(n > 0)
+		diag("%s: %d keystrokes, input to doupdate latency "
+			"p50=%.3fms p90=%.3fms p99=%.3fms max=%.3fms", name, (int) n,
+			lat[n/2]/1e6, lat[(n*9)/10]/1e6, lat[(n*99)/100]/1e6, lat[n-1]/1e6);
+	g.nlat = 0;
+	pthread_mutex_unlock(&g.mtx);
+}
+
+static void add_entries() {
+	const char *tags[] = {"shell"};
+	const char *cmds[] = {"git", "grep", "find", "make", "tar", "ssh"};
+	char buf[128];
+	size_t i;
+
+	db_bulk_begin();
+	for(i = 0; i < 500; i++) {
+		snprintf(buf, sizeof(buf), "%s --option-%u /some/path/%u", 
+				cmds[i % ARRAY_SIZE(cmds)], (unsigned int) i, (unsigned int) (i*7919 % 1000));
+		db_add(buf, strlen(buf), 0, tags, ARRAY_SIZE(tags));
+	}
+	db_add("ls -la /tmp", 11, 0, tags, ARRAY_SIZE(tags));
+	db_add("echo hello", 10, 0, tags, ARRAY_SIZE(tags));
+	db_bulk_end();
+}
+
+void test1() {
+	diag("++++test1++++");
+
+	ok1(open_ui() == 0);
+	ok1(row_is(1, "(search)`':"));
+	ok1(row_is(2, "------------------------------------------------------------------------------"));
+
+	ok1(type_str("echo h", UPDATE_TIMEOUT_MS) == 0);
+	ok1(row_is(1, "(search)`echo h':"));
+	ok1(row_is(3, "echo hello"));
+	/* it is the only result */
+	ok1(row_is(4, ""));
+
+	/* backspace and ^G */
+	ok1(type_key(0x7f, UPDATE_TIMEOUT_MS) == 0);
+	ok1(row_is(1, "(search)`echo ':"));
+	ok1(type_key(0x07, UPDATE_TIMEOUT_MS) == 0);
+	ok1(row_is(1, "(search)`':"));
+
+	ok1(type_str("ls -la", UPDATE_TIMEOUT_MS) == 0);
+	ok1(row_is(3, "ls -la /tmp"));
+	clear_input();
+	ok1(close_ui('\r') == 0);
+	util_usleep(0, 100000);
+	ok1(input_is("ls -la /tmp\r"));
+
+	report_latency("test1");
+#define TEST1AMT 3 + 4 + 4 + 4
+	diag("----test1----\n#");
+}
+
+void test2() {
+	char buf[SCREEN_COLS+1], next[SCREEN_COLS+1];
+	size_t i;
+	int n;
+
+	diag("++++test2++++");
+
+	/* a burst of keys typed faster than the ui renders: the screen
+	 * has to end up showing all of them */
+	ok1(open_ui() == 0);
+	n = updates();
+	for(i = 0; i < 3; i++) {
+		const char *s;
+		uint32_t ch;
+
+		for(s = "grep --option-"; *s != '\0'; s++) {
+			ch = *s;
+			while(ui_on_input(&ch) == 1)
+				util_usleep(0, 1000);
+		}
+		ch = 0x07;
+		ui_on_input(&ch);
+	}
+	for(i = 0; i < 5000; i++) {
+		screen_row(1, buf, sizeof(buf));
+		if(strcmp(buf, "(search)`':") == 0 && updates() > n)
+			break;
+		util_usleep(0, 1000);
+	}
+	ok1(row_is(1, "(search)`':"));
+
+	/* ^N and ^P page through the results */
+	ok1(type_str("grep", UPDATE_TIMEOUT_MS) == 0);
+	screen_row(3, buf, sizeof(buf));
+	ok1(strncmp(buf, "grep ", 5) == 0);
+	ok1(type_key(0x0e, UPDATE_TIMEOUT_MS) == 0);
+	screen_row(3, next, sizeof(next));
+	ok1(strcmp(buf, next) != 0);
+	ok1(type_key(0x10, UPDATE_TIMEOUT_MS) == 0);
+	ok1(row_is(3, buf));
+
+	/* ^C closes the window without writing anything */
+	clear_input();
+	ok1(close_ui(0x03) == 0);
+	util_usleep(0, 100000);
+	ok1(input_is(""));
+
+	report_latency("test2");
+#define TEST2AMT 2 + 6 + 2
+	diag("----test2----\n#");
+}
+
+void test3() {
+	const char *path;
+	FILE *f;
+	char *keys;
+	size_t n, i;
+	int missed;
+
+	diag("++++test3++++");
+	if( (path = getenv("AUG_DB_UI_SESSION")) == NULL) {
+		skip(2, "AUG_DB_UI_SESSION is not set");
+		diag("----test3----\n#");
+		return;
+	}
+
+	keys = talloc_array(NULL, char, MAX_KEYS+1);
+	n = 0;
+	if( (f = fopen(path, "r")) != NULL) {
+		n = fread(keys, 1, MAX_KEYS, f);
+		fclose(f);
+	}
+	keys[n] = '\0';
+	ok(n > 0, "read session from %s", path);
+
+	ok1(open_ui() == 0);
+	missed = 0;
+	for(i = 0; i < n; i++)
+		/* ^C, ^/ and keys that choose a result end the session */
+		if(keys[i] >= 0x20 || keys[i] == 0x07 || keys[i] == 0x08 
+				|| keys[i] == 0x0e || keys[i] == 0x10) {
+			if(type_key((uint8_t) keys[i], 200) != 0)
+				missed++;
+		}
+	diag("%d of %d keys didnt change the screen", missed, (int) n);
+	close_ui(0x03);
+
+	report_latency("session");
+	talloc_free(keys);
+#define TEST3AMT 2
+	diag("----test3----\n#");
+}
+
+void test4() {
+	char buf[SCREEN_COLS+1];
+	int n;
+
+	diag("++++test4++++");
+
+	/* ^T shows the statistics screen, which redraws itself
+	 * until any key takes it back to the search */
+	ok1(open_ui() == 0);
+	ok1(type_key(0x14, UPDATE_TIMEOUT_MS) == 0);
+	ok1(row_is(1, "aug-db statistics (any key to return)"));
+	screen_row(2, buf, sizeof(buf));
+	ok(strncmp(buf, "corpus ", 7) == 0, "corpus line: '%s'", buf);
+	n = updates();
+	ok1(wait_updates(n, 3000) == 0);
+
+	ok1(type_key('x', UPDATE_TIMEOUT_MS) == 0);
+	screen_row(1, buf, sizeof(buf));
+	ok(strncmp(buf, "(search)`", 9) == 0, "search line: '%s'", buf);
+	ok1(close_ui(0x03) == 0);
+
+#define TEST4AMT 5 + 3
+	diag("----test4----\n#");
+}
+
+/* sqlite allocates the temporary b-trees for the DISTINCT and 
+ * ORDER BY of a search every time it runs, and a little for each 
+ * row it sorts. deleting the character back to the empty query 
+ * is answered by the recent cache. */
+#define SQLITE_KEY_ALLOCS 64
+
+/* types and deletes a character 16 times after @prefix, once the
+ * statements are prepared and the results laid out. */
+static void test5_cycle(const char *prefix) {
+	int64_t allocs, sqlite_allocs;
+	int i, missed;
+
+	ok1(open_ui() == 0);
+	/* ^G drops whatever the last test left in the query */
+	missed = (*prefix != '\0')? type_key(0x07, UPDATE_TIMEOUT_MS) : 0;
+	missed += type_str(prefix, UPDATE_TIMEOUT_MS);
+	for(i = 0; i < 4; i++)
+		missed += type_str("s\x7f", UPDATE_TIMEOUT_MS);
+
+	allocs = test_allocs();
+	sqlite_allocs = test_sqlite_allocs();
+	for(i = 0; i < 16; i++)
+		missed += type_str("s\x7f", UPDATE_TIMEOUT_MS);
+	allocs = test_allocs() - allocs;
+	sqlite_allocs = test_sqlite_allocs() - sqlite_allocs;
+
+	ok(missed == 0, "'%s': %d keys didnt update the screen", prefix, missed);
+	ok(allocs == 0, "'%s': %lld allocations in 32 keystrokes", prefix, (long long) allocs);
+	ok(sqlite_allocs <= 32*SQLITE_KEY_ALLOCS, "'%s': %lld sqlite allocations in 32 keystrokes", 
+		prefix, (long long) sqlite_allocs);
+	close_ui(0x03);
+}
+
+void test5() {
+	diag("++++test5++++");
+	if(test_allocs() < 0) {
+		skip(8, "this build cant count allocations");
+		diag("----test5----\n#");
+		return;
+	}
+
+	/* typing and deleting a character shouldnt allocate anything,
+	 * whether the query is only text or has a tag */
+	test5_cycle("");
+	test5_cycle("#shell ");
+
+#define TEST5AMT 4 + 4
+	diag("----test5----\n#");
+}
+
+int main()
+{
+	int i, len, total_tests;
+	struct aug_api *api;
+	FILE *out, *in;
+#define TESTN(_num) {test##_num, TEST##_num##AMT}
+	struct test tests[] = {
+		TESTN(1),
+		TESTN(2),
+		TESTN(3),
+		TESTN(4),
+		TESTN(5)
+	};
+
+	setlocale(LC_ALL,"");
+	total_tests = 0;
+	len = ARRAY_SIZE(tests);
+	for(i = 0; i < len; i++) {
+		total_tests += tests[i].amt;
+	}
+
+	plan_tests(total_tests);
+
+	test_init_api();
+	pthread_mutex_init(&g.screen, NULL);
+	pthread_mutex_init(&g.mtx, NULL);
+	pthread_cond_init(&g.cond, NULL);
+	g.updates = 0;
+	g.input_n = 0;
+	g.nlat = 0;
+
+	api = (struct aug_api *) G_api;
+	api->lock_screen = stub_lock_screen;
+	api->unlock_screen = stub_unlock_screen;
+	api->screen_panel_alloc = stub_screen_panel_alloc;
+	api->screen_panel_dealloc = stub_screen_panel_dealloc;
+	api->screen_panel_update = stub_screen_panel_update;
+	api->screen_doupdate = stub_screen_doupdate;
+	api->primary_input = stub_primary_input;
+	api->primary_input_chars = stub_primary_input_chars;
+
+	out = fopen("/dev/null", "w");
+	in = fopen("/dev/null", "r");
+	if(newterm("xterm", out, in) == NULL)
+		err(1, "failed to create offscreen terminal");
+	resize_term(SCREEN_ROWS, SCREEN_COLS);
+
+	if(test_sqlite_count() != 0)
+		errx(1, "failed to configure sqlite");
+	unlink(FILENAME);
+	if(db_init(FILENAME) != 0)
+		errx(1, "failed to init db");
+	add_entries();
+	if(ui_init() != 0)
+		errx(1, "failed to init ui");
+
+	for(i = 0; i < len; i++) {
+		(*tests[i].fn)();
+	}
+
+	ui_free();
+	db_free();
+	endwin();
+	fclose(out);
+	fclose(in);
+	test_free_api();
+
+	return exit_status();
+}